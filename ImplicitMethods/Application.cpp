@@ -16,13 +16,52 @@
 //	X: toggle informational text display
 //  E: run an explicit implementation of the simulation (useful for comparison; most obvious if you turn automatic implicit animation off with space bar)
 //  R: reset the simulation
-//  I: render to a series of numbered images so that they can be combined into a video
+//  F: toggle self collision of the surface (keeps folding parts of the mesh from passing through each other)
+//  K: toggle implicit (backward Euler) integration - takes one large step per frame instead of 10 small explicit ones
+//  J: toggle adaptive explicit time steps - each frame takes as few steps as the estimated stability limit allows instead of 10
+//  L: toggle sleeping - vertices that come to rest are frozen and skipped until something moves them again (explicit steps only)
+//  V: start / stop recording the run to trajectory.traj (play it back with -play trajectory.traj)
+//  N: save the simulation state to checkpoint.ckpt
+//  M: continue from the state saved in checkpoint.ckpt
+//  I: render to a series of numbered images so that they can be combined into a video (or pipe the frames to -encoder);
+//		pressing it again finishes writing the queued frames
 //	O: toggle logging of positions/velocities of constrained particles (only if DEBUGGING macro is #defined in Logger.h)
 //	P: toggle complete logging (only if DEBUGGING macro is #defined in Logger.h)
+//	T: start / stop profiling; stopping writes the recorded timings and counters to profile.json (Chrome trace) and profile.csv
 //Mouse:
 //	Left button - hold this whie dragging the mouse to change the rotation angle of the piece of cloth shown
 //	Middle button - zoom in
 //	Right button - zoom out
+//Command line:
+//	-threads N: number of threads used for force assembly and integration (defaults to the OpenMP maximum)
+//	-nocache: always parse the .node/.ele text files instead of using (and writing) the binary <mesh>.node.cache file,
+//		and recompute the rest state data of the deformation method instead of using precompute_<method>_<hash>.cache
+//	-adaptive: start with adaptive explicit time steps (see J)
+//	-sleep: start with sleeping turned on (see L)
+//	-hugepages: back the per mesh arrays of the simulation with huge pages where the system allows it (see MemoryArena)
+//	-reorder: renumber the vertices and tetrahedra of each mesh for memory locality after loading (see TetraMeshReader)
+//	-encoder "COMMAND": pipe the frames recorded with I to COMMAND as raw BGRA video instead of writing images/ImplicitMethods<n>.tga,
+//		for example -encoder "ffmpeg -y -f rawvideo -pix_fmt bgra -s 1000x700 -r 60 -i - capture.mp4" (the size is the window's)
+//	-syncsim: advance the simulation in the render loop (one frame of time steps per rendered frame) instead of on a
+//		separate thread at a fixed 60 frames per second of simulated time
+//	-scene FILE: simulate every body of a scene file together (see Scene) instead of the built in model
+//	-render NAME: draw the surface of NAME.node / NAME.ele, moved with the simulated model, instead of the model's own surface
+//		(see RenderEmbedding); NAME must be in the model's rest coordinates.  Not used with -scene
+//	-gpu: run the explicit time steps and the normals on the graphics card with compute shaders (OpenGL 4.3 - see GpuSimulator),
+//		in single precision; implies -syncsim, since the simulation then needs the render thread's GL context
+//	-record FILE: record the run to the trajectory file FILE, one record per frame of time steps (see TrajectoryWriter)
+//	-play FILE: play back a trajectory recorded with the same model instead of simulating it (space pauses)
+//	-resume FILE: continue from a checkpoint saved with N (or by -batch -checkpoint) instead of the rest state
+//	-fracture TOUGHNESS: let the model fracture brittlely (method 2 only - see GeorgiaInstituteSystem::setFractureToughness);
+//		implies -syncsim, since the splits change the surface the render thread draws.  Not used with -scene or -render,
+//		and the state can not be checkpointed (N, M and -resume are refused)
+//	-fracturespares FRACTION: reserve FRACTION * the model's vertices (+ 1) for -fracture, 0.25 by default - each split uses one,
+//		and fracture stops when they run out
+//	-batch -mesh NAME [-method 1|2|3|4] [-frames N] [-dt SECONDS] [-K BULK] [-mu SHEAR] [-kd DAMPING] [-implicit] [-adaptive] [-sleep] [-selfcollide] [-fracture TOUGHNESS [-fracturespares FRACTION]] [-trace FILE]
+//		[-record FILE] [-checkpoint NAME] [-resume FILE] [-play FILE]: simulate without a window
+//		and print per phase timings (see BatchRunner); -batch -scene FILE runs a scene file the same way
+//	-batch -mesh NAME -distributed ...: under mpirun, split the mesh across the MPI processes (builds with USE_MPI only - see DistributedSimulation)
+//	-benchmark [-frames N] [-implicit] [-adaptive] [-sleep] [-selfcollide] [-csv FILE] [-trace FILE]: headless timings of every method on chrisSimpler, house2, P and dragon
 //Written by Chris Jacobsen with advisement from Professor Huamin Wang
 
 //Based on:
@@ -36,6 +75,9 @@
 //http://www-ljk.imag.fr/Publications/Basilic/com.lmc.publi.PUBLI_Article@11f6a0378d9_18c74/tensile.pdf  Simple, yet Accurate Nonlinear Tensile Stiffness
 //Pascal Volino et. al
 //Deformation Method #3 - Class NonlinearMethodSystem
+//http://graphics.ethz.ch/Downloads/Publications/Papers/2004/Mue04/Mue04.pdf - Interactive Virtual Materials
+//Matthias Mueller and Markus Gross
+//Deformation Method #4 - Class CorotationalSystem
 
 #include <gl/glew.h>
 
@@ -45,26 +87,38 @@
 #include <glm/gtx/transform.hpp>
 
 #include <string>
+#include <cstring>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 #include "StanfordSystem.h"
 #include "GeorgiaInstituteSystem.h"
 #include "NonlinearMethodSystem.h"
 #include "ViewManager.h"
 #include "Keyboard.h"
 #include "TetraMeshReader.h"
+#include "PrecomputeCache.h"
+#include "Memory.h"
+#include "BatchRunner.h"
+#include "SimulationThread.h"
+#include "Scene.h"
 
 using namespace std;
 
-GLuint SetupGLSL(char *fileName);
+GLuint SetupGLSL(char *fileName, const char *defines, bool useGeometryShader);
 
 //Note: the reason these were declared globally is to accommodate Glut's function calling system
 ParticleSystem * particleSystem;	//The main particle system
 ViewManager viewManager;			//Instance of the view manager to allow user view control
 Keyboard * keyboard;				//Instance of the Keyboard class to process key presses
 Logger * logger;					//Instance of Logger class to perform all logging
-const int whichMethod = 1;			//1 for stanford method.  2 for georgia Institute Method.  3 for NonLinear Paper method.
+SimulationThread * simulationThread = NULL;	//Advances the particle system at a fixed rate (NULL if it is advanced by render, see -syncsim)
+const int whichMethod = 1;			//1 for stanford method.  2 for georgia Institute Method.  3 for NonLinear Paper method.  4 for corotated linear method.
 const int whichModel = 1;
+Scene * scene = NULL;				//The scene being simulated instead of whichModel (NULL without -scene)
+double simulationDeltaT = 0;		//Time step of whichModel or of the scene
+TrajectoryReader * trajectoryPlayer = NULL;	//The trajectory being played back instead of simulated (NULL without -play)
+double playbackSeconds = 0;			//Real time the playback has been running for (not counting pauses)
 
 double ar = 0;
 
@@ -72,6 +126,29 @@ int summedTime = 0;
 int frameCount = 0;
 const int FRAME_COUNT_LIMIT = 1000;
 
+//Shows the record of the trajectory being played that is due now, then the normals for it
+//A record holds stepsPerRecord steps, and a frame of STEPS_PER_FRAME steps is played every SIMULATION_TICK_SECONDS, so the
+//recording plays at the rate the simulation thread would have run it.
+void advancePlayback()
+{
+	static int lastTime = glutGet(GLUT_ELAPSED_TIME);
+	static int shownRecord = -1;
+	int time = glutGet(GLUT_ELAPSED_TIME);
+	if (particleSystem -> isAnimating)
+	{
+		playbackSeconds += (time - lastTime) / 1000.0;
+	}
+	lastTime = time;
+
+	double recordSeconds = SIMULATION_TICK_SECONDS * trajectoryPlayer -> getStepsPerRecord() / STEPS_PER_FRAME;
+	int record = min((int) (playbackSeconds / recordSeconds), trajectoryPlayer -> getRecordCount() - 1);
+	if (record != shownRecord && particleSystem -> showTrajectoryRecord(*trajectoryPlayer, record))
+	{
+		shownRecord = record;
+		particleSystem -> calculateNormals();
+	}
+}
+
 //This function is called for rendering by GLUT
 void render()
 {
@@ -82,82 +159,21 @@ void render()
 	//Update Logic
 	double timeElapsed;
 
-	if (whichModel == 3)
-	{
-		//Gigantic dragon model -- need bigger constants
-		switch (whichMethod)
-		{
-		case 1:					//Stanford Method
-			timeElapsed = 0.00225;
-			particleSystem->setConstants(2800,2800);
-			break;
-		case 2:					//Georgia Institute Method
-			timeElapsed = 0.00225;
-			particleSystem->setConstants(2800,2800);
-			break;
-		case 3:					//Non Linear Paper Method
-			timeElapsed = 0.00225;
-			particleSystem->setConstants(7000,7000);
-			break;
-		default:
-			timeElapsed = 0.005;
-			break;
-		}
-	}
-	else if (whichModel == 1 || whichModel == 2)
+	timeElapsed = simulationDeltaT;
+	
+	//With a simulation thread the frame only draws the newest snapshot it published
+	if (trajectoryPlayer != NULL)
 	{
-		//Regular model of some sort - do not need quite as big of constants
-		switch (whichMethod)
-		{
-		case 1:					//Stanford Method
-			timeElapsed = 0.00225;
-			particleSystem->setConstants(700,700);
-			break;
-		case 2:					//Georgia Institute Method
-			timeElapsed = 0.00225;
-			particleSystem->setConstants(700,700);
-			break;
-		case 3:					//Non Linear Paper Method
-			timeElapsed = 0.00225;
-			particleSystem->setConstants(600,600);
-			break;
-		default:
-			timeElapsed = 0.005;
-			break;
-		}
+		advancePlayback();
 	}
-	else 
+	else if (simulationThread == NULL)
 	{
-		//The 'simpler' tetrahedral model
-		switch (whichMethod)
-		{
-		case 1:					//Stanford Method
-			timeElapsed = 0.005;
-			particleSystem->setConstants(700,700,0.5);
-			break;
-		case 2:					//Georgia Institute Method
-			timeElapsed = 0.00225;
-			particleSystem->setConstants(700,700);
-			break;
-		case 3:					//Non Linear Paper Method
-			timeElapsed = 0.00225;
-			particleSystem->setConstants(600,600);
-			break;
-		default:
-			timeElapsed = 0.005;
-			break;
-		}
-	}
+		particleSystem -> advanceFrame(timeElapsed);
 	
-	//for (int i = 0; i < 1; i++)
-	for (int i = 0; i < 10; i++)
-	{				
-		particleSystem -> doUpdate(timeElapsed);
-	}
-	
-	//startTime = glutGet(GLUT_ELAPSED_TIME);
+		//startTime = glutGet(GLUT_ELAPSED_TIME);
 		
-	particleSystem -> calculateNormals();
+		particleSystem -> calculateNormals();
+	}
 
 	viewManager.doUpdate(timeElapsed);
 
@@ -170,12 +186,13 @@ void render()
 	glm::mat4 floorModelViewMatrix = viewManager.doTransform();
 	glm::mat4 tetraModelViewMatrix = floorModelViewMatrix;
 
-	if (whichModel == 2)
+	//A scene places its bodies itself
+	if (scene == NULL && whichModel == 2)
 	{
 		tetraModelViewMatrix= glm::translate(tetraModelViewMatrix, glm::vec3(-10.0f, 0, 7.0f));
 	}
 
-	if (whichModel == 3)
+	if (scene == NULL && whichModel == 3)
 	{
 		tetraModelViewMatrix= glm::scale(tetraModelViewMatrix, glm::vec3(0.25, 0.25, 0.25));
 		tetraModelViewMatrix= glm::translate(tetraModelViewMatrix, glm::vec3(-45.0f, -12, 30.0f));
@@ -250,7 +267,16 @@ void mouseMove(int x, int y)
 //The other parameters are not used
 void keyPressed (unsigned char key, int mystery, int mystery2)
 {
+	//Keys change the simulation state, so they wait for the current simulation tick to finish
+	if (simulationThread != NULL)
+	{
+		simulationThread -> lock();
+	}
 	keyboard -> keyPressed(key);
+	if (simulationThread != NULL)
+	{
+		simulationThread -> unlock();
+	}
 }
 
 //This function processes keyRelease events (a keyboard button going up)
@@ -262,9 +288,38 @@ void keyReleased (unsigned char key, int mystery, int mystery2)
 }
 
 
+//Loads renderMeshName.node / .ele and draws it, embedded in the particle system, instead of the simulated surface (see -render)
+void loadRenderMesh(const char * renderMeshName)
+{
+	string nodeFileName = string(renderMeshName) + ".node";
+	string elementFileName = string(renderMeshName) + ".ele";
+	int renderVertexCount = 0;
+	int renderTetraCount = 0;
+	Vertex * renderVertexList = NULL;
+	int * renderTetraList = NULL;
+	TetraMeshReader renderReader;
+	if (!renderReader.openFile((char *) nodeFileName.c_str(), (char *) elementFileName.c_str()) ||
+		!renderReader.loadData(renderVertexList, renderVertexCount, renderTetraList, renderTetraCount, logger))
+	{
+		cerr << "Could not load render mesh " << renderMeshName << endl;
+		return;
+	}
+	renderReader.closeFile();
+	particleSystem -> setRenderMesh(renderVertexList, renderVertexCount, renderTetraList, renderTetraCount);
+	delete [] renderVertexList;	//The embedding keeps what it needs; the tetraList belongs to the reader
+}
+
+
 //Main function
 int main(int argCount, char **argValue)
 {
+	//Headless runs never touch GLUT or GL
+	if (argCount > 1 && (strcmp(argValue[1], "-batch") == 0 || strcmp(argValue[1], "-benchmark") == 0))
+	{
+		BatchRunner batchRunner;
+		return batchRunner.run(argCount, argValue);
+	}
+
 	logger = new Logger();
 
 	int vertexCount = 0;
@@ -272,52 +327,156 @@ int main(int argCount, char **argValue)
 	Vertex * vertexList = NULL;
 	int * tetraList = NULL;
 	TetraMeshReader theReader;
-	
-	bool loadSucceeded = false;
-	if (whichModel == 1)
+	bool useSimulationThread = true;
+	bool useGpu = false;
+	bool useAdaptiveTimeStep = false;
+	bool useSleeping = false;
+	const char * sceneFileName = NULL;
+	const char * playFileName = NULL;
+	double fractureToughness = 0;
+	double spareVertexFraction = 0;
+
+	for (int i = 1; i < argCount; i++)
 	{
-		loadSucceeded = theReader.openFile("house2.node", "house2.ele");
-	}
-	else if (whichModel == 2)
-	{
-		loadSucceeded = theReader.openFile("P.node", "P.ele");
+		if (strcmp(argValue[i], "-nocache") == 0)
+		{
+			theReader.setUseCache(false);
+			PrecomputeCache::setEnabled(false);
+		}
+		if (strcmp(argValue[i], "-reorder") == 0)
+		{
+			theReader.setReorder(true);
+		}
+		if (strcmp(argValue[i], "-hugepages") == 0)
+		{
+			MemoryArena::setHugePages(true);
+		}
+		if (strcmp(argValue[i], "-adaptive") == 0)
+		{
+			useAdaptiveTimeStep = true;
+		}
+		if (strcmp(argValue[i], "-sleep") == 0)
+		{
+			useSleeping = true;
+		}
+		if (strcmp(argValue[i], "-syncsim") == 0)
+		{
+			useSimulationThread = false;
+		}
+		if (strcmp(argValue[i], "-gpu") == 0)
+		{
+			useGpu = true;
+			useSimulationThread = false;
+		}
+		if (strcmp(argValue[i], "-scene") == 0 && i < argCount - 1)
+		{
+			sceneFileName = argValue[i + 1];
+		}
+		if (strcmp(argValue[i], "-play") == 0 && i < argCount - 1)
+		{
+			playFileName = argValue[i + 1];
+			useSimulationThread = false;
+		}
+		if (strcmp(argValue[i], "-fracture") == 0 && i < argCount - 1)
+		{
+			fractureToughness = atof(argValue[i + 1]);
+			useSimulationThread = false;
+		}
+		if (strcmp(argValue[i], "-fracturespares") == 0 && i < argCount - 1)
+		{
+			spareVertexFraction = atof(argValue[i + 1]);
+		}
 	}
-	else if (whichModel == 3)
+	
+	bool loadSucceeded;
+	if (sceneFileName != NULL)
 	{
-		loadSucceeded = theReader.openFile("dragon.node", "dragon.ele");
+		scene = new Scene();
+		scene -> setUseCache(theReader.getUseCache());
+		scene -> setReorder(theReader.getReorder());
+		loadSucceeded = scene -> loadFile(sceneFileName);
 	}
 	else
 	{
-		loadSucceeded = theReader.openFile("chrisSimpler.node", "chrisSimpler.ele");
+		string nodeFileName = string(getModelName(whichModel)) + ".node";
+		string elementFileName = string(getModelName(whichModel)) + ".ele";
+		loadSucceeded = theReader.openFile((char *) nodeFileName.c_str(), (char *) elementFileName.c_str());
 	}
 
 	if (loadSucceeded)
 	{
-		bool loadSucceeded = theReader.loadData(vertexList, vertexCount, tetraList, tetraCount, logger);
-		
-		theReader.closeFile();
+		bool loadSucceeded;
+		if (scene != NULL)
+		{
+			loadSucceeded = scene -> loadMeshes(logger);
+		}
+		else
+		{
+			loadSucceeded = theReader.loadData(vertexList, vertexCount, tetraList, tetraCount, logger) && vertexList != NULL && tetraList != NULL;
+			theReader.closeFile();
+		}
 
-		if (loadSucceeded && vertexList != NULL && tetraList != NULL)
+		if (loadSucceeded)
 		{
-			switch(whichMethod)
+			if (scene != NULL)
 			{
-			case 1:
-				particleSystem = new StanfordSystem(vertexList, vertexCount, tetraList, tetraCount, logger);
-				break;
-			case 2:
-				particleSystem = new GeorgiaInstituteSystem(vertexList, vertexCount, tetraList, tetraCount, logger);
-				break;
-			case 3:
-				particleSystem = new NonlinearMethodSystem(vertexList, vertexCount, tetraList, tetraCount, logger);
-				break;
-			default:
-				cerr << "Incorrect system identifier -- defaulting to stanford system" << endl;
-				particleSystem = new StanfordSystem(vertexList, vertexCount, tetraList, tetraCount, logger);
-				break;
+				particleSystem = scene -> createParticleSystem(whichMethod, logger);
+				simulationDeltaT = scene -> getDeltaT(whichMethod);
+			}
+			else
+			{
+				particleSystem = createParticleSystem(whichMethod, vertexList, vertexCount, tetraList, tetraCount, logger, fractureToughness, spareVertexFraction);
+				SimulationSettings settings = getDefaultSettings(whichModel, whichMethod);
+				applySettings(particleSystem, settings);
+				simulationDeltaT = settings.deltaT;
+
+				for (int i = 1; i < argCount - 1; i++)
+				{
+					if (strcmp(argValue[i], "-render") == 0 && fractureToughness == 0)
+					{
+						loadRenderMesh(argValue[i + 1]);
+					}
+				}
 			}
 
 
 			//particleSystem -> loadSpecialState();
+
+			for (int i = 1; i < argCount - 1; i++)
+			{
+				if (strcmp(argValue[i], "-threads") == 0)
+				{
+					particleSystem -> setThreadCount(atoi(argValue[i + 1]));
+				}
+				if (strcmp(argValue[i], "-encoder") == 0)
+				{
+					particleSystem -> setCaptureEncoder(argValue[i + 1]);
+				}
+			}
+			particleSystem -> setAdaptiveTimeStep(useAdaptiveTimeStep);
+			particleSystem -> setSleeping(useSleeping);
+
+			for (int i = 1; i < argCount - 1; i++)
+			{
+				if (strcmp(argValue[i], "-resume") == 0)
+				{
+					particleSystem -> loadCheckpoint(argValue[i + 1]);
+				}
+				if (strcmp(argValue[i], "-record") == 0)
+				{
+					particleSystem -> startRecording(argValue[i + 1], STEPS_PER_FRAME);
+				}
+			}
+			if (playFileName != NULL)
+			{
+				trajectoryPlayer = new TrajectoryReader();
+				if (!particleSystem -> openTrajectory(*trajectoryPlayer, playFileName) || trajectoryPlayer -> getRecordCount() == 0)
+				{
+					cerr << "Could not play " << playFileName << " - simulating instead" << endl;
+					delete trajectoryPlayer;
+					trajectoryPlayer = NULL;
+				}
+			}
 			
 			keyboard = new Keyboard(particleSystem, &viewManager, logger);
 
@@ -338,11 +497,29 @@ int main(int argCount, char **argValue)
 			glShadeModel(GL_SMOOTH);
 
 			GLenum errorCode = glewInit();
-			GLuint programObject = SetupGLSL("maze");
+			GLuint programObject = SetupGLSL("maze", "", false);
+			GLuint rgbProgramObject = SetupGLSL("maze", "#define RGB_COLORS\n", true);	//Debugging view of the tetrahedra (see toggleRGB)
 			particleSystem->initVBOs();
-			particleSystem->setProgramObject(programObject);
+			particleSystem->setProgramObject(programObject, rgbProgramObject);
+			if (useGpu && !particleSystem -> enableGpuSimulation())
+			{
+				cerr << "Could not start the GPU simulation - simulating on the CPU" << endl;
+			}
 
 			glClearColor(0.0f,0.0f,0.0f,0.0f);
+
+			if (useSimulationThread)
+			{
+				particleSystem -> calculateNormals();
+				particleSystem -> enableRenderSnapshots();
+				simulationThread = new SimulationThread(particleSystem, simulationDeltaT);
+				if (!simulationThread -> start())
+				{
+					cerr << "Could not start the simulation thread - simulating in the render loop" << endl;
+					delete simulationThread;
+					simulationThread = NULL;
+				}
+			}
 	
 			glutDisplayFunc(render);
 			glutIdleFunc(render);
@@ -354,7 +531,9 @@ int main(int argCount, char **argValue)
 			
 			glutMainLoop();
 
+			delete simulationThread;
 			delete keyboard;
+			delete trajectoryPlayer;
 			delete particleSystem;
 		}
 		else
@@ -369,6 +548,7 @@ int main(int argCount, char **argValue)
 		system("pause");
 	}
 
+	delete scene;	//After the particle system, which uses its tetraList
 	delete logger;
 
 	return 0;
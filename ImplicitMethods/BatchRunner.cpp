@@ -0,0 +1,1035 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "BatchRunner.h"
+#include "StanfordSystem.h"
+#include "GeorgiaInstituteSystem.h"
+#include "NonlinearMethodSystem.h"
+#include "CorotationalSystem.h"
+#include "TetraMeshReader.h"
+#include "PrecomputeCache.h"
+#include "Memory.h"
+#include "Scene.h"
+#include "Timer.h"
+#include "DistributedSimulation.h"
+#include "SVD3.h"
+
+using namespace std;
+
+static const char * phaseNames[NUM_TIMING_PHASES] = {"forces", "integration", "collision", "fracture", "normals"};
+
+const char * getModelName(int whichModel)
+{
+	switch (whichModel)
+	{
+	case 1:
+		return "house2";
+	case 2:
+		return "P";
+	case 3:
+		return "dragon";
+	default:
+		return "chrisSimpler";
+	}
+}
+
+//Inverse of getModelName - meshes that are not one of the application's models get the house2 (regular model) settings
+int getModelNumber(const char * modelName)
+{
+	for (int whichModel = 0; whichModel <= 3; whichModel++)
+	{
+		if (strcmp(modelName, getModelName(whichModel)) == 0)
+		{
+			return whichModel;
+		}
+	}
+	return 1;
+}
+
+//Parameter whichModel - see getModelName
+//Parameter whichMethod - 1 for stanford method.  2 for georgia Institute Method.  3 for NonLinear Paper method.  4 for corotated linear method.
+SimulationSettings getDefaultSettings(int whichModel, int whichMethod)
+{
+	SimulationSettings settings;
+	settings.deltaT = 0.005;
+	settings.K = 0;
+	settings.mu = 0;
+	settings.kd = -1;
+
+	if (whichModel == 3)
+	{
+		//Gigantic dragon model -- need bigger constants
+		switch (whichMethod)
+		{
+		case 1:					//Stanford Method
+			settings.deltaT = 0.00225;
+			settings.K = settings.mu = 2800;
+			break;
+		case 2:					//Georgia Institute Method
+			settings.deltaT = 0.00225;
+			settings.K = settings.mu = 2800;
+			break;
+		case 3:					//Non Linear Paper Method
+			settings.deltaT = 0.00225;
+			settings.K = settings.mu = 7000;
+			break;
+		case 4:					//Corotated Linear Method
+			settings.deltaT = 0.00225;
+			settings.K = settings.mu = 2800;
+			break;
+		}
+	}
+	else if (whichModel == 1 || whichModel == 2)
+	{
+		//Regular model of some sort - do not need quite as big of constants
+		switch (whichMethod)
+		{
+		case 1:					//Stanford Method
+			settings.deltaT = 0.00225;
+			settings.K = settings.mu = 700;
+			break;
+		case 2:					//Georgia Institute Method
+			settings.deltaT = 0.00225;
+			settings.K = settings.mu = 700;
+			break;
+		case 3:					//Non Linear Paper Method
+			settings.deltaT = 0.00225;
+			settings.K = settings.mu = 600;
+			break;
+		case 4:					//Corotated Linear Method
+			settings.deltaT = 0.00225;
+			settings.K = settings.mu = 700;
+			break;
+		}
+	}
+	else
+	{
+		//The 'simpler' tetrahedral model
+		switch (whichMethod)
+		{
+		case 1:					//Stanford Method
+			settings.deltaT = 0.005;
+			settings.K = settings.mu = 700;
+			settings.kd = 0.5;
+			break;
+		case 2:					//Georgia Institute Method
+			settings.deltaT = 0.00225;
+			settings.K = settings.mu = 700;
+			break;
+		case 3:					//Non Linear Paper Method
+			settings.deltaT = 0.00225;
+			settings.K = settings.mu = 600;
+			break;
+		case 4:					//Corotated Linear Method
+			settings.deltaT = 0.00225;
+			settings.K = settings.mu = 700;
+			break;
+		}
+	}
+
+	return settings;
+}
+
+//Sets the constants of settings on particleSystem (settings with K = 0 leave the method's own constants alone)
+void applySettings(ParticleSystem * particleSystem, const SimulationSettings & settings)
+{
+	if (settings.K == 0 && settings.mu == 0)
+	{
+		return;
+	}
+
+	if (settings.kd < 0)
+	{
+		particleSystem -> setConstants(settings.K, settings.mu);
+	}
+	else
+	{
+		particleSystem -> setConstants(settings.K, settings.mu, settings.kd);
+	}
+}
+
+//Creates the particle system of a deformation method (see getDefaultSettings for the method numbers)
+//Parameter fractureToughness - above 0 to let the mesh fracture with that toughness (method 2 only - see GeorgiaInstituteSystem::setFractureToughness)
+//Parameter spareVertexFraction - spare vertices reserved for the splits, as a fraction of the mesh vertices; 0 for FRACTURE_SPARE_VERTEX_FRACTION
+ParticleSystem * createParticleSystem(int whichMethod, Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger, double fractureToughness, double spareVertexFraction)
+{
+	if (fractureToughness > 0 && whichMethod != 2)
+	{
+		cerr << "Only the Georgia Institute method (2) fractures - simulating without fracture" << endl;
+	}
+
+	switch(whichMethod)
+	{
+	case 1:
+		return new StanfordSystem(vertexList, vertexCount, tetraList, tetraCount, logger);
+	case 2:
+		if (fractureToughness > 0)
+		{
+			GeorgiaInstituteSystem * georgiaSystem = new GeorgiaInstituteSystem(vertexList, vertexCount, tetraList, tetraCount, logger,
+				(int) (vertexCount * (spareVertexFraction > 0 ? spareVertexFraction : FRACTURE_SPARE_VERTEX_FRACTION)) + 1);
+			georgiaSystem -> setFractureToughness(fractureToughness);
+			return georgiaSystem;
+		}
+		return new GeorgiaInstituteSystem(vertexList, vertexCount, tetraList, tetraCount, logger);
+	case 3:
+		return new NonlinearMethodSystem(vertexList, vertexCount, tetraList, tetraCount, logger);
+	case 4:
+		return new CorotationalSystem(vertexList, vertexCount, tetraList, tetraCount, logger);
+	default:
+		cerr << "Incorrect system identifier -- defaulting to stanford system" << endl;
+		return new StanfordSystem(vertexList, vertexCount, tetraList, tetraCount, logger);
+	}
+}
+
+BatchRunner::BatchRunner()
+{
+	frames = 100;
+	threadCount = 0;
+	useImplicit = false;
+	useAdaptiveTimeStep = false;
+	useSleeping = false;
+	useSelfCollision = false;
+	useCache = true;
+	reorder = false;
+	recordSteps = 0;
+	checkpointFrames = 0;
+	fractureToughness = 0;
+	spareVertexFraction = 0;
+	distributed = false;
+}
+
+//First lane of a SIMD value (the matrices of checkSvd3 are broadcast to every lane)
+template <typename T, typename R> inline void storeFirstLane(T value, R & first)
+{
+	R lanes[16];
+	simdStoreUnaligned(lanes, value);
+	first = lanes[0];
+}
+#if SIMD_WIDTH > 1
+template <> inline void storeFirstLane<double, double>(double value, double & first) {first = value;}
+#endif
+
+//Decomposes the test matrices with svd3 in one precision (T double, SimdDouble or SimdFloat, R its element type)
+//Returns the number of matrices whose U or V is not a rotation or whose U * diag(sigma) * V' is off by more than tolerance
+template <typename T, typename R> static int checkSvd3Precision(const char * precisionName, const double (* matrices)[9], int matrixCount, double tolerance)
+{
+	int failures = 0;
+	for (int m = 0; m < matrixCount; m++)
+	{
+		T A[9], U[9], sigma[3], V[9];
+		for (int k = 0; k < 9; k++)
+		{
+			A[k] = simdConstant<T>(matrices[m][k]);
+		}
+		svd3(A, U, sigma, V);
+
+		R u[9], s[3], v[9];
+		for (int k = 0; k < 9; k++)
+		{
+			storeFirstLane(U[k], u[k]);
+			storeFirstLane(V[k], v[k]);
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			storeFirstLane(sigma[k], s[k]);
+		}
+
+		//NaN fails every comparison, so the errors start from 0 and only grow through !(error <= tolerance)
+		bool valid = true;
+		for (int row = 0; row < 3; row++)
+		{
+			for (int col = 0; col < 3; col++)
+			{
+				double product = 0, uOrthogonal = 0, vOrthogonal = 0;
+				for (int k = 0; k < 3; k++)
+				{
+					product += (double) u[row * 3 + k] * s[k] * v[col * 3 + k];
+					uOrthogonal += (double) u[k * 3 + row] * u[k * 3 + col];
+					vOrthogonal += (double) v[k * 3 + row] * v[k * 3 + col];
+				}
+				double identity = row == col ? 1 : 0;
+				valid = valid && fabs(product - matrices[m][row * 3 + col]) <= tolerance && fabs(uOrthogonal - identity) <= tolerance && fabs(vOrthogonal - identity) <= tolerance;
+			}
+		}
+		valid = valid && determinant(Mat<3, 3, R>::fromArray(u)) > 0 && determinant(Mat<3, 3, R>::fromArray(v)) > 0;
+		if (!valid)
+		{
+			cerr << "  svd3 " << precisionName << " fails on matrix " << m << ": sigma " << s[0] << " " << s[1] << " " << s[2] << endl;
+			failures++;
+		}
+	}
+	return failures;
+}
+
+//Checks svd3 in every precision the force kernels instantiate it with, on the degenerate deformation gradients of
+//flattened and fully inverted tetrahedra as well as ordinary ones (-batch -svdcheck)
+//Returns true if every decomposition is valid
+static bool checkSvd3()
+{
+	const double matrices[][9] = {
+		{1, 0, 0, 0, 1, 0, 0, 0, 1},				//Rest state
+		{0, 0, 0, 0, 0, 0, 0, 0, 0},				//Collapsed to a point
+		{1, 0, 0, 0, 0, 0, 0, 0, 0},				//Collapsed to a line
+		{1, 2, 3, 2, 4, 6, -1, -2, -3},				//Rank 1, off the axes
+		{1, 0, 0, 0, 1, 0, 0, 0, 0},				//Flattened
+		{1, 0, 0, 0, 1, 0, 0, 0, -1},				//Inverted
+		{-1, 0, 0, 0, -1, 0, 0, 0, -1},				//Fully inverted
+		{1.2, 0.3, -0.1, -0.2, 0.9, 0.4, 0.05, -0.3, 1.1}	//General
+	};
+	int matrixCount = sizeof(matrices) / sizeof(matrices[0]);
+
+	int failures = checkSvd3Precision<double, double>("double", matrices, matrixCount, 1e-9);
+	failures += checkSvd3Precision<SimdDouble, double>("SimdDouble", matrices, matrixCount, 1e-9);
+	failures += checkSvd3Precision<SimdFloat, float>("SimdFloat", matrices, matrixCount, 1e-4);
+	cout << "svd3 check: " << 3 * matrixCount - failures << " of " << 3 * matrixCount << " decompositions valid" << endl;
+	return failures == 0;
+}
+
+//Parses the command line (see the class comment) and performs the runs
+//Returns the process exit code: 0 if every run succeeded
+int BatchRunner::run(int argCount, char ** argValue)
+{
+	bool benchmark = false;
+	bool svdCheck = false;
+	string meshName;
+	string sceneFileName;
+	string csvFileName;
+	string traceName;
+	int whichMethod = 1;
+	double deltaT = 0, K = 0, mu = 0, kd = -1;
+
+	for (int i = 1; i < argCount; i++)
+	{
+		bool hasValue = i < argCount - 1;
+		if (strcmp(argValue[i], "-benchmark") == 0)
+		{
+			benchmark = true;
+		}
+		else if (strcmp(argValue[i], "-svdcheck") == 0)
+		{
+			svdCheck = true;
+		}
+		else if (strcmp(argValue[i], "-implicit") == 0)
+		{
+			useImplicit = true;
+		}
+		else if (strcmp(argValue[i], "-adaptive") == 0)
+		{
+			useAdaptiveTimeStep = true;
+		}
+		else if (strcmp(argValue[i], "-sleep") == 0)
+		{
+			useSleeping = true;
+		}
+		else if (strcmp(argValue[i], "-selfcollide") == 0)
+		{
+			useSelfCollision = true;
+		}
+		else if (strcmp(argValue[i], "-nocache") == 0)
+		{
+			useCache = false;
+			PrecomputeCache::setEnabled(false);
+		}
+		else if (strcmp(argValue[i], "-hugepages") == 0)
+		{
+			MemoryArena::setHugePages(true);
+		}
+		else if (strcmp(argValue[i], "-reorder") == 0)
+		{
+			reorder = true;
+		}
+		else if (strcmp(argValue[i], "-distributed") == 0)
+		{
+			distributed = true;
+		}
+		else if (hasValue && strcmp(argValue[i], "-mesh") == 0)
+		{
+			meshName = argValue[++i];
+		}
+		else if (hasValue && strcmp(argValue[i], "-render") == 0)
+		{
+			renderMeshName = argValue[++i];
+		}
+		else if (hasValue && strcmp(argValue[i], "-scene") == 0)
+		{
+			sceneFileName = argValue[++i];
+		}
+		else if (hasValue && strcmp(argValue[i], "-method") == 0)
+		{
+			whichMethod = atoi(argValue[++i]);
+		}
+		else if (hasValue && strcmp(argValue[i], "-frames") == 0)
+		{
+			frames = atoi(argValue[++i]);
+		}
+		else if (hasValue && strcmp(argValue[i], "-threads") == 0)
+		{
+			threadCount = atoi(argValue[++i]);
+		}
+		else if (hasValue && strcmp(argValue[i], "-dt") == 0)
+		{
+			deltaT = atof(argValue[++i]);
+		}
+		else if (hasValue && strcmp(argValue[i], "-K") == 0)
+		{
+			K = atof(argValue[++i]);
+		}
+		else if (hasValue && strcmp(argValue[i], "-mu") == 0)
+		{
+			mu = atof(argValue[++i]);
+		}
+		else if (hasValue && strcmp(argValue[i], "-kd") == 0)
+		{
+			kd = atof(argValue[++i]);
+		}
+		else if (hasValue && strcmp(argValue[i], "-csv") == 0)
+		{
+			csvFileName = argValue[++i];
+		}
+		else if (hasValue && strcmp(argValue[i], "-trace") == 0)
+		{
+			traceName = argValue[++i];
+		}
+		else if (hasValue && strcmp(argValue[i], "-record") == 0)
+		{
+			recordFileName = argValue[++i];
+		}
+		else if (hasValue && strcmp(argValue[i], "-recordevery") == 0)
+		{
+			recordSteps = atoi(argValue[++i]);
+		}
+		else if (hasValue && strcmp(argValue[i], "-checkpoint") == 0)
+		{
+			checkpointName = argValue[++i];
+		}
+		else if (hasValue && strcmp(argValue[i], "-checkpointevery") == 0)
+		{
+			checkpointFrames = atoi(argValue[++i]);
+		}
+		else if (hasValue && strcmp(argValue[i], "-resume") == 0)
+		{
+			resumeFileName = argValue[++i];
+		}
+		else if (hasValue && strcmp(argValue[i], "-play") == 0)
+		{
+			playFileName = argValue[++i];
+		}
+		else if (hasValue && strcmp(argValue[i], "-bodies") == 0)
+		{
+			bodiesFileName = argValue[++i];
+		}
+		else if (i + 4 < argCount && strcmp(argValue[i], "-sphere") == 0)
+		{
+			SceneObstacle obstacle;
+			obstacle.type = COLLIDER_SPHERE;
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				obstacle.center[j] = atof(argValue[++i]);
+			}
+			obstacle.radius = atof(argValue[++i]);
+			obstacles.push_back(obstacle);
+		}
+		else if (i + 6 < argCount && strcmp(argValue[i], "-box") == 0)
+		{
+			SceneObstacle obstacle;
+			obstacle.type = COLLIDER_BOX;
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				obstacle.boxMin[j] = atof(argValue[++i]);
+			}
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				obstacle.boxMax[j] = atof(argValue[++i]);
+			}
+			obstacles.push_back(obstacle);
+		}
+		else if (hasValue && strcmp(argValue[i], "-fracture") == 0)
+		{
+			fractureToughness = atof(argValue[++i]);
+		}
+		else if (hasValue && strcmp(argValue[i], "-fracturespares") == 0)
+		{
+			spareVertexFraction = atof(argValue[++i]);
+		}
+	}
+
+	bool allSucceeded = true;
+	BatchResult result;
+
+	if (svdCheck)
+	{
+		allSucceeded = checkSvd3();
+	}
+	else if (benchmark)
+	{
+		//Smallest to largest, so a regression in a small mesh shows up before waiting for the dragon
+		const int benchmarkModels[4] = {0, 1, 2, 3};
+		for (int i = 0; i < 4; i++)
+		{
+			const char * modelName = getModelName(benchmarkModels[i]);
+			for (int method = 1; method <= 4; method++)
+			{
+				string runTraceName;
+				if (!traceName.empty())
+				{
+					char suffix[64];
+					sprintf(suffix, "_%s_%d", modelName, method);
+					runTraceName = traceName + suffix;
+				}
+
+				if (runOne(modelName, method, getDefaultSettings(benchmarkModels[i], method), runTraceName, result))
+				{
+					printResult(modelName, method, result);
+					if (!csvFileName.empty())
+					{
+						writeCsvResult(csvFileName, modelName, method, result);
+					}
+				}
+				else
+				{
+					allSucceeded = false;
+				}
+			}
+		}
+	}
+	else if (!sceneFileName.empty())
+	{
+		allSucceeded = runScene(sceneFileName.c_str(), whichMethod, deltaT, traceName, result);
+		if (allSucceeded)
+		{
+			printResult(sceneFileName.c_str(), whichMethod, result);
+			if (!csvFileName.empty())
+			{
+				writeCsvResult(csvFileName, sceneFileName.c_str(), whichMethod, result);
+			}
+		}
+	}
+	else
+	{
+		if (meshName.empty())
+		{
+			cerr << "Batch mode needs a mesh: -batch -mesh NAME (loads NAME.node and NAME.ele) or -batch -scene FILE" << endl;
+			return 1;
+		}
+
+		//Anything not given on the command line comes from the interactive settings
+		SimulationSettings settings = getDefaultSettings(getModelNumber(meshName.c_str()), whichMethod);
+		if (deltaT > 0)
+		{
+			settings.deltaT = deltaT;
+		}
+		if (K > 0 || mu > 0)
+		{
+			settings.K = K > 0 ? K : settings.K;
+			settings.mu = mu > 0 ? mu : settings.mu;
+		}
+		if (kd >= 0)
+		{
+			settings.kd = kd;
+		}
+
+		if (distributed)
+		{
+			#ifdef USE_MPI
+			MPI_Init(NULL, NULL);
+			int rank = 0;
+			MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+			allSucceeded = runDistributed(meshName.c_str(), whichMethod, settings, traceName, result);
+			MPI_Finalize();
+			if (rank != 0)
+			{
+				return allSucceeded ? 0 : 1;	//Rank 0 reports the run
+			}
+			#else
+			cerr << "-distributed needs a build with USE_MPI defined (see DistributedSimulation)" << endl;
+			return 1;
+			#endif
+		}
+		else
+		{
+			allSucceeded = runOne(meshName.c_str(), whichMethod, settings, traceName, result);
+		}
+		if (allSucceeded)
+		{
+			printResult(meshName.c_str(), whichMethod, result);
+			if (!csvFileName.empty())
+			{
+				writeCsvResult(csvFileName, meshName.c_str(), whichMethod, result);
+			}
+		}
+	}
+
+	return allSucceeded ? 0 : 1;
+}
+
+//Loads a mesh, simulates it and fills in result
+//Every run starts from the mesh's rest state, so the same command line always takes the same steps.
+//Parameter traceName - if not empty, the frames are profiled and written to traceName.json and traceName.csv
+bool BatchRunner::runOne(const char * meshName, int whichMethod, const SimulationSettings & settings, const string & traceName, BatchResult & result)
+{
+	string nodeFileName = string(meshName) + ".node";
+	string elementFileName = string(meshName) + ".ele";
+
+	Logger logger;
+	int vertexCount = 0;
+	int tetraCount = 0;
+	Vertex * vertexList = NULL;
+	int * tetraList = NULL;
+	TetraMeshReader theReader;	//Must outlive the particle system - a cached tetraList points into its mapping
+	theReader.setUseCache(useCache);
+	theReader.setReorder(reorder);
+
+	double startTime = getTimeSeconds();
+	if (!theReader.openFile((char *) nodeFileName.c_str(), (char *) elementFileName.c_str()) ||
+		!theReader.loadData(vertexList, vertexCount, tetraList, tetraCount, &logger))
+	{
+		cerr << "Could not load mesh " << meshName << endl;
+		return false;
+	}
+	theReader.closeFile();
+	double loadTime = getTimeSeconds();
+
+	if (fractureToughness > 0 && !renderMeshName.empty())
+	{
+		cerr << "A render mesh can not follow a fracturing mesh - run -fracture without -render" << endl;
+		delete [] vertexList;
+		return false;
+	}
+	if (fractureToughness > 0 && (!checkpointName.empty() || !resumeFileName.empty()))
+	{
+		cerr << "Checkpoints do not hold the topology fracture changes - run -fracture without -checkpoint and -resume" << endl;
+		delete [] vertexList;
+		return false;
+	}
+
+	ParticleSystem * particleSystem = createParticleSystem(whichMethod, vertexList, vertexCount, tetraList, tetraCount, &logger, fractureToughness, spareVertexFraction);
+	applySettings(particleSystem, settings);
+	addObstacles(particleSystem, obstacles);
+
+	if (!renderMeshName.empty())
+	{
+		string renderNodeFileName = renderMeshName + ".node";
+		string renderElementFileName = renderMeshName + ".ele";
+		int renderVertexCount = 0;
+		int renderTetraCount = 0;
+		Vertex * renderVertexList = NULL;
+		int * renderTetraList = NULL;
+		TetraMeshReader renderReader;
+		renderReader.setUseCache(useCache);
+		if (!renderReader.openFile((char *) renderNodeFileName.c_str(), (char *) renderElementFileName.c_str()) ||
+			!renderReader.loadData(renderVertexList, renderVertexCount, renderTetraList, renderTetraCount, &logger))
+		{
+			cerr << "Could not load render mesh " << renderMeshName << endl;
+			delete particleSystem;
+			return false;
+		}
+		renderReader.closeFile();
+		particleSystem -> setRenderMesh(renderVertexList, renderVertexCount, renderTetraList, renderTetraCount);
+		delete [] renderVertexList;	//The embedding keeps what it needs; the tetraList belongs to the reader
+	}
+
+	return simulate(particleSystem, logger, settings.deltaT, traceName, startTime, loadTime, result);
+}
+
+#ifdef USE_MPI
+//Loads a mesh in every MPI process, splits it among them, simulates the parts together and fills in result on rank 0
+//Explicit steps only (see DistributedSimulation); every process must make the same call.
+//Parameter traceName - if not empty, each process profiles its frames and writes traceName_<rank>.json and .csv
+bool BatchRunner::runDistributed(const char * meshName, int whichMethod, const SimulationSettings & settings, const string & traceName, BatchResult & result)
+{
+	Logger logger;
+	DistributedSimulation simulation(MPI_COMM_WORLD, &logger);
+	int rank = simulation.getRank();
+	if (useImplicit || useAdaptiveTimeStep || useSleeping || useSelfCollision || !renderMeshName.empty() || fractureToughness > 0 ||
+		!checkpointName.empty() || !resumeFileName.empty() || !playFileName.empty() || recordSteps > 0)
+	{
+		if (rank == 0)
+		{
+			cerr << "-distributed runs take explicit steps of one mesh - without -implicit, -adaptive, -sleep, -selfcollide, -render, -fracture, "
+				"-checkpoint, -resume, -play or -recordevery" << endl;
+		}
+		return false;
+	}
+
+	string nodeFileName = string(meshName) + ".node";
+	string elementFileName = string(meshName) + ".ele";
+	int vertexCount = 0;
+	int tetraCount = 0;
+	Vertex * vertexList = NULL;
+	int * tetraList = NULL;
+	TetraMeshReader theReader;	//Must outlive the partition - a cached tetraList points into its mapping
+	theReader.setUseCache(useCache);
+	theReader.setReorder(reorder);
+
+	//Rank 0 reads first, so a missing mesh cache is written once and then mapped by the others
+	double startTime = getTimeSeconds();
+	int loaded = 1;
+	for (int turn = 0; turn < 2; turn++)
+	{
+		if ((turn == 0) == (rank == 0))
+		{
+			loaded = theReader.openFile((char *) nodeFileName.c_str(), (char *) elementFileName.c_str()) &&
+				theReader.loadData(vertexList, vertexCount, tetraList, tetraCount, &logger);
+			theReader.closeFile();
+		}
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+	int allLoaded = 0;
+	MPI_Allreduce(&loaded, &allLoaded, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+	if (!allLoaded)
+	{
+		if (!loaded)
+		{
+			cerr << "Rank " << rank << " could not load mesh " << meshName << endl;
+		}
+		delete [] vertexList;
+		return false;
+	}
+	double loadTime = getTimeSeconds();
+
+	simulation.partition(vertexList, vertexCount, tetraList, tetraCount);
+	ParticleSystem * particleSystem = simulation.createParticleSystem(whichMethod);
+	applySettings(particleSystem, settings);
+	addObstacles(particleSystem, obstacles);
+	if (threadCount > 0)
+	{
+		particleSystem -> setThreadCount(threadCount);
+	}
+
+	//The whole mesh's state, on rank 0
+	vector<double> positions(rank == 0 ? DIMENSION * vertexCount : 0);
+	vector<double> velocities(positions.size());
+	TrajectoryWriter writer(&logger);
+	bool usable = true;
+	if (rank == 0 && !recordFileName.empty())
+	{
+		usable = writer.start(recordFileName.c_str(), vertexList, vertexCount, particleSystem -> getStepsPerFrame());
+	}
+	int recording = usable;
+	MPI_Bcast(&recording, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (!recording)
+	{
+		delete particleSystem;
+		delete [] vertexList;
+		return false;
+	}
+	recording = !recordFileName.empty();
+	MPI_Barrier(MPI_COMM_WORLD);
+	double setupTime = getTimeSeconds();
+
+	//The frames of runOne without the normals - no process has the whole surface
+	int firstStep = particleSystem -> getStepCount();
+	particleSystem -> resetPhaseTimings();
+	logger.profiler.setEnabled(!traceName.empty());
+	for (int frame = 0; frame < frames; frame++)
+	{
+		ProfileScope profileScope(logger.profiler, "frame");
+		particleSystem -> advanceFrame(settings.deltaT);
+		if (recording)
+		{
+			simulation.gatherState(positions.empty() ? NULL : &positions[0], velocities.empty() ? NULL : &velocities[0]);
+			if (rank == 0)
+			{
+				writer.record(particleSystem -> getStepCount(), &positions[0], &velocities[0]);
+			}
+		}
+	}
+	writer.stop();
+	MPI_Barrier(MPI_COMM_WORLD);
+	double endTime = getTimeSeconds();
+	logger.profiler.setEnabled(false);
+
+	if (!traceName.empty())
+	{
+		char suffix[64];
+		sprintf(suffix, "_%d", rank);
+		string jsonFileName = traceName + suffix + ".json";
+		string csvFileName = traceName + suffix + ".csv";
+		if (!logger.profiler.writeChromeTrace(jsonFileName.c_str()) || !logger.profiler.writeCsv(csvFileName.c_str()))
+		{
+			cerr << "Could not write trace " << traceName << suffix << endl;
+		}
+	}
+
+	//Each time is that of the slowest process
+	double times[NUM_TIMING_PHASES + 4];
+	double slowest[NUM_TIMING_PHASES + 4];
+	for (int phase = 0; phase < NUM_TIMING_PHASES; phase++)
+	{
+		times[phase] = particleSystem -> getPhaseSeconds(phase);
+	}
+	times[NUM_TIMING_PHASES] = loadTime - startTime;
+	times[NUM_TIMING_PHASES + 1] = setupTime - loadTime;
+	times[NUM_TIMING_PHASES + 2] = endTime - setupTime;
+	times[NUM_TIMING_PHASES + 3] = simulation.getExchangeSeconds();
+	MPI_Reduce(times, slowest, NUM_TIMING_PHASES + 4, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	int sizes[2] = {simulation.getLocalTetraCount(), simulation.getSharedVertexCount()};
+	int largest[2];
+	MPI_Reduce(sizes, largest, 2, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+	simulation.gatherState(positions.empty() ? NULL : &positions[0], velocities.empty() ? NULL : &velocities[0]);
+
+	if (rank == 0)
+	{
+		result.vertexCount = vertexCount;
+		result.tetraCount = tetraCount;
+		result.threadCount = particleSystem -> getThreadCount();
+		result.steps = particleSystem -> getStepCount() - firstStep;
+		result.frames = frames;
+		for (int phase = 0; phase < NUM_TIMING_PHASES; phase++)
+		{
+			result.phaseSeconds[phase] = slowest[phase];
+		}
+		result.loadSeconds = slowest[NUM_TIMING_PHASES];
+		result.setupSeconds = slowest[NUM_TIMING_PHASES + 1];
+		result.runSeconds = slowest[NUM_TIMING_PHASES + 2];
+		result.exchangeSeconds = slowest[NUM_TIMING_PHASES + 3];
+		result.processCount = simulation.getRankCount();
+		result.largestPartTetraCount = largest[0];
+		result.largestSharedVertexCount = largest[1];
+
+		//Same sums as ParticleSystem::getStateSums over the whole mesh
+		result.positionSum = 0;
+		result.velocitySum = 0;
+		for (int i = 0; i < DIMENSION * vertexCount; i++)
+		{
+			result.positionSum += positions[i];
+			result.velocitySum += velocities[i];
+		}
+		result.sleepingVertexCount = 0;
+		result.splitCount = 0;
+		result.bodySummaries.clear();
+	}
+
+	delete particleSystem;
+	delete [] vertexList;
+	return true;
+}
+#endif
+
+//Loads every mesh of a scene file, simulates them together in one particle system and fills in result
+//Parameter deltaT - time step, 0 for the scene's own (see Scene::getDeltaT)
+bool BatchRunner::runScene(const char * sceneFileName, int whichMethod, double deltaT, const string & traceName, BatchResult & result)
+{
+	Logger logger;
+	Scene scene;	//Must outlive the particle system - it owns the packed tetraList
+	scene.setUseCache(useCache);
+	scene.setReorder(reorder);
+
+	double startTime = getTimeSeconds();
+	if (!scene.loadFile(sceneFileName) || !scene.loadMeshes(&logger))
+	{
+		cerr << "Could not load scene " << sceneFileName << endl;
+		return false;
+	}
+	double loadTime = getTimeSeconds();
+
+	ParticleSystem * particleSystem = scene.createParticleSystem(whichMethod, &logger);
+	addObstacles(particleSystem, obstacles);
+	if (!simulate(particleSystem, logger, deltaT > 0 ? deltaT : scene.getDeltaT(whichMethod), traceName, startTime, loadTime, result))
+	{
+		return false;
+	}
+	return bodiesFileName.empty() || writeBodySummaries(bodiesFileName, scene, result);
+}
+
+//Writes the constants and final state of every body of a scene run to a CSV file, one row per body
+//Returns false if the file could not be written
+bool BatchRunner::writeBodySummaries(const string & fileName, Scene & scene, const BatchResult & result)
+{
+	ofstream csv(fileName.c_str());
+	if (!csv)
+	{
+		cerr << "Could not write body summaries to " << fileName << endl;
+		return false;
+	}
+
+	csv << "body,mesh,first_vertex,vertices,K,mu,kd,gravity,center_x,center_y,center_z,min_x,min_y,min_z,max_x,max_y,max_z,max_speed,kinetic_energy" << endl;
+	csv << setprecision(9);
+	for (int i = 0; i < (int) result.bodySummaries.size(); i++)
+	{
+		const BodyMaterial & material = scene.getBodyMaterial(i);
+		const BodySummary & summary = result.bodySummaries[i];
+		csv << i << "," << scene.getBody(i).meshName << "," << material.firstVertex << "," << material.vertexCount << ",";
+		csv << material.lambda + (2.0/3) * material.mu << "," << material.mu << "," << material.kd << "," << summary.gravity;
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			csv << "," << summary.centerOfMass[j];
+		}
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			csv << "," << summary.boundsMin[j];
+		}
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			csv << "," << summary.boundsMax[j];
+		}
+		csv << "," << summary.maxSpeed << "," << summary.kineticEnergy << endl;
+	}
+	return true;
+}
+
+//Runs the frames of a batch run on a constructed particle system, fills in result and deletes the particle system
+//Parameters startTime and loadTime - when loading started and finished (construction is timed from loadTime)
+//Returns false if the checkpoint to resume from or the trajectory to play could not be used
+bool BatchRunner::simulate(ParticleSystem * particleSystem, Logger & logger, double deltaT, const string & traceName, double startTime, double loadTime, BatchResult & result)
+{
+	if (threadCount > 0)
+	{
+		particleSystem -> setThreadCount(threadCount);
+	}
+	if (useImplicit)
+	{
+		particleSystem -> toggleImplicitIntegration();
+	}
+	if (useSelfCollision)
+	{
+		particleSystem -> toggleSelfCollision();
+	}
+	particleSystem -> setAdaptiveTimeStep(useAdaptiveTimeStep);
+	particleSystem -> setSleeping(useSleeping);
+
+	TrajectoryReader player;
+	bool usable = (resumeFileName.empty() || particleSystem -> loadCheckpoint(resumeFileName.c_str())) &&
+		(playFileName.empty() || particleSystem -> openTrajectory(player, playFileName.c_str())) &&
+		(recordFileName.empty() || particleSystem -> startRecording(recordFileName.c_str(), recordSteps > 0 ? recordSteps : particleSystem -> getStepsPerFrame()));
+	if (!usable)
+	{
+		delete particleSystem;
+		return false;
+	}
+	double setupTime = getTimeSeconds();
+
+	//Same step pattern as the interactive application: one frame of time steps (ParticleSystem::advanceFrame), then the normals
+	//A playback shows every record instead, as if each were a frame.
+	int firstStep = particleSystem -> getStepCount();
+	int frameCount = playFileName.empty() ? frames : player.getRecordCount();
+	particleSystem -> resetPhaseTimings();
+	logger.profiler.setEnabled(!traceName.empty());
+	for (int frame = 0; frame < frameCount; frame++)
+	{
+		ProfileScope profileScope(logger.profiler, "frame");
+		if (playFileName.empty())
+		{
+			particleSystem -> advanceFrame(deltaT);
+		}
+		else if (!particleSystem -> showTrajectoryRecord(player, frame))
+		{
+			cerr << "Could not decode record " << frame << " of " << playFileName << endl;
+			break;
+		}
+		particleSystem -> calculateNormals();
+
+		if (!checkpointName.empty() && ((checkpointFrames > 0 && (frame + 1) % checkpointFrames == 0) || frame == frameCount - 1))
+		{
+			char suffix[64];
+			sprintf(suffix, "_%d.ckpt", particleSystem -> getStepCount());
+			particleSystem -> saveCheckpoint((checkpointName + suffix).c_str());
+		}
+	}
+	particleSystem -> stopRecording();
+	double endTime = getTimeSeconds();
+	logger.profiler.setEnabled(false);
+
+	if (!traceName.empty())
+	{
+		string jsonFileName = traceName + ".json";
+		string csvFileName = traceName + ".csv";
+		if (!logger.profiler.writeChromeTrace(jsonFileName.c_str()) || !logger.profiler.writeCsv(csvFileName.c_str()))
+		{
+			cerr << "Could not write trace " << traceName << endl;
+		}
+	}
+
+	result.vertexCount = particleSystem -> getVertexCount();
+	result.tetraCount = particleSystem -> getTetraCount();
+	result.threadCount = particleSystem -> getThreadCount();
+	result.steps = particleSystem -> getStepCount() - firstStep;
+	result.frames = frameCount;
+	result.loadSeconds = loadTime - startTime;
+	result.setupSeconds = setupTime - loadTime;
+	result.runSeconds = endTime - setupTime;
+	for (int phase = 0; phase < NUM_TIMING_PHASES; phase++)
+	{
+		result.phaseSeconds[phase] = particleSystem -> getPhaseSeconds(phase);
+	}
+	particleSystem -> getStateSums(result.positionSum, result.velocitySum);
+	result.sleepingVertexCount = particleSystem -> getSleepingVertexCount();
+	result.splitCount = particleSystem -> getSplitCount();
+	particleSystem -> getBodySummaries(result.bodySummaries);
+
+	delete particleSystem;
+	return true;
+}
+
+//Prints one run: per step times for the simulation phases, per frame time for the normals
+void BatchRunner::printResult(const char * meshName, int whichMethod, const BatchResult & result)
+{
+	cout << fixed << setprecision(3);
+	cout << meshName << " method " << whichMethod << (!playFileName.empty() ? " playback" : useImplicit ? " implicit" : " explicit") << (useSelfCollision ? " self collision" : "") << ": " << result.vertexCount << " vertices, " << result.tetraCount << " tetrahedra, " << result.threadCount << " threads, " << result.steps << " steps" << endl;
+	cout << "  load " << result.loadSeconds * 1000 << " ms, setup " << result.setupSeconds * 1000 << " ms, run " << result.runSeconds * 1000 << " ms" << endl;
+	cout << "  ms per step:";
+	for (int phase = 0; phase < PHASE_NORMALS; phase++)
+	{
+		cout << " " << phaseNames[phase] << " " << result.phaseSeconds[phase] * 1000 / max(result.steps, 1);
+	}
+	cout << "  ms per frame: " << phaseNames[PHASE_NORMALS] << " " << result.phaseSeconds[PHASE_NORMALS] * 1000 / result.frames << endl;
+	if (useSleeping)
+	{
+		cout << "  " << result.sleepingVertexCount << " of " << result.vertexCount << " vertices asleep at the end" << endl;
+	}
+	if (distributed)
+	{
+		cout << "  distributed over " << result.processCount << " processes: largest part " << result.largestPartTetraCount << " tetrahedra, " << result.largestSharedVertexCount <<
+			" shared vertices, exchange wait " << result.exchangeSeconds * 1000 / max(result.steps, 1) << " ms per step" << endl;
+	}
+	if (fractureToughness > 0)
+	{
+		cout << "  " << result.splitCount << " vertices split by fracture" << endl;
+	}
+	if (!bodiesFileName.empty() && !result.bodySummaries.empty())
+	{
+		cout << "  " << result.bodySummaries.size() << " bodies summarized in " << bodiesFileName << endl;
+	}
+	cout << scientific << setprecision(9) << "  final position sum " << result.positionSum << ", velocity sum " << result.velocitySum << endl;
+}
+
+//Appends one run to a CSV file (the header row is written when the file is new)
+void BatchRunner::writeCsvResult(const string & fileName, const char * meshName, int whichMethod, const BatchResult & result)
+{
+	bool isNew = true;
+	FILE * existing = fopen(fileName.c_str(), "r");
+	if (existing != NULL)
+	{
+		isNew = false;
+		fclose(existing);
+	}
+
+	ofstream csv(fileName.c_str(), ios::out | ios::app);
+	if (!csv)
+	{
+		cerr << "Could not write benchmark results to " << fileName << endl;
+		return;
+	}
+
+	if (isNew)
+	{
+		csv << "mesh,method,integration,vertices,tetrahedra,threads,steps,load_ms,setup_ms,run_ms";
+		for (int phase = 0; phase < NUM_TIMING_PHASES; phase++)
+		{
+			csv << "," << phaseNames[phase] << "_ms";
+		}
+		csv << ",position_sum,velocity_sum" << endl;
+	}
+
+	csv << meshName << "," << whichMethod << "," << (useImplicit ? "implicit" : "explicit") << "," << result.vertexCount << "," << result.tetraCount << "," << result.threadCount << "," << result.steps;
+	csv << fixed << setprecision(4) << "," << result.loadSeconds * 1000 << "," << result.setupSeconds * 1000 << "," << result.runSeconds * 1000;
+	for (int phase = 0; phase < NUM_TIMING_PHASES; phase++)
+	{
+		csv << "," << result.phaseSeconds[phase] * 1000;
+	}
+	csv << scientific << setprecision(9) << "," << result.positionSum << "," << result.velocitySum << endl;
+}
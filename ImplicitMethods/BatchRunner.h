@@ -0,0 +1,129 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "ParticleSystem.h"
+#include "Logger.h"
+#include "Scene.h"
+
+using namespace std;
+
+//Time step and constants a mesh / method pair is simulated with (tuned by hand for the interactive application)
+struct SimulationSettings
+{
+	double deltaT;			//Time of one doUpdate step
+	double K;				//Bulk modulus
+	double mu;				//Shear modulus
+	double kd;				//Damping constant - negative keeps the deformation method's own default
+};
+
+//Model numbers used by the application: 1 house2, 2 P, 3 dragon, anything else chrisSimpler
+const char * getModelName(int whichModel);
+int getModelNumber(const char * modelName);
+SimulationSettings getDefaultSettings(int whichModel, int whichMethod);
+void applySettings(ParticleSystem * particleSystem, const SimulationSettings & settings);
+ParticleSystem * createParticleSystem(int whichMethod, Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger, double fractureToughness = 0, double spareVertexFraction = 0);
+
+//Outcome of one headless run
+struct BatchResult
+{
+	int vertexCount;
+	int tetraCount;
+	int threadCount;
+	int steps;									//doUpdate calls made
+	int frames;									//calculateNormals calls made (one per frame of STEPS_PER_FRAME explicit - or adaptively many - / 1 implicit steps)
+	double loadSeconds;							//Reading the mesh
+	double setupSeconds;						//Constructing the particle system (coloring, surface, precomputation)
+	double phaseSeconds[NUM_TIMING_PHASES];		//Time spent in each TimingPhase over the whole run
+	double runSeconds;							//Wall clock time of all the frames
+	double positionSum;							//Final state fingerprint (see ParticleSystem::getStateSums)
+	double velocitySum;
+	int sleepingVertexCount;					//Vertices asleep after the last step (see ParticleSystem::setSleeping)
+	int splitCount;								//Vertices split by fracture (see GeorgiaInstituteSystem::setFractureToughness)
+	vector<BodySummary> bodySummaries;			//Final state of each body of a scene (see ParticleSystem::getBodySummaries)
+	int processCount;							//MPI processes of a -distributed run (see DistributedSimulation)
+	int largestPartTetraCount;					//Tetrahedra of the largest part
+	int largestSharedVertexCount;				//Most vertices a process shares with the others
+	double exchangeSeconds;						//Longest time a process waited for the force exchange
+};
+
+//Headless simulation mode and benchmark harness - runs the same time steps as the interactive application without
+//creating a window or GL context, and reports where the time goes.
+//Command lines (the application switches to this mode when the first argument is -batch or -benchmark):
+//	-batch -mesh NAME [-method 1|2|3|4] [-frames N] [-dt SECONDS] [-K BULK] [-mu SHEAR] [-kd DAMPING] [-implicit] [-adaptive] [-sleep] [-selfcollide] [-threads N] [-nocache] [-hugepages] [-reorder] [-render NAME] [-fracture TOUGHNESS [-fracturespares FRACTION]] [-trace FILE]
+//		Simulates NAME.node / NAME.ele.  The time step and constants default to the interactive settings for that mesh.
+//		-trace records the run with the Profiler and writes FILE.json (Chrome trace) and FILE.csv.
+//		-reorder renumbers the mesh for memory locality after loading (see TetraMeshReader).
+//		-hugepages backs the per mesh arrays with huge pages where the system allows it (see MemoryArena).
+//		-render embeds the surface of another mesh, NAME.node / NAME.ele, in the simulated one and moves it every frame, so
+//		its cost shows up in the normals phase (see RenderEmbedding).
+//		-adaptive splits each frame into as many explicit steps as the stability estimate needs instead of STEPS_PER_FRAME
+//		(see ParticleSystem::estimateStableTimeStep).
+//		-sleep freezes the vertices that come to rest and skips them (see ParticleSystem::setSleeping); the vertices asleep at
+//		the end are reported.
+//		-fracture TOUGHNESS lets method 2 fracture brittlely (see GeorgiaInstituteSystem::setFractureToughness) and reports the
+//		vertices split; not with -render, -checkpoint or -resume.  At most FRACTION * the mesh vertices (+ 1) split, 0.25 by default (-fracturespares):
+//		each split takes one spare vertex reserved up front, and fracture stops when they run out.
+//	Obstacle options of -mesh and -scene runs (added to a scene's own; in simulation coordinates, as the lines of a scene file):
+//	[-sphere X Y Z RADIUS] [-box MINX MINY MINZ MAXX MAXY MAXZ]
+//		Each may be given several times.
+//	Persistence options of -mesh and -scene runs:
+//	[-record FILE [-recordevery STEPS]] [-checkpoint NAME [-checkpointevery FRAMES]] [-resume FILE] [-play FILE]
+//		-record streams the state to the trajectory file FILE every STEPS time steps (default: every frame's worth of steps).
+//		-checkpoint saves the exact state to NAME_<step>.ckpt every FRAMES frames and after the last one.
+//		-resume continues from a checkpoint instead of the rest state; -frames then counts the frames added to it.
+//		-play decodes every record of a trajectory of the mesh instead of simulating (with the normals of each record), to time
+//		playback and compare its final state with the recorded run's.
+//	-batch -scene FILE [-method 1|2|3|4] [-frames N] [-dt SECONDS] [-implicit] [-adaptive] [-sleep] [-selfcollide] [-threads N] [-nocache] [-hugepages] [-reorder] [-bodies FILE] [-trace FILE]
+//		Simulates every body of a scene file in one particle system (see Scene).  The constants come from the scene file.
+//		-bodies writes the constants and final state of every body to FILE as CSV - with a sweep line in the scene file this
+//		is a calibration sweep, all its variants simulated together in one run.
+//	-batch -mesh NAME -distributed [-method 1|2|3|4] [-frames N] [-dt SECONDS] [-K BULK] [-mu SHEAR] [-kd DAMPING] [-threads N] [-nocache] [-hugepages] [-reorder] [-sphere X Y Z RADIUS] [-box ...] [-record FILE] [-trace FILE]
+//		Run under mpirun / mpiexec: splits the mesh across the MPI processes, each simulating its part (see
+//		DistributedSimulation), and prints the run and the whole mesh's final state from rank 0, plus the largest part and the
+//		time spent waiting for the force exchange.  Explicit steps of one mesh only.  -record writes one trajectory of the
+//		whole mesh, a record per frame, from rank 0; -trace writes one FILE_<rank> trace per process.
+//		Needs a build with USE_MPI defined.
+//	-benchmark [-frames N] [-implicit] [-adaptive] [-sleep] [-selfcollide] [-threads N] [-nocache] [-hugepages] [-reorder] [-csv FILE] [-trace FILE]
+//		Runs every method on chrisSimpler, house2, P and dragon with their interactive settings and prints one line per run
+//		(and appends them to FILE as CSV, so results can be compared from one build to the next).
+//		-trace writes one FILE_<mesh>_<method> trace per run.
+//	-batch -svdcheck
+//		Checks the 3 X 3 SVD of the force kernels (SVD3.h) in double, SimdDouble and SimdFloat on ordinary, flattened and
+//		inverted deformation gradients; fails if any decomposition is not valid.
+class BatchRunner
+{
+public:
+	BatchRunner();
+	int run(int argCount, char ** argValue);
+
+private:
+	int frames;
+	int threadCount;						//0 uses the OpenMP default
+	bool useImplicit;
+	bool useAdaptiveTimeStep;				//Adaptive explicit time steps (-adaptive)
+	bool useSleeping;						//Freeze the vertices at rest (-sleep)
+	bool useSelfCollision;					//Turns on ParticleSystem self collision (-selfcollide)
+	bool useCache;							//False to bypass the mesh and precompute caches (-nocache)
+	bool reorder;							//Renumber the meshes for memory locality (-reorder)
+	string renderMeshName;					//Render mesh embedded in a -mesh run, empty for none (-render)
+	double fractureToughness;				//Toughness of a fracturing -mesh run of method 2, 0 for none (-fracture)
+	double spareVertexFraction;				//Spare vertices reserved for its splits as a fraction of the mesh vertices, 0 for the default (-fracturespares)
+	string recordFileName;					//Trajectory to record, empty for none (-record)
+	int recordSteps;						//Time steps between records, 0 for one record per frame of steps (-recordevery)
+	string checkpointName;					//Prefix of the checkpoint files, empty for none (-checkpoint)
+	int checkpointFrames;					//Frames between checkpoints, 0 to only save after the last frame (-checkpointevery)
+	string resumeFileName;					//Checkpoint the run starts from, empty for the rest state (-resume)
+	string playFileName;					//Trajectory decoded instead of simulating, empty to simulate (-play)
+	string bodiesFileName;					//Per body CSV of a -scene run, empty for none (-bodies)
+	bool distributed;						//Split a -mesh run across the MPI processes (-distributed)
+	vector<SceneObstacle> obstacles;		//Added to every -mesh and -scene run (-sphere, -box)
+
+	bool runOne(const char * meshName, int whichMethod, const SimulationSettings & settings, const string & traceName, BatchResult & result);
+	bool runDistributed(const char * meshName, int whichMethod, const SimulationSettings & settings, const string & traceName, BatchResult & result);
+	bool runScene(const char * sceneFileName, int whichMethod, double deltaT, const string & traceName, BatchResult & result);
+	bool simulate(ParticleSystem * particleSystem, Logger & logger, double deltaT, const string & traceName, double startTime, double loadTime, BatchResult & result);
+	void printResult(const char * meshName, int whichMethod, const BatchResult & result);
+	void writeCsvResult(const string & fileName, const char * meshName, int whichMethod, const BatchResult & result);
+	bool writeBodySummaries(const string & fileName, Scene & scene, const BatchResult & result);
+};
@@ -0,0 +1,259 @@
+#include <iostream>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "BlockSparseMatrix.h"
+#include "Memory.h"
+
+using namespace std;
+
+//Constructor - builds the block sparsity pattern from the tetrahedra
+//Parameter tetraList - tetrahedron vertex indices, tetraList[k * tetraCount + currentTetrad]
+//Parameter tetraCount - number of tetrahedra
+//Parameter vertexCount - number of vertices (block rows)
+BlockSparseMatrix::BlockSparseMatrix(int * tetraList, int tetraCount, int vertexCount)
+{
+	numVertices = vertexCount;
+	numTetra = tetraCount;
+
+	//Collect the neighbors (including itself) of every vertex
+	vector< vector<int> > neighbors(numVertices);
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+	{
+		for (int a = 0; a < 4; a++)
+		{
+			for (int b = 0; b < 4; b++)
+			{
+				neighbors[tetraList[a * numTetra + currentTetrad]].push_back(tetraList[b * numTetra + currentTetrad]);
+			}
+		}
+	}
+
+	rowOffsets = new int[numVertices + 1];
+	rowOffsets[0] = 0;
+	for (int i = 0; i < numVertices; i++)
+	{
+		//A vertex that belongs to no tetrahedron still gets its diagonal block so the matrix stays invertible
+		if (neighbors[i].empty())
+		{
+			neighbors[i].push_back(i);
+		}
+
+		sort(neighbors[i].begin(), neighbors[i].end());
+		neighbors[i].erase(unique(neighbors[i].begin(), neighbors[i].end()), neighbors[i].end());
+		rowOffsets[i + 1] = rowOffsets[i] + neighbors[i].size();
+	}
+
+	numBlocks = rowOffsets[numVertices];
+	blockColumns = new int[numBlocks];
+	diagonalBlocks = new int[numVertices];
+	blocks = alignedAlloc<double>(numBlocks * 9);
+
+	for (int i = 0; i < numVertices; i++)
+	{
+		for (int k = 0; k < (int) neighbors[i].size(); k++)
+		{
+			blockColumns[rowOffsets[i] + k] = neighbors[i][k];
+		}
+	}
+
+	for (int i = 0; i < numVertices; i++)
+	{
+		diagonalBlocks[i] = rowOffsets[i] + (lower_bound(&blockColumns[rowOffsets[i]], &blockColumns[rowOffsets[i + 1]], i) - &blockColumns[rowOffsets[i]]);
+	}
+
+	//Look up the block of every vertex pair of every tetrahedron once, so assembly needs no searching
+	tetraBlocks = new int[16 * numTetra];
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+	{
+		for (int a = 0; a < 4; a++)
+		{
+			int row = tetraList[a * numTetra + currentTetrad];
+			for (int b = 0; b < 4; b++)
+			{
+				int column = tetraList[b * numTetra + currentTetrad];
+				tetraBlocks[currentTetrad * 16 + a * 4 + b] = rowOffsets[row] + (lower_bound(&blockColumns[rowOffsets[row]], &blockColumns[rowOffsets[row + 1]], column) - &blockColumns[rowOffsets[row]]);
+			}
+		}
+	}
+
+	residual = alignedAlloc<double>(3 * numVertices);
+	direction = alignedAlloc<double>(3 * numVertices);
+	product = alignedAlloc<double>(3 * numVertices);
+	preconditioned = alignedAlloc<double>(3 * numVertices);
+	inverseDiagonal = alignedAlloc<double>(3 * numVertices);
+
+	clear();
+}
+
+BlockSparseMatrix::~BlockSparseMatrix()
+{
+	delete [] rowOffsets;
+	delete [] blockColumns;
+	delete [] diagonalBlocks;
+	delete [] tetraBlocks;
+	alignedFree(blocks);
+	alignedFree(residual);
+	alignedFree(direction);
+	alignedFree(product);
+	alignedFree(preconditioned);
+	alignedFree(inverseDiagonal);
+}
+
+//Sets every block to 0 (the sparsity pattern is kept)
+void BlockSparseMatrix::clear()
+{
+	for (int i = 0; i < numBlocks * 9; i++)
+	{
+		blocks[i] = 0;
+	}
+}
+
+//Adds scale times a tetrahedron's 12 X 12 matrix into the blocks of its vertex pairs
+//The matrix is symmetrized first (finite difference Jacobians are only symmetric up to truncation error).
+//Two tetrahedra that share a vertex must not be added at the same time from different threads.
+//Parameter tetraMatrix - tetraMatrix[(a * 3 + r) * 12 + b * 3 + c] is the entry for dimension r of vertex a and dimension c of vertex b
+void BlockSparseMatrix::addTetraBlocks(int currentTetrad, double * tetraMatrix, double scale)
+{
+	for (int a = 0; a < 4; a++)
+	{
+		for (int b = 0; b < 4; b++)
+		{
+			double * block = &blocks[tetraBlocks[currentTetrad * 16 + a * 4 + b] * 9];
+			for (int r = 0; r < 3; r++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					block[r * 3 + c] += scale * 0.5 * (tetraMatrix[(a * 3 + r) * 12 + b * 3 + c] + tetraMatrix[(b * 3 + c) * 12 + a * 3 + r]);
+				}
+			}
+		}
+	}
+}
+
+//Adds a diagonal matrix (given in vector layout, diagonal[dimension * numVertices + vertex])
+void BlockSparseMatrix::addDiagonal(double * diagonal)
+{
+	for (int i = 0; i < numVertices; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			blocks[diagonalBlocks[i] * 9 + j * 3 + j] += diagonal[j * numVertices + i];
+		}
+	}
+}
+
+//result = matrix * x
+void BlockSparseMatrix::multiply(double * x, double * result, int numThreads)
+{
+	#pragma omp parallel for num_threads(numThreads) schedule(static)
+	for (int i = 0; i < numVertices; i++)
+	{
+		double sum[3] = {0, 0, 0};
+		for (int block = rowOffsets[i]; block < rowOffsets[i + 1]; block++)
+		{
+			int column = blockColumns[block];
+			double * entries = &blocks[block * 9];
+			double x0 = x[column];
+			double x1 = x[numVertices + column];
+			double x2 = x[2 * numVertices + column];
+			sum[0] += entries[0] * x0 + entries[1] * x1 + entries[2] * x2;
+			sum[1] += entries[3] * x0 + entries[4] * x1 + entries[5] * x2;
+			sum[2] += entries[6] * x0 + entries[7] * x1 + entries[8] * x2;
+		}
+		result[i] = sum[0];
+		result[numVertices + i] = sum[1];
+		result[2 * numVertices + i] = sum[2];
+	}
+}
+
+//Solves matrix * x = rhs with the Jacobi preconditioned conjugate gradient method
+//x holds the initial guess and receives the solution.  Iteration stops once the residual norm is below tolerance times the norm of rhs,
+//or early if the matrix turns out not to be positive definite along the search direction (x is then the best solution found so far).
+//Returns the number of iterations taken.
+int BlockSparseMatrix::solveConjugateGradient(double * rhs, double * x, double tolerance, int maxIterations, int numThreads, Logger * logger)
+{
+	(void) logger;	//Only read by the DEBUGGING residual report below
+	int n = 3 * numVertices;
+
+	for (int i = 0; i < numVertices; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			double diagonal = blocks[diagonalBlocks[i] * 9 + j * 3 + j];
+			inverseDiagonal[j * numVertices + i] = diagonal > 0 ? 1.0 / diagonal : 1.0;
+		}
+	}
+
+	//r = b - A * x, z = inv(D) * r, d = z
+	multiply(x, product, numThreads);
+	double rhsNorm = 0;
+	double rz = 0;
+	#pragma omp parallel for num_threads(numThreads) schedule(static) reduction(+:rhsNorm,rz)
+	for (int i = 0; i < n; i++)
+	{
+		residual[i] = rhs[i] - product[i];
+		preconditioned[i] = inverseDiagonal[i] * residual[i];
+		direction[i] = preconditioned[i];
+		rhsNorm += rhs[i] * rhs[i];
+		rz += residual[i] * preconditioned[i];
+	}
+
+	double threshold = tolerance * tolerance * rhsNorm;
+	int iteration = 0;
+	double residualNorm = threshold + 1;
+
+	while (iteration < maxIterations)
+	{
+		//alpha = (r' * z) / (d' * A * d)
+		multiply(direction, product, numThreads);
+		double curvature = 0;
+		#pragma omp parallel for num_threads(numThreads) schedule(static) reduction(+:curvature)
+		for (int i = 0; i < n; i++)
+		{
+			curvature += direction[i] * product[i];
+		}
+
+		if (curvature <= 0)
+		{
+			break;
+		}
+
+		double alpha = rz / curvature;
+		double newRz = 0;
+		residualNorm = 0;
+		#pragma omp parallel for num_threads(numThreads) schedule(static) reduction(+:newRz,residualNorm)
+		for (int i = 0; i < n; i++)
+		{
+			x[i] += alpha * direction[i];
+			residual[i] -= alpha * product[i];
+			preconditioned[i] = inverseDiagonal[i] * residual[i];
+			newRz += residual[i] * preconditioned[i];
+			residualNorm += residual[i] * residual[i];
+		}
+		iteration++;
+
+		if (residualNorm <= threshold)
+		{
+			break;
+		}
+
+		//d = z + beta * d
+		double beta = newRz / rz;
+		rz = newRz;
+		#pragma omp parallel for num_threads(numThreads) schedule(static)
+		for (int i = 0; i < n; i++)
+		{
+			direction[i] = preconditioned[i] + beta * direction[i];
+		}
+	}
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging && logger -> loggingLevel >= logger -> FULL)
+	{
+		cout << "Conjugate gradient: " << iteration << " iterations, residual " << sqrt(residualNorm) << " (rhs " << sqrt(rhsNorm) << ")" << endl;
+	}
+	#endif
+
+	return iteration;
+}
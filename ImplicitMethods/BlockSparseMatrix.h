@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Logger.h"
+
+//Symmetric sparse matrix made of 3 X 3 blocks in block compressed sparse row (BCSR) format
+//There is one block row per vertex and a block for every pair of vertices that share a tetrahedron.
+//Vectors multiplied by the matrix use the same layout as the particle system's positions: vector[dimension * numVertices + vertex].
+//Used for the force Jacobian of the implicit integrator.
+class BlockSparseMatrix
+{
+public:
+	BlockSparseMatrix(int * tetraList, int tetraCount, int vertexCount);
+	~BlockSparseMatrix();
+	void clear();
+	void addTetraBlocks(int currentTetrad, double * tetraMatrix, double scale);
+	void addDiagonal(double * diagonal);
+	void multiply(double * x, double * result, int numThreads);
+	int solveConjugateGradient(double * rhs, double * x, double tolerance, int maxIterations, int numThreads, Logger * logger);
+	int getNumBlocks() {return numBlocks;}
+
+private:
+	int numVertices;
+	int numTetra;
+	int numBlocks;						//Number of nonzero 3 X 3 blocks
+	int * rowOffsets;					//First block of each block row (numVertices + 1 entries)
+	int * blockColumns;					//Block column (vertex) of each block, sorted within a row
+	double * blocks;					//Block entries: blocks[block * 9 + row * 3 + col]
+	int * diagonalBlocks;				//Diagonal block of each block row
+	int * tetraBlocks;					//Block holding each vertex pair of each tetrahedron: tetraBlocks[currentTetrad * 16 + a * 4 + b]
+
+	//Conjugate gradient work vectors (3 * numVertices entries each)
+	double * residual;
+	double * direction;
+	double * product;
+	double * preconditioned;
+	double * inverseDiagonal;			//Jacobi preconditioner
+};
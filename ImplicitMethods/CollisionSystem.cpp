@@ -0,0 +1,528 @@
+#include <iostream>
+#include <algorithm>
+#include "CollisionSystem.h"
+#include "Simd.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+const double COLLISION_EPSILON = 1e-12;		//Used to check approximate equality to 0
+const int HASH_CELLS_PER_EXTENT = 16;		//Spatial hash cells along the longest side of the surface bounds
+
+//Parameter surfaceVertices - the vertices on the surface of the mesh (the only ones spheres and boxes are tested against)
+CollisionSystem::CollisionSystem(int numVertices, const vector<int> & surfaceVertices, Logger * logger)
+{
+	this -> numVertices = numVertices;
+	this -> surfaceVertices = surfaceVertices;
+	this -> logger = logger;
+
+	contacts = new int[numVertices];
+
+	hashBucketCount = 1;
+	while (hashBucketCount < 2 * (int) surfaceVertices.size())
+	{
+		hashBucketCount *= 2;
+	}
+	hashBucketStarts = new int[hashBucketCount + 1];
+	hashVertices = new int[numVertices + 1];
+	surfaceBuckets = new int[numVertices + 1];
+	isSurfaceVertex.assign(numVertices, false);
+	for (int i = 0; i < (int) surfaceVertices.size(); i++)
+	{
+		isSurfaceVertex[surfaceVertices[i]] = true;
+	}
+	cellSize = 1;
+	for (int k = 0; k < DIMENSION; k++)
+	{
+		meshMin[k] = 0;
+		meshMax[k] = 0;
+	}
+
+	visitedStamps = new int[numVertices];
+	for (int i = 0; i < numVertices; i++)
+	{
+		visitedStamps[i] = 0;
+	}
+	queryStamp = 0;
+}
+
+CollisionSystem::~CollisionSystem()
+{
+	delete [] contacts;
+	delete [] hashBucketStarts;
+	delete [] hashVertices;
+	delete [] surfaceBuckets;
+	delete [] visitedStamps;
+}
+
+//Adds the half space dot(normal, x) < offset (normal must be unit length)
+void CollisionSystem::addPlane(const double normal[DIMENSION], double offset, const ContactMaterial & material)
+{
+	Collider collider;
+	collider.type = COLLIDER_PLANE;
+	for (int k = 0; k < DIMENSION; k++)
+	{
+		collider.normal[k] = normal[k];
+		collider.center[k] = 0;
+		collider.boxMin[k] = 0;
+		collider.boxMax[k] = 0;
+	}
+	collider.offset = offset;
+	collider.radius = 0;
+	collider.material = material;
+	colliders.push_back(collider);
+}
+
+void CollisionSystem::addSphere(const double center[DIMENSION], double radius, const ContactMaterial & material)
+{
+	Collider collider;
+	collider.type = COLLIDER_SPHERE;
+	for (int k = 0; k < DIMENSION; k++)
+	{
+		collider.normal[k] = 0;
+		collider.center[k] = center[k];
+		collider.boxMin[k] = center[k] - radius;
+		collider.boxMax[k] = center[k] + radius;
+	}
+	collider.offset = 0;
+	collider.radius = radius;
+	collider.material = material;
+	colliders.push_back(collider);
+}
+
+//Adds an axis aligned box
+void CollisionSystem::addBox(const double boxMin[DIMENSION], const double boxMax[DIMENSION], const ContactMaterial & material)
+{
+	Collider collider;
+	collider.type = COLLIDER_BOX;
+	for (int k = 0; k < DIMENSION; k++)
+	{
+		collider.normal[k] = 0;
+		collider.center[k] = (boxMin[k] + boxMax[k]) / 2;
+		collider.boxMin[k] = boxMin[k];
+		collider.boxMax[k] = boxMax[k];
+	}
+	collider.offset = 0;
+	collider.radius = 0;
+	collider.material = material;
+	colliders.push_back(collider);
+}
+
+//Adds a vertex that became part of the surface (after fracture - see GeorgiaInstituteSystem) to the vertices spheres and boxes are tested against
+void CollisionSystem::addSurfaceVertex(int vertex)
+{
+	if (!isSurfaceVertex[vertex])
+	{
+		isSurfaceVertex[vertex] = true;
+		surfaceVertices.push_back(vertex);
+	}
+}
+
+//Replaces the vertices tested against spheres and boxes - for a part of a mesh whose own surface is not the mesh's
+//(see DistributedSimulation)
+void CollisionSystem::setSurfaceVertices(const vector<int> & surfaceVertices)
+{
+	for (int i = 0; i < (int) this -> surfaceVertices.size(); i++)
+	{
+		isSurfaceVertex[this -> surfaceVertices[i]] = false;
+	}
+	this -> surfaceVertices.clear();
+	for (int i = 0; i < (int) surfaceVertices.size(); i++)
+	{
+		addSurfaceVertex(surfaceVertices[i]);
+	}
+}
+
+//Finds the vertices inside each collider and applies the impulse response to them
+//Colliders are handled one after another, so a vertex touching two of them responds to both in turn.
+//Returns the number of contacts
+int CollisionSystem::detectAndRespond(double * positions, double * velocities, double deltaT, int numThreads)
+{
+	int totalContacts = 0;
+	bool hashBuilt = false;
+
+	for (int c = 0; c < (int) colliders.size(); c++)
+	{
+		const Collider & collider = colliders[c];
+		int collisions = 0;
+
+		if (collider.type == COLLIDER_PLANE)
+		{
+			//Each thread compacts the contacts of its own range of vertices into the same range of the contact list and
+			//responds to them - a vertex belongs to one range only, so the threads never write the same vertex
+			#pragma omp parallel num_threads(numThreads) reduction(+:collisions)
+			{
+				int threadCount = 1;
+				int thread = 0;
+				#ifdef _OPENMP
+				threadCount = omp_get_num_threads();
+				thread = omp_get_thread_num();
+				#endif
+
+				int rangeSize = ((numVertices + threadCount - 1) / threadCount + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+				int begin = min(thread * rangeSize, numVertices);
+				int end = min(begin + rangeSize, numVertices);
+
+				int count = detectPlane(collider, positions, begin, end, contacts + begin);
+				for (int i = 0; i < count; i++)
+				{
+					respond(contacts[begin + i], collider.normal, collider.material, positions, velocities, deltaT);
+				}
+				collisions += count;
+			}
+		}
+		else
+		{
+			//The hash is built once per step; responses only move vertices by an impulse times deltaT, so it stays good enough
+			//for the remaining colliders (the narrow phase always uses the current positions)
+			if (!hashBuilt)
+			{
+				buildSpatialHash(positions);
+				hashBuilt = true;
+			}
+
+			collisions = queryBounds(collider, positions, contacts);
+
+			#pragma omp parallel for num_threads(numThreads) schedule(static)
+			for (int i = 0; i < collisions; i++)
+			{
+				double normal[DIMENSION];
+				getContactNormal(collider, positions, contacts[i], normal);
+				respond(contacts[i], normal, collider.material, positions, velocities, deltaT);
+			}
+		}
+
+		totalContacts += collisions;
+	}
+
+	return totalContacts;
+}
+
+//Writes the vertices in [begin, end) below the plane to contactList and returns how many there are
+//SIMD_WIDTH signed distances are computed at a time and the lanes below the plane are compacted from the comparison mask,
+//so there is no branch per vertex.
+int CollisionSystem::detectPlane(const Collider & collider, const double * positions, int begin, int end, int * contactList)
+{
+	const double * x = positions;
+	const double * y = positions + numVertices;
+	const double * z = positions + 2 * numVertices;
+
+	SimdDouble normalX = simdSet(collider.normal[0]);
+	SimdDouble normalY = simdSet(collider.normal[1]);
+	SimdDouble normalZ = simdSet(collider.normal[2]);
+	SimdDouble offset = simdSet(collider.offset);
+
+	int count = 0;
+	int i = begin;
+	for (; i + SIMD_WIDTH <= end; i += SIMD_WIDTH)
+	{
+		SimdDouble distance = simdMul(normalX, simdLoadUnaligned(x + i));
+		distance = simdMulAdd(normalY, simdLoadUnaligned(y + i), distance);
+		distance = simdMulAdd(normalZ, simdLoadUnaligned(z + i), distance);
+
+		SimdMask inside = simdLess(distance, offset);
+		if (simdAny(inside))
+		{
+			int lanes = simdMaskBits(inside);
+			for (int lane = 0; lane < SIMD_WIDTH; lane++)
+			{
+				contactList[count] = i + lane;
+				count += (lanes >> lane) & 1;
+			}
+		}
+	}
+
+	for (; i < end; i++)
+	{
+		double distance = collider.normal[0] * x[i];
+		distance = collider.normal[1] * y[i] + distance;
+		distance = collider.normal[2] * z[i] + distance;
+		contactList[count] = i;
+		count += distance < collider.offset;
+	}
+
+	return count;
+}
+
+//Sorts the surface vertices into hash buckets by the grid cell they are in (a counting sort, so it is linear in the vertices)
+void CollisionSystem::buildSpatialHash(const double * positions)
+{
+	int numSurfaceVertices = (int) surfaceVertices.size();
+	if (numSurfaceVertices == 0)
+	{
+		return;
+	}
+
+	for (int k = 0; k < DIMENSION; k++)
+	{
+		meshMin[k] = positions[k * numVertices + surfaceVertices[0]];
+		meshMax[k] = meshMin[k];
+	}
+	for (int i = 1; i < numSurfaceVertices; i++)
+	{
+		for (int k = 0; k < DIMENSION; k++)
+		{
+			double position = positions[k * numVertices + surfaceVertices[i]];
+			meshMin[k] = min(meshMin[k], position);
+			meshMax[k] = max(meshMax[k], position);
+		}
+	}
+
+	double extent = 0;
+	for (int k = 0; k < DIMENSION; k++)
+	{
+		extent = max(extent, meshMax[k] - meshMin[k]);
+	}
+	cellSize = extent > COLLISION_EPSILON ? extent / HASH_CELLS_PER_EXTENT : 1;
+
+	for (int b = 0; b <= hashBucketCount; b++)
+	{
+		hashBucketStarts[b] = 0;
+	}
+	for (int i = 0; i < numSurfaceVertices; i++)
+	{
+		int vertex = surfaceVertices[i];
+		surfaceBuckets[i] = hashCell(getCell(positions[vertex], 0), getCell(positions[numVertices + vertex], 1), getCell(positions[2 * numVertices + vertex], 2));
+		hashBucketStarts[surfaceBuckets[i] + 1]++;
+	}
+	for (int b = 0; b < hashBucketCount; b++)
+	{
+		hashBucketStarts[b + 1] += hashBucketStarts[b];
+	}
+
+	//Filling each bucket from its end leaves hashBucketStarts[b + 1] at the first entry of bucket b
+	for (int i = numSurfaceVertices - 1; i >= 0; i--)
+	{
+		hashVertices[--hashBucketStarts[surfaceBuckets[i] + 1]] = surfaceVertices[i];
+	}
+	for (int b = 0; b < hashBucketCount; b++)
+	{
+		hashBucketStarts[b] = hashBucketStarts[b + 1];
+	}
+	hashBucketStarts[hashBucketCount] = numSurfaceVertices;
+}
+
+//Writes the surface vertices inside a sphere or box collider to contactList and returns how many there are
+int CollisionSystem::queryBounds(const Collider & collider, const double * positions, int * contactList)
+{
+	int numSurfaceVertices = (int) surfaceVertices.size();
+
+	//Nothing to do if the collider misses the bounds of the whole surface
+	int lowCell[DIMENSION];
+	int highCell[DIMENSION];
+	double cellCount = 1;
+	for (int k = 0; k < DIMENSION; k++)
+	{
+		if (numSurfaceVertices == 0 || collider.boxMax[k] < meshMin[k] || collider.boxMin[k] > meshMax[k])
+		{
+			return 0;
+		}
+		lowCell[k] = getCell(max(collider.boxMin[k], meshMin[k]), k);
+		highCell[k] = getCell(min(collider.boxMax[k], meshMax[k]), k);
+		cellCount *= highCell[k] - lowCell[k] + 1;
+	}
+
+	int count = 0;
+
+	//A collider covering more cells than there are vertices is cheaper to test against every surface vertex
+	if (cellCount > numSurfaceVertices)
+	{
+		double normal[DIMENSION];
+		for (int i = 0; i < numSurfaceVertices; i++)
+		{
+			if (getContactNormal(collider, positions, surfaceVertices[i], normal))
+			{
+				contactList[count++] = surfaceVertices[i];
+			}
+		}
+		return count;
+	}
+
+	//Different cells can share a bucket, so every vertex is stamped the first time it is tested
+	queryStamp++;
+	double normal[DIMENSION];
+	for (int x = lowCell[0]; x <= highCell[0]; x++)
+	{
+		for (int y = lowCell[1]; y <= highCell[1]; y++)
+		{
+			for (int z = lowCell[2]; z <= highCell[2]; z++)
+			{
+				int bucket = hashCell(x, y, z);
+				for (int i = hashBucketStarts[bucket]; i < hashBucketStarts[bucket + 1]; i++)
+				{
+					int vertex = hashVertices[i];
+					if (visitedStamps[vertex] != queryStamp)
+					{
+						visitedStamps[vertex] = queryStamp;
+						if (getContactNormal(collider, positions, vertex, normal))
+						{
+							contactList[count++] = vertex;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+//Narrow phase - returns true if the vertex is inside the collider, with the direction to push it out in normal
+bool CollisionSystem::getContactNormal(const Collider & collider, const double * positions, int vertex, double normal[DIMENSION])
+{
+	double position[DIMENSION];
+	for (int k = 0; k < DIMENSION; k++)
+	{
+		position[k] = positions[k * numVertices + vertex];
+	}
+
+	if (collider.type == COLLIDER_PLANE)
+	{
+		double distance = 0;
+		for (int k = 0; k < DIMENSION; k++)
+		{
+			distance += collider.normal[k] * position[k];
+			normal[k] = collider.normal[k];
+		}
+		return distance < collider.offset;
+	}
+
+	if (collider.type == COLLIDER_SPHERE)
+	{
+		double offset[DIMENSION];
+		double distanceSquared = 0;
+		for (int k = 0; k < DIMENSION; k++)
+		{
+			offset[k] = position[k] - collider.center[k];
+			distanceSquared += offset[k] * offset[k];
+		}
+		if (distanceSquared >= collider.radius * collider.radius)
+		{
+			return false;
+		}
+
+		//A vertex exactly at the center is pushed straight up
+		double distance = sqrt(distanceSquared);
+		for (int k = 0; k < DIMENSION; k++)
+		{
+			normal[k] = distance > COLLISION_EPSILON ? offset[k] / distance : (k == 1 ? 1 : 0);
+		}
+		return true;
+	}
+
+	//Box - the vertex leaves through the closest face
+	double closestDepth = 0;
+	int closestFace = -1;
+	for (int k = 0; k < DIMENSION; k++)
+	{
+		double lowDepth = position[k] - collider.boxMin[k];
+		double highDepth = collider.boxMax[k] - position[k];
+		if (lowDepth <= 0 || highDepth <= 0)
+		{
+			return false;
+		}
+		if (closestFace < 0 || lowDepth < closestDepth)
+		{
+			closestDepth = lowDepth;
+			closestFace = 2 * k;
+		}
+		if (highDepth < closestDepth)
+		{
+			closestDepth = highDepth;
+			closestFace = 2 * k + 1;
+		}
+	}
+	for (int k = 0; k < DIMENSION; k++)
+	{
+		normal[k] = 0;
+	}
+	normal[closestFace / 2] = closestFace % 2 == 0 ? -1 : 1;
+	return true;
+}
+
+//Linear impulse with Coulomb friction against a contact with the given unit normal
+//Linear impulse based on: http://gafferongames.com/virtualgo/collision-response-and-coulomb-friction/
+//Static / Dynamic Friction based on Gravitas: An extensible physics engine framework using object- oriented and design pattern-driven software architecture principles, by Colin Vella
+//https://drive.google.com/file/d/0Bze6mKYvrpOKYjdkODVhMTAtM2Q4Zi00NzgyLWE2YzMtN2MwZmQ4NjA3OWMw/view?ddrp=1&pli=1&hl=en
+void CollisionSystem::respond(int vertex, const double normal[DIMENSION], const ContactMaterial & material, double * positions, double * velocities, double deltaT)
+{
+	//j = max(-(1 + restitution) * dot(velocity, normal), 0); %Magnitude of reaction force without rotational inertia
+	double dotProduct = 0;
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		dotProduct += velocities[j * numVertices + vertex] * normal[j];
+	}
+
+	double jr = -(1 + material.restitution) * dotProduct;
+	if (jr < 0)
+	{
+		jr = 0;
+	}
+
+	double js = material.staticFriction * jr;
+	double jd = material.dynamicFriction * jr;
+
+	//tangent = velocity - dot(velocity, normal) * normal, normalized (0 if it is too short or the vertex is not moving along the normal)
+	double tangent[DIMENSION];
+	double magnitude = 0; //This is the magnitude of the tangent vector
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		tangent[j] = velocities[j * numVertices + vertex] - dotProduct * normal[j];
+		magnitude += tangent[j] * tangent[j];
+	}
+	magnitude = sqrt(magnitude);
+
+	if (magnitude > COLLISION_EPSILON && fabs(dotProduct) > COLLISION_EPSILON) //STABILITY FIX - dot product check
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			tangent[j] /= magnitude;
+		}
+	}
+	else //Precision problem - magnitude rounded to zero.  We cannot normalize the vector with it, or we'll get division by zero.
+	{
+		tangent[0] = 0;		//STABILITY FIX - 0 vector instead of 1 0 0 vector
+		tangent[1] = 0;
+		tangent[2] = 0;
+	}
+
+	double dotProduct2 = 0; //This is the dot product of the velocity and the tangent vectors
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		dotProduct2 += velocities[j * numVertices + vertex] * tangent[j];
+	}
+
+	//Static friction cancels the tangential velocity, dynamic friction opposes it
+	double jf[DIMENSION];
+	if (fabs(dotProduct2) < COLLISION_EPSILON && dotProduct2 <= js) //STABILITY FIX - changed || to &&
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			jf[j] = -dotProduct2 * tangent[j];
+		}
+	}
+	else
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			jf[j] = -jd * tangent[j];
+		}
+	}
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Contact at vertex " << vertex << ": jr " << jr << ", jf " << jf[0] << " " << jf[1] << " " << jf[2] << endl;
+	}
+	#endif
+
+	//Apply instantaneous reaction impulse force
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		velocities[j * numVertices + vertex] += jr * normal[j] + jf[j];
+		positions[j * numVertices + vertex] += (jr * normal[j] + jf[j]) * deltaT;
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include "Vertex.h"
+#include "Logger.h"
+
+using namespace std;
+
+enum ColliderType {COLLIDER_PLANE, COLLIDER_SPHERE, COLLIDER_BOX};
+
+//Restitution and friction of the contacts with one collider
+struct ContactMaterial
+{
+	double restitution;			//Controls how much the object bounces back
+	double staticFriction;
+	double dynamicFriction;
+};
+
+//A static obstacle the mesh collides with
+struct Collider
+{
+	ColliderType type;
+	double normal[DIMENSION];		//Plane: unit normal pointing out of the solid half space
+	double offset;					//Plane: points with dot(normal, x) < offset are inside
+	double center[DIMENSION];		//Sphere
+	double radius;					//Sphere
+	double boxMin[DIMENSION];		//Box (axis aligned) - also the bounds of a sphere, used by the broad phase
+	double boxMax[DIMENSION];
+	ContactMaterial material;
+};
+
+//Collision detection and response of the mesh vertices against a list of static colliders
+//Planes are tested against every vertex, SIMD_WIDTH vertices at a time without branches.  Spheres and boxes only ever
+//touch the surface first, so they query a spatial hash of the surface vertices (rebuilt each step) with their bounds.
+//Either way the vertices in contact are compacted into a contact list, and only those get the impulse response.
+class CollisionSystem
+{
+public:
+	CollisionSystem(int numVertices, const vector<int> & surfaceVertices, Logger * logger);
+	~CollisionSystem();
+	void addPlane(const double normal[DIMENSION], double offset, const ContactMaterial & material);
+	void addSphere(const double center[DIMENSION], double radius, const ContactMaterial & material);
+	void addBox(const double boxMin[DIMENSION], const double boxMax[DIMENSION], const ContactMaterial & material);
+	void clearColliders() {colliders.clear();}
+	int getColliderCount() {return (int) colliders.size();}
+	const Collider & getCollider(int i) {return colliders[i];}
+	int detectAndRespond(double * positions, double * velocities, double deltaT, int numThreads);
+	void addSurfaceVertex(int vertex);
+	void setSurfaceVertices(const vector<int> & surfaceVertices);
+
+private:
+	CollisionSystem(const CollisionSystem &);				//Not copyable - owns the contact and hash arrays
+	CollisionSystem & operator = (const CollisionSystem &);
+
+	int numVertices;
+	vector<Collider> colliders;
+	Logger * logger;
+
+	int * contacts;					//Vertices in contact with the current collider; each thread compacts into its own range
+	vector<int> surfaceVertices;
+	vector<bool> isSurfaceVertex;
+
+	//Spatial hash of the surface vertices - hashVertices holds them grouped by cell bucket, bucket b in
+	//[hashBucketStarts[b], hashBucketStarts[b + 1])
+	int hashBucketCount;			//Power of 2
+	int * hashBucketStarts;
+	int * hashVertices;				//Room for every vertex, so addSurfaceVertex never reallocates
+	int * surfaceBuckets;			//Bucket of each surface vertex
+	double cellSize;
+	double meshMin[DIMENSION];		//Bounds of the surface vertices
+	double meshMax[DIMENSION];
+	int * visitedStamps;			//Query a vertex was last tested in, so buckets shared by several cells are not tested twice
+	int queryStamp;
+
+	int detectPlane(const Collider & collider, const double * positions, int begin, int end, int * contactList);
+	void buildSpatialHash(const double * positions);
+	int queryBounds(const Collider & collider, const double * positions, int * contactList);
+	bool getContactNormal(const Collider & collider, const double * positions, int vertex, double normal[DIMENSION]);
+	//Unsigned, so the products wrap instead of overflowing (cells below the bounds have negative coordinates)
+	int hashCell(int x, int y, int z) {return (int) ((((unsigned) x * 73856093u) ^ ((unsigned) y * 19349663u) ^ ((unsigned) z * 83492791u)) & (unsigned) (hashBucketCount - 1));}
+	int getCell(double position, int k) {return (int) floor((position - meshMin[k]) / cellSize);}
+	void respond(int vertex, const double normal[DIMENSION], const ContactMaterial & material, double * positions, double * velocities, double deltaT);
+};
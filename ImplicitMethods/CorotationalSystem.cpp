@@ -0,0 +1,408 @@
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+#include "Logger.h"
+#include "CorotationalSystem.h"
+#include "Memory.h"
+#include "Simd.h"
+#include "PrecomputeCache.h"
+#include "SVD3.h"
+
+using namespace std;
+
+//Linear elasticity in the rest frame of a tetrahedron
+//With the displacement gradient H = R' * F - I, the small strain is E = (H + H') / 2 and the Cauchy stress
+//stress = lambda * trace(E) * I + 2 * mu * E.  Vertex k + 1 (k = 0 - 2) gets -volume * R * stress * (row k of invDm), which is
+//the rest stiffness matrix K of the tetrahedron applied to the rotated back displacements R' * x - x0, rotated forward by R.
+//K = volume * B' * C * B is never stored: applying it in this factored form takes a fraction of the 144 multiply adds
+//(and of the memory) of the 12 X 12 matrix.
+
+//Constructor
+CorotationalSystem::CorotationalSystem(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger) : ParticleSystem(vertexList, vertexCount, tetraList, tetraCount, logger)
+{
+	strcpy(text, "Method 4");
+	double K = 700;					//Bulk Modulus
+	mu = 700;						//Shear modulus (Lame's second parameter)
+	lambda = K - (2.0/3) * mu;		//Lame's first parameter
+	kd = 0.2;
+
+	cout << fixed << setprecision(5);
+	logger -> initFile("corotationalDeformation.log");
+	logger -> printText(text);
+
+	invDm = allocateTetraArray(9, 1);
+	restVolumes = allocateTetraArray(1, 1);
+	rotationV = allocateTetraArray(9, 1);
+	for (int i = 0; i < 9 * numTetra; i++)
+	{
+		rotationV[i] = (i % 9 % 4 == 0) ? 1 : 0;
+	}
+	rotationVSteps = (int *) allocateArenaBytes(sizeof(int) * numTetra);
+
+	PrecomputeCache precompute("corotational", orgVertices, numVertices, tetraList, numTetra);
+	precompute.addArray(invDm, 9 * numTetra);
+	precompute.addArray(restVolumes, numTetra);
+	if (!precompute.load(logger))
+	{
+		computeRestState();
+		precompute.save();
+	}
+
+	buildBlockedData();
+	resetWarmStart();
+}
+
+CorotationalSystem::~CorotationalSystem()
+{
+	//The rest state and the SIMD blocks belong to the arena
+}
+
+//Computes invDm and the rest volume of every tetrahedron from the original vertices
+void CorotationalSystem::computeRestState()
+{
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+	{
+		Vec3 edges[3];
+		for (int k = 0; k < 3; k++)
+		{
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				edges[k][j] = orgVertices[tetraList[(k + 1) * numTetra + currentTetrad]].position[j] - orgVertices[tetraList[0 * numTetra + currentTetrad]].position[j];
+			}
+		}
+
+		//The rows of inv(Dm) are the cross products of its columns over the determinant
+		double determinantDm = dot(edges[0], cross(edges[1], edges[2]));
+		Vec3 rows[3] = {cross(edges[1], edges[2]), cross(edges[2], edges[0]), cross(edges[0], edges[1])};
+		for (int row = 0; row < DIMENSION; row++)
+		{
+			for (int col = 0; col < DIMENSION; col++)
+			{
+				invDm[currentTetrad * 9 + row * 3 + col] = rows[row][col] / determinantDm;
+			}
+		}
+		restVolumes[currentTetrad] = fabs(determinantDm) / 6;
+
+		#ifdef DEBUGGING
+		if (logger -> isLogging)
+		{
+			logger -> print3By3MatrixSingleIndex(&invDm[currentTetrad * 9], "Inverse of DM", logger -> MEDIUM);
+		}
+		#endif
+	}
+}
+
+//The warm started rotations are saved with the state, so a resumed run starts its SVDs from the same V as the original run
+void CorotationalSystem::addCheckpointArrays(vector<CheckpointArray> & arrays)
+{
+	ParticleSystem::addCheckpointArrays(arrays);
+	CheckpointArray rotationArray = {rotationV, sizeof(double) * 9 * numTetra};
+	CheckpointArray blockedRotationArray = {blockedRotationV, sizeof(ForceReal) * numForceBlocks * 9 * FORCE_BLOCK_WIDTH};
+	CheckpointArray stepArray = {rotationVSteps, sizeof(int) * numTetra};
+	CheckpointArray blockedStepArray = {blockedRotationVSteps, sizeof(int) * numForceBlocks};
+	arrays.push_back(rotationArray);
+	arrays.push_back(blockedRotationArray);
+	arrays.push_back(stepArray);
+	arrays.push_back(blockedStepArray);
+}
+
+//Marks every V as too old to warm start from, so the next SVD of each tetrahedron takes the full sweeps
+void CorotationalSystem::resetWarmStart()
+{
+	for (int i = 0; i < numTetra; i++)
+	{
+		rotationVSteps[i] = -2;
+	}
+	for (int block = 0; block < numForceBlocks; block++)
+	{
+		blockedRotationVSteps[block] = -2;
+	}
+}
+
+//Jacobi sweeps for an SVD started from a V computed in step rotationStep: one if the V is from this step or the previous one
+//(F has barely changed since), else the full sweeps of a cold start
+int CorotationalSystem::getRotationSweeps(int rotationStep)
+{
+	return rotationStep >= getStepCount() - 1 ? SVD3_WARM_SWEEPS : SVD3_JACOBI_SWEEPS;
+}
+
+//Repacks invDm and the volumes for the blocks of FORCE_BLOCK_WIDTH tetrahedra (see ParticleSystem::buildForceBlocks)
+//so that entry k of the tetrahedra in a block are adjacent (one SIMD load per matrix entry).
+void CorotationalSystem::buildBlockedData()
+{
+	blockedInvDm = allocateBlockArray(9);
+	blockedRestVolumes = allocateBlockArray(1);
+	blockedRotationV = allocateBlockArray(9);
+	blockedRotationVSteps = (int *) allocateArenaBytes(sizeof(int) * numForceBlocks);
+
+	for (int color = 0; color < numTetraColors; color++)
+	{
+		for (int block = colorBlockOffsets[color]; block < colorBlockOffsets[color + 1]; block++)
+		{
+			for (int lane = 0; lane < FORCE_BLOCK_WIDTH; lane++)
+			{
+				int currentTetrad = tetraColorOffsets[color] + (block - colorBlockOffsets[color]) * FORCE_BLOCK_WIDTH + lane;
+				for (int k = 0; k < 9; k++)
+				{
+					blockedInvDm[(block * 9 + k) * FORCE_BLOCK_WIDTH + lane] = invDm[currentTetrad * 9 + k];
+					blockedRotationV[(block * 9 + k) * FORCE_BLOCK_WIDTH + lane] = (k % 4 == 0) ? 1 : 0;
+				}
+				blockedRestVolumes[block * FORCE_BLOCK_WIDTH + lane] = restVolumes[currentTetrad];
+			}
+		}
+	}
+}
+
+//SIMD version of computeTetraForces for the block of FORCE_BLOCK_WIDTH tetrahedra starting at firstTetrad
+//Each SimdForce holds one matrix entry for all tetrahedra of the block; the SVD runs on all the lanes at once without branches.
+//The forces (plus damping) are added into currentForce.
+void CorotationalSystem::computeBlockForces(int firstTetrad, int block)
+{
+	const ForceReal * blockInvDm = &blockedInvDm[block * 9 * FORCE_BLOCK_WIDTH];
+
+	//Scratch space for moving lane data in and out of registers
+	double lanes[12 * FORCE_BLOCK_WIDTH];
+
+	//Ds = [p1 - p0, p2 - p0, p3 - p0] gathered lane by lane
+	for (int lane = 0; lane < FORCE_BLOCK_WIDTH; lane++)
+	{
+		int i = firstTetrad + lane;
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			const double * position = &positions[j * numVertices];
+			double p0 = position[tetraList[0 * numTetra + i]];
+			lanes[(j * 3 + 0) * FORCE_BLOCK_WIDTH + lane] = position[tetraList[1 * numTetra + i]] - p0;
+			lanes[(j * 3 + 1) * FORCE_BLOCK_WIDTH + lane] = position[tetraList[2 * numTetra + i]] - p0;
+			lanes[(j * 3 + 2) * FORCE_BLOCK_WIDTH + lane] = position[tetraList[3 * numTetra + i]] - p0;
+		}
+	}
+
+	SimdForce Ds[9];
+	for (int k = 0; k < 9; k++)
+	{
+		Ds[k] = simdLoadForce(&lanes[k * FORCE_BLOCK_WIDTH]);
+	}
+
+	//F = Ds * inv(Dm)
+	SimdForce F[9];
+	for (int row = 0; row < DIMENSION; row++)
+	{
+		for (int col = 0; col < DIMENSION; col++)
+		{
+			SimdForce sum = simdMul(Ds[row * 3 + 0], simdLoad(&blockInvDm[(0 * 3 + col) * FORCE_BLOCK_WIDTH]));
+			sum = simdMulAdd(Ds[row * 3 + 1], simdLoad(&blockInvDm[(1 * 3 + col) * FORCE_BLOCK_WIDTH]), sum);
+			F[row * 3 + col] = simdMulAdd(Ds[row * 3 + 2], simdLoad(&blockInvDm[(2 * 3 + col) * FORCE_BLOCK_WIDTH]), sum);
+		}
+	}
+
+	//R = U * V', with the SVD started from the V of the previous step
+	ForceReal * blockV = &blockedRotationV[block * 9 * FORCE_BLOCK_WIDTH];
+	SimdForce U[9];
+	SimdForce sigma[3];
+	SimdForce V[9];
+	for (int k = 0; k < 9; k++)
+	{
+		V[k] = simdLoad(&blockV[k * FORCE_BLOCK_WIDTH]);
+	}
+	svd3WarmStart(F, U, sigma, V, getRotationSweeps(blockedRotationVSteps[block]));
+	for (int k = 0; k < 9; k++)
+	{
+		simdStore(&blockV[k * FORCE_BLOCK_WIDTH], V[k]);
+	}
+	blockedRotationVSteps[block] = getStepCount();
+
+	SimdForce R[9];
+	for (int row = 0; row < DIMENSION; row++)
+	{
+		for (int col = 0; col < DIMENSION; col++)
+		{
+			SimdForce sum = simdMul(U[row * 3 + 0], V[col * 3 + 0]);
+			sum = simdMulAdd(U[row * 3 + 1], V[col * 3 + 1], sum);
+			R[row * 3 + col] = simdMulAdd(U[row * 3 + 2], V[col * 3 + 2], sum);
+		}
+	}
+
+	//S = R' * F, the deformation in the rest frame - only the upper triangle of its symmetric part is needed
+	SimdForce S[9];
+	for (int row = 0; row < DIMENSION; row++)
+	{
+		for (int col = 0; col < DIMENSION; col++)
+		{
+			SimdForce sum = simdMul(R[0 * 3 + row], F[0 * 3 + col]);
+			sum = simdMulAdd(R[1 * 3 + row], F[1 * 3 + col], sum);
+			S[row * 3 + col] = simdMulAdd(R[2 * 3 + row], F[2 * 3 + col], sum);
+		}
+	}
+
+	//stress = lambda * trace(E) * I + 2 * mu * E with E = (S + S') / 2 - I
+	SimdForce one = simdConstant<SimdForce>(1);
+	SimdForce tetraMuLanes = simdLoadForce(&tetraMu[firstTetrad]);
+	SimdForce twoMu = simdMul(simdConstant<SimdForce>(2), tetraMuLanes);
+	SimdForce strainTrace = simdSub(simdAdd(simdAdd(S[0], S[4]), S[8]), simdConstant<SimdForce>(3));
+	SimdForce lambdaTrace = simdMul(simdLoadForce(&tetraLambda[firstTetrad]), strainTrace);
+	SimdForce stress[9];
+	for (int row = 0; row < DIMENSION; row++)
+	{
+		stress[row * 3 + row] = simdMulAdd(twoMu, simdSub(S[row * 3 + row], one), lambdaTrace);
+		for (int col = row + 1; col < DIMENSION; col++)
+		{
+			stress[row * 3 + col] = stress[col * 3 + row] = simdMul(tetraMuLanes, simdAdd(S[row * 3 + col], S[col * 3 + row]));
+		}
+	}
+
+	//P = -volume * R * stress, rotated forward and scaled for the force
+	SimdForce scale = simdSub(simdConstant<SimdForce>(0), simdLoad(&blockedRestVolumes[block * FORCE_BLOCK_WIDTH]));
+	SimdForce P[9];
+	for (int row = 0; row < DIMENSION; row++)
+	{
+		for (int col = 0; col < DIMENSION; col++)
+		{
+			SimdForce sum = simdMul(R[row * 3 + 0], stress[0 * 3 + col]);
+			sum = simdMulAdd(R[row * 3 + 1], stress[1 * 3 + col], sum);
+			P[row * 3 + col] = simdMul(scale, simdMulAdd(R[row * 3 + 2], stress[2 * 3 + col], sum));
+		}
+	}
+
+	//Vertex k + 1 gets P * (row k of invDm); vertex 0 gets minus the sum of the others
+	for (int row = 0; row < DIMENSION; row++)
+	{
+		SimdForce f0 = simdConstant<SimdForce>(0);
+		for (int vertex = 1; vertex < 4; vertex++)
+		{
+			SimdForce f = simdMul(P[row * 3 + 0], simdLoad(&blockInvDm[((vertex - 1) * 3 + 0) * FORCE_BLOCK_WIDTH]));
+			f = simdMulAdd(P[row * 3 + 1], simdLoad(&blockInvDm[((vertex - 1) * 3 + 1) * FORCE_BLOCK_WIDTH]), f);
+			f = simdMulAdd(P[row * 3 + 2], simdLoad(&blockInvDm[((vertex - 1) * 3 + 2) * FORCE_BLOCK_WIDTH]), f);
+			simdStoreForce(&lanes[(row * 4 + vertex) * FORCE_BLOCK_WIDTH], f);
+			f0 = simdSub(f0, f);
+		}
+		simdStoreForce(&lanes[(row * 4 + 0) * FORCE_BLOCK_WIDTH], f0);
+	}
+
+	//Scatter the forces (plus damping) lane by lane
+	for (int lane = 0; lane < FORCE_BLOCK_WIDTH; lane++)
+	{
+		int i = firstTetrad + lane;
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			for (int k = 0; k < 4; k++)
+			{
+				int vertex = j * numVertices + tetraList[k * numTetra + i];
+				currentForce[vertex] += lanes[(j * 4 + k) * FORCE_BLOCK_WIDTH + lane] - tetraKd[i] * velocities[vertex];
+			}
+		}
+	}
+}
+
+//Deformation gradient F = Ds * inv(Dm) of one tetrahedron and its rotation R = U * V' (updates rotationV)
+//Parameter p - deformed positions of the 4 vertices (3 X 4, p[j * 4 + vertex])
+void CorotationalSystem::computeRotation(int currentTetrad, double * p, Mat3 & F, Mat3 & R)
+{
+	Mat3 Ds;
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			Ds(j, k) = p[j * 4 + k + 1] - p[j * 4 + 0];
+		}
+	}
+	F = Ds * Mat3::fromArray(&invDm[currentTetrad * 9]);
+
+	//R = U * V', with the SVD started from the V of the previous call
+	Mat3 U;
+	Vec3 sigma;
+	Mat3 V = Mat3::fromArray(&rotationV[currentTetrad * 9]);
+	svd3WarmStart(F.data, U.data, sigma.data, V.data, getRotationSweeps(rotationVSteps[currentTetrad]));
+	memcpy(&rotationV[currentTetrad * 9], V.data, 9 * sizeof(double));
+	rotationVSteps[currentTetrad] = getStepCount();
+	R = timesTranspose(U, V);
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		logger -> print3By3MatrixSingleIndex(F.data, "F", logger -> MEDIUM);
+		logger -> print3By3MatrixSingleIndex(R.data, "R", logger -> MEDIUM);
+	}
+	#endif
+}
+
+//Overridden force kernel - computes the corotated linear elastic forces for one tetrahedron
+//Parameter p is the deformed positions of its 4 vertices (3 X 4, p[j * 4 + vertex]); the forces are written to forces in the same layout
+//The velocities are not used - accumulateTetraForces adds the kd damping.
+void CorotationalSystem::computeTetraForces(int currentTetrad, double * p, double *, double * forces)
+{
+	Mat3 F;
+	Mat3 R;
+	computeRotation(currentTetrad, p, F, R);
+
+	//E = (S + S') / 2 - I with S = R' * F
+	Mat3 S = transposeTimes(R, F);
+	Mat3 strain = 0.5 * (S + transpose(S)) - Mat3::identity();
+	Mat3 stress = (2 * tetraMu[currentTetrad]) * strain + (tetraLambda[currentTetrad] * trace(strain)) * Mat3::identity();
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		logger -> print3By3MatrixSingleIndex(stress.data, "stress", logger -> MEDIUM);
+	}
+	#endif
+
+	//Vertex k + 1 gets -volume * R * stress * (row k of invDm) - the columns of P * inv(Dm)'; vertex 0 gets minus the sum of the others
+	Mat3 P = (-restVolumes[currentTetrad]) * (R * stress);
+	Mat3 vertexForces = timesTranspose(P, Mat3::fromArray(&invDm[currentTetrad * 9]));
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		forces[j * 4 + 0] = -(vertexForces(j, 0) + vertexForces(j, 1) + vertexForces(j, 2));
+		for (int k = 0; k < 3; k++)
+		{
+			forces[j * 4 + k + 1] = vertexForces(j, k);
+		}
+	}
+}
+
+//Analytic force Jacobian for the implicit integrator - the rest stiffness rotated into the current frame, -R * K * R',
+//ignoring the change of R with the positions (the usual corotational approximation, which keeps it symmetric negative semidefinite)
+//With g_a the shape function gradients, K_ab = volume * (lambda * g_a * g_b' + mu * g_b * g_a' + mu * dot(g_a, g_b) * I).
+//Parameter stiffness - receives the 12 X 12 Jacobian (see ParticleSystem.h for the layout)
+void CorotationalSystem::computeTetraStiffness(int currentTetrad, double * p, double *, double * stiffness)
+{
+	Mat3 F;
+	Mat3 R;
+	computeRotation(currentTetrad, p, F, R);
+
+	Vec3 gradients[4];
+	for (int k = 0; k < 3; k++)
+	{
+		for (int col = 0; col < DIMENSION; col++)
+		{
+			gradients[k + 1][col] = invDm[currentTetrad * 9 + k * 3 + col];
+		}
+	}
+	gradients[0] = -(gradients[1] + gradients[2] + gradients[3]);
+
+	double volume = restVolumes[currentTetrad];
+	double tetraLambdaValue = tetraLambda[currentTetrad];
+	double tetraMuValue = tetraMu[currentTetrad];
+	for (int a = 0; a < 4; a++)
+	{
+		for (int b = 0; b < 4; b++)
+		{
+			Mat3 restBlock = (tetraMuValue * dot(gradients[a], gradients[b])) * Mat3::identity();
+			for (int row = 0; row < DIMENSION; row++)
+			{
+				for (int col = 0; col < DIMENSION; col++)
+				{
+					restBlock(row, col) += tetraLambdaValue * gradients[a][row] * gradients[b][col] + tetraMuValue * gradients[b][row] * gradients[a][col];
+				}
+			}
+
+			Mat3 block = (-volume) * timesTranspose(R * restBlock, R);
+			for (int row = 0; row < DIMENSION; row++)
+			{
+				for (int col = 0; col < DIMENSION; col++)
+				{
+					stiffness[(a * 3 + row) * 12 + b * 3 + col] = block(row, col);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ParticleSystem.h"
+#include "SmallMatrix.h"
+
+//Particle System class - Deformation Method #4
+//
+//Corotated linear elasticity: each tetrahedron is rotated back into its rest frame, the linear (small strain) elastic forces are
+//evaluated there and rotated forward again.  The rotation R is the polar part of the deformation gradient F = R * S, taken from
+//the 3 X 3 SVD F = U * sigma * V' as R = U * V' (see SVD3.h).  Both U and V are proper rotations, so R stays a rotation for an
+//inverted tetrahedron too and the forces push it back out - this method never needs uninvertF.
+//Each SVD starts from the tetrahedron's V of the previous step, which needs a single Jacobi sweep instead of 5.  A V that is
+//older than that (the tetrahedron slept, the last steps ran on the GPU, the system was reset, or the SIMD blocks computed the
+//forces while the scalar path is warm starting) gets the full 5 sweeps.
+//Based on: Mueller and Gross, "Interactive Virtual Materials" and Irving et al., "Invertible Finite Elements For Robust Simulation of Large Deformation"
+class CorotationalSystem : public ParticleSystem
+{
+	public:
+	CorotationalSystem(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger);
+	~CorotationalSystem();
+
+	protected:
+	void computeRestState();
+	void buildBlockedData();
+	void computeBlockForces(int firstTetrad, int block);
+	void computeTetraForces(int currentTetrad, double * p, double * v, double * forces);
+	void computeTetraStiffness(int currentTetrad, double * p, double * v, double * stiffness);
+	void computeRotation(int currentTetrad, double * p, Mat3 & F, Mat3 & R);
+	void addCheckpointArrays(vector<CheckpointArray> & arrays);
+	void resetWarmStart();
+	int getRotationSweeps(int rotationStep);
+
+	private:
+	double * invDm;					//Inverse rest edge matrix of each tetrahedron, Dm = [x1 - x0, x2 - x0, x3 - x0]: invDm[currentTetrad * 9 + row * 3 + col]
+									//Row k is the gradient of the linear shape function of vertex k + 1 (vertex 0 has minus their sum)
+	double * restVolumes;			//Volume of each undeformed tetrahedron
+	double * rotationV;				//Right rotation V of the last SVD of F of each tetrahedron in computeRotation (starts the next one - see svd3WarmStart)
+	int * rotationVSteps;			//Step (getStepCount) each rotationV was computed in
+	ForceReal * blockedInvDm;		//invDm repacked for the SIMD blocks: [(block * 9 + row * 3 + col) * FORCE_BLOCK_WIDTH + lane]
+	ForceReal * blockedRestVolumes;	//restVolumes repacked for the SIMD blocks: [block * FORCE_BLOCK_WIDTH + lane]
+	ForceReal * blockedRotationV;	//Right rotation V of the last SVD of F in each SIMD block (starts the next one - see svd3WarmStart), same layout as blockedInvDm
+	int * blockedRotationVSteps;	//Step each block of blockedRotationV was computed in
+};
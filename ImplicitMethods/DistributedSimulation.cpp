@@ -0,0 +1,419 @@
+#ifdef USE_MPI
+
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include "DistributedSimulation.h"
+#include "BatchRunner.h"
+#include "Timer.h"
+
+using namespace std;
+
+const int FORCE_TAG = 1;		//MPI tag of the force parts (see start)
+
+//Orders tetrahedra by one coordinate of their centroids (the index breaks ties, so every process splits the same way)
+struct TetraCentroidLess
+{
+	const vector<double> & centroids;
+	int axis;
+
+	TetraCentroidLess(const vector<double> & centroids, int axis) : centroids(centroids), axis(axis) {}
+	bool operator () (int a, int b) const
+	{
+		double ca = centroids[a * DIMENSION + axis];
+		double cb = centroids[b * DIMENSION + axis];
+		return ca < cb || (ca == cb && a < b);
+	}
+};
+
+//Gives tetrahedra order[begin ... end) to processes firstRank ... firstRank + rankCount - 1 (recursive coordinate bisection)
+//Each split is across the longest side of the centroids' bounds, with the tetrahedra shared out in proportion to the processes.
+static void bisect(vector<int> & order, int begin, int end, const vector<double> & centroids, int firstRank, int rankCount, vector<int> & tetraRanks)
+{
+	if (rankCount == 1)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			tetraRanks[order[i]] = firstRank;
+		}
+		return;
+	}
+
+	double boundsMin[DIMENSION];
+	double boundsMax[DIMENSION];
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		boundsMin[j] = numeric_limits<double>::max();
+		boundsMax[j] = -numeric_limits<double>::max();
+	}
+	for (int i = begin; i < end; i++)
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			boundsMin[j] = min(boundsMin[j], centroids[order[i] * DIMENSION + j]);
+			boundsMax[j] = max(boundsMax[j], centroids[order[i] * DIMENSION + j]);
+		}
+	}
+	int axis = 0;
+	for (int j = 1; j < DIMENSION; j++)
+	{
+		if (boundsMax[j] - boundsMin[j] > boundsMax[axis] - boundsMin[axis])
+		{
+			axis = j;
+		}
+	}
+
+	int lowRanks = rankCount / 2;
+	int middle = begin + (int) ((long long) (end - begin) * lowRanks / rankCount);
+	nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, TetraCentroidLess(centroids, axis));
+	bisect(order, begin, middle, centroids, firstRank, lowRanks, tetraRanks);
+	bisect(order, middle, end, centroids, firstRank + lowRanks, rankCount - lowRanks, tetraRanks);
+}
+
+DistributedSimulation::DistributedSimulation(MPI_Comm communicator, Logger * logger)
+{
+	this -> communicator = communicator;
+	this -> logger = logger;
+	MPI_Comm_rank(communicator, &rank);
+	MPI_Comm_size(communicator, &rankCount);
+	localVertices = NULL;
+	localVertexCount = 0;
+	localTetraList = NULL;
+	localTetraCount = 0;
+	globalVertexCount = 0;
+	particleSystem = NULL;
+	exchangeSeconds = 0;
+}
+
+//The particle system must be deleted first - it references localTetraList
+DistributedSimulation::~DistributedSimulation()
+{
+	delete [] localVertices;	//Only still set if no particle system was created
+	delete [] localTetraList;
+}
+
+//Splits the mesh among the processes and builds this process's part: its tetrahedra, their vertices and the vertices it
+//shares with each other process.  Every process must call this with the same mesh.
+//Parameter tetraList - 4 * tetraCount vertex indices, k * tetraCount + tetrahedron (see TetraMeshReader)
+void DistributedSimulation::partition(const Vertex * vertexList, int vertexCount, const int * tetraList, int tetraCount)
+{
+	globalVertexCount = vertexCount;
+
+	vector<double> centroids(DIMENSION * tetraCount, 0);
+	for (int t = 0; t < tetraCount; t++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				centroids[t * DIMENSION + j] += 0.25 * vertexList[tetraList[k * tetraCount + t]].position[j];
+			}
+		}
+	}
+	vector<int> order(tetraCount);
+	for (int t = 0; t < tetraCount; t++)
+	{
+		order[t] = t;
+	}
+	vector<int> tetraRanks(tetraCount);
+	bisect(order, 0, tetraCount, centroids, 0, rankCount, tetraRanks);
+
+	//The processes using each vertex, in rank order: vertexRanks[vertexRankOffsets[v] ... vertexRankOffsets[v + 1])
+	vector<long long> uses(4 * tetraCount);
+	for (int t = 0; t < tetraCount; t++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			uses[k * tetraCount + t] = (long long) tetraList[k * tetraCount + t] * rankCount + tetraRanks[t];
+		}
+	}
+	sort(uses.begin(), uses.end());
+	uses.erase(unique(uses.begin(), uses.end()), uses.end());
+	vector<int> vertexRankOffsets(vertexCount + 1, 0);
+	vector<int> vertexRanks(uses.size());
+	for (int i = 0; i < (int) uses.size(); i++)
+	{
+		vertexRankOffsets[uses[i] / rankCount + 1]++;
+		vertexRanks[i] = (int) (uses[i] % rankCount);
+	}
+	for (int v = 0; v < vertexCount; v++)
+	{
+		vertexRankOffsets[v + 1] += vertexRankOffsets[v];
+	}
+
+	//Local vertices in global order
+	vector<int> localIndices(vertexCount, -1);
+	globalVertices.clear();
+	for (int v = 0; v < vertexCount; v++)
+	{
+		for (int i = vertexRankOffsets[v]; i < vertexRankOffsets[v + 1]; i++)
+		{
+			if (vertexRanks[i] == rank)
+			{
+				localIndices[v] = (int) globalVertices.size();
+				globalVertices.push_back(v);
+			}
+		}
+	}
+	localVertexCount = (int) globalVertices.size();
+	delete [] localVertices;
+	localVertices = new Vertex[localVertexCount];
+	for (int i = 0; i < localVertexCount; i++)
+	{
+		localVertices[i] = vertexList[globalVertices[i]];
+	}
+
+	localTetraCount = 0;
+	for (int t = 0; t < tetraCount; t++)
+	{
+		localTetraCount += tetraRanks[t] == rank;
+	}
+	delete [] localTetraList;
+	localTetraList = new int[4 * localTetraCount];
+	int localTetrad = 0;
+	for (int t = 0; t < tetraCount; t++)
+	{
+		if (tetraRanks[t] == rank)
+		{
+			for (int k = 0; k < 4; k++)
+			{
+				localTetraList[k * localTetraCount + localTetrad] = localIndices[tetraList[k * tetraCount + t]];
+			}
+			localTetrad++;
+		}
+	}
+
+	//The surface of the whole mesh - the cuts add faces to the surface of each part
+	vector<int> triangleIndices;
+	ParticleSystem::findSurfaceTriangles(tetraList, tetraCount, triangleIndices);
+	vector<bool> onSurface(vertexCount, false);
+	for (int i = 0; i < (int) triangleIndices.size(); i++)
+	{
+		onSurface[triangleIndices[i]] = true;
+	}
+	surfaceVertices.clear();
+	for (int i = 0; i < localVertexCount; i++)
+	{
+		if (onSurface[globalVertices[i]])
+		{
+			surfaceVertices.push_back(i);
+		}
+	}
+
+	//Shared vertices, the neighbors they are shared with and where each part of their force comes from
+	neighbors.clear();
+	sharedVertices.clear();
+	ownedVertices.clear();
+	contributionOffsets.assign(1, 0);
+	contributions.clear();
+	vector<int> neighborIndices(rankCount, -1);
+	for (int i = 0; i < localVertexCount; i++)
+	{
+		int v = globalVertices[i];
+		if (vertexRanks[vertexRankOffsets[v]] == rank)
+		{
+			ownedVertices.push_back(i);
+		}
+		if (vertexRankOffsets[v + 1] - vertexRankOffsets[v] == 1)
+		{
+			continue;
+		}
+
+		sharedVertices.push_back(i);
+		for (int r = vertexRankOffsets[v]; r < vertexRankOffsets[v + 1]; r++)
+		{
+			int otherRank = vertexRanks[r];
+			if (otherRank == rank)
+			{
+				contributions.push_back(-1);
+				continue;
+			}
+			if (neighborIndices[otherRank] < 0)
+			{
+				neighborIndices[otherRank] = (int) neighbors.size();
+				neighbors.push_back(HaloNeighbor());
+				neighbors.back().rank = otherRank;
+			}
+			HaloNeighbor & neighbor = neighbors[neighborIndices[otherRank]];
+			contributions.push_back((int) neighbor.vertices.size());	//(slot, neighbor) pair - turned into an offset below
+			contributions.push_back(neighborIndices[otherRank]);
+			neighbor.vertices.push_back(i);
+		}
+		contributionOffsets.push_back((int) contributions.size());
+	}
+
+	//The received parts go one neighbor after another; replace each (slot, neighbor) pair by the offset of its values
+	int receiveOffset = 0;
+	for (int n = 0; n < (int) neighbors.size(); n++)
+	{
+		neighbors[n].receiveOffset = receiveOffset;
+		neighbors[n].sendForces.resize(DIMENSION * neighbors[n].vertices.size());
+		receiveOffset += DIMENSION * (int) neighbors[n].vertices.size();
+	}
+	receivedForces.resize(receiveOffset);
+	ownForces.resize(DIMENSION * sharedVertices.size());
+	vector<int> packed;
+	for (int k = 0; k < (int) sharedVertices.size(); k++)
+	{
+		int end = (int) packed.size();
+		for (int c = contributionOffsets[k]; c < contributionOffsets[k + 1]; c++)
+		{
+			if (contributions[c] < 0)
+			{
+				packed.push_back(-1);
+			}
+			else
+			{
+				packed.push_back(neighbors[contributions[c + 1]].receiveOffset + DIMENSION * contributions[c]);
+				c++;
+			}
+		}
+		contributionOffsets[k] = end;
+	}
+	contributionOffsets[sharedVertices.size()] = (int) packed.size();
+	contributions.swap(packed);
+	requests.resize(2 * neighbors.size());
+
+	//Rank 0 learns which vertices each process reports, once
+	int ownedCount = (int) ownedVertices.size();
+	gatherCounts.assign(rankCount, 0);
+	MPI_Gather(&ownedCount, 1, MPI_INT, &gatherCounts[0], 1, MPI_INT, 0, communicator);
+	gatherOffsets.assign(rankCount + 1, 0);
+	for (int r = 0; r < rankCount; r++)
+	{
+		gatherOffsets[r + 1] = gatherOffsets[r] + gatherCounts[r];
+	}
+	vector<int> ownedGlobal(ownedCount + 1);
+	for (int i = 0; i < ownedCount; i++)
+	{
+		ownedGlobal[i] = globalVertices[ownedVertices[i]];
+	}
+	gatheredVertices.assign(rank == 0 ? gatherOffsets[rankCount] + 1 : 1, 0);
+	MPI_Gatherv(&ownedGlobal[0], ownedCount, MPI_INT, &gatheredVertices[0], &gatherCounts[0], &gatherOffsets[0], MPI_INT, 0, communicator);
+
+	//From here on the counts and offsets are of the state values, 2 * DIMENSION per vertex
+	for (int r = 0; r <= rankCount; r++)
+	{
+		if (r < rankCount)
+		{
+			gatherCounts[r] *= 2 * DIMENSION;
+		}
+		gatherOffsets[r] *= 2 * DIMENSION;
+	}
+	sendState.resize(2 * DIMENSION * ownedCount + 1);
+	gatheredState.resize(rank == 0 ? gatherOffsets[rankCount] + 1 : 1);
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Rank " << rank << ": " << localTetraCount << " tetrahedra, " << localVertexCount << " vertices, " << sharedVertices.size() <<
+			" shared with " << neighbors.size() << " other processes" << endl;
+	}
+	#endif
+}
+
+//Creates the particle system of a deformation method over this process's part of the mesh (see partition)
+//The particle system's forces are completed by this object, which must outlive it.
+ParticleSystem * DistributedSimulation::createParticleSystem(int whichMethod)
+{
+	particleSystem = ::createParticleSystem(whichMethod, localVertices, localVertexCount, localTetraList, localTetraCount, logger);
+	localVertices = NULL;
+
+	particleSystem -> getCollisionSystem() -> setSurfaceVertices(surfaceVertices);
+	if (!sharedVertices.empty())
+	{
+		vector<bool> shared(localVertexCount, false);
+		for (int k = 0; k < (int) sharedVertices.size(); k++)
+		{
+			shared[sharedVertices[k]] = true;
+		}
+		particleSystem -> setForceExchange(this, shared);
+	}
+	return particleSystem;
+}
+
+//Sends this process's part of the force on the shared vertices to each neighbor and starts receiving theirs
+void DistributedSimulation::start(const double * forces)
+{
+	for (int k = 0; k < (int) sharedVertices.size(); k++)
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			ownForces[k * DIMENSION + j] = forces[j * localVertexCount + sharedVertices[k]];
+		}
+	}
+
+	for (int n = 0; n < (int) neighbors.size(); n++)
+	{
+		HaloNeighbor & neighbor = neighbors[n];
+		int count = DIMENSION * (int) neighbor.vertices.size();
+		for (int i = 0; i < (int) neighbor.vertices.size(); i++)
+		{
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				neighbor.sendForces[i * DIMENSION + j] = forces[j * localVertexCount + neighbor.vertices[i]];
+			}
+		}
+		MPI_Irecv(&receivedForces[neighbor.receiveOffset], count, MPI_DOUBLE, neighbor.rank, FORCE_TAG, communicator, &requests[2 * n]);
+		MPI_Isend(&neighbor.sendForces[0], count, MPI_DOUBLE, neighbor.rank, FORCE_TAG, communicator, &requests[2 * n + 1]);
+	}
+}
+
+//Waits for the neighbors' parts and replaces the force on each shared vertex by the sum of all parts, taken in rank order
+void DistributedSimulation::finish(double * forces)
+{
+	double waitStart = getTimeSeconds();
+	if (!requests.empty())
+	{
+		MPI_Waitall((int) requests.size(), &requests[0], MPI_STATUSES_IGNORE);
+	}
+	double waitEnd = getTimeSeconds();
+	exchangeSeconds += waitEnd - waitStart;
+	logger -> profiler.recordSpan("forceExchange", waitStart, waitEnd);
+
+	for (int k = 0; k < (int) sharedVertices.size(); k++)
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			double total = 0;
+			for (int c = contributionOffsets[k]; c < contributionOffsets[k + 1]; c++)
+			{
+				total += contributions[c] < 0 ? ownForces[k * DIMENSION + j] : receivedForces[contributions[c] + j];
+			}
+			forces[j * localVertexCount + sharedVertices[k]] = total;
+		}
+	}
+}
+
+//Collects the state of the whole mesh on rank 0, in the layout of ParticleSystem's positions and velocities
+//Every process must call this; positions and velocities (DIMENSION * the mesh's vertex count each) are only filled on rank 0.
+void DistributedSimulation::gatherState(double * positions, double * velocities)
+{
+	const double * localPositions = particleSystem -> getPositions();
+	const double * localVelocities = particleSystem -> getVelocities();
+	for (int i = 0; i < (int) ownedVertices.size(); i++)
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			sendState[i * 2 * DIMENSION + j] = localPositions[j * localVertexCount + ownedVertices[i]];
+			sendState[i * 2 * DIMENSION + DIMENSION + j] = localVelocities[j * localVertexCount + ownedVertices[i]];
+		}
+	}
+	MPI_Gatherv(&sendState[0], 2 * DIMENSION * (int) ownedVertices.size(), MPI_DOUBLE, &gatheredState[0], &gatherCounts[0], &gatherOffsets[0],
+		MPI_DOUBLE, 0, communicator);
+
+	if (rank == 0)
+	{
+		for (int i = 0; i < gatherOffsets[rankCount] / (2 * DIMENSION); i++)
+		{
+			int v = gatheredVertices[i];
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				positions[j * globalVertexCount + v] = gatheredState[i * 2 * DIMENSION + j];
+				velocities[j * globalVertexCount + v] = gatheredState[i * 2 * DIMENSION + DIMENSION + j];
+			}
+		}
+	}
+}
+
+#endif
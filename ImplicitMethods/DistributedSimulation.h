@@ -0,0 +1,88 @@
+#pragma once
+
+//Only built with MPI: define USE_MPI and add the MPI include directory and library (MS-MPI or Open MPI) to the project
+#ifdef USE_MPI
+
+#include <vector>
+#include <mpi.h>
+#include "ParticleSystem.h"
+#include "Logger.h"
+
+using namespace std;
+
+//The vertices one process shares with another, in increasing global vertex order (so both processes agree on the order)
+struct HaloNeighbor
+{
+	int rank;
+	vector<int> vertices;				//Local indices of the shared vertices
+	vector<double> sendForces;			//DIMENSION forces per shared vertex, this process's part
+	int receiveOffset;					//First value of the neighbor's part in DistributedSimulation::receivedForces
+};
+
+//Simulates one mesh split across the processes of an MPI communicator, each process stepping its part in its own ParticleSystem
+//The tetrahedra are split by recursive coordinate bisection of their centroids, into one part per process of about the same
+//size; every process reads the whole mesh and computes the same split, so nothing needs to be sent to set it up.
+//Each process simulates its own tetrahedra and every vertex they use, so the vertices on a cut exist in each process whose
+//tetrahedra meet there.  Every time step those processes swap their parts of the force on the shared vertices: computeForces
+//does the tetrahedra at the cut first, the parts travel while the interior tetrahedra are computed (see ForceExchange), and
+//each process adds them up in rank order.  Every copy of a shared vertex thus gets the same total force - to the bit - and,
+//being integrated and collided the same way, stays identical, so positions never need to be exchanged.
+//Rank 0 gathers the state of the whole mesh (each vertex from the lowest ranked process that has it) for the results and
+//the trajectory, which the application can play back (-play) like that of a single process run.
+//Explicit steps only: the implicit solve, adaptive steps and sleeping each need decisions across the whole mesh.
+class DistributedSimulation : public ForceExchange
+{
+public:
+	DistributedSimulation(MPI_Comm communicator, Logger * logger);
+	~DistributedSimulation();
+	void partition(const Vertex * vertexList, int vertexCount, const int * tetraList, int tetraCount);
+	ParticleSystem * createParticleSystem(int whichMethod);
+	void gatherState(double * positions, double * velocities);
+	void start(const double * forces);
+	void finish(double * forces);
+
+	int getRank() {return rank;}
+	int getRankCount() {return rankCount;}
+	int getLocalTetraCount() {return localTetraCount;}
+	int getSharedVertexCount() {return (int) sharedVertices.size();}
+	double getExchangeSeconds() {return exchangeSeconds;}
+
+private:
+	DistributedSimulation(const DistributedSimulation &);				//Not copyable - owns the local mesh
+	DistributedSimulation & operator = (const DistributedSimulation &);
+
+	MPI_Comm communicator;
+	int rank;
+	int rankCount;
+	Logger * logger;
+
+	//This process's part of the mesh (see partition)
+	Vertex * localVertices;				//Handed to the particle system, which deletes it
+	int localVertexCount;
+	int * localTetraList;				//Referenced by the particle system, so it is deleted with this object
+	int localTetraCount;
+	vector<int> globalVertices;			//Global index of each local vertex (increasing)
+	vector<int> surfaceVertices;		//Local vertices on the surface of the whole mesh (the only ones spheres and boxes collide with)
+	int globalVertexCount;
+	ParticleSystem * particleSystem;
+
+	//Force exchange
+	vector<HaloNeighbor> neighbors;
+	vector<int> sharedVertices;			//Local indices of the vertices shared with any other process
+	vector<int> contributionOffsets;	//The parts of shared vertex k are contributions[contributionOffsets[k] ... contributionOffsets[k + 1]),
+	vector<int> contributions;			//in rank order: -1 for this process's part, otherwise its first value in receivedForces
+	vector<double> ownForces;			//This process's part of the force on each shared vertex (DIMENSION values each)
+	vector<double> receivedForces;
+	vector<MPI_Request> requests;
+	double exchangeSeconds;				//Time spent waiting for the neighbors' parts
+
+	//Gathering (see gatherState)
+	vector<int> ownedVertices;			//Local vertices this process reports (those it shares with no lower ranked process)
+	vector<int> gatherCounts;			//Rank 0: values each process sends
+	vector<int> gatherOffsets;
+	vector<int> gatheredVertices;		//Rank 0: global index of each vertex in the gathered order
+	vector<double> sendState;
+	vector<double> gatheredState;
+};
+
+#endif
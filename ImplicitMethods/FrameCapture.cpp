@@ -0,0 +1,297 @@
+#include <gl/glew.h>
+
+#include <cstdio>
+#include <iostream>
+#include "targa.h"
+#include "FrameCapture.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+const char * ENCODER_PIPE_MODE = "wb";	//Binary, or the frames get newline translation
+#else
+const char * ENCODER_PIPE_MODE = "w";
+#endif
+
+using namespace std;
+
+FrameCapture::FrameCapture(Logger * logger)
+{
+	this -> logger = logger;
+	capturing = false;
+	width = 0;
+	height = 0;
+	readBuffer = 0;
+	readPending = false;
+	for (int i = 0; i < FRAME_CAPTURE_PIXEL_BUFFERS; i++)
+	{
+		pixelBuffers[i] = 0;
+	}
+	for (int i = 0; i < FRAME_CAPTURE_QUEUE; i++)
+	{
+		frames[i] = NULL;
+		frameNumbers[i] = 0;
+	}
+	queueHead = 0;
+	queueCount = 0;
+	stopRequested = 0;
+	nextFrameNumber = 1;
+	clearedOldImages = false;
+	encoder = NULL;
+}
+
+//Note: the GL context must still exist if a recording is running
+FrameCapture::~FrameCapture()
+{
+	stop();
+}
+
+//Begins recording frames of width x height pixels
+//Parameter encoderCommand - command line to pipe the frames to, or empty to write TGA files
+//Returns false if the writer thread could not be started
+bool FrameCapture::start(int width, int height, const string & encoderCommand)
+{
+	if (capturing)
+	{
+		return true;
+	}
+
+	this -> width = width;
+	this -> height = height;
+
+	glGenBuffers(FRAME_CAPTURE_PIXEL_BUFFERS, pixelBuffers);
+	for (int i = 0; i < FRAME_CAPTURE_PIXEL_BUFFERS; i++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, getFrameBytes(), NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	for (int i = 0; i < FRAME_CAPTURE_QUEUE; i++)
+	{
+		frames[i] = new uint8_t[getFrameBytes()];
+	}
+	readBuffer = 0;
+	readPending = false;
+	queueHead = 0;
+	queueCount = 0;
+	atomicExchange(&stopRequested, 0);
+
+	if (!encoderCommand.empty())
+	{
+		encoder = popen(encoderCommand.c_str(), ENCODER_PIPE_MODE);
+		if (encoder == NULL)
+		{
+			cerr << "Could not start encoder \"" << encoderCommand << "\" - writing TGA images instead" << endl;
+		}
+	}
+
+	capturing = writer.start(writerMain, this);
+	if (!capturing)
+	{
+		cerr << "Could not start the frame writer thread" << endl;
+		capturing = true;	//Lets stop release everything
+		stop();
+	}
+
+	return capturing;
+}
+
+//Queues the frame still in flight, waits for the writer to finish every queued frame and releases the buffers
+void FrameCapture::stop()
+{
+	if (!capturing)
+	{
+		return;
+	}
+
+	if (readPending)
+	{
+		int lastBuffer = (readBuffer + FRAME_CAPTURE_PIXEL_BUFFERS - 1) % FRAME_CAPTURE_PIXEL_BUFFERS;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[lastBuffer]);
+		uint8_t * pixels = (uint8_t *) glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		if (pixels != NULL)
+		{
+			queueFrame(pixels);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		readPending = false;
+	}
+
+	atomicExchange(&stopRequested, 1);
+	writer.join();
+
+	if (encoder != NULL)
+	{
+		pclose(encoder);
+		encoder = NULL;
+	}
+
+	glDeleteBuffers(FRAME_CAPTURE_PIXEL_BUFFERS, pixelBuffers);
+	for (int i = 0; i < FRAME_CAPTURE_QUEUE; i++)
+	{
+		delete [] frames[i];
+		frames[i] = NULL;
+	}
+	capturing = false;
+}
+
+//Starts reading the frame just rendered (call before swapping buffers) and queues the frame read the time before
+//The read into a pixel buffer object returns at once; by the time the buffer is mapped a frame later the GPU is done with it.
+void FrameCapture::captureFrame()
+{
+	if (!capturing)
+	{
+		return;
+	}
+
+	ProfileScope profileScope(logger -> profiler, "captureFrame");
+
+	//Rows come bottom row first, which is the TGA default origin, so they never have to be flipped for the images
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[readBuffer]);
+	glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+
+	int previousBuffer = (readBuffer + FRAME_CAPTURE_PIXEL_BUFFERS - 1) % FRAME_CAPTURE_PIXEL_BUFFERS;
+	if (readPending)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[previousBuffer]);
+		uint8_t * pixels = (uint8_t *) glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		if (pixels != NULL)
+		{
+			queueFrame(pixels);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	readBuffer = (readBuffer + 1) % FRAME_CAPTURE_PIXEL_BUFFERS;
+	readPending = true;
+}
+
+//Copies a mapped frame into the queue, waiting for the writer if the queue is full
+//Frames are never dropped - a slow disk or encoder slows the recording down instead of leaving gaps in the video.
+void FrameCapture::queueFrame(const uint8_t * pixels)
+{
+	queueLock.lock();
+	while (queueCount == FRAME_CAPTURE_QUEUE)
+	{
+		queueLock.unlock();
+		sleepMilliseconds(1);
+		queueLock.lock();
+	}
+	int slot = (queueHead + queueCount) % FRAME_CAPTURE_QUEUE;
+	queueLock.unlock();
+
+	//The writer does not touch the slot until it is counted, so the copy needs no lock
+	memcpy(frames[slot], pixels, getFrameBytes());
+	frameNumbers[slot] = nextFrameNumber++;
+
+	queueLock.lock();
+	queueCount++;
+	queueLock.unlock();
+}
+
+void FrameCapture::writerMain(void * frameCapture)
+{
+	((FrameCapture *) frameCapture) -> writeFrames();
+}
+
+//Writer thread - writes queued frames, oldest first, until stop is requested and the queue is empty
+void FrameCapture::writeFrames()
+{
+	if (encoder == NULL && !clearedOldImages)
+	{
+		removeOldImages();
+		clearedOldImages = true;
+	}
+
+	while (true)
+	{
+		bool stopping = atomicLoad(&stopRequested) != 0;
+
+		queueLock.lock();
+		if (queueCount == 0)
+		{
+			queueLock.unlock();
+			if (stopping)
+			{
+				return;
+			}
+			sleepMilliseconds(1);
+			continue;
+		}
+		int slot = queueHead;
+		queueLock.unlock();
+
+		writeFrame(frames[slot], frameNumbers[slot]);
+
+		queueLock.lock();
+		queueHead = (queueHead + 1) % FRAME_CAPTURE_QUEUE;
+		queueCount--;
+		queueLock.unlock();
+	}
+}
+
+//Parameter pixels - BGRA, bottom row first
+bool FrameCapture::writeFrame(const uint8_t * pixels, int frameNumber)
+{
+	if (encoder != NULL)
+	{
+		//Encoders expect the top row first
+		size_t rowBytes = (size_t) width * 4;
+		bool written = true;
+		for (int row = height - 1; row >= 0 && written; row--)
+		{
+			written = fwrite(pixels + row * rowBytes, 1, rowBytes, encoder) == rowBytes;
+		}
+		return written;
+	}
+
+	tga_image image;
+	image.image_id_length = 0;
+	image.color_map_type = TGA_COLOR_MAP_ABSENT;
+	image.image_type = TGA_IMAGE_TYPE_BGR_RLE;
+	image.color_map_origin = 0;
+	image.color_map_length = 0;
+	image.color_map_depth = 0;
+	image.origin_x = 0;
+	image.origin_y = 0;
+	image.width = width;
+	image.height = height;
+	image.pixel_depth = 32;
+	image.image_descriptor = 0;		//Bottom to top rows, as read from GL
+	image.image_id = NULL;
+	image.color_map_data = NULL;
+	image.image_data = (uint8_t *) pixels;
+
+	char imageFileName[100];
+	sprintf(imageFileName, "images/ImplicitMethods%d.tga", frameNumber);
+	tga_result result = tga_write(imageFileName, &image);
+	#ifdef DEBUGGING
+	if (logger -> isLogging && logger -> loggingLevel >= logger -> LIGHT)
+	{
+		if (result != TGA_NOERR)
+		{
+			cout << tga_error(result) << " at frame number " << frameNumber << endl;
+		}
+	}
+	#endif
+
+	return result == TGA_NOERR;
+}
+
+//Removes the numbered images left by previous executions of this program, so the series only holds this run's frames
+void FrameCapture::removeOldImages()
+{
+	char imageFileName[100];
+	for (int i = 1; ; i++)
+	{
+		sprintf(imageFileName, "images/ImplicitMethods%d.tga", i);
+		if (remove(imageFileName) != 0)
+		{
+			break;
+		}
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+#include "Logger.h"
+#include "Threading.h"
+
+using namespace std;
+
+#define FRAME_CAPTURE_PIXEL_BUFFERS 2	//Pixel buffer objects the reads alternate between (a frame is mapped one frame after it is read)
+#define FRAME_CAPTURE_QUEUE 4			//Frames waiting for the writer thread before captureFrame waits for it
+
+//Records the rendered frames for a video without stalling the render loop
+//glReadPixels goes into a pixel buffer object, so the read is queued on the GPU instead of waiting for the frame to finish;
+//the previous frame's buffer is mapped and copied into a bounded queue, and a writer thread takes it from there.
+//The writer either saves every frame as a run-length compressed TGA (images/ImplicitMethods<n>.tga) or, given an encoder
+//command, pipes raw top-down BGRA frames to it (for example "ffmpeg -f rawvideo -pix_fmt bgra -s 1000x700 -r 60 -i - out.mp4").
+//All methods except the writer thread's must be called from the thread that owns the GL context.
+class FrameCapture
+{
+public:
+	FrameCapture(Logger * logger);
+	~FrameCapture();
+	bool start(int width, int height, const string & encoderCommand);
+	void stop();
+	bool isCapturing() {return capturing;}
+	int getWidth() {return width;}
+	int getHeight() {return height;}
+	void captureFrame();
+
+private:
+	FrameCapture(const FrameCapture &);				//Not copyable - owns the buffers and the writer thread
+	FrameCapture & operator = (const FrameCapture &);
+
+	Logger * logger;
+	bool capturing;
+	int width, height;
+	unsigned int pixelBuffers[FRAME_CAPTURE_PIXEL_BUFFERS];
+	int readBuffer;					//Pixel buffer the next frame is read into
+	bool readPending;				//True if the other pixel buffer holds a frame that has not been queued yet
+
+	//Frame queue - a ring of FRAME_CAPTURE_QUEUE frames, filled by captureFrame and emptied by the writer thread
+	uint8_t * frames[FRAME_CAPTURE_QUEUE];
+	int frameNumbers[FRAME_CAPTURE_QUEUE];
+	int queueHead;					//Oldest queued frame
+	int queueCount;
+	Mutex queueLock;				//Guards queueHead and queueCount
+	volatile long stopRequested;	//Set once nothing more will be queued - the writer exits when the queue is empty
+
+	int nextFrameNumber;			//Numbered across recordings, like the image series always was
+	bool clearedOldImages;
+	FILE * encoder;					//Pipe to the encoder command (NULL to write TGA files)
+	Thread writer;
+
+	void queueFrame(const uint8_t * pixels);
+	static void writerMain(void * frameCapture);
+	void writeFrames();
+	bool writeFrame(const uint8_t * pixels, int frameNumber);
+	void removeOldImages();
+	int getFrameBytes() {return width * height * 4;}
+};
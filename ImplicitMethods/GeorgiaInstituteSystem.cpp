@@ -1,20 +1,33 @@
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <assert.h>
 #include "Logger.h"
 #include "GeorgiaInstituteSystem.h"
+#include "Memory.h"
+#include "Simd.h"
+#include "PrecomputeCache.h"
+#include "GpuSimulator.h"
+#include "SmallMatrix.h"
+#include "SVD3.h"
+#include "Timer.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
-#include "Macros.h"
-
 const double epsilon = 1e-12;	//Used to check approximate equality to 0
+const int faceVertices[4][3] = {{3, 1, 0}, {2, 1, 3}, {2, 3, 0}, {0, 1, 2}};	//Corners of the 4 faces of a tetrahedron, counter clockwise seen from outside (see ParticleSystem::findSurfaceTriangles)
 
 //Based on the paper at http://graphics.berkeley.edu/papers/Obrien-GMA-1999-08/Obrien-GMA-1999-08.pdf  Graphical Modeling and Animation of Brittle Fracture
 //By James O'Brien and Jessica Hodgkins
 
 //Constructor
-GeorgiaInstituteSystem::GeorgiaInstituteSystem(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger) : ParticleSystem(vertexList, vertexCount, tetraList, tetraCount, logger)
+//Parameter spareVertexCount - vertices reserved for fracture splits (see setFractureToughness); 0 for a mesh that never fractures
+GeorgiaInstituteSystem::GeorgiaInstituteSystem(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger, int spareVertexCount) :
+	ParticleSystem(addSpareVertices(vertexList, vertexCount, spareVertexCount), vertexCount + spareVertexCount, tetraList, tetraCount, logger)
 {
 	strcpy(text, "Method 2");
 	////double K = 100;					//Bulk Modulus
@@ -26,6 +39,13 @@ GeorgiaInstituteSystem::GeorgiaInstituteSystem(Vertex * vertexList, int vertexCo
 	lambda = K - (2.0/3) * mu;		//Lame's first parameter
 	//kd = 1.93;
 	kd = 0.2;
+	phi = 0;
+	psi = 0;
+	toughness = 0;
+	firstSpareVertex = vertexCount;
+	splitCount = 0;
+	separation = NULL;
+	separationBounds = NULL;
 
 	//doTransform();
 
@@ -33,341 +53,728 @@ GeorgiaInstituteSystem::GeorgiaInstituteSystem(Vertex * vertexList, int vertexCo
 	logger -> initFile("georgiaDeformation.log");
 	logger ->printText(text);
 
-	//m = zeros(3,size(triangles,2)*4);
-	m = new double[4 * 4 * numTetra];
 	//beta = zeros(4,size(triangles,2)*4);
-	beta = new double [4 * 4 * numTetra];
+	//Only the first 3 columns of beta are used by the force kernels.  m is only needed while computing beta and the volume.
+	beta = allocateTetraArray(4 * 3, 1);
+	restVolumes = allocateTetraArray(1, 1);
+
+	PrecomputeCache precompute("georgia", orgVertices, numVertices, tetraList, numTetra);
+	precompute.addArray(beta, 4 * 3 * numTetra);
+	precompute.addArray(restVolumes, numTetra);
+	if (!precompute.load(logger))
+	{
+		computeRestState();
+		precompute.save();
+	}
 
-	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+	//Repack beta and the volumes so that entry k of the tetrahedra in a SIMD block are adjacent (see ParticleSystem::buildForceBlocks)
+	blockedBeta = allocateBlockArray(12);
+	blockedRestVolumes = allocateBlockArray(1);
+
+	for (int color = 0; color < numTetraColors; color++)
 	{
-		for(int j = 0; j < DIMENSION; j++)
+		for (int block = colorBlockOffsets[color]; block < colorBlockOffsets[color + 1]; block++)
+		{
+			for (int lane = 0; lane < FORCE_BLOCK_WIDTH; lane++)
+			{
+				int currentTetrad = tetraColorOffsets[color] + (block - colorBlockOffsets[color]) * FORCE_BLOCK_WIDTH + lane;
+				for (int k = 0; k < 12; k++)
+				{
+					blockedBeta[(block * 12 + k) * FORCE_BLOCK_WIDTH + lane] = beta[currentTetrad * 12 + k];
+				}
+				blockedRestVolumes[block * FORCE_BLOCK_WIDTH + lane] = restVolumes[currentTetrad];
+			}
+		}
+	}
+
+	//Splits need the tetrahedra around each vertex, the tetrahedron behind each surface triangle and room for the triangles they add
+	if (spareVertexCount > 0)
+	{
+		vertexTetra.resize(numVertices);
+		for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
 		{
 			for (int k = 0; k < 4; k++)
 			{
-				m[4 * numTetra * j + currentTetrad * 4 + k] = orgVertices[tetraList[k * numTetra + currentTetrad]].position[j];
-				
+				vertexTetra[tetraList[k * numTetra + currentTetrad]].push_back(currentTetrad);
 			}
-			
 		}
 
-		for (int j = 0; j < 4; j++)
+		int numSurfaceTriangles = indices.size() / 3;
+		triangleTetra.resize(numSurfaceTriangles);
+		for (int triangle = 0; triangle < numSurfaceTriangles; triangle++)
 		{
-			m[12 * numTetra + currentTetrad * 4 + j] = 1;
+			const vector<int> & candidates = vertexTetra[indices[triangle * 3]];
+			for (int i = 0; i < (int) candidates.size(); i++)
+			{
+				int found = 0;
+				for (int k = 0; k < 4; k++)
+				{
+					int vertex = tetraList[k * numTetra + candidates[i]];
+					found += vertex == indices[triangle * 3 + 1] || vertex == indices[triangle * 3 + 2];
+				}
+				if (found == 2)
+				{
+					triangleTetra[triangle] = candidates[i];
+					break;
+				}
+			}
 		}
 
-		#ifdef DEBUGGING
-		if (logger -> isLogging)
+		tetraSplitSteps.assign(numTetra, -1);
+		separation = allocateVertexArray(SEPARATION_VALUES, 1);
+		separationBounds = allocateVertexArray(1, 1);
+
+		//Each split moves the entries of up to 5 vertices, each move taking twice the room it needs
+		int extraTriangles = FRACTURE_TRIANGLES_PER_SPLIT * spareVertexCount;
+		reserveSurfaceChanges(extraTriangles, 8 * extraTriangles);
+	}
+}
+
+//Returns vertexList with spareVertexCount vertices appended for fracture splits (see splitVertex), and deletes vertexList
+//The spares are copies of vertex 0 that no tetrahedron uses, held where they are until a split gives them a place.
+Vertex * GeorgiaInstituteSystem::addSpareVertices(Vertex * vertexList, int vertexCount, int spareVertexCount)
+{
+	if (spareVertexCount == 0)
+	{
+		return vertexList;
+	}
+
+	Vertex * vertices = new Vertex[vertexCount + spareVertexCount];
+	for (int i = 0; i < vertexCount; i++)
+	{
+		vertices[i] = vertexList[i];
+	}
+	for (int i = vertexCount; i < vertexCount + spareVertexCount; i++)
+	{
+		vertices[i] = vertexList[0];
+	}
+	delete [] vertexList;
+	return vertices;
+}
+
+//Computes beta and the rest volume of every tetrahedron from the original vertices
+void GeorgiaInstituteSystem::computeRestState()
+{
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+	{
+		//m = [orgVertices(:, triangles(1, i)) orgVertices(:, triangles(2, i)) orgVertices(:, triangles(3, i)) orgVertices(:, triangles(4, i))];
+		Mat4 m;
+		for(int j = 0; j < DIMENSION; j++)
 		{
-			logger -> print4By4MatrixSingleIndex(m, numTetra, currentTetrad, "m", logger -> MEDIUM);
+			for (int k = 0; k < 4; k++)
+			{
+				m(j, k) = orgVertices[tetraList[k * numTetra + currentTetrad]].position[j];
+
+			}
+
 		}
-		#endif
 
-		//Formula from http://www.cg.info.hiroshima-cu.ac.jp/~miyazaki/knowledge/teche23.html
-		double invDeterminant =
-		1.0 /
-		(
-		  m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+1] + m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+2]
-		+ m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+2] + m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+0]
-		+ m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+0] + m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+1]
-		+ m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+1] + m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+2] + m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+0]
-		- m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+2] - m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+1]
-		- m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+0] - m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+2]
-		- m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+1] - m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+0]
-		- m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+2] - m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+0] - m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+1]
-		);
+		for (int j = 0; j < 4; j++)
+		{
+			m(3, j) = 1;
+		}
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
+			logger -> print4By4MatrixSingleIndex(m.data, "m", logger -> MEDIUM);
 			if (logger ->loggingLevel >= logger->MEDIUM)
 			{
-				logger->printIteration("Inverse of determinant is: ",invDeterminant);
+				logger->printIteration("Inverse of determinant is: ",1 / determinant(m));
 			}
 		}
 		#endif
 
-		beta[0*numTetra*4+currentTetrad*4+0] = invDeterminant * (m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+3] + m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+1] + m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+2] - m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+2] - m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+3] - m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+1]);
-		beta[0*numTetra*4+currentTetrad*4+1] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+2] + m[0*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+1] - m[0*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+1] - m[0*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+2]);
-		beta[0*numTetra*4+currentTetrad*4+2] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+1] + m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+2] - m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+2] - m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+1]);
-		beta[0*numTetra*4+currentTetrad*4+3] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+2] + m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+1] - m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+1] - m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+2]);
-		beta[1*numTetra*4+currentTetrad*4+0] = invDeterminant * (m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+2] + m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+3] + m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+0] - m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+3] - m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+0] - m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+2]);
-		beta[1*numTetra*4+currentTetrad*4+1] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+0] + m[0*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+2] - m[0*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+2] - m[0*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+0]);
-		beta[1*numTetra*4+currentTetrad*4+2] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+2] + m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+0] - m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+0] - m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+2]);
-		beta[1*numTetra*4+currentTetrad*4+3] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+0] + m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+2] - m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+2] - m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+0]);
-		beta[2*numTetra*4+currentTetrad*4+0] = invDeterminant * (m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+3] + m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+0] + m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+1] - m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+1] - m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+3] - m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+0]);
-		beta[2*numTetra*4+currentTetrad*4+1] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+1] + m[0*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+0] - m[0*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+0] - m[0*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+1]);
-		beta[2*numTetra*4+currentTetrad*4+2] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+0] + m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+1] - m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+3]*m[3*numTetra*4+currentTetrad*4+1] - m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+0]);
-		beta[2*numTetra*4+currentTetrad*4+3] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+1] + m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+3] + m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+0] - m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+3] - m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+3]*m[2*numTetra*4+currentTetrad*4+0] - m[0*numTetra*4+currentTetrad*4+3]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+1]);
-		beta[3*numTetra*4+currentTetrad*4+0] = invDeterminant * (m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+1] + m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+2] + m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+0] - m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+2] - m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+0] - m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+1]);
-		beta[3*numTetra*4+currentTetrad*4+1] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+2] + m[0*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+0] + m[0*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+1] - m[0*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+1] - m[0*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+2] - m[0*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+0]);
-		beta[3*numTetra*4+currentTetrad*4+2] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+1] + m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+2] + m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+0] - m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+1]*m[3*numTetra*4+currentTetrad*4+2] - m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+2]*m[3*numTetra*4+currentTetrad*4+0] - m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+0]*m[3*numTetra*4+currentTetrad*4+1]);
-		beta[3*numTetra*4+currentTetrad*4+3] = invDeterminant * (m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+2] + m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+0] + m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+1] - m[0*numTetra*4+currentTetrad*4+0]*m[1*numTetra*4+currentTetrad*4+2]*m[2*numTetra*4+currentTetrad*4+1] - m[0*numTetra*4+currentTetrad*4+1]*m[1*numTetra*4+currentTetrad*4+0]*m[2*numTetra*4+currentTetrad*4+2] - m[0*numTetra*4+currentTetrad*4+2]*m[1*numTetra*4+currentTetrad*4+1]*m[2*numTetra*4+currentTetrad*4+0]);
+		Mat4 tetraBeta = inverse(m);
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger -> print4By4MatrixSingleIndex(beta, numTetra, currentTetrad, "beta", logger -> MEDIUM);
+			logger -> print4By4MatrixSingleIndex(tetraBeta.data, "beta", logger -> MEDIUM);
 		}
 		#endif
 
+		for (int k = 0; k < 4; k++)
+		{
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				beta[currentTetrad * 12 + k * 3 + j] = tetraBeta(k, j);
+			}
+		}
+
+		//volume = (1/6) * dot(crossProduct((m(:,2) - m(:,1)),(m(:,3) - m(:,1))), (m(:,4) - m(:,1)));
+		Vec3 temp1;
+		Vec3 temp2;
+		Vec3 temp3;
 
+		for (int i = 0; i < 3; i++)
+		{
+			temp1[i] = m(i, 1) - m(i, 0);
+			temp2[i] = m(i, 2) - m(i, 0);
+			temp3[i] = m(i, 3) - m(i, 0);
+		}
 
+		restVolumes[currentTetrad] = (1.0/6) * dot(cross(temp2, temp1), temp3);
 	}
-	
 }
 
 GeorgiaInstituteSystem::~GeorgiaInstituteSystem()
 {
-	delete [] m;
-	delete [] beta;
-	
+	//The rest state and the SIMD blocks belong to the arena
+}
 
+//Sets the strain rate (viscous) damping constants from the O'Brien paper
+//The damping stress phi * trace(nu) * I + 2 * psi * nu is added to the elastic stress, where nu is the strain rate tensor.
+//Both default to 0, leaving only the kd velocity damping.
+void GeorgiaInstituteSystem::setStrainRateDamping(double phi, double psi)
+{
+	this->phi = phi;
+	this->psi = psi;
 }
 
-int iter = 1;
+//Turns brittle fracture on: after each explicit time step every vertex whose largest separation eigenvalue is above
+//toughness splits (see updateFracture).  Needs the spare vertices reserved by the constructor; 0 turns fracture off again.
+//Fracture is only tested between explicit steps with sleeping off.  The sleep neighbors and the implicit system matrix
+//are dropped by a split and found again the next time they are needed.
+void GeorgiaInstituteSystem::setFractureToughness(double toughness)
+{
+	if (toughness > 0 && separation == NULL)
+	{
+		cerr << "Fracture needs spare vertices - construct the system with a spare vertex count" << endl;
+		return;
+	}
+	this->toughness = toughness;
+}
 
-//Overriden doUpdate method
+//Time step of ParticleSystem::doUpdate, followed by the fracture test
 void GeorgiaInstituteSystem::doUpdate(double deltaT)
 {
-	#ifdef DEBUGGING
-	if (logger -> isLogging)
+	ParticleSystem::doUpdate(deltaT);
+
+	if (toughness > 0 && isAnimating && !useImplicit && !useSleeping)
 	{
-		logger -> printText("=======================================================================================================");
-		logger -> printIteration("Iteration #", iter);
-		logger ->printVelocitiesAndPositions(defVertices, numVertices, "Positions - start of method", "Velocities - start of method", logger ->MEDIUM);
+		updateFracture();
 	}
-	#endif
-	
+}
+
+//Forces of ParticleSystem::computeForces, plus a force balancing gravity on every spare vertex no split has used yet
+//The spares belong to no tetrahedron and have unit mass, so their velocity stays exactly zero and they never move.
+void GeorgiaInstituteSystem::computeForces()
+{
+	ParticleSystem::computeForces();
 
-	//Start with 0 force each iteration
-	//currentForce = zeros(3, size(inVelocities,2));
-	for (int i = 0; i < DIMENSION * numVertices; i++)
+	for (int i = firstSpareVertex; i < numVertices; i++)
 	{
-		currentForce[i] = 0;
+		currentForce[numVertices + i] = massMatrix[i] * earthGravityValue;
 	}
-	
-	//STart
-	//for i = 1:size(triangles,2)
-	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+}
+
+//Adds m(force) = force * force' / |force| (the paper's outer product of a force with itself) to tensor (3 X 3, row major)
+static void addForceOuterProduct(double * tensor, const double * force)
+{
+	double magnitude = sqrt(force[0] * force[0] + force[1] * force[1] + force[2] * force[2]);
+	if (magnitude < epsilon)
 	{
-		#ifdef DEBUGGING
-		if (logger -> isLogging)
+		return;
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
 		{
-			logger -> printText("**************");
-			logger -> printIteration("Tetrahedron #", currentTetrad);
+			tensor[i * 3 + j] += force[i] * force[j] / magnitude;
 		}
-		#endif
-		
-		//3 X 4 matrix followed by an optional row of all one's (4 X 4 total)
-		//double m [16];
-		//3 X 4 matrices
-		double p [12];
-		double v [12];
-		
-		for(int j = 0; j < DIMENSION; j++)
+	}
+}
+
+//Tests every vertex for fracture and splits the ones that fail (at most FRACTURE_MAX_SPLITS, the most strained first)
+//Each tetrahedron's stress is split by its eigenvalues into a tensile part (the positive ones) and a compressive part, and
+//each part gives the tetrahedron's vertices a force as in computeTetraForces.  With f+ and f- those forces at one vertex,
+//its separation tensor is 1/2 (-m(sum f+) + m(sum f-) + sum m(f+) - sum m(f-)): it measures the tensile forces pulling the
+//vertex apart in different directions, as opposed to pulling it along as a whole.
+//The eigen decompositions this takes are only done near failure.  Dropping the negative terms, the largest eigenvalue is at
+//most 1/2 sum (|f+| + |f-|).  At vertex k of a tetrahedron f+ and f- are -volume / 2 * F times stress+ * b and stress- * b
+//(b row k of beta), whose squared lengths add up to |stress * b|^2 (the two parts have orthogonal ranges), so
+//|f+| + |f-| <= volume / 2 * |F| * sqrt(2) * |stress * b|, with |F|^2 <= 1 + |e|.  This bound needs no eigen decomposition;
+//only the vertices whose bound comes near the toughness get the exact tensor, from their tetrahedra - the others cannot fail.
+void GeorgiaInstituteSystem::updateFracture()
+{
+	ProfileScope profileScope(logger -> profiler, "fracture");
+	double phaseStart = getTimeSeconds();
+
+	if (firstSpareVertex == numVertices)
+	{
+		cerr << "Fracture ran out of spare vertices after " << splitCount << " splits - no more vertices will split" << endl;
+		toughness = 0;
+		return;
+	}
+
+	//Tetrahedra of one color share no vertices, so each color adds into the vertex sums in parallel
+	double threshold = SEPARATION_BOUND_SLACK * toughness;
+	memset(separationBounds, 0, sizeof(double) * firstSpareVertex);
+	#pragma omp parallel num_threads(numThreads)
+	for (int color = 0; color < numTetraColors; color++)
+	{
+		#pragma omp for schedule(static)
+		for (int currentTetrad = tetraColorOffsets[color]; currentTetrad < tetraColorOffsets[color + 1]; currentTetrad++)
 		{
+			Mat3 fullPartialXWrtU;
+			Mat3 e;
+			Mat3 stress;
+			computeTetraStress(currentTetrad, fullPartialXWrtU, e, stress);
+			double tetraBound = sqrt(2.0) / 4 * restVolumes[currentTetrad] * sqrt(1 + frobeniusNorm(e));
 			for (int k = 0; k < 4; k++)
 			{
-				p[j * 4 + k] = defVertices[tetraList[k * numTetra + currentTetrad]].position[j];
-				v[j * 4 + k] = defVertices[tetraList[k * numTetra + currentTetrad]].velocity[j];
+				Vec3 traction = stress * Vec3::fromArray(&beta[currentTetrad * 12 + k * 3]);
+				separationBounds[tetraList[k * numTetra + currentTetrad]] += tetraBound * sqrt(dot(traction, traction));
 			}
 		}
+	}
 
-		//m = [orgVertices(:, triangles(1, i)) orgVertices(:, triangles(2, i)) orgVertices(:, triangles(3, i)) orgVertices(:, triangles(4, i))];
-		//p = [defVertices(:, triangles(1, i)) defVertices(:, triangles(2, i)) defVertices(:, triangles(3, i)) defVertices(:, triangles(4, i))];
-		//v = [inVelocities(:, triangles(1, i)) inVelocities(:, triangles(2, i)) inVelocities(:, triangles(3, i)) inVelocities(:, triangles(4, i))];
-    
-		//if isDebugging == 1
-		//	display('m:');
-		//	display(m);
-		//	display('p:');
-		//	display(p);
-		//	display('v:');
-		//	display(v);
-		//end
-
-		#ifdef DEBUGGING
-		if (logger -> isLogging)
+	vector<int> candidates;
+	for (int vertex = 0; vertex < firstSpareVertex; vertex++)
+	{
+		if (separationBounds[vertex] > threshold)
 		{
-			logger -> print3By4MatrixSingleIndex(p,"p", logger ->MEDIUM);
-			logger -> print3By4MatrixSingleIndex(v,"v", logger ->MEDIUM);
+			candidates.push_back(vertex);
 		}
-		#endif
-
+	}
+	logger -> profiler.recordCounter("fracture candidates", (int) candidates.size());
+	if (candidates.empty())
+	{
+		logger -> profiler.recordCounter("splits", 0);
+		phaseSeconds[PHASE_FRACTURE] += getTimeSeconds() - phaseStart;
+		return;
+	}
 
-		//beta = inv([m; 1 1 1 1]);
-		
-		//double beta[16];
+	//separation[vertex * SEPARATION_VALUES + ...]: sum f+ (0 - 2), sum f- (3 - 5), sum m(f+) (6 - 14), sum m(f-) (15 - 23), for the candidates
+	for (int i = 0; i < (int) candidates.size(); i++)
+	{
+		memset(&separation[candidates[i] * SEPARATION_VALUES], 0, sizeof(double) * SEPARATION_VALUES);
+	}
 
-		
-		
-		//if isDebugging == 1
-		//	display('beta:');
-		//	display(beta);
-		//end
-    
+	#pragma omp parallel num_threads(numThreads)
+	for (int color = 0; color < numTetraColors; color++)
+	{
+		#pragma omp for schedule(static)
+		for (int currentTetrad = tetraColorOffsets[color]; currentTetrad < tetraColorOffsets[color + 1]; currentTetrad++)
+		{
+			bool hasCandidate = false;
+			for (int k = 0; k < 4; k++)
+			{
+				hasCandidate = hasCandidate || separationBounds[tetraList[k * numTetra + currentTetrad]] > threshold;
+			}
+			if (!hasCandidate)
+			{
+				continue;
+			}
 
-		//////////////////////////////
-		//////////////////////////////
-		//p * beta
-		//3 X 4(p) * 4 X 4(beta) = 3 X 4(result) size matrix
-
-		double resultMatrix [12];
-																																									
-		//for (int i = 0; i < 3; i++) //current row # of calculated final matrix element						
-		//{																											
-		//	for (int j = 0; j < 4; j++) //current col # of calculated final matrix element					
-		//	{																										
-		//		resultMatrix[i * 4 + j] = 0;																				
-		//		for (int k = 0; k < 4; k++) //current col in left matrix and row in right matrix for summing
-		//		{																									
-		//			resultMatrix[i * 4 + j] += p[i * 4 + k] * beta[k * 4 + j];											
-		//		}																									
-		//																										
-		//	}																										
-		//																										
-		//}
-
-		//multiplyMatricesATimesBSingleIndexes(resultMatrix, p, 3, 4, beta, 4, 4);
-		
-		//TO DO (TODO): use a macro here that works with an offset
-		int aRows = 3, aCols = 4, bCols = 4;
-		
-		/////////////
-		for (int i = 0; i < aRows; i++) /*current row # of calculated final matrix element*/						
-		{																											
-			for (int j = 0; j < bCols; j++) /*current col # of calculated final matrix element*/					
-			{																										
-				resultMatrix[i * bCols + j] = 0;																				
-				for (int k = 0; k < aCols; k++) /*current col in left matrix and row in right matrix for summing*/	
-				{																									
-					resultMatrix[i * bCols + j] += p[i * aCols + k] * beta[k * 4 * numTetra + currentTetrad * 4 + j];							
-				}																									
-																												
-			}																										
-																												
-		}		
-		/////////////
-
-		double partialXWrtUi [3];
-		double partialXWrtUj [3];
-		double fullPartialXWrtU[3][3];
-
-		
+			double tensileForces[12];
+			double compressiveForces[12];
+			computeTetraSeparation(currentTetrad, tensileForces, compressiveForces);
 
-		//I = eye(3);
-		//e = zeros(3,3);
-		double e[9]; //3 X 3 matrix
-		for (int ii = 0; ii < 3; ii++)
-		{
-		//for ii = 1:3
-			//partialXWrtUi = p * beta * [I(ii,:) 0]';
-			for (int i = 0; i < 3; i++)
+			for (int k = 0; k < 4; k++)
 			{
-				partialXWrtUi[i] = 0;
-				for (int j = 0; j < 4; j++)
+				int vertex = tetraList[k * numTetra + currentTetrad];
+				if (separationBounds[vertex] <= threshold)
+				{
+					continue;
+				}
+				double * sums = &separation[vertex * SEPARATION_VALUES];
+				double tensile[3] = {tensileForces[k], tensileForces[4 + k], tensileForces[8 + k]};
+				double compressive[3] = {compressiveForces[k], compressiveForces[4 + k], compressiveForces[8 + k]};
+				for (int j = 0; j < 3; j++)
 				{
-					partialXWrtUi[i] += resultMatrix[i * 4 + j] * (ii == j);
+					sums[j] += tensile[j];
+					sums[3 + j] += compressive[j];
 				}
-				fullPartialXWrtU[ii][i] = partialXWrtUi[i]; //is it really horizontal?  Or is it vertical?
+				addForceOuterProduct(&sums[6], tensile);
+				addForceOuterProduct(&sums[15], compressive);
 			}
+		}
+	}
+
+	//The largest eigenvalue of each separation tensor and its eigenvector replace the sums (entries 0 and 1 - 3)
+	#pragma omp parallel for num_threads(numThreads) schedule(static)
+	for (int i = 0; i < (int) candidates.size(); i++)
+	{
+		double * sums = &separation[candidates[i] * SEPARATION_VALUES];
+		double tensileSum[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+		double compressiveSum[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+		addForceOuterProduct(tensileSum, &sums[0]);
+		addForceOuterProduct(compressiveSum, &sums[3]);
+
+		double tensor[9];
+		for (int k = 0; k < 9; k++)
+		{
+			tensor[k] = 0.5 * (-tensileSum[k] + compressiveSum[k] + sums[6 + k] - sums[15 + k]);
+		}
+
+		double eigenvalues[3];
+		double eigenvectors[9];
+		symmetricEigen3(tensor, eigenvalues, eigenvectors);
+		sums[0] = eigenvalues[0];
+		for (int j = 0; j < 3; j++)
+		{
+			sums[1 + j] = eigenvectors[j * 3];
+		}
+	}
+
+	vector< pair<double, int> > failed;
+	for (int i = 0; i < (int) candidates.size(); i++)
+	{
+		int vertex = candidates[i];
+		if (separation[vertex * SEPARATION_VALUES] > toughness)
+		{
+			failed.push_back(make_pair(separation[vertex * SEPARATION_VALUES], vertex));
+		}
+	}
+	sort(failed.rbegin(), failed.rend());
+
+	//A vertex next to one split in this step is left for the next step, when its stress reflects the split
+	int splits = 0;
+	for (int i = 0; i < (int) failed.size() && splits < FRACTURE_MAX_SPLITS && firstSpareVertex < numVertices; i++)
+	{
+		int vertex = failed[i].second;
+		bool isFresh = true;
+		for (int k = 0; k < (int) vertexTetra[vertex].size(); k++)
+		{
+			isFresh = isFresh && tetraSplitSteps[vertexTetra[vertex][k]] != iteration;
+		}
+
+		Vec3 normal;
+		for (int j = 0; j < 3; j++)
+		{
+			normal[j] = separation[vertex * SEPARATION_VALUES + 1 + j];
+		}
+		if (isFresh && splitVertex(vertex, normal))
+		{
+			splits++;
+		}
+	}
+
+	logger -> profiler.recordCounter("splits", splits);
+	phaseSeconds[PHASE_FRACTURE] += getTimeSeconds() - phaseStart;
+}
 
-			
-			#ifdef DEBUGGING
-			if (logger -> isLogging)
+//Deformation gradient (the paper's dx/du) and elastic plus strain rate stress of one tetrahedron, as in computeTetraForces
+void GeorgiaInstituteSystem::computeTetraStress(int currentTetrad, Mat3 & fullPartialXWrtU, Mat3 & e, Mat3 & stress)
+{
+	double p[12];
+	double v[12];
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			p[j * 4 + k] = positions[j * numVertices + tetraList[k * numTetra + currentTetrad]];
+			v[j * 4 + k] = velocities[j * numVertices + tetraList[k * numTetra + currentTetrad]];
+		}
+	}
+
+	Mat<4, 3> tetraBeta = Mat<4, 3>::fromArray(&beta[currentTetrad * 12]);
+	fullPartialXWrtU = Mat34::fromArray(p) * tetraBeta;
+	e = transposeTimes(fullPartialXWrtU, fullPartialXWrtU) - Mat3::identity();
+	stress = (tetraLambda[currentTetrad] * trace(e)) * Mat3::identity() + (2 * tetraMu[currentTetrad]) * e;
+	if (phi != 0 || psi != 0)
+	{
+		Mat3 fullPartialVWrtU = Mat34::fromArray(v) * tetraBeta;
+		Mat3 nu = transposeTimes(fullPartialXWrtU, fullPartialVWrtU) + transposeTimes(fullPartialVWrtU, fullPartialXWrtU);
+		stress += (phi * trace(nu)) * Mat3::identity() + (2 * psi) * nu;
+	}
+}
+
+//Tensile and compressive parts of the elastic forces of one tetrahedron (3 X 4, forces[j * 4 + vertex] like computeTetraForces)
+//They sum to the forces of computeTetraForces (with the strain rate damping, but without the kd damping, which is not a stress).
+void GeorgiaInstituteSystem::computeTetraSeparation(int currentTetrad, double * tensileForces, double * compressiveForces)
+{
+	Mat3 fullPartialXWrtU;
+	Mat3 e;
+	Mat3 stress;
+	computeTetraStress(currentTetrad, fullPartialXWrtU, e, stress);
+	Mat<4, 3> tetraBeta = Mat<4, 3>::fromArray(&beta[currentTetrad * 12]);
+
+	//Tensile stress: the positive eigenvalues with their eigenvectors n, sum of max(eigenvalue, 0) * n * n'
+	double eigenvalues[3];
+	Mat3 eigenvectors;
+	symmetricEigen3(stress.data, eigenvalues, eigenvectors.data);
+	Mat3 tensileStress = Mat3::zero();
+	for (int i = 0; i < 3; i++)
+	{
+		if (eigenvalues[i] > 0)
+		{
+			Vec3 n = column(eigenvectors, i);
+			tensileStress += eigenvalues[i] * timesTranspose(n, n);
+		}
+	}
+
+	double scale = -restVolumes[currentTetrad] / 2;
+	(scale * timesTranspose(fullPartialXWrtU * tensileStress, tetraBeta)).toArray(tensileForces);
+	(scale * timesTranspose(fullPartialXWrtU * (stress - tensileStress), tetraBeta)).toArray(compressiveForces);
+}
+
+//Splits vertex along the plane through its deformed position with the given normal
+//The tetrahedra of the vertex whose deformed centroids are on the positive side of the plane move to a spare vertex with
+//the same rest position, position and velocity.  Every face between a moved tetrahedron and one that stayed becomes two
+//surface triangles, one facing each way, and the surface triangles of the moved tetrahedra move to the new vertex with them.
+//A split needs tetrahedra on both sides; it is also refused (returns false, changing nothing) when the surface room reserved
+//by the constructor has run out.
+bool GeorgiaInstituteSystem::splitVertex(int vertex, const Vec3 & normal)
+{
+	const vector<int> & incident = vertexTetra[vertex];
+	vector<int> stay;
+	vector<int> move;
+	for (int i = 0; i < (int) incident.size(); i++)
+	{
+		double side = 0;
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			double centroid = 0;
+			for (int k = 0; k < 4; k++)
 			{
-				logger -> printVector(partialXWrtUi,3,"partialXWrtUi", logger ->FULL);
+				centroid += positions[j * numVertices + tetraList[k * numTetra + incident[i]]];
 			}
-			#endif
+			side += (centroid / 4 - positions[j * numVertices + vertex]) * normal[j];
+		}
+		(side > 0 ? move : stay).push_back(incident[i]);
+	}
+	if (stay.empty() || move.empty())
+	{
+		return false;
+	}
 
+	//Faces that open: a face of a moving tetrahedron through vertex shared with a staying one (moving face, staying face)
+	vector< pair<int, int> > openFaces;	//tetrahedron * 4 + face
+	for (int i = 0; i < (int) move.size(); i++)
+	{
+		for (int face = 0; face < 4; face++)
+		{
+			int corners[3];
+			bool hasVertex = false;
+			for (int k = 0; k < 3; k++)
+			{
+				corners[k] = tetraList[faceVertices[face][k] * numTetra + move[i]];
+				hasVertex = hasVertex || corners[k] == vertex;
+			}
+			if (!hasVertex)
+			{
+				continue;
+			}
 
-			//for jj = 1:3
-			for (int jj = 0; jj < 3; jj++)
+			for (int s = 0; s < (int) stay.size(); s++)
 			{
-				//partialXWrtUj = p * beta * [I(jj,:) 0]';
-				for (int i = 0; i < 3; i++)
+				for (int otherFace = 0; otherFace < 4; otherFace++)
 				{
-					partialXWrtUj[i] = 0;
-					for (int j = 0; j < 4; j++)
+					int shared = 0;
+					for (int k = 0; k < 3; k++)
+					{
+						int corner = tetraList[faceVertices[otherFace][k] * numTetra + stay[s]];
+						shared += corner == corners[0] || corner == corners[1] || corner == corners[2];
+					}
+					if (shared == 3)
 					{
-						partialXWrtUj[i] += resultMatrix[i * 4 + j] * (jj == j);
+						openFaces.push_back(make_pair(move[i] * 4 + face, stay[s] * 4 + otherFace));
 					}
 				}
+			}
+		}
+	}
 
-				#ifdef DEBUGGING
-				if (logger -> isLogging)
-				{
-					logger -> printVector(partialXWrtUj,3,"partialXWrtUj", logger ->FULL);
-				}
-				#endif
+	vector<int> movedTriangles;
+	for (int k = surfaceTriangleOffsets[vertex]; k < surfaceTriangleEnds[vertex]; k++)
+	{
+		if (find(move.begin(), move.end(), triangleTetra[surfaceTriangles[k]]) != move.end())
+		{
+			movedTriangles.push_back(surfaceTriangles[k]);
+		}
+	}
+
+	//Room for the new triangles: 2 for the vertex and the new vertex per opened face, and 2 more for each other corner of it
+	int newVertex = firstSpareVertex;
+	if ((int) (indices.size() / 3 + 2 * openFaces.size()) > surfaceTriangleCapacity ||
+		!makeSurfaceRoom(vertex, (int) openFaces.size()) || !makeSurfaceRoom(newVertex, (int) (openFaces.size() + movedTriangles.size())))
+	{
+		return false;
+	}
+	for (int i = 0; i < (int) openFaces.size(); i++)
+	{
+		int currentTetrad = openFaces[i].first / 4;
+		int face = openFaces[i].first % 4;
+		for (int k = 0; k < 3; k++)
+		{
+			int corner = tetraList[faceVertices[face][k] * numTetra + currentTetrad];
+			if (corner != vertex && !makeSurfaceRoom(corner, 2 * (int) openFaces.size()))
+			{
+				return false;
+			}
+		}
+	}
+
+	//The new vertex - unit mass like every vertex (see ParticleSystem), so the split does not shorten the stable time step
+	firstSpareVertex++;
+	orgVertices[newVertex] = orgVertices[vertex];
+	defVertices[newVertex] = defVertices[vertex];
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		positions[j * numVertices + newVertex] = positions[j * numVertices + vertex];
+		velocities[j * numVertices + newVertex] = velocities[j * numVertices + vertex];
+	}
+	massMatrix[newVertex] = massMatrix[vertex];
+	vertexKd[newVertex] = vertexKd[vertex];
+	changedVertices.push_back(newVertex);
 
-				//e(ii,jj) = dot(partialXWrtUi, partialXWrtUj) - I(ii,jj);
-	            e[ii * 3 + jj] = dot3(partialXWrtUi, partialXWrtUj) - (ii == jj);
-		    //end
+	//Only the moving tetrahedra's entries change - they shared vertex, so they have different colors and still do with newVertex
+	for (int i = 0; i < (int) move.size(); i++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			if (tetraList[k * numTetra + move[i]] == vertex)
+			{
+				tetraList[k * numTetra + move[i]] = newVertex;
 			}
-		//end
 		}
+		tetraSplitSteps[move[i]] = iteration;
+		changedTetra.push_back(move[i]);
+	}
+	for (int i = 0; i < (int) stay.size(); i++)
+	{
+		tetraSplitSteps[stay[i]] = iteration;
+	}
+	vertexTetra[newVertex] = move;
+	vertexTetra[vertex] = stay;
+	if (vertexTetraCounts != NULL)
+	{
+		vertexTetraCounts[vertex] = (int) stay.size();
+		vertexTetraCounts[newVertex] = (int) move.size();
+	}
+
+	for (int i = 0; i < (int) movedTriangles.size(); i++)
+	{
+		moveSurfaceTriangle(movedTriangles[i], vertex, newVertex);
+	}
+	for (int i = 0; i < (int) openFaces.size(); i++)
+	{
+		int faces[2] = {openFaces[i].first, openFaces[i].second};
+		for (int side = 0; side < 2; side++)
+		{
+			int currentTetrad = faces[side] / 4;
+			int face = faces[side] % 4;
+			addSurfaceTriangle(tetraList[faceVertices[face][0] * numTetra + currentTetrad], tetraList[faceVertices[face][1] * numTetra + currentTetrad],
+				tetraList[faceVertices[face][2] * numTetra + currentTetrad]);
+			triangleTetra.push_back(currentTetrad);
+		}
+	}
+
+	//Built for the old topology - found again when next needed
+	stableElasticStep = 0;
+	if (systemMatrix != NULL)
+	{
+		delete systemMatrix;
+		systemMatrix = NULL;
+	}
+	if (calmSteps != NULL)
+	{
+		delete [] calmSteps;
+		delete [] vertexSleeping;
+		delete [] vertexMoving;
+		calmSteps = NULL;
+		vertexSleeping = NULL;
+		vertexMoving = NULL;
+		sleepNeighborOffsets.clear();
+		sleepNeighbors.clear();
+	}
+
+	splitCount++;
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Vertex " << vertex << " split into " << vertex << " and " << newVertex << ": " << stay.size() << " and " << move.size() << " tetrahedra, "
+			<< openFaces.size() << " faces opened" << endl;
+	}
+	#endif
+	return true;
+}
+
+//Overriden force kernel - computes the elastic forces for one tetrahedron
+//Parameters p and v are the deformed positions and velocities of its 4 vertices (3 X 4, p[j * 4 + vertex]); the forces are written to forces in the same layout
+void GeorgiaInstituteSystem::computeTetraForces(int currentTetrad, double * p, double * v, double * forces)
+{
+		//m = [orgVertices(:, triangles(1, i)) orgVertices(:, triangles(2, i)) orgVertices(:, triangles(3, i)) orgVertices(:, triangles(4, i))];
+		//p = [defVertices(:, triangles(1, i)) defVertices(:, triangles(2, i)) defVertices(:, triangles(3, i)) defVertices(:, triangles(4, i))];
+		//v = [inVelocities(:, triangles(1, i)) inVelocities(:, triangles(2, i)) inVelocities(:, triangles(3, i)) inVelocities(:, triangles(4, i))];
+    
+		//if isDebugging == 1
+		//	display('m:');
+		//	display(m);
+		//	display('p:');
+		//	display(p);
+		//	display('v:');
+		//	display(v);
+		//end
 
-		//Inverted tetrahedron code is likely to start here...
-		//double thatDeterminant = determinant3By3(fullPartialXWrtU);
-		
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			//setprecision(18);
-			logger -> print3By3MatrixSingleIndex(e,"e", logger ->MEDIUM);
+			logger -> print3By4MatrixSingleIndex(p,"p", logger ->MEDIUM);
+			logger -> print3By4MatrixSingleIndex(v,"v", logger ->MEDIUM);
 		}
 		#endif
 
-		
-		//elasticStress = lambda * trace(e) * I + 2 * mu * e;
 
-		double elasticStress[9];
+		//beta = inv([m; 1 1 1 1]); (precomputed in the constructor) - only the first 3 columns are kept
+		Mat<4, 3> tetraBeta = Mat<4, 3>::fromArray(&beta[currentTetrad * 12]);
+		Mat34 positionMatrix = Mat34::fromArray(p);
+		bool useStrainRate = phi != 0 || psi != 0;
 
-		double trace = trace3By3(e);
+		//p * beta and v * beta
+		//Column i of p * beta is partialXWrtU(i): the derivative of the world position with respect to material coordinate i
+		Mat3 fullPartialXWrtU = positionMatrix * tetraBeta;
 
-		for (int i = 0; i < 3; i++)
+		#ifdef DEBUGGING
+		if (logger -> isLogging)
 		{
-			for (int j = 0; j < 3; j++)
-			{
-				elasticStress[i*3+j] = lambda*trace*(i==j) + 2 * mu * e[i*3+j];
+			logger -> print3By3MatrixSingleIndex(fullPartialXWrtU.data,"partialXWrtU", logger ->FULL);
+		}
+		#endif
 
-			}
+		//I = eye(3);
+		//e(ii,jj) = dot(partialXWrtUi, partialXWrtUj) - I(ii,jj);
+		//nu(ii,jj) = dot(partialXWrtUi, partialVWrtUj) + dot(partialVWrtUi, partialXWrtUj);
+		Mat3 e = transposeTimes(fullPartialXWrtU, fullPartialXWrtU) - Mat3::identity();
+		Mat3 nu = Mat3::zero();
+		if (useStrainRate)
+		{
+			Mat3 fullPartialVWrtU = Mat34::fromArray(v) * tetraBeta;
+			nu = transposeTimes(fullPartialXWrtU, fullPartialVWrtU) + transposeTimes(fullPartialVWrtU, fullPartialXWrtU);
 		}
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			cout << setprecision(18);
-			logger -> print3By3MatrixSingleIndex(elasticStress,"elasticStress", logger ->MEDIUM);
+			//setprecision(18);
+			logger -> print3By3MatrixSingleIndex(e.data,"e", logger ->MEDIUM);
 		}
 		#endif
 
-		//volume = (1/6) * dot(crossProduct((m(:,2) - m(:,1)),(m(:,3) - m(:,1))), (m(:,4) - m(:,1)));
 
-		//logger -> print3By4MatrixSingleIndex(m,"m", logger ->MEDIUM);
-
-		double temp1[3];
-		double temp2[3];
-		double temp3[3];
-		
-		for (int i = 0; i < 3; i++)
+		//elasticStress = lambda * trace(e) * I + 2 * mu * e;
+		//(plus the damping stress phi * trace(nu) * I + 2 * psi * nu when strain rate damping is on)
+		double traceE = trace(e);
+		Mat3 elasticStress = (tetraLambda[currentTetrad] * traceE) * Mat3::identity() + (2 * tetraMu[currentTetrad]) * e;
+		if (useStrainRate)
 		{
-			temp1[i] = m[i*numTetra*4+currentTetrad*4+1] - m[i*numTetra*4+currentTetrad*4+0];
-			temp2[i] = m[i*numTetra*4+currentTetrad*4+2] - m[i*numTetra*4+currentTetrad*4+0];
-			temp3[i] = m[i*numTetra*4+currentTetrad*4+3] - m[i*numTetra*4+currentTetrad*4+0];
+			elasticStress += (phi * trace(nu)) * Mat3::identity() + (2 * psi) * nu;
 		}
 
-		double temp4[3];
-		///crossProductGeneral(temp4,temp1,temp2);
-		crossProductGeneral(temp4,temp2,temp1);
-		
-		//logger ->printVector(temp1, 3, "temp1", logger ->LIGHT);
-		//logger ->printVector(temp2, 3, "temp2", logger ->LIGHT);
-		//logger ->printVector(temp3, 3, "Ttemp3", logger ->LIGHT);
-		//logger ->printVector(temp4, 3, "That cross product", logger ->LIGHT);
+		#ifdef DEBUGGING
+		if (logger -> isLogging)
+		{
+			cout << setprecision(18);
+			logger -> print3By3MatrixSingleIndex(elasticStress.data,"elasticStress", logger ->MEDIUM);
+		}
+		#endif
 
-		double volume = (1.0/6) * dot3(temp4,temp3);
+		double volume = restVolumes[currentTetrad];
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
@@ -378,7 +785,7 @@ void GeorgiaInstituteSystem::doUpdate(double deltaT)
 			}
 		}
 		#endif
-		    
+
 		//forces = zeros(3,4);
 		//for ii = 1:4
 		//	%forces(:,ii) = zeros(3,1);
@@ -390,40 +797,17 @@ void GeorgiaInstituteSystem::doUpdate(double deltaT)
 		//			end
 		//		end
 		//		forces(:,ii) = forces(:,ii) + p(:,j) * sum;
-        //    
+        //
 		//	end
 		//end
-    
+
 		//forces = -volume / 2 * forces;
 
-		double forces[12] = {0}; //rest init to 0.  3X4 matrix.
-				
-		for (int ii = 0; ii < 4; ii++)
-		{
-			for (int j = 0; j < 4; j++)
-			{
-				double sum = 0;
-				for (int k = 0; k < 3; k++)
-				{
-					for (int l = 0; l < 3; l++)
-					{
-						sum = sum + beta[j * 4 * numTetra + currentTetrad * 4 + l] * beta[ii*4*numTetra + currentTetrad*4 + k] * elasticStress[k * 3 + l];
-					}
-				}
-				for (int k = 0; k < 3; k++)
-				{
-					forces[k*4+ii] += p[k*4+j] * sum;
-				}
-            
-			}
-		}
+		//Summing p(:,j) * beta(j,l) over j gives partialXWrtU, so the loops above reduce to
+		//forces(:,ii) = -volume / 2 * (partialXWrtU * elasticStress) * beta(ii,1:3)'
+		Mat3 stressProduct = fullPartialXWrtU * elasticStress;
+		(-volume / 2 * timesTranspose(stressProduct, tetraBeta)).toArray(forces);
 
-		//forces = -volume / 2 * forces;
-		for (int i = 0; i < 12; i++)
-		{
-			forces[i] = -volume / 2 * forces[i];
-		}
-    
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
@@ -436,72 +820,189 @@ void GeorgiaInstituteSystem::doUpdate(double deltaT)
 		//currentForce(:, triangles(2, i)) = forces(:,2) - kd * inVelocities(:,triangles(2,i));
 		//currentForce(:, triangles(3, i)) = forces(:,3) - kd * inVelocities(:,triangles(3,i));
 		//currentForce(:, triangles(4, i)) = forces(:,4) - kd * inVelocities(:,triangles(4,i));
-    
-		for (int i = 0; i < 3; i++)
+		//(the caller adds the damping term while scattering the forces)
+}
+
+//SIMD version of computeTetraForces for the block of FORCE_BLOCK_WIDTH tetrahedra starting at firstTetrad
+//Each SimdForce holds one matrix entry for all tetrahedra of the block.  The forces (plus damping) are added into currentForce.
+void GeorgiaInstituteSystem::computeBlockForces(int firstTetrad, int block)
+{
+	const ForceReal * blockBeta = &blockedBeta[block * 12 * FORCE_BLOCK_WIDTH];
+	bool useStrainRate = phi != 0 || psi != 0;
+
+	//Scratch space for moving lane data in and out of registers
+	double lanes[12 * FORCE_BLOCK_WIDTH];
+
+	//p * beta - gather p lane by lane
+	SimdForce partialXWrtU[9];		//partialXWrtU[row * 3 + i]
+	SimdForce partialVWrtU[9];
+	for (int pass = 0; pass < (useStrainRate ? 2 : 1); pass++)
+	{
+		const double * state = pass == 0 ? positions : velocities;
+		SimdForce * partial = pass == 0 ? partialXWrtU : partialVWrtU;
+
+		for (int lane = 0; lane < FORCE_BLOCK_WIDTH; lane++)
 		{
-			for (int j = 0; j < 4; j++)
+			int currentTetrad = firstTetrad + lane;
+			#ifdef SINGLE_PRECISION_FORCES
+			//The columns of beta sum to zero, so the positions can be taken relative to vertex 0 (in double) - absolute
+			//coordinates would lose most of the float mantissa to the distance from the origin
+			int origin = tetraList[currentTetrad];
+			#endif
+			for (int k = 0; k < 4; k++)
 			{
-				//FIX: = changed to +=
-				currentForce[i * numVertices + tetraList[j * numTetra + currentTetrad]] += forces[i*4+j] - kd * defVertices[tetraList[j*numTetra+currentTetrad]].velocity[i];
+				int vertex = tetraList[k * numTetra + currentTetrad];
+				for (int row = 0; row < DIMENSION; row++)
+				{
+					#ifdef SINGLE_PRECISION_FORCES
+					lanes[(row * 4 + k) * FORCE_BLOCK_WIDTH + lane] = state[row * numVertices + vertex] - state[row * numVertices + origin];
+					#else
+					lanes[(row * 4 + k) * FORCE_BLOCK_WIDTH + lane] = state[row * numVertices + vertex];
+					#endif
+				}
 			}
 		}
-		
-		
-	}
-	
 
-	//inVelocities = inVelocities + currentForce * elapsedTime + repmat(earthGravity, 1, size(inVelocities,2)) * elapsedTime;
-	//defVertices = defVertices + inVelocities * elapsedTime;
-
-
-	#ifdef DEBUGGING
-	if (logger -> isLogging)
-	{
-		logger -> printVertexTypeMatrix(currentForce,numVertices,"currentForce", logger ->MEDIUM);
+		for (int row = 0; row < DIMENSION; row++)
+		{
+			SimdForce p0 = simdLoadForce(&lanes[(row * 4 + 0) * FORCE_BLOCK_WIDTH]);
+			SimdForce p1 = simdLoadForce(&lanes[(row * 4 + 1) * FORCE_BLOCK_WIDTH]);
+			SimdForce p2 = simdLoadForce(&lanes[(row * 4 + 2) * FORCE_BLOCK_WIDTH]);
+			SimdForce p3 = simdLoadForce(&lanes[(row * 4 + 3) * FORCE_BLOCK_WIDTH]);
+			for (int i = 0; i < 3; i++)
+			{
+				SimdForce sum = simdMul(p0, simdLoad(&blockBeta[(0 * 3 + i) * FORCE_BLOCK_WIDTH]));
+				sum = simdMulAdd(p1, simdLoad(&blockBeta[(1 * 3 + i) * FORCE_BLOCK_WIDTH]), sum);
+				sum = simdMulAdd(p2, simdLoad(&blockBeta[(2 * 3 + i) * FORCE_BLOCK_WIDTH]), sum);
+				partial[row * 3 + i] = simdMulAdd(p3, simdLoad(&blockBeta[(3 * 3 + i) * FORCE_BLOCK_WIDTH]), sum);
+			}
+		}
 	}
-	#endif
 
-	
-
-	if (isAnimating)
+	//e(ii,jj) = dot(partialXWrtUi, partialXWrtUj) - I(ii,jj), nu(ii,jj) = dot(partialXWrtUi, partialVWrtUj) + dot(partialVWrtUi, partialXWrtUj)
+	//Both are symmetric, so only the upper triangle is computed
+	SimdForce one = simdConstant<SimdForce>(1);
+	SimdForce e[9];
+	SimdForce nu[9];
+	for (int ii = 0; ii < 3; ii++)
 	{
-		for (int i = 0; i < numVertices; i++)
+		for (int jj = ii; jj < 3; jj++)
 		{
-			for (int j = 0; j < DIMENSION; j++)
-			{
-				//Add delta velocity to each particle's velocity
-				defVertices[i].velocity[j] += (currentForce[j * numVertices + i] / massMatrix[i]) * deltaT;
+			SimdForce sum = simdMul(partialXWrtU[0 * 3 + ii], partialXWrtU[0 * 3 + jj]);
+			sum = simdMulAdd(partialXWrtU[1 * 3 + ii], partialXWrtU[1 * 3 + jj], sum);
+			sum = simdMulAdd(partialXWrtU[2 * 3 + ii], partialXWrtU[2 * 3 + jj], sum);
+			e[ii * 3 + jj] = ii == jj ? simdSub(sum, one) : sum;
 
-				if (j == 1)
+			if (useStrainRate)
+			{
+				SimdForce rate = simdConstant<SimdForce>(0);
+				for (int row = 0; row < 3; row++)
 				{
-					defVertices[i].velocity[j] += -earthGravityValue * deltaT;
-
+					rate = simdMulAdd(partialXWrtU[row * 3 + ii], partialVWrtU[row * 3 + jj], rate);
+					rate = simdMulAdd(partialVWrtU[row * 3 + ii], partialXWrtU[row * 3 + jj], rate);
 				}
-
-				//Use explicit integration with velocity to update each particle's position
-				defVertices[i].position[j] += defVertices[i].velocity[j] * deltaT;
+				nu[ii * 3 + jj] = rate;
 			}
-		
 		}
+	}
 
-		doCollisionDetectionAndResponse(deltaT);
+	//elasticStress = lambda * trace(e) * I + 2 * mu * e (+ phi * trace(nu) * I + 2 * psi * nu)
+	SimdForce twoMu = simdMul(simdConstant<SimdForce>(2), simdLoadForce(&tetraMu[firstTetrad]));
+	SimdForce lambdaTrace = simdMul(simdLoadForce(&tetraLambda[firstTetrad]), simdAdd(simdAdd(e[0], e[4]), e[8]));
+	SimdForce elasticStress[9];
+	for (int i = 0; i < 3; i++)
+	{
+		elasticStress[i * 3 + i] = simdMulAdd(twoMu, e[i * 3 + i], lambdaTrace);
+		for (int j = i + 1; j < 3; j++)
+		{
+			elasticStress[i * 3 + j] = simdMul(twoMu, e[i * 3 + j]);
+		}
+	}
 
-		
+	if (useStrainRate)
+	{
+		SimdForce twoPsi = simdConstant<SimdForce>(2 * psi);
+		SimdForce phiTrace = simdMul(simdConstant<SimdForce>(phi), simdAdd(simdAdd(nu[0], nu[4]), nu[8]));
+		for (int i = 0; i < 3; i++)
+		{
+			elasticStress[i * 3 + i] = simdAdd(elasticStress[i * 3 + i], simdMulAdd(twoPsi, nu[i * 3 + i], phiTrace));
+			for (int j = i + 1; j < 3; j++)
+			{
+				elasticStress[i * 3 + j] = simdMulAdd(twoPsi, nu[i * 3 + j], elasticStress[i * 3 + j]);
+			}
+		}
 	}
 
-	#ifdef DEBUGGING
-	if (logger -> isLogging)
+	for (int i = 0; i < 3; i++)
 	{
-		logger ->printVelocitiesAndPositions(defVertices,numVertices,"Deformed Positions", "Deformed Velocities", logger ->MEDIUM);
+		for (int j = i + 1; j < 3; j++)
+		{
+			elasticStress[j * 3 + i] = elasticStress[i * 3 + j];
+		}
 	}
-	#endif
 
-	timeSinceVideoWrite += deltaT;
+	//forces(:,ii) = -volume / 2 * (partialXWrtU * elasticStress) * beta(ii,1:3)'
+	SimdForce scale = simdMul(simdConstant<SimdForce>(-0.5), simdLoad(&blockedRestVolumes[block * FORCE_BLOCK_WIDTH]));
+	for (int row = 0; row < DIMENSION; row++)
+	{
+		SimdForce stressProduct[3];
+		for (int k = 0; k < 3; k++)
+		{
+			SimdForce sum = simdMul(partialXWrtU[row * 3 + 0], elasticStress[0 * 3 + k]);
+			sum = simdMulAdd(partialXWrtU[row * 3 + 1], elasticStress[1 * 3 + k], sum);
+			stressProduct[k] = simdMul(scale, simdMulAdd(partialXWrtU[row * 3 + 2], elasticStress[2 * 3 + k], sum));
+		}
 
-	iter++;	
+		for (int ii = 0; ii < 4; ii++)
+		{
+			SimdForce force = simdMul(stressProduct[0], simdLoad(&blockBeta[(ii * 3 + 0) * FORCE_BLOCK_WIDTH]));
+			force = simdMulAdd(stressProduct[1], simdLoad(&blockBeta[(ii * 3 + 1) * FORCE_BLOCK_WIDTH]), force);
+			force = simdMulAdd(stressProduct[2], simdLoad(&blockBeta[(ii * 3 + 2) * FORCE_BLOCK_WIDTH]), force);
+			simdStoreForce(&lanes[(row * 4 + ii) * FORCE_BLOCK_WIDTH], force);
+		}
+	}
 
-	
+	//Scatter the forces (plus damping) lane by lane
+	for (int lane = 0; lane < FORCE_BLOCK_WIDTH; lane++)
+	{
+		int currentTetrad = firstTetrad + lane;
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			for (int k = 0; k < 4; k++)
+			{
+				int vertex = j * numVertices + tetraList[k * numTetra + currentTetrad];
+				currentForce[vertex] += lanes[(j * 4 + k) * FORCE_BLOCK_WIDTH + lane] - tetraKd[currentTetrad] * velocities[vertex];
+			}
+		}
+	}
+}
+
+//GPU form of the elastic forces (see GpuForceModel)
+//partialXWrtU = p * beta is F with the rows of beta as G, e = F' * F - I is the strain unhalved, and the force on vertex ii is
+//-volume / 2 * F * stress * beta(ii,:)'.
+bool GeorgiaInstituteSystem::getGpuForceModel(GpuForceModel & model)
+{
+	//The GPU keeps the topology it was given, so a mesh that can fracture stays on the CPU
+	if (separation != NULL)
+	{
+		return false;
+	}
 
-	
-	
-}
\ No newline at end of file
+	model.shapeGradients.resize(12 * numTetra);
+	model.forceWeights.resize(12 * numTetra);
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+	{
+		for (int k = 0; k < 12; k++)
+		{
+			double weight = beta[currentTetrad * 12 + k];
+			model.shapeGradients[currentTetrad * 12 + k] = (float) weight;
+			model.forceWeights[currentTetrad * 12 + k] = (float) (-0.5 * restVolumes[currentTetrad] * weight);
+		}
+	}
+	model.strainScale = 1;
+	model.shearScale = 1;
+	model.useDeformedVolume = false;
+	model.phi = (float) phi;
+	model.psi = (float) psi;
+	return true;
+}
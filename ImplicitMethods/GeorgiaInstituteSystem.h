@@ -1,19 +1,66 @@
 #pragma once
 
 #include "ParticleSystem.h"
+#include "SmallMatrix.h"
+
+#define FRACTURE_SPARE_VERTEX_FRACTION 0.25	//Spare vertices reserved for splits by default, as a fraction of the mesh vertices
+#define FRACTURE_TRIANGLES_PER_SPLIT 24		//Surface triangles reserved per spare vertex (a split adds 2 per face it opens)
+#define FRACTURE_MAX_SPLITS 16				//Most vertices split after one time step
+#define SEPARATION_VALUES 24				//Per vertex sums of the separation tensor: tensile and compressive force (3 each), their m(f) (9 each)
+#define SEPARATION_BOUND_SLACK 0.999		//Vertices whose separation bound is above this fraction of the toughness get the exact tensor (covers its rounding)
 
 //Particle System class - Deformation Method #2
 //
 //Based on the paper at http://graphics.berkeley.edu/papers/Obrien-GMA-1999-08/Obrien-GMA-1999-08.pdf  Graphical Modeling and Animation of Brittle Fracture
 //By James O'Brien and Jessica Hodgkins
+//
+//Fracture (see setFractureToughness): after each explicit time step the stress of every tetrahedron near failing is split into its
+//tensile and compressive parts, which give each vertex the separation tensor of the paper.  A vertex whose largest separation
+//eigenvalue exceeds the toughness splits along the plane normal to that eigenvector: its tetrahedra on the far side of the
+//plane get a new vertex, and the faces between the two sides open into a pair of surface triangles.  The cut follows the
+//existing faces - no tetrahedron is cut - so the rest state (beta, the volumes, the coloring and the SIMD blocks) never changes.
+//The new vertices come from spare vertices appended to the mesh by the constructor and held still until they are used, so
+//only the entries of the split vertex and its tetrahedra change (tetraList, massMatrix, the surface and its buffers).
 class GeorgiaInstituteSystem : public ParticleSystem
 {
 	public:
-		GeorgiaInstituteSystem(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger);
+		GeorgiaInstituteSystem(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger, int spareVertexCount = 0);
 		~GeorgiaInstituteSystem();
-		void doUpdate(double elapsedSeconds);
+		void setStrainRateDamping(double phi, double psi);
+		void setFractureToughness(double toughness);
+		double getFractureToughness() {return toughness;}
+		int getSplitCount() {return splitCount;}
+		void doUpdate(double deltaT);
+		static Vertex * addSpareVertices(Vertex * vertexList, int vertexCount, int spareVertexCount);
+	protected:
+		void computeRestState();
+		void computeForces();
+		void computeBlockForces(int firstTetrad, int block);
+		void computeTetraForces(int currentTetrad, double * p, double * v, double * forces);
+		bool getGpuForceModel(GpuForceModel & model);
+		//The splits change tetraList, the surface and the spare vertices in use, none of which a checkpoint holds
+		bool canCheckpoint() {return separation == NULL;}
+		void updateFracture();
+		void computeTetraStress(int currentTetrad, Mat3 & fullPartialXWrtU, Mat3 & e, Mat3 & stress);
+		void computeTetraSeparation(int currentTetrad, double * tensileForces, double * compressiveForces);
+		bool splitVertex(int vertex, const Vec3 & normal);
 	private:
-		double * m;
-		double * beta;
+		double * beta;					//First 3 columns of inv([m; 1 1 1 1]) for each tetrahedron, contiguous: beta[currentTetrad * 12 + row * 3 + col]
+		double * restVolumes;			//Volume of each undeformed tetrahedron
+		ForceReal * blockedBeta;			//beta repacked for the SIMD blocks: [(block * 12 + row * 3 + col) * FORCE_BLOCK_WIDTH + lane]
+		ForceReal * blockedRestVolumes;	//restVolumes repacked for the SIMD blocks: [block * FORCE_BLOCK_WIDTH + lane]
+
+		double phi;						//Strain rate damping constants (viscous analogues of lambda and mu); 0 turns the strain rate terms off
+		double psi;
+
+		//Fracture data (see setFractureToughness) - only built when the constructor is given spare vertices
+		double toughness;				//Separation eigenvalue a vertex splits at; 0 turns fracture off
+		int firstSpareVertex;			//Spare vertices not yet used by a split are [firstSpareVertex, numVertices)
+		int splitCount;
+		vector< vector<int> > vertexTetra;	//Tetrahedra containing each vertex
+		vector<int> triangleTetra;		//Tetrahedron each surface triangle is a face of
+		vector<int> tetraSplitSteps;	//Step each tetrahedron last changed in, so a vertex next to a split waits for fresh stresses
+		double * separation;			//SEPARATION_VALUES per vertex: separation[vertex * SEPARATION_VALUES + k]
+		double * separationBounds;		//Upper bound of the largest separation eigenvalue of each vertex (see updateFracture)
 
 };
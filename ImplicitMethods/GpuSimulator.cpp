@@ -0,0 +1,360 @@
+#include <gl/glew.h>
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "GpuSimulator.h"
+
+using namespace std;
+
+GpuSimulator::GpuSimulator(Logger * logger)
+{
+	this -> logger = logger;
+	for (int i = 0; i < NUM_GPU_BUFFERS; i++)
+	{
+		buffers[i] = 0;
+	}
+	renderBuffer = 0;
+	numTetra = 0;
+	numVertices = 0;
+	numSurfaceTriangles = 0;
+	forceProgram = 0;
+	integrateProgram = 0;
+	faceNormalProgram = 0;
+	vertexNormalProgram = 0;
+}
+
+//Note: the GL context must still exist
+GpuSimulator::~GpuSimulator()
+{
+	glDeleteBuffers(NUM_GPU_BUFFERS, buffers);
+	glDeleteProgram(forceProgram);
+	glDeleteProgram(integrateProgram);
+	glDeleteProgram(faceNormalProgram);
+	glDeleteProgram(vertexNormalProgram);
+}
+
+//Returns true if the current GL context has compute shaders (OpenGL 4.3)
+bool GpuSimulator::isSupported()
+{
+	return GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object);
+}
+
+//Compiles and links the compute shader in fileName
+//Returns 0 (after printing the log) if it cannot be read or does not compile
+GLuint GpuSimulator::loadProgram(const char * fileName)
+{
+	ifstream file(fileName);
+	if (!file)
+	{
+		cerr << "Could not open shader " << fileName << endl;
+		return 0;
+	}
+	stringstream contents;
+	contents << file.rdbuf();
+	string source = contents.str();
+	const GLchar * sourceText = source.c_str();
+
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 1, &sourceText, NULL);
+	glCompileShader(shader);
+
+	GLint compiled = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (!compiled)
+	{
+		GLint length = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+		vector<GLchar> log(length + 1, 0);
+		if (length > 0)
+		{
+			glGetShaderInfoLog(shader, length, NULL, &log[0]);
+		}
+		cerr << "Could not compile shader " << fileName << ":" << endl << &log[0] << endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glLinkProgram(program);
+	glDeleteShader(shader);		//Only flagged - it is deleted with the program
+
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked)
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+		vector<GLchar> log(length + 1, 0);
+		if (length > 0)
+		{
+			glGetProgramInfoLog(program, length, NULL, &log[0]);
+		}
+		cerr << "Could not link shader " << fileName << ":" << endl << &log[0] << endl;
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	return program;
+}
+
+//Binds buffers to the storage block binding points 0, 1, ... of the next dispatch
+void GpuSimulator::bindBuffers(const GpuBuffer * bindings, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, buffers[bindings[i]]);
+	}
+}
+
+void GpuSimulator::createBuffer(GpuBuffer buffer, size_t size, const void * data)
+{
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[buffer]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, data == NULL ? GL_DYNAMIC_COPY : GL_STATIC_DRAW);
+}
+
+//Builds the shaders and uploads the mesh and rest state data
+//tetraList and tetraColorOffsets are those of the ParticleSystem (sorted by color - see buildTetraColoring); renderVertices
+//fill the parts of renderBuffer the shaders never write
+//Returns false if the shaders cannot be built
+bool GpuSimulator::initialize(const GpuForceModel & model, const int * tetraList, int numTetra, int numTetraColors, const int * tetraColorOffsets,
+	const double * masses, int numVertices, const vector<int> & indices, const int * surfaceTriangleOffsets, const int * surfaceTriangles,
+	const Vertex * renderVertices, GLuint renderBuffer)
+{
+	forceProgram = loadProgram("femForces.comp");
+	integrateProgram = loadProgram("femIntegrate.comp");
+	faceNormalProgram = loadProgram("femFaceNormals.comp");
+	vertexNormalProgram = loadProgram("femVertexNormals.comp");
+	if (forceProgram == 0 || integrateProgram == 0 || faceNormalProgram == 0 || vertexNormalProgram == 0)
+	{
+		return false;
+	}
+
+	forceFirstTetrad = glGetUniformLocation(forceProgram, "firstTetrad");
+	forceTetraCount = glGetUniformLocation(forceProgram, "tetraCount");
+	forceStrainScale = glGetUniformLocation(forceProgram, "strainScale");
+	forceShearScale = glGetUniformLocation(forceProgram, "shearScale");
+	forceUseDeformedVolume = glGetUniformLocation(forceProgram, "useDeformedVolume");
+	forcePhi = glGetUniformLocation(forceProgram, "phi");
+	forcePsi = glGetUniformLocation(forceProgram, "psi");
+	forceDoUninvert = glGetUniformLocation(forceProgram, "doUninvert");
+	integrateVertexCount = glGetUniformLocation(integrateProgram, "vertexCount");
+	integrateDeltaT = glGetUniformLocation(integrateProgram, "deltaT");
+	integrateGravity = glGetUniformLocation(integrateProgram, "gravity");
+	integratePlaneCount = glGetUniformLocation(integrateProgram, "planeCount");
+	integratePlanes = glGetUniformLocation(integrateProgram, "planes");
+	integrateMaterials = glGetUniformLocation(integrateProgram, "planeMaterials");
+	faceTriangleCount = glGetUniformLocation(faceNormalProgram, "triangleCount");
+	vertexVertexCount = glGetUniformLocation(vertexNormalProgram, "vertexCount");
+
+	this -> numTetra = numTetra;
+	this -> numVertices = numVertices;
+	this -> renderBuffer = renderBuffer;
+	numSurfaceTriangles = (int) indices.size() / 3;
+	this -> tetraColorOffsets.assign(tetraColorOffsets, tetraColorOffsets + numTetraColors + 1);
+	this -> model = model;
+	this -> model.shapeGradients.clear();
+	this -> model.forceWeights.clear();
+
+	glGenBuffers(NUM_GPU_BUFFERS, buffers);
+
+	//tetraList is stored corner by corner (k * numTetra + tetrahedron); the shader reads all 4 corners at once
+	vector<int> tetra(4 * numTetra);
+	for (int t = 0; t < numTetra; t++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			tetra[t * 4 + k] = tetraList[k * numTetra + t];
+		}
+	}
+	createBuffer(BUFFER_TETRA, sizeof(int) * tetra.size(), &tetra[0]);
+	createBuffer(BUFFER_SHAPE_GRADIENTS, sizeof(float) * model.shapeGradients.size(), &model.shapeGradients[0]);
+	createBuffer(BUFFER_FORCE_WEIGHTS, sizeof(float) * model.forceWeights.size(), &model.forceWeights[0]);
+	createBuffer(BUFFER_MATERIALS, sizeof(float) * 4 * numTetra, NULL);
+	createBuffer(BUFFER_POSITIONS, sizeof(float) * 4 * numVertices, NULL);
+	createBuffer(BUFFER_VELOCITIES, sizeof(float) * 4 * numVertices, NULL);
+
+	vector<float> zeroForces(4 * numVertices, 0);
+	createBuffer(BUFFER_FORCES, sizeof(float) * zeroForces.size(), &zeroForces[0]);
+
+	vector<float> inverseMasses(numVertices);
+	for (int i = 0; i < numVertices; i++)
+	{
+		inverseMasses[i] = (float) (1 / masses[i]);
+	}
+	createBuffer(BUFFER_INVERSE_MASSES, sizeof(float) * numVertices, &inverseMasses[0]);
+
+	//Surface - an empty buffer cannot be bound, so meshes without a surface still get one entry
+	vector<int> surface(indices);
+	surface.push_back(0);
+	createBuffer(BUFFER_SURFACE, sizeof(int) * surface.size(), &surface[0]);
+	createBuffer(BUFFER_FACE_NORMALS, sizeof(float) * 4 * (numSurfaceTriangles + 1), NULL);
+	createBuffer(BUFFER_TRIANGLE_OFFSETS, sizeof(int) * (numVertices + 1), surfaceTriangleOffsets);
+	vector<int> vertexTriangles(surfaceTriangles, surfaceTriangles + surfaceTriangleOffsets[numVertices]);
+	vertexTriangles.push_back(0);
+	createBuffer(BUFFER_VERTEX_TRIANGLES, sizeof(int) * vertexTriangles.size(), &vertexTriangles[0]);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	//The render buffer gets its final contents here; the normal shaders only overwrite the xyz components
+	vector<float> stream(8 * numVertices);
+	for (int i = 0; i < numVertices; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			stream[i * 8 + j] = renderVertices[i].position[j];
+			stream[i * 8 + 4 + j] = renderVertices[i].vertexNormal[j];
+		}
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, renderBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * stream.size(), &stream[0], GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "GPU simulation of " << numVertices << " vertices and " << numTetra << " tetrahedra in " << numTetraColors << " colors" << endl;
+	}
+	#endif
+
+	return true;
+}
+
+//Uploads the constants of every tetrahedron (see ParticleSystem::updateMaterials)
+void GpuSimulator::uploadMaterials(const double * tetraLambda, const double * tetraMu, const double * tetraKd)
+{
+	staging.resize(4 * numTetra);
+	for (int t = 0; t < numTetra; t++)
+	{
+		staging[t * 4 + 0] = (float) tetraLambda[t];
+		staging[t * 4 + 1] = (float) tetraMu[t];
+		staging[t * 4 + 2] = (float) tetraKd[t];
+		staging[t * 4 + 3] = 0;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[BUFFER_MATERIALS]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(float) * staging.size(), &staging[0]);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+//Replaces the state on the graphics card with positions and velocities (ParticleSystem layout: [dimension * numVertices + vertex])
+void GpuSimulator::uploadState(const double * positions, const double * velocities)
+{
+	staging.resize(4 * numVertices);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		const double * state = pass == 0 ? positions : velocities;
+		for (int i = 0; i < numVertices; i++)
+		{
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				staging[i * 4 + j] = (float) state[j * numVertices + i];
+			}
+			staging[i * 4 + 3] = 0;
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[pass == 0 ? BUFFER_POSITIONS : BUFFER_VELOCITIES]);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(float) * staging.size(), &staging[0]);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+//Reads the state on the graphics card back into positions and velocities (waits for the queued steps to finish)
+void GpuSimulator::downloadState(double * positions, double * velocities)
+{
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	staging.resize(4 * numVertices);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		double * state = pass == 0 ? positions : velocities;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[pass == 0 ? BUFFER_POSITIONS : BUFFER_VELOCITIES]);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(float) * staging.size(), &staging[0]);
+		for (int i = 0; i < numVertices; i++)
+		{
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				state[j * numVertices + i] = staging[i * 4 + j];
+			}
+		}
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+//Queues one explicit time step: the forces of every color, then the integration and the plane colliders of collisionSystem
+//Only plane colliders are handled (at most GPU_MAX_PLANES; see ParticleSystem::canSimulateOnGpu)
+void GpuSimulator::step(double deltaT, double earthGravity, bool doUninvert, CollisionSystem * collisionSystem)
+{
+	const GpuBuffer forceBindings[] = {BUFFER_TETRA, BUFFER_SHAPE_GRADIENTS, BUFFER_FORCE_WEIGHTS, BUFFER_MATERIALS, BUFFER_POSITIONS, BUFFER_VELOCITIES, BUFFER_FORCES};
+	glUseProgram(forceProgram);
+	bindBuffers(forceBindings, sizeof(forceBindings) / sizeof(forceBindings[0]));
+	glUniform1f(forceStrainScale, model.strainScale);
+	glUniform1f(forceShearScale, model.shearScale);
+	glUniform1i(forceUseDeformedVolume, model.useDeformedVolume);
+	glUniform1f(forcePhi, model.phi);
+	glUniform1f(forcePsi, model.psi);
+	glUniform1i(forceDoUninvert, doUninvert);
+	for (int color = 0; color + 1 < (int) tetraColorOffsets.size(); color++)
+	{
+		int tetraCount = tetraColorOffsets[color + 1] - tetraColorOffsets[color];
+		glUniform1i(forceFirstTetrad, tetraColorOffsets[color]);
+		glUniform1i(forceTetraCount, tetraCount);
+		glDispatchCompute(getGroupCount(tetraCount), 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);		//The next color adds to forces this one wrote
+	}
+
+	float planes[4 * GPU_MAX_PLANES];
+	float materials[3 * GPU_MAX_PLANES];
+	int planeCount = 0;
+	for (int c = 0; c < collisionSystem -> getColliderCount() && planeCount < GPU_MAX_PLANES; c++)
+	{
+		const Collider & collider = collisionSystem -> getCollider(c);
+		if (collider.type == COLLIDER_PLANE)
+		{
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				planes[planeCount * 4 + j] = (float) collider.normal[j];
+			}
+			planes[planeCount * 4 + 3] = (float) collider.offset;
+			materials[planeCount * 3 + 0] = (float) collider.material.restitution;
+			materials[planeCount * 3 + 1] = (float) collider.material.staticFriction;
+			materials[planeCount * 3 + 2] = (float) collider.material.dynamicFriction;
+			planeCount++;
+		}
+	}
+
+	const GpuBuffer integrateBindings[] = {BUFFER_POSITIONS, BUFFER_VELOCITIES, BUFFER_FORCES, BUFFER_INVERSE_MASSES};
+	glUseProgram(integrateProgram);
+	bindBuffers(integrateBindings, sizeof(integrateBindings) / sizeof(integrateBindings[0]));
+	glUniform1i(integrateVertexCount, numVertices);
+	glUniform1f(integrateDeltaT, (float) deltaT);
+	glUniform1f(integrateGravity, (float) earthGravity);
+	glUniform1i(integratePlaneCount, planeCount);
+	if (planeCount > 0)
+	{
+		glUniform4fv(integratePlanes, planeCount, planes);
+		glUniform3fv(integrateMaterials, planeCount, materials);
+	}
+	glDispatchCompute(getGroupCount(numVertices), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(0);
+}
+
+//Queues the vertex normals, written with the positions into the render buffer
+void GpuSimulator::calculateNormals()
+{
+	const GpuBuffer faceBindings[] = {BUFFER_POSITIONS, BUFFER_SURFACE, BUFFER_FACE_NORMALS};
+	glUseProgram(faceNormalProgram);
+	bindBuffers(faceBindings, sizeof(faceBindings) / sizeof(faceBindings[0]));
+	glUniform1i(faceTriangleCount, numSurfaceTriangles);
+	glDispatchCompute(getGroupCount(numSurfaceTriangles), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	const GpuBuffer vertexBindings[] = {BUFFER_POSITIONS, BUFFER_FACE_NORMALS, BUFFER_TRIANGLE_OFFSETS, BUFFER_VERTEX_TRIANGLES};
+	glUseProgram(vertexNormalProgram);
+	bindBuffers(vertexBindings, sizeof(vertexBindings) / sizeof(vertexBindings[0]));
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, renderBuffer);
+	glUniform1i(vertexVertexCount, numVertices);
+	glDispatchCompute(getGroupCount(numVertices), 1, 1);
+	glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);	//Drawn from next
+
+	glUseProgram(0);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <gl/glut.h>
+#include <vector>
+#include "Vertex.h"
+#include "Logger.h"
+#include "CollisionSystem.h"
+
+using namespace std;
+
+#define GPU_WORK_GROUP_SIZE 64		//Invocations per work group - must match local_size_x of the fem*.comp shaders
+#define GPU_MAX_PLANES 8			//Most plane colliders the integration shader handles (the size of its uniform arrays)
+
+//Rest state data of a deformation method in the generic form the GPU force shader evaluates
+//Every method's elastic force has the same shape: the deformation gradient is F = sum over the 4 vertices k of p_k * G_k',
+//the strain is E = strainScale * (F' * F - I), the stress is S = lambda * trace(E) * I + 2 * mu * E with the off diagonal
+//entries scaled by shearScale, and the force on vertex k is scale * F * S * h_k, where scale is 1 or the deformed volume.
+//G_k and h_k are 3 vectors per vertex of each tetrahedron, in tetraList order: [tetrahedron * 12 + k * 3 + i].
+struct GpuForceModel
+{
+	vector<float> shapeGradients;	//G_k
+	vector<float> forceWeights;		//h_k
+	float strainScale;
+	float shearScale;
+	bool useDeformedVolume;			//True to scale the forces by the deformed volume of the tetrahedron
+	float phi;						//Strain rate damping (see GeorgiaInstituteSystem::setStrainRateDamping) - 0 for none
+	float psi;
+};
+
+//Explicit time steps of a ParticleSystem on the graphics card with OpenGL compute shaders
+//The mesh, the rest state data and the simulation state stay resident in shader storage buffers.  Each step runs one force
+//dispatch per tetrahedron color (tetrahedra of one color share no vertices, so the scatter needs no atomics), then one
+//dispatch that integrates every vertex, resolves the plane colliders and clears the forces for the next step.  The normals
+//are computed on the graphics card as well and written straight into the render vertex buffer, so nothing is read back or
+//uploaded per frame.
+//The state is single precision, so long runs drift from the double precision CPU result.
+//All methods must be called from the thread that owns the GL context.
+class GpuSimulator
+{
+public:
+	GpuSimulator(Logger * logger);
+	~GpuSimulator();
+	static bool isSupported();
+	bool initialize(const GpuForceModel & model, const int * tetraList, int numTetra, int numTetraColors, const int * tetraColorOffsets,
+		const double * masses, int numVertices, const vector<int> & indices, const int * surfaceTriangleOffsets, const int * surfaceTriangles,
+		const Vertex * renderVertices, GLuint renderBuffer);
+	void uploadMaterials(const double * tetraLambda, const double * tetraMu, const double * tetraKd);
+	void uploadState(const double * positions, const double * velocities);
+	void downloadState(double * positions, double * velocities);
+	void step(double deltaT, double earthGravity, bool doUninvert, CollisionSystem * collisionSystem);
+	void calculateNormals();
+
+private:
+	GpuSimulator(const GpuSimulator &);				//Not copyable - owns the GL buffers and programs
+	GpuSimulator & operator = (const GpuSimulator &);
+
+	//Shader storage buffers
+	enum GpuBuffer
+	{
+		BUFFER_TETRA,				//ivec4 vertices of each tetrahedron
+		BUFFER_SHAPE_GRADIENTS,		//GpuForceModel::shapeGradients
+		BUFFER_FORCE_WEIGHTS,		//GpuForceModel::forceWeights
+		BUFFER_MATERIALS,			//vec4 lambda, mu, kd of each tetrahedron
+		BUFFER_POSITIONS,			//vec4 per vertex
+		BUFFER_VELOCITIES,			//vec4 per vertex
+		BUFFER_FORCES,				//vec4 per vertex
+		BUFFER_INVERSE_MASSES,		//float per vertex
+		BUFFER_SURFACE,				//Surface triangle indices
+		BUFFER_FACE_NORMALS,		//vec4 per surface triangle
+		BUFFER_TRIANGLE_OFFSETS,	//ParticleSystem::surfaceTriangleOffsets
+		BUFFER_VERTEX_TRIANGLES,	//ParticleSystem::surfaceTriangles
+		NUM_GPU_BUFFERS
+	};
+
+	Logger * logger;
+	GLuint buffers[NUM_GPU_BUFFERS];
+	GLuint renderBuffer;			//Render vertex buffer (RENDER_STREAM_FLOATS per vertex) - owned by the ParticleSystem
+	int numTetra;
+	int numVertices;
+	int numSurfaceTriangles;
+	vector<int> tetraColorOffsets;
+	GpuForceModel model;			//Only the scalar settings are kept (the arrays are cleared once uploaded)
+	vector<float> staging;			//Float conversion space for uploads and downloads
+
+	GLuint forceProgram;
+	GLuint integrateProgram;
+	GLuint faceNormalProgram;
+	GLuint vertexNormalProgram;
+
+	//Uniform locations
+	GLint forceFirstTetrad, forceTetraCount, forceStrainScale, forceShearScale, forceUseDeformedVolume, forcePhi, forcePsi, forceDoUninvert;
+	GLint integrateVertexCount, integrateDeltaT, integrateGravity, integratePlaneCount, integratePlanes, integrateMaterials;
+	GLint faceTriangleCount;
+	GLint vertexVertexCount;
+
+	GLuint loadProgram(const char * fileName);
+	void bindBuffers(const GpuBuffer * bindings, int count);
+	void createBuffer(GpuBuffer buffer, size_t size, const void * data);
+	int getGroupCount(int count) {return (count + GPU_WORK_GROUP_SIZE - 1) / GPU_WORK_GROUP_SIZE;}
+};
@@ -1,5 +1,6 @@
 #include "Keyboard.h"
 #include <gl/glut.h>
+#include <iostream>
 
 //Constructor for Keyboard class
 //Parameter theSystem - a pointer reference to the ParticleSystem class
@@ -74,10 +75,42 @@ void Keyboard::keyPressed(unsigned char key)
 		case 'I':
 			particleSystem -> toggleImageRendering();
 			break;
+		case 'f':
+		case 'F':
+			particleSystem -> toggleSelfCollision();
+			break;
+		case 'k':
+		case 'K':
+			particleSystem -> toggleImplicitIntegration();
+			break;
+		case 'j':
+		case 'J':
+			particleSystem -> toggleAdaptiveTimeStep();
+			break;
+		case 'l':
+		case 'L':
+			particleSystem -> toggleSleeping();
+			break;
+		case 'v':
+		case 'V':
+			particleSystem -> toggleRecording();
+			break;
+		case 'n':
+		case 'N':
+			particleSystem -> saveCheckpoint("checkpoint.ckpt");
+			break;
+		case 'm':
+		case 'M':
+			particleSystem -> loadCheckpoint("checkpoint.ckpt");
+			break;
 		case 'p':
 		case 'P':
 			logger -> isLogging = !logger -> isLogging;
 			break;
+		case 't':
+		case 'T':
+			toggleProfiling();
+			break;
 		case 'O':
 		case 'o':
 			logger -> printConstraintDeltaV = !logger -> printConstraintDeltaV;
@@ -102,3 +135,26 @@ void Keyboard::keyReleased(unsigned char key)
 	keys[key] = false;
 
 }
+
+//Starts recording into the logger's profiler, or stops it and writes what was recorded to profile.json (Chrome trace) and profile.csv
+void Keyboard::toggleProfiling()
+{
+	Profiler & profiler = logger -> profiler;
+	if (!profiler.isEnabled())
+	{
+		profiler.clear();
+		profiler.setEnabled(true);
+		cout << "Profiling started" << endl;
+		return;
+	}
+
+	profiler.setEnabled(false);
+	if (profiler.writeChromeTrace("profile.json") && profiler.writeCsv("profile.csv"))
+	{
+		cout << "Profiling stopped - wrote " << profiler.getEventCount() << " events to profile.json and profile.csv" << endl;
+	}
+	else
+	{
+		cerr << "Profiling stopped - could not write profile.json / profile.csv" << endl;
+	}
+}
@@ -13,6 +13,7 @@ private:
 	ParticleSystem * particleSystem;		//Reference to the particle system so that control methods can be called
 	ViewManager * viewManager;				//Reference to the view manager
 	Logger * logger;						//Reference to the logger class to allow logging to the console
+	void toggleProfiling();
 public:
 	Keyboard(ParticleSystem * theSystem, ViewManager * viewManager, Logger * logger);
 	void keyPressed(unsigned char key);
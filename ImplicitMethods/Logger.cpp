@@ -415,6 +415,22 @@ void Logger::printVelocitiesAndPositions(Vertex * vertices, int numVertices, cha
 
 }
 
+//Prints positions and velocities stored in vertex type (structure of arrays) form, ie array[dimension * numVertices + vertex]
+void Logger::printVelocitiesAndPositions(double * positions, double * velocities, int numVertices, char * message, char * message2, LoggingLevel requestLevel)
+{
+	if (loggingLevel < requestLevel)
+	{
+		return;
+	}
+
+	printVertexTypeMatrix(positions, numVertices, message, requestLevel);
+
+	cout << endl;
+	logFile << endl;
+
+	printVertexTypeMatrix(velocities, numVertices, message2, requestLevel);
+}
+
 //This method prints the contents of the edge array
 //Parameters:
 //edges - the array containing the edges
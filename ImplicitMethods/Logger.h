@@ -3,6 +3,7 @@
 //#include "Edge.h"
 //#include "Particle.h"
 #include "Vertex.h"
+#include "Profiler.h"
 #include <fstream>
 #include <string>
 
@@ -30,6 +31,7 @@ public:
 
 	LoggingLevel loggingLevel;	//Stores the value of the current logging level
 	ofstream logFile;
+	Profiler profiler;			//Timing and counter instrumentation (unlike the logging this is always compiled in; off until enabled)
 
 
 	Logger();
@@ -53,6 +55,7 @@ public:
 	void printMassMatrix(double * massMatrix, int numParticles, LoggingLevel requestLevel);
 	void printVertexTypeMatrix(double * matrix, int numVertices, char * message, LoggingLevel requestLevel);
 	void printVelocitiesAndPositions(Vertex * vertices, int numVertices, char * message, char * message2, LoggingLevel requestLevel);
+	void printVelocitiesAndPositions(double * positions, double * velocities, int numVertices, char * message, char * message2, LoggingLevel requestLevel);
 	void printText(string text);
 	void printIteration(string text, int number);
 };
@@ -0,0 +1,145 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+	data = NULL;
+	size = 0;
+	#ifdef _WIN32
+	fileHandle = NULL;
+	mappingHandle = NULL;
+	#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+//Maps the whole file (an empty or missing file fails)
+//Returns true if the file is now mapped
+bool MappedFile::open(const char * fileName)
+{
+	close();
+
+	#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	data = (char *) MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (data == NULL)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	size = (size_t) fileSize.QuadPart;
+	fileHandle = file;
+	mappingHandle = mapping;
+	#else
+	int file = ::open(fileName, O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStatus;
+	if (fstat(file, &fileStatus) != 0 || fileStatus.st_size == 0)
+	{
+		::close(file);
+		return false;
+	}
+
+	void * mapping = mmap(NULL, fileStatus.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+	::close(file);	//The mapping keeps its own reference to the file
+	if (mapping == MAP_FAILED)
+	{
+		return false;
+	}
+
+	data = (char *) mapping;
+	size = fileStatus.st_size;
+	#endif
+
+	return true;
+}
+
+//Unmaps the file (does nothing if nothing is mapped)
+void MappedFile::close()
+{
+	if (data == NULL)
+	{
+		return;
+	}
+
+	#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle(mappingHandle);
+	CloseHandle(fileHandle);
+	mappingHandle = NULL;
+	fileHandle = NULL;
+	#else
+	munmap(data, size);
+	#endif
+
+	data = NULL;
+	size = 0;
+}
+
+unsigned long long hashBytes(const void * bytes, size_t count, unsigned long long hash)
+{
+	const unsigned char * byte = (const unsigned char *) bytes;
+	for (size_t i = 0; i < count; i++)
+	{
+		hash ^= byte[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool getFileStamp(const char * fileName, unsigned long long & fileSize, unsigned long long & modificationTime)
+{
+	#ifdef _WIN32
+	struct _stat64 fileStatus;
+	if (_stat64(fileName, &fileStatus) != 0)
+	#else
+	struct stat fileStatus;
+	if (stat(fileName, &fileStatus) != 0)
+	#endif
+	{
+		return false;
+	}
+
+	fileSize = fileStatus.st_size;
+	modificationTime = fileStatus.st_mtime;
+	return true;
+}
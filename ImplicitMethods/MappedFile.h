@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+//A whole file mapped into memory (MapViewOfFile on Windows, mmap elsewhere)
+//The pages are copy on write: the mapped data may be modified in memory, and the file itself is never changed.
+//Pointers into the data stay valid until close is called or the MappedFile is destroyed.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	bool open(const char * fileName);
+	void close();
+	bool isOpen() {return data != NULL;}
+	char * getData() {return data;}
+	size_t getSize() {return size;}
+
+private:
+	MappedFile(const MappedFile &);				//Not copyable - the mapping has a single owner
+	MappedFile & operator = (const MappedFile &);
+
+	char * data;
+	size_t size;
+	#ifdef _WIN32
+	void * fileHandle;
+	void * mappingHandle;
+	#endif
+};
+
+//64 bit FNV-1a hash of count bytes, used to checksum and identify cache files
+//Pass the result of a previous call as hash to continue hashing over several buffers.
+unsigned long long hashBytes(const void * bytes, size_t count, unsigned long long hash = 14695981039346656037ULL);
+
+//Size and last modification time of a file, used to notice when a cached file is out of date
+bool getFileStamp(const char * fileName, unsigned long long & fileSize, unsigned long long & modificationTime);
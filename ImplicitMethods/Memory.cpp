@@ -0,0 +1,125 @@
+#include "Memory.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+bool MemoryArena::useHugePages = false;
+
+MemoryArena::MemoryArena()
+{
+	chunkCount = 0;
+	used = 0;
+	reserved = 0;
+	allocatedBytes = 0;
+}
+
+MemoryArena::~MemoryArena()
+{
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		#ifdef _WIN32
+		VirtualFree(chunks[i], 0, MEM_RELEASE);
+		#else
+		munmap(chunks[i], chunkSizes[i]);
+		#endif
+	}
+}
+
+//Makes the next chunk at least bytes long, so that a known set of arrays ends up in one chunk
+//Call before allocating them; the estimate may be exceeded (another chunk is added) at no cost beyond the allocation.
+void MemoryArena::reserve(size_t bytes)
+{
+	reserved = bytes;
+}
+
+//Returns bytes of uninitialized memory aligned to MEMORY_ALIGNMENT, or NULL if the system is out of memory
+void * MemoryArena::allocateBytes(size_t bytes)
+{
+	bytes = (bytes + MEMORY_ALIGNMENT - 1) / MEMORY_ALIGNMENT * MEMORY_ALIGNMENT;
+	if (bytes == 0)
+	{
+		bytes = MEMORY_ALIGNMENT;
+	}
+
+	if (chunkCount == 0 || used + bytes > chunkSizes[chunkCount - 1])
+	{
+		size_t size = bytes;
+		if (size < reserved)
+		{
+			size = reserved;
+		}
+		if (size < allocatedBytes)
+		{
+			size = allocatedBytes;
+		}
+		if (!addChunk(size))
+		{
+			return NULL;
+		}
+		reserved = 0;
+	}
+
+	void * memory = chunks[chunkCount - 1] + used;
+	used += bytes;
+	allocatedBytes += bytes;
+	return memory;
+}
+
+//Maps a new chunk of at least bytes, rounded up to whole huge pages if they are used
+//Returns false if the system is out of memory (or the arena out of chunks)
+bool MemoryArena::addChunk(size_t bytes)
+{
+	if (chunkCount == MAX_CHUNKS)
+	{
+		return false;
+	}
+
+	bool hugePages = useHugePages && bytes >= HUGE_PAGE_SIZE;
+	if (hugePages)
+	{
+		bytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+	}
+
+	#ifdef _WIN32
+	//Large pages need the "Lock pages in memory" privilege and are touched (so placed) by VirtualAlloc itself -
+	//without the privilege the request fails and the chunk falls back to ordinary pages.
+	void * memory = NULL;
+	SIZE_T largePage = GetLargePageMinimum();
+	if (hugePages && largePage > 0 && bytes % largePage == 0)
+	{
+		memory = VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+	}
+	if (memory == NULL)
+	{
+		memory = VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+	if (memory == NULL)
+	{
+		return false;
+	}
+	#else
+	void * memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		return false;
+	}
+	#ifdef MADV_HUGEPAGE
+	//Transparent huge pages - only a hint, the kernel may still use ordinary pages
+	if (hugePages)
+	{
+		madvise(memory, bytes, MADV_HUGEPAGE);
+	}
+	#endif
+	#endif
+
+	chunks[chunkCount] = (char *) memory;
+	chunkSizes[chunkCount] = bytes;
+	chunkCount++;
+	used = 0;
+	return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdlib>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+const int MEMORY_ALIGNMENT = 64;	//Alignment in bytes for simulation arrays (one cache line - also enough for any SIMD register width)
+
+//Allocates an uninitialized array of count elements aligned to MEMORY_ALIGNMENT bytes
+//Arrays allocated here must be freed with alignedFree, not delete []
+template <class T>
+T * alignedAlloc(int count)
+{
+	size_t size = sizeof(T) * (count > 0 ? count : 1);
+	#ifdef _MSC_VER
+	return (T *) _aligned_malloc(size, MEMORY_ALIGNMENT);
+	#else
+	void * memory = NULL;
+	if (posix_memalign(&memory, MEMORY_ALIGNMENT, size) != 0)
+	{
+		return NULL;
+	}
+	return (T *) memory;
+	#endif
+}
+
+//Frees an array allocated with alignedAlloc
+template <class T>
+void alignedFree(T * memory)
+{
+	#ifdef _MSC_VER
+	_aligned_free(memory);
+	#else
+	free(memory);
+	#endif
+}
+
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;		//Size of a huge page on x86 (see MemoryArena::setHugePages)
+
+//One block of memory per simulated body, carved into MEMORY_ALIGNMENT aligned arrays that all live until the arena is destroyed
+//The memory comes straight from the operating system in a few large chunks, so a body costs a handful of allocations
+//instead of one per array.  Its pages are untouched until first written, so whichever thread first writes a page places
+//it on its own NUMA node (see ParticleSystem::allocateVertexArray).
+//A request that does not fit in the current chunk starts a new one, at least as large as everything allocated so far.
+class MemoryArena
+{
+public:
+	MemoryArena();
+	~MemoryArena();
+	void reserve(size_t bytes);
+	void * allocateBytes(size_t bytes);
+	size_t getAllocatedBytes() {return allocatedBytes;}
+	int getChunkCount() {return (int) chunkCount;}
+
+	//Allocates an uninitialized (untouched) array of count elements - only for types without a destructor
+	template <class T>
+	T * allocate(size_t count)
+	{
+		return (T *) allocateBytes(sizeof(T) * count);
+	}
+
+	static void setHugePages(bool useHugePages) {MemoryArena::useHugePages = useHugePages;}
+	static bool getHugePages() {return useHugePages;}
+
+private:
+	MemoryArena(const MemoryArena &);				//Not copyable - owns the chunks
+	MemoryArena & operator = (const MemoryArena &);
+
+	static const int MAX_CHUNKS = 32;
+	static bool useHugePages;			//True to back chunks of at least HUGE_PAGE_SIZE bytes with huge pages where the system allows it
+
+	char * chunks[MAX_CHUNKS];
+	size_t chunkSizes[MAX_CHUNKS];
+	size_t chunkCount;
+	size_t used;						//Bytes handed out from the last chunk
+	size_t reserved;					//Size of the next chunk, if larger than the request (see reserve)
+	size_t allocatedBytes;
+
+	bool addChunk(size_t bytes);
+};
@@ -3,7 +3,9 @@
 #include <assert.h>
 #include "Logger.h"
 #include "NonlinearMethodSystem.h"
-#include "Macros.h"
+#include "PrecomputeCache.h"
+#include "GpuSimulator.h"
+#include "SmallMatrix.h"
 
 using namespace std;
 
@@ -24,10 +26,24 @@ NonlinearMethodSystem::NonlinearMethodSystem(Vertex * vertexList, int vertexCoun
 	logger -> initFile("nonLinearDeformation.log");
 	logger ->printText(text);
 
-	ruWeights = new double [4 * numTetra];
-	rvWeights = new double [4 * numTetra];
-	rwWeights = new double [4 * numTetra];
+	ruWeights = allocateTetraArray(4, 1);
+	rvWeights = allocateTetraArray(4, 1);
+	rwWeights = allocateTetraArray(4, 1);
 
+	PrecomputeCache precompute("nonlinear", orgVertices, numVertices, tetraList, numTetra);
+	precompute.addArray(ruWeights, 4 * numTetra);
+	precompute.addArray(rvWeights, 4 * numTetra);
+	precompute.addArray(rwWeights, 4 * numTetra);
+	if (!precompute.load(logger))
+	{
+		computeRestState();
+		precompute.save();
+	}
+}
+
+//Computes the ru, rv and rw weights of every tetrahedron from the original vertices
+void NonlinearMethodSystem::computeRestState()
+{
 	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
 	{
 		//vertex1 = orgVertices(:,triangles(1,currentTriangle));
@@ -74,60 +90,55 @@ NonlinearMethodSystem::NonlinearMethodSystem(Vertex * vertexList, int vertexCoun
 		//[rua rub ruc rud]' = inv([ua ub uc ud; va vb vc vd; wa wb wc wd; 1 1 1 1]) * [1 0 0 0]'
 		/////////////////////////////////////////////////////////////////////////////////////////
 
-		double squareMatrix[16];
-		double inverseSquareMatrix[16];
-		
-		squareMatrix[0] = ua;   squareMatrix[1] = ub;   squareMatrix[2] = uc;   squareMatrix[3] = ud;
-		squareMatrix[4] = va;   squareMatrix[5] = vb;   squareMatrix[6] = vc;   squareMatrix[7] = vd;
-		squareMatrix[8] = wa;   squareMatrix[9] = wb;   squareMatrix[10] = wc;  squareMatrix[11] = wd;
-		squareMatrix[12] = 1;   squareMatrix[13] = 1;   squareMatrix[14] = 1;   squareMatrix[15] = 1;
+		Mat4 squareMatrix = {{
+			ua, ub, uc, ud,
+			va, vb, vc, vd,
+			wa, wb, wc, wd,
+			1,  1,  1,  1
+		}};
 		
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger -> print4By4MatrixSingleIndex(squareMatrix,"original vertices square matrix", logger ->MEDIUM);
+			logger -> print4By4MatrixSingleIndex(squareMatrix.data,"original vertices square matrix", logger ->MEDIUM);
 		}
 		#endif
 
-		find4By4MatrixInverse(squareMatrix,inverseSquareMatrix, logger);
+		Mat4 inverseSquareMatrix = inverse(squareMatrix);
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger -> print4By4MatrixSingleIndex(inverseSquareMatrix,"Inverse of original vertices square matrix", logger ->MEDIUM);
+			logger -> print4By4MatrixSingleIndex(inverseSquareMatrix.data,"Inverse of original vertices square matrix", logger ->MEDIUM);
 		}
 		#endif
 
-		double ruWeightsTemp[4];
-		double ruRightVector[4] = {1, 0, 0, 0};  //TODO: Can we optimize this matrix-vector multiplication to exploit the zeroes?
-		multiplyMatricesATimesBSingleIndexes(ruWeightsTemp,inverseSquareMatrix, 4, 4, ruRightVector, 4, 1);
+		//Multiplying by [1 0 0 0]', [0 1 0 0]' and [0 0 1 0]' picks out the first 3 columns of the inverse
+
+		Vec4 ruWeightsTemp = column(inverseSquareMatrix, 0);
 		
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger ->printVector(ruWeightsTemp,4,"ru weights", logger ->MEDIUM);
+			logger ->printVector(ruWeightsTemp.data,4,"ru weights", logger ->MEDIUM);
 		}
 		#endif
 
-		double rvWeightsTemp[4];
-		double rvRightVector[4] = {0, 1, 0, 0};  //TODO: Can we optimize this matrix-vector multiplication to exploit the zeroes?
-		multiplyMatricesATimesBSingleIndexes(rvWeightsTemp,inverseSquareMatrix, 4, 4, rvRightVector, 4, 1);
+		Vec4 rvWeightsTemp = column(inverseSquareMatrix, 1);
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger ->printVector(rvWeightsTemp,4,"rv weights", logger ->MEDIUM);
+			logger ->printVector(rvWeightsTemp.data,4,"rv weights", logger ->MEDIUM);
 		}
 		#endif
 
-		double rwWeightsTemp[4];
-		double rwRightVector[4] = {0, 0, 1, 0};  //TODO: Can we optimize this matrix-vector multiplication to exploit the zeroes?
-		multiplyMatricesATimesBSingleIndexes(rwWeightsTemp,inverseSquareMatrix, 4, 4, rwRightVector, 4, 1);
+		Vec4 rwWeightsTemp = column(inverseSquareMatrix, 2);
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger ->printVector(rwWeightsTemp,4,"rw weights", logger ->MEDIUM);
+			logger ->printVector(rwWeightsTemp.data,4,"rw weights", logger ->MEDIUM);
 		}
 		#endif
 
@@ -140,37 +151,18 @@ NonlinearMethodSystem::NonlinearMethodSystem(Vertex * vertexList, int vertexCoun
 
 
 	}
-		
 }
 
 NonlinearMethodSystem::~NonlinearMethodSystem()
 {
-	delete [] ruWeights;
-	delete [] rvWeights;
-	delete [] rwWeights;
+	//The weights belong to the arena
 }
 
-//Overridden update method
-void NonlinearMethodSystem::doUpdate(double deltaT)
+//Overridden force kernel - computes the nonlinear tensile forces for one tetrahedron
+//Parameter p is the deformed positions of its 4 vertices (3 X 4, p[j * 4 + vertex]); the forces are written to forces in the same layout
+//The velocities are not used - accumulateTetraForces adds the kd damping.
+void NonlinearMethodSystem::computeTetraForces(int currentTetrad, double * p, double *, double * forces)
 {
-	#ifdef DEBUGGING
-	if (logger -> isLogging)
-	{
-		logger ->printVelocitiesAndPositions(defVertices, numVertices, "Positions - start of method", "Velocities - start of method", logger ->MEDIUM);
-	}
-	#endif
-	
-    //currentForce = zeros(size(inVelocities,1), size(inVelocities,2));
-    
-	//Start with 0 force each iteration
-	for (int i = 0; i < DIMENSION * numVertices; i++)
-	{
-		currentForce[i] = 0;
-	}
-
-	//for currentTriangle = 1:size(triangles,2)
-	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
-	{
 		//rua = ruWeights(1,1);
         //rub = ruWeights(2,1);
         //ruc = ruWeights(3,1);
@@ -195,20 +187,20 @@ void NonlinearMethodSystem::doUpdate(double deltaT)
         //V = rva * vertex1 + rvb * vertex2 + rvc * vertex3 + rvd * vertex4;
         //W = rwa * vertex1 + rwb * vertex2 + rwc * vertex3 + rwd * vertex4;
 
-		double U[3], V[3], W[3];
+		Vec3 U, V, W;
 		for (int i = 0; i < DIMENSION; i++)
 		{
-			U[i] = ruWeights[currentTetrad * 4 + 0] * defVertices[tetraList[0 * numTetra + currentTetrad]].position[i] + ruWeights[currentTetrad * 4 + 1] * defVertices[tetraList[1 * numTetra + currentTetrad]].position[i] + ruWeights[currentTetrad * 4 + 2] * defVertices[tetraList[2 * numTetra + currentTetrad]].position[i] + ruWeights[currentTetrad * 4 + 3] * defVertices[tetraList[3 * numTetra + currentTetrad]].position[i];
-			V[i] = rvWeights[currentTetrad * 4 + 0] * defVertices[tetraList[0 * numTetra + currentTetrad]].position[i] + rvWeights[currentTetrad * 4 + 1] * defVertices[tetraList[1 * numTetra + currentTetrad]].position[i] + rvWeights[currentTetrad * 4 + 2] * defVertices[tetraList[2 * numTetra + currentTetrad]].position[i] + rvWeights[currentTetrad * 4 + 3] * defVertices[tetraList[3 * numTetra + currentTetrad]].position[i];
-			W[i] = rwWeights[currentTetrad * 4 + 0] * defVertices[tetraList[0 * numTetra + currentTetrad]].position[i] + rwWeights[currentTetrad * 4 + 1] * defVertices[tetraList[1 * numTetra + currentTetrad]].position[i] + rwWeights[currentTetrad * 4 + 2] * defVertices[tetraList[2 * numTetra + currentTetrad]].position[i] + rwWeights[currentTetrad * 4 + 3] * defVertices[tetraList[3 * numTetra + currentTetrad]].position[i];
+			U[i] = ruWeights[currentTetrad * 4 + 0] * p[i * 4 + 0] + ruWeights[currentTetrad * 4 + 1] * p[i * 4 + 1] + ruWeights[currentTetrad * 4 + 2] * p[i * 4 + 2] + ruWeights[currentTetrad * 4 + 3] * p[i * 4 + 3];
+			V[i] = rvWeights[currentTetrad * 4 + 0] * p[i * 4 + 0] + rvWeights[currentTetrad * 4 + 1] * p[i * 4 + 1] + rvWeights[currentTetrad * 4 + 2] * p[i * 4 + 2] + rvWeights[currentTetrad * 4 + 3] * p[i * 4 + 3];
+			W[i] = rwWeights[currentTetrad * 4 + 0] * p[i * 4 + 0] + rwWeights[currentTetrad * 4 + 1] * p[i * 4 + 1] + rwWeights[currentTetrad * 4 + 2] * p[i * 4 + 2] + rwWeights[currentTetrad * 4 + 3] * p[i * 4 + 3];
 		}
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger ->printVector(U,3,"U Axis Vector", logger ->MEDIUM);
-			logger ->printVector(V,3,"V Axis Vector", logger ->MEDIUM);
-			logger ->printVector(W,3,"W Axis Vector", logger ->MEDIUM);
+			logger ->printVector(U.data,3,"U Axis Vector", logger ->MEDIUM);
+			logger ->printVector(V.data,3,"V Axis Vector", logger ->MEDIUM);
+			logger ->printVector(W.data,3,"W Axis Vector", logger ->MEDIUM);
 		}
 		#endif
         
@@ -219,12 +211,12 @@ void NonlinearMethodSystem::doUpdate(double deltaT)
         //Euw = 0.5 * (U' * W);
         //Euv = 0.5 * (U' * V);
 
-		double Euu = 0.5 * (dot3(U, U) - 1);
-        double Evv = 0.5 * (dot3(V, V) - 1);
-        double Eww = 0.5 * (dot3(W, W) - 1);
-        double Evw = 0.5 * (dot3(V, W));
-        double Euw = 0.5 * (dot3(U, W));
-        double Euv = 0.5 * (dot3(U, V));
+		double Euu = 0.5 * (dot(U, U) - 1);
+        double Evv = 0.5 * (dot(V, V) - 1);
+        double Eww = 0.5 * (dot(W, W) - 1);
+        double Evw = 0.5 * (dot(V, W));
+        double Euw = 0.5 * (dot(U, W));
+        double Euv = 0.5 * (dot(U, V));
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
@@ -245,12 +237,12 @@ void NonlinearMethodSystem::doUpdate(double deltaT)
 
 		//voigtStrain = [Euu Evv Eww 2 * Evw 2 * Euw 2 * Euv]';
 
-		double voigtGreenStrain[6] = {Euu, Evv, Eww, 2 * Evw, 2 * Euw, 2 * Euv};    
+		Vec6 voigtGreenStrain = {{Euu, Evv, Eww, 2 * Evw, 2 * Euw, 2 * Euv}};    
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger ->printVector(voigtGreenStrain,6,"voigtGreenStrain", logger ->MEDIUM);
+			logger ->printVector(voigtGreenStrain.data,6,"voigtGreenStrain", logger ->MEDIUM);
 		}
 		#endif
 
@@ -264,32 +256,33 @@ void NonlinearMethodSystem::doUpdate(double deltaT)
         //0                   0                 0                   0   0   mu;   ...
         //];
 
-		double strainToStress[36] = 
-		{
+		//This tetrahedron's constants (see ParticleSystem::updateMaterials)
+		double lambda = tetraLambda[currentTetrad];
+		double mu = tetraMu[currentTetrad];
+		Mat6 strainToStress = 
+		{{
 			2 * mu + lambda,     lambda,             lambda,              0,   0,    0,
 			lambda,              2 * mu + lambda,    lambda,              0,   0,    0,
 			lambda,              lambda,             2 * mu + lambda,     0,   0,    0,
 			0,                   0,                  0,                   mu,  0,    0,
 			0,                   0,                  0,                   0,   mu,   0,
 			0,                   0,                  0,                   0,   0,    mu
-		};
+		}};
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger ->printStrainToStressMatrixSingleIndex(strainToStress,"strain to stress matrix", logger ->MEDIUM);
+			logger ->printStrainToStressMatrixSingleIndex(strainToStress.data,"strain to stress matrix", logger ->MEDIUM);
 		}
 		#endif
     
         //voigtStress = strainToStress * voigtStrain;
-		double voigtStress[6];
-
-		multiplyMatricesATimesBSingleIndexes(voigtStress, strainToStress,6, 6, voigtGreenStrain, 6,1);
+		Vec6 voigtStress = strainToStress * voigtGreenStrain;
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger ->printVector(voigtStress,6,"voigtStress", logger ->MEDIUM);
+			logger ->printVector(voigtStress.data,6,"voigtStress", logger ->MEDIUM);
 		}
 		#endif
    
@@ -328,23 +321,23 @@ void NonlinearMethodSystem::doUpdate(double deltaT)
         //                 1            1            1            1             ...
         //               ];
 
-		double volumeMatrix[16] = 
-		{ 
-			                    defVertices[tetraList[0 * numTetra + currentTetrad]].position[0], defVertices[tetraList[1 * numTetra + currentTetrad]].position[0], defVertices[tetraList[2 * numTetra + currentTetrad]].position[0], defVertices[tetraList[3 * numTetra + currentTetrad]].position[0],
-								defVertices[tetraList[0 * numTetra + currentTetrad]].position[1], defVertices[tetraList[1 * numTetra + currentTetrad]].position[1], defVertices[tetraList[2 * numTetra + currentTetrad]].position[1], defVertices[tetraList[3 * numTetra + currentTetrad]].position[1],
-								defVertices[tetraList[0 * numTetra + currentTetrad]].position[2], defVertices[tetraList[1 * numTetra + currentTetrad]].position[2], defVertices[tetraList[2 * numTetra + currentTetrad]].position[2], defVertices[tetraList[3 * numTetra + currentTetrad]].position[2],
-								                                                               1,                                                                1,                                                                1,                                                                1
-		};
+		Mat4 volumeMatrix = 
+		{{ 
+			p[0], p[1],  p[2],  p[3],
+			p[4], p[5],  p[6],  p[7],
+			p[8], p[9], p[10], p[11],
+			   1,    1,     1,     1
+		}};
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger -> print4By4MatrixSingleIndex(volumeMatrix,"volume matrix", logger ->MEDIUM);
+			logger -> print4By4MatrixSingleIndex(volumeMatrix.data,"volume matrix", logger ->MEDIUM);
 		}
 		#endif
         
 		//volume = (1/6) * abs(det(volumeMatrix));
-        double volume = (1.0/6) * abs(determinant4By4(volumeMatrix));
+        double volume = (1.0/6) * abs(determinant(volumeMatrix));
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
@@ -365,51 +358,43 @@ void NonlinearMethodSystem::doUpdate(double deltaT)
 		{
 			for (int i = 0; i < DIMENSION; i++)
 			{
-				currentForce[i * numVertices + tetraList[j * numTetra + currentTetrad]] +=  -volume * (ouu*ruWeights[currentTetrad * 4 + j] * U[i] + ouv*(0.5*ruWeights[currentTetrad * 4 + j]*V[i] + 0.5*rvWeights[currentTetrad * 4 + j] * U[i]) + ouw*(0.5 * ruWeights[currentTetrad * 4 + j]*W[i]+0.5*rwWeights[currentTetrad * 4 + j]*U[i]) + ovv*rvWeights[currentTetrad * 4 + j]*V[i] + ovw*(0.5*rvWeights[currentTetrad * 4 + j]*W[i] + 0.5*rwWeights[currentTetrad * 4 + j]*V[i]) + oww*rwWeights[currentTetrad * 4 + j]*W[i]) - kd * defVertices[tetraList[j*numTetra+currentTetrad]].velocity[i];
+				forces[i * 4 + j] = -volume * (ouu*ruWeights[currentTetrad * 4 + j] * U[i] + ouv*(0.5*ruWeights[currentTetrad * 4 + j]*V[i] + 0.5*rvWeights[currentTetrad * 4 + j] * U[i]) + ouw*(0.5 * ruWeights[currentTetrad * 4 + j]*W[i]+0.5*rwWeights[currentTetrad * 4 + j]*U[i]) + ovv*rvWeights[currentTetrad * 4 + j]*V[i] + ovw*(0.5*rvWeights[currentTetrad * 4 + j]*W[i] + 0.5*rwWeights[currentTetrad * 4 + j]*V[i]) + oww*rwWeights[currentTetrad * 4 + j]*W[i]);
 			}
 		}
 
 		#ifdef DEBUGGING
 		if (logger -> isLogging)
 		{
-			logger -> printVertexTypeMatrix(currentForce,numVertices,"currentForce", logger ->MEDIUM);
+			logger -> print3By4MatrixSingleIndex(forces,"forces", logger ->MEDIUM);
 		}
 		#endif
         
-    //end
-	}
-	    
-    //currentForce = currentForce + repmat(earthGravity, 1, size(inVelocities,2));
-    //inVelocities = inVelocities + currentForce * elapsedTime;
-    
-    //defVertices = defVertices + inVelocities * elapsedTime;
+		//(the caller adds the damping term - kd * inVelocities while scattering the forces)
+}
 
-	if (isAnimating)
+//GPU form of the tensile forces (see GpuForceModel)
+//[U V W] is F with the ru, rv and rw weights of each vertex as G, and the force on vertex j is -volume * F * stress * G_j, where
+//the Voigt stress halves the off diagonal entries (ouv multiplies 0.5 * (ru * V + rv * U)) and volume is the deformed volume.
+bool NonlinearMethodSystem::getGpuForceModel(GpuForceModel & model)
+{
+	model.shapeGradients.resize(12 * numTetra);
+	model.forceWeights.resize(12 * numTetra);
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
 	{
-		for (int i = 0; i < numVertices; i++)
+		for (int j = 0; j < 4; j++)
 		{
-			for (int j = 0; j < DIMENSION; j++)
+			double weights[3] = {ruWeights[currentTetrad * 4 + j], rvWeights[currentTetrad * 4 + j], rwWeights[currentTetrad * 4 + j]};
+			for (int i = 0; i < 3; i++)
 			{
-				//Add delta velocity to each particle's velocity
-				defVertices[i].velocity[j] += (currentForce[j * numVertices + i] / massMatrix[i]) * deltaT;
-
-				if (j == 1)
-				{
-					defVertices[i].velocity[j] += -earthGravityValue * deltaT;
-
-				}
-
-				//Use explicit integration with velocity to update each particle's position
-				defVertices[i].position[j] += defVertices[i].velocity[j] * deltaT;
+				model.shapeGradients[currentTetrad * 12 + j * 3 + i] = (float) weights[i];
+				model.forceWeights[currentTetrad * 12 + j * 3 + i] = (float) -weights[i];
 			}
-		
 		}
-
-		doCollisionDetectionAndResponse(deltaT);
-
-		
 	}
-    
-    timeSinceVideoWrite += deltaT;
+	model.strainScale = 0.5f;
+	model.shearScale = 0.5f;
+	model.useDeformedVolume = true;
+	model.phi = 0;
+	model.psi = 0;
+	return true;
 }
-
@@ -11,9 +11,13 @@ class NonlinearMethodSystem : public ParticleSystem
 	public:
 	NonlinearMethodSystem(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger);
 	~NonlinearMethodSystem();
-	void doUpdate(double elapsedSeconds);
 
 	double * ruWeights;
 	double * rvWeights;
 	double * rwWeights;
+
+	protected:
+	void computeRestState();
+	void computeTetraForces(int currentTetrad, double * p, double * v, double * forces);
+	bool getGpuForceModel(GpuForceModel & model);
 };
@@ -1,3 +0,0 @@
-//These are prototypes to let the .cpp file be used with anything.  See the .cpp file for more info.
-void svdcmp(float **a, int m, int n, float w[], float **v);
-void svbksb(float **u, float w[], float **v, int m, int n, float b[], float x[]);
\ No newline at end of file
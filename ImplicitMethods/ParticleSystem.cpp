@@ -6,17 +6,32 @@
 #include <iomanip>
 #include <assert.h>
 #include <iostream>
-#include "targa.h"
-#include "Macros.h"
-#include "NumericalRecipes.h"
+#include <algorithm>
+#include <limits>
+#include <new>
+#include <cstring>
+#include "SmallMatrix.h"
+#include "SVD3.h"
+#include "Memory.h"
+#include "Simd.h"
+#include "Timer.h"
+#include "Threading.h"
+#include "GpuSimulator.h"
+#include "RenderEmbedding.h"
 
 #include "ParticleSystem.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 
 using namespace std;
 
 const double epsilon = 1e-12;	//Used to check approximate equality to 0
+const long RENDER_SNAPSHOT_FRESH = 4;	//Flag in readySnapshot (above the snapshot index bits) marking a snapshot not yet taken by the render thread
+const int TETRA_FACE_CORNERS[12] = {3, 1, 0, 2, 1, 3, 2, 3, 0, 0, 1, 2};	//Corners of the 4 faces of a tetrahedron in the RGB view, counter clockwise seen from outside
 extern const int DIMENSION;		//DIMENSION of system (3 for 3D)
 
 //Constructor - initializes particles and settings
@@ -44,9 +59,35 @@ ParticleSystem::ParticleSystem(Vertex * vertexList, int vertexCount, int * tetra
 	//numVertices = 4;
 	numVertices = vertexCount;
 	
+	numTetra = tetraCount;
+
+	#ifdef _OPENMP
+	numThreads = omp_get_max_threads();
+	#else
+	numThreads = 1;
+	#endif
+
+	//One chunk for the arrays of this class and (estimated) those of the deformation method (see allocateVertexArray)
+	arena.reserve(sizeof(Vertex) * numVertices + sizeof(double) * ((size_t) BASE_ARENA_VALUES_PER_VERTEX * numVertices +
+		(size_t) (BASE_ARENA_VALUES_PER_TETRA + METHOD_ARENA_VALUES_PER_TETRA) * numTetra) + ARENA_SLACK_BYTES);
+
 	//orgVertices = new Vertex[numVertices];
-	defVertices = new Vertex[numVertices];
+	defVertices = allocateVertices();
 	orgVertices = vertexList;
+
+	//Simulation state - kept apart from the Vertex structs so the solvers only stream through what they use
+	positions = allocateVertexArray(1, DIMENSION);
+	velocities = allocateVertexArray(1, DIMENSION);
+	gpuSimulator = NULL;
+	gpuStateCurrent = false;
+	renderEmbedding = NULL;
+
+	//Before reset, which wakes every vertex
+	useSleeping = false;
+	calmSteps = NULL;
+	vertexSleeping = NULL;
+	vertexMoving = NULL;
+	sleepingVertexCount = 0;
 	
 	const double height = 1.0;
 	//const double height = -3.0;
@@ -62,6 +103,12 @@ ParticleSystem::ParticleSystem(Vertex * vertexList, int vertexCount, int * tetra
 	//tetraList = new int[numTetra * 4];
 	numTetra = tetraCount;
 	this -> tetraList = tetraList;
+	iteration = 1;
+
+	//Group the tetrahedra so that force assembly can run in parallel without two threads writing to the same vertex
+	buildTetraColoring();
+	buildForceBlocks();
+	buildSurface();
 	
 	//Note: these are in CLOCKWISE ORDER.  Winding must be consistent.
 	//tetraList[0] = 0;
@@ -81,21 +128,59 @@ ParticleSystem::ParticleSystem(Vertex * vertexList, int vertexCount, int * tetra
 		
 	//reset();  //Set up the particle positions / velocities
 
-	normals = new double[DIMENSION * numTetra * 4];
+	normals = allocateTetraArray(4, DIMENSION);
 
 	//vertexNormals = new double [(DIMENSION + 1) * numVertices];
-	tetraCounts = new int [numVertices];
-
-	massMatrix = new double [numVertices];
-	currentForce = new double[numVertices * DIMENSION];
-	zeroVector = new double [numVertices * DIMENSION];
-
-	//Allocate buffers to hold portions of the screen grabbed / swapped for video generation
-	//We allocate enough space to work with the entire screen because the window size must be less than the screen
-	int screenWidth = glutGet(GLUT_SCREEN_WIDTH);
-	int screenHeight = glutGet(GLUT_SCREEN_HEIGHT);
-	screenBuffer = new uint8_t[screenWidth * screenHeight * 4];
-	screenRowTemp = new uint8_t [screenWidth * 4];
+
+	massMatrix = allocateVertexArray(1, 1);
+	currentForce = allocateVertexArray(1, DIMENSION);
+	zeroVector = allocateVertexArray(1, DIMENSION);
+
+	//Filled on the first step, once the derived class has set its constants
+	tetraLambda = allocateTetraArray(1, 1);
+	tetraMu = allocateTetraArray(1, 1);
+	tetraKd = allocateTetraArray(1, 1);
+	vertexKd = allocateVertexArray(1, 1);
+	materialsChanged = true;
+
+	//The capture only touches GL once image rendering is turned on (a headless run never does)
+	frameCapture = new FrameCapture(logger);
+
+	//Only the surface can touch spheres and boxes (see CollisionSystem), so they are tested against the surface vertices
+	vector<int> surfaceVertices;
+	for (int i = 0; i < numVertices; i++)
+	{
+		if (surfaceTriangleOffsets[i + 1] > surfaceTriangleOffsets[i])
+		{
+			surfaceVertices.push_back(i);
+		}
+	}
+	collisionSystem = new CollisionSystem(numVertices, surfaceVertices, logger);
+
+	//The floor
+	double floorNormal[DIMENSION] = {0, 1, 0};
+	ContactMaterial floorMaterial = {restitution, us, ud};
+	collisionSystem -> addPlane(floorNormal, FLOOR_HEIGHT, floorMaterial);
+	useSelfCollision = false;
+	selfCollision = NULL;
+	selfCollisionCount = 0;
+	resetPhaseTimings();
+	invertedTetraCount = 0;
+	collisionCount = 0;
+
+	useRenderSnapshots = false;
+	for (int i = 0; i < RENDER_SNAPSHOTS; i++)
+	{
+		renderSnapshots[i] = NULL;
+	}
+	writeSnapshot = 0;
+	displaySnapshot = 1;
+	readySnapshot = 2;
+	snapshotChanged = false;
+
+	//No particles are constrained (the destructor still frees the array)
+	constraintParticles = NULL;
+	numConstraints = 0;
 	
 	
 	
@@ -117,7 +202,6 @@ ParticleSystem::ParticleSystem(Vertex * vertexList, int vertexCount, int * tetra
 	isAnimating = true;
 	renderMode = 1;
 	renderToImage = false;
-	frameNumber = 1;
 	timeSinceVideoWrite = 0.0;
 
 	
@@ -129,8 +213,6 @@ ParticleSystem::ParticleSystem(Vertex * vertexList, int vertexCount, int * tetra
 
 	windowWidth = windowHeight = 0;
 
-	system("del images\\*.tga");  //DOS command to remove all tga image files from previous executions of this program
-
 	#ifdef DEBUGGING
 	//logger -> loggingLevel = logger -> FULL;
 	if (logger -> isLogging)
@@ -199,8 +281,28 @@ ParticleSystem::ParticleSystem(Vertex * vertexList, int vertexCount, int * tetra
 	matShininess[0] = 10000;
 	
 	ambientMode = false;
+	lightingChanged = true;
+	meshVao = tetraFaceVao = floorVao = 0;
+	tetraFaceIndexCount = 0;
 	useRGBColor = false;
 	doUninvert = true;
+
+	useImplicit = false;
+	systemMatrix = NULL;
+	deltaV = NULL;
+	implicitRHS = NULL;
+	implicitDiagonal = NULL;
+	vertexTetraCounts = NULL;
+	cgTolerance = 1e-4;
+	cgMaxIterations = 200;
+
+	useAdaptiveTimeStep = false;
+	tetraStiffnessRates = NULL;
+	minRestAltitude = 0;
+	stableElasticStep = 0;
+
+	trajectoryWriter = NULL;
+	forceExchange = NULL;
 }
 
 //Destructor - free all memory for dynamically allocated arrays
@@ -209,15 +311,36 @@ ParticleSystem::~ParticleSystem()
 	
 
 	delete [] orgVertices;
-	delete [] defVertices;
 	delete [] constraintParticles;
 	
 	
-	delete [] massMatrix;
-	delete [] zeroVector;
-	delete [] currentForce;
-	delete [] screenBuffer;
-	delete [] screenRowTemp;
+	delete frameCapture;
+	delete trajectoryWriter;	//Finishes writing the queued records
+	delete gpuSimulator;
+	delete renderEmbedding;
+	delete collisionSystem;
+	delete selfCollision;
+	delete [] tetraColorOffsets;
+	delete [] colorBlockOffsets;
+	delete [] surfaceTriangleOffsets;
+	delete [] surfaceTriangles;
+	delete [] surfaceTriangleEnds;
+	delete [] surfaceTriangleLimits;
+	delete [] faceNormals;
+
+	delete systemMatrix;
+	alignedFree(deltaV);
+	alignedFree(implicitRHS);
+	alignedFree(implicitDiagonal);
+	delete [] vertexTetraCounts;
+	delete [] tetraStiffnessRates;
+	delete [] calmSteps;
+	delete [] vertexSleeping;
+	delete [] vertexMoving;
+	for (int i = 0; i < RENDER_SNAPSHOTS; i++)
+	{
+		alignedFree(renderSnapshots[i]);
+	}
 
 }
 
@@ -248,13 +371,16 @@ void ParticleSystem::reset()
 	{
 		for (int j = 0; j < DIMENSION; j++)
 		{
-			defVertices[i].position[j] = orgVertices[i].position[j];
-			//orgVertices[i].velocity[j] = defVertices[i].velocity[j] = (j == 0?3:0);
-			orgVertices[i].velocity[j] = defVertices[i].velocity[j] = (j == 0?0:0);
+			positions[j * numVertices + i] = orgVertices[i].position[j];
+			//orgVertices[i].velocity[j] = velocities[j * numVertices + i] = (j == 0?3:0);
+			orgVertices[i].velocity[j] = velocities[j * numVertices + i] = (j == 0?0:0);
 		}
 	}
 
 	doTransform();
+	gpuStateCurrent = false;	//Uploaded again by the next GPU step
+	wakeAll();
+	resetWarmStart();
 
 }
 
@@ -262,6 +388,9 @@ void ParticleSystem::reset()
 // This allows easy testing of the uninversion functionality
 void ParticleSystem::invertTetra()
 {
+	leaveGpuState();
+	wakeAll();
+	resetWarmStart();
 	
 	double scaleFactor = -1;
 	double scaleTransform[3][3] = {{scaleFactor, 0, 0}, {0, scaleFactor, 0}, {0, 0, scaleFactor}};
@@ -279,7 +408,7 @@ void ParticleSystem::invertTetra()
 			temp[i * numVertices + j] = 0;																				
 			for (int k = 0; k < 3; k++) //current col in left matrix and row in right matrix for summing
 			{																									
-				temp[i * numVertices + j] += scaleTransform[i][k] * defVertices[j].position[k];											
+				temp[i * numVertices + j] += scaleTransform[i][k] * positions[k * numVertices + j];											
 			}																									
 																												
 		}																										
@@ -290,571 +419,1962 @@ void ParticleSystem::invertTetra()
 	{
 		for (int j = 0; j < numVertices; j++)
 		{
-			defVertices[j].position[i] = temp[i * numVertices + j];
+			positions[i * numVertices + j] = temp[i * numVertices + j];
 		}
 	}
 
 	delete [] temp;
 }
 
-//Update Method - Implements one time step for the animation
-//Uses hooke's law with implicit methods to construct matrix A and vector b then calls the conjugate gradient method to find deltaV
-//This is then used to update the particle velocities and in turn the positions
-//Parameter - deltaT - Amount of time elapsed to use in integrating.  Type double. 
-void ParticleSystem::doUpdate(double deltaT)
-{
-	
-}
-
-//Implement collision detection against the floor and collison response
-void ParticleSystem::doCollisionDetectionAndResponse(double deltaT)
+//Splits the tetrahedra into colors such that no two tetrahedra of the same color share a vertex
+//Each color can then be processed in parallel with a plain += scatter into currentForce and no races.
+//Greedy coloring in tetrahedron order, choosing the least used admissible color so the colors stay balanced.
+//tetraList is then renumbered so each color is a contiguous range of tetrahedra; this keeps the per tetrahedron data
+//precomputed by the derived classes contiguous in the order it is processed.
+//The result depends only on the mesh, so the force summation order (and therefore the simulation) is deterministic for any thread count.
+void ParticleSystem::buildTetraColoring()
 {
-	//for k = 1:size(defVertices,2)
-	for (int i = 0; i < numVertices; i++)
-		{
-			//if defVertices(2,k) < floor
-			///if (defVertices[i].position[1] < 1)  //TEMP HACK
-			if (defVertices[i].position[1] < -4)
-			{
-				#ifdef DEBUGGING
-				if (logger -> isLogging)
-				{
-					logger ->printVelocitiesAndPositions(defVertices,numVertices,"Positions during collision response", "Velocities", logger->MEDIUM);
-				}
-				#endif
-				
-				//%Linear impulse based on: http://gafferongames.com/virtualgo/collision-response-and-coulomb-friction/
-				//j = max(-(1 + restitution) * dot(inVelocities(:,k), [0 1 0]'), 0); %Magnitude of reaction force without rotational inertia
-
-				double verticalNormal[3] = {0, 1, 0};
-
-				double dotProduct = 0;
-				for (int j = 0; j < DIMENSION; j++)
-				{
-					dotProduct += defVertices[i].velocity[j] * verticalNormal[j];
-				}
-				
-				double jr = -(1 + restitution) * dotProduct;
-				if (jr < 0)
-				{
-					jr = 0;
-				}
-
-				#ifdef DEBUGGING
-				if (logger -> isLogging)
-				{
-					cout << "jr is: " << jr << endl;
-				}
-				#endif
-
-				//Static / Dynamic Friction based on Gravitas: An extensible physics engine framework using object- oriented and design pattern-driven software architecture principles, by Colin Vella
-				//https://drive.google.com/file/d/0Bze6mKYvrpOKYjdkODVhMTAtM2Q4Zi00NzgyLWE2YzMtN2MwZmQ4NjA3OWMw/view?ddrp=1&pli=1&hl=en
-
-				//js = us * j;
-				//jd = ud * j;
-				double js = us * jr;
-				double jd = ud * jr;
-                
-				//tangent = inVelocities(:,k) - dot(inVelocities(:,k), [0 1 0]') * [0 1 0]';
-				double tangent[3];
-				double magnitude = 0; //This is the magnitude of the tangent vector
-				for (int j = 0; j < DIMENSION; j++)
-				{
-					tangent[j] = defVertices[i].velocity[j] - dotProduct * verticalNormal[j];
-					magnitude += tangent[j] * tangent[j];
-				}
-				magnitude = sqrt(magnitude);
-
-				//if norm(tangent) ~= 0 && dot(inVelocities(:,k),[0 1 0]' ~= 0);
-				//	tangent = tangent / norm(tangent);       
-				//else %Note: decided to omit the "sum of external forces" case for now - just setting it to zero in this case
-				//	tangent = [0 0 0]'; %Being really explicit in the code for now
-				//end
-				if (magnitude > epsilon && abs(dotProduct) > epsilon) //STABILITY FIX - dot product check
-				{
-					for (int j = 0; j < DIMENSION; j++)
-					{
-						tangent[j] /= magnitude;
-					}
-				}
-				else //Precision problem - magnitude rounded to zero.  We cannot normalize the vector with it, or we'll get division by zero.
-				{
-					tangent[0] = 0;		//STABILITY FIX - 0 vector instead of 1 0 0 vector
-					tangent[1] = 0;
-					tangent[2] = 0;
-				}
-
-				#ifdef DEBUGGING
-				if (logger -> isLogging)
-				{
-					cout << "Tangent vector is: " << endl;
-					for (int j = 0; j < DIMENSION; j++)
-					{
-						cout << tangent[j] << " ";
-					}
-					cout << endl;
-				}
-				#endif
-				     
-				double dotProduct2 = 0; //This is the dot product of the velocity and the tangent vectors
-				for (int j = 0; j < DIMENSION; j++)
-				{
-					dotProduct2 += defVertices[i].velocity[j] * tangent[j];
-				}
-
-				//if dot(inVelocities(:,k),tangent) == 0 && dot(inVelocities(:,k),tangent) <= js
-				//	jf =  -(dot(inVelocities(:,k), tangent)) * tangent;
-				//else
-				//	jf = -jd * tangent;
-				//end
-				double jf[3];
-				if (abs(dotProduct2) < epsilon && dotProduct2 <= js) //STABILITY FIX - changed || to &&
-				{
-					for (int j = 0; j < DIMENSION; j++)
-					{
-						jf[j] = -dotProduct2 * tangent[j];
-					}
-				}
-				else
-				{
-					for (int j = 0; j < DIMENSION; j++)
-					{
-						jf[j] = -jd * tangent[j];
-					}
-				}
-
-				#ifdef DEBUGGING
-				if (logger -> isLogging)
-				{
-					cout << "jf:" << endl;
-					for (int j = 0; j < DIMENSION; j++)
-					{
-						cout << jf[j] << " ";
-					}
-					cout << endl;
-			    }
-				#endif
-        
-				//inVelocities(:,k) = inVelocities(:,k) + j * [0 1 0]' + jf; %Apply instantaneous reaction impulse force
-				//defVertices(:,k) = defVertices(:,k) + (j * [0 1 0]' + jf) * elapsedTime;
-				for (int j = 0; j < DIMENSION; j++)
-				{
-					defVertices[i].velocity[j] += jr * verticalNormal[j] + jf[j];
-					defVertices[i].position[j] += (jr * verticalNormal[j] + jf[j]) * deltaT;
-				}
-
-				#ifdef DEBUGGING
-				if (logger -> isLogging)
-				{
-					cout << "Final positions/velocities for your viewing pleasure..." << endl;
-					logger ->printVelocitiesAndPositions(defVertices,numVertices,"Positions after collision response", "Velocities", logger->LIGHT);
-				}
-				#endif
-			}
-		//end
-		} 
+	//Vertex to tetrahedron adjacency in compressed row form
+	int * vertexTetraOffsets = new int[numVertices + 1];
+	int * vertexTetra = new int[4 * numTetra];
+	int * tetraColors = new int[numTetra];
 
+	for (int i = 0; i <= numVertices; i++)
+	{
+		vertexTetraOffsets[i] = 0;
+	}
 
-}
+	for (int i = 0; i < 4 * numTetra; i++)
+	{
+		vertexTetraOffsets[tetraList[i] + 1]++;
+	}
 
-//This method uses the SVD to uninvert F based on the paper by Fedkiw et al
-//F is the matrix representing the change in the deformed vertices versus the original vertices
-//Algorithm is based directly on the paper at: http://physbam.stanford.edu/~fedkiw/papers/stanford2004-04.pdf
-void ParticleSystem::uninvertF( double * F)
-{
-	if (!doUninvert) //Guarantee any caller checks the setting
+	for (int i = 0; i < numVertices; i++)
 	{
-		return;
+		vertexTetraOffsets[i + 1] += vertexTetraOffsets[i];
 	}
 
-	static int numTimes = 1;
+	int * fillPosition = new int[numVertices];
+	for (int i = 0; i < numVertices; i++)
+	{
+		fillPosition[i] = vertexTetraOffsets[i];
+	}
 
-	#ifdef DEBUGGING
-	if (logger -> isLogging && logger ->loggingLevel >= logger ->MEDIUM)
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
 	{
-		cout << "F:" << endl;
-		for (int i = 0; i < 3; i++)
+		for (int k = 0; k < 4; k++)
 		{
-			for (int j = 0; j < 3; j++)
-			{
-				cout << F[i * 3 + j] << " ";
-			}
-			cout << endl;
+			int vertex = tetraList[k * numTetra + currentTetrad];
+			vertexTetra[fillPosition[vertex]++] = currentTetrad;
 		}
 	}
-	#endif
 
+	delete [] fillPosition;
+
+	vector<int> colorCounts;	//Number of tetrahedra given each color so far
+	vector<int> colorMarks;		//colorMarks[c] == currentTetrad if color c is used by a neighbor of currentTetrad
 	
-	double determinantF = determinant3By3SingleIndex(F);
-	if (determinantF < 0)
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
 	{
-		//cout << "Inverted tetrahedron -- determinant of F is less than 0" << endl;
-						
-		//Step 1: establish U, V, and W matrices to find the SVD
-		float ** U = new float * [4];  //4 x 4 matrices to allow numerical recipes code to use 1 based indices
-		float ** V = new float * [4];
-		float * W = new float[4];
-
-		//Get everything allocated and initialized to zero for U, V, and W
-		for (int i = 0; i < 4; i++)
-		{
-			U[i] = new float[4];  
-			V[i] = new float[4];
-			W[i] = 0;
-		
-			U[i][0] = 0;
-			V[i][0] = 0;
-
-			for (int j = 0; j < 4; j++)
-			{
-				U[i][j] = 0;  
-				V[i][j] = 0;
-
-			}
-		
-		}
-
-		for (int i = 0; i < 3; i++)
+		//Mark the colors of all previously colored neighbors (tetrahedra sharing a vertex)
+		for (int k = 0; k < 4; k++)
 		{
-			for (int j = 0; j < 3; j++)
+			int vertex = tetraList[k * numTetra + currentTetrad];
+			for (int j = vertexTetraOffsets[vertex]; j < vertexTetraOffsets[vertex + 1]; j++)
 			{
-				U[i+1][j+1] = F[i * DIMENSION + j];  //U starts out equal to F; offset by one because the svd code uses indexes starting by 1
-			}	
+				int neighbor = vertexTetra[j];
+				if (neighbor < currentTetrad)
+				{
+					colorMarks[tetraColors[neighbor]] = currentTetrad;
+				}
+			}
 		}
 
-		#ifdef DEBUGGING
-		if (logger -> isLogging && logger ->loggingLevel >= logger ->MEDIUM)
+		int chosenColor = -1;
+		for (int c = 0; c < (int)colorCounts.size(); c++)
 		{
-			cout << "U:" << endl;
-			for (int i = 0; i <= 3; i++)
+			if (colorMarks[c] != currentTetrad && (chosenColor == -1 || colorCounts[c] < colorCounts[chosenColor]))
 			{
-				for (int j = 0; j <= 3; j++)
-				{
-					cout << U[i][j] << " ";
-
-				}
-				cout << endl;
+				chosenColor = c;
 			}
-
-			cout << "num times is " << numTimes << endl;
 		}
-		#endif
-			
-		//Step 2: find the svd of F
-		svdcmp(U, 3, 3, W, V);
 
-		#ifdef DEBUGGING
-		if (logger -> isLogging && logger ->loggingLevel >= logger ->MEDIUM)
+		if (chosenColor == -1)
 		{
-			cout << "SVD for F:" << endl;
-			cout << "U:" << endl;
-			for (int i = 0; i <= 3; i++)
-			{
-				for (int j = 0; j <= 3; j++)
-				{
-					cout << U[i][j] << " ";
+			chosenColor = colorCounts.size();
+			colorCounts.push_back(0);
+			colorMarks.push_back(-1);
+		}
 
-				}
-				cout << endl;
-			}
+		tetraColors[currentTetrad] = chosenColor;
+		colorCounts[chosenColor]++;
+	}
 
-			cout << "W:" << endl;
-			for (int i = 0; i <= 3; i++)
-			{
-				cout << W[i] << " ";
-			}
-			cout << endl;
+	//Counting sort of the tetrahedra by color
+	numTetraColors = colorCounts.size();
+	tetraColorOffsets = new int[numTetraColors + 1];
+	int * coloredTetra = new int[4 * numTetra];
 
-			cout << "V:" << endl;
-			for (int i = 0; i <= 3; i++)
-			{
-				for (int j = 0; j <= 3; j++)
-				{
-					cout << V[i][j] << " ";
+	tetraColorOffsets[0] = 0;
+	for (int c = 0; c < numTetraColors; c++)
+	{
+		tetraColorOffsets[c + 1] = tetraColorOffsets[c] + colorCounts[c];
+		colorCounts[c] = tetraColorOffsets[c];
+	}
 
-				}
-				cout << endl;
-			}
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+	{
+		int newIndex = colorCounts[tetraColors[currentTetrad]]++;
+		for (int k = 0; k < 4; k++)
+		{
+			coloredTetra[k * numTetra + newIndex] = tetraList[k * numTetra + currentTetrad];
 		}
-		#endif
+	}
 
-			
-		//Step 3: Find the min value in W
-		//If the determinant of U is less than 0 (which it should be if it got here),
-		//negate that column in U, W, and V
-		//This is the essence of uninversion
+	for (int i = 0; i < 4 * numTetra; i++)
+	{
+		tetraList[i] = coloredTetra[i];
+	}
 
-		//Find the min value in diagonal matrix W
-		int minIndex = 1; //Index of the min value
-		for (int i = 2; i <=3; i++)
-		{
-			if (W[i] < W[minIndex])
-			{
-				minIndex = i;
-			}
+	delete [] coloredTetra;
+	delete [] vertexTetraOffsets;
+	delete [] vertexTetra;
+	delete [] tetraColors;
 
-		}
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Tetrahedra grouped into " << numTetraColors << " colors" << endl;
+	}
+	#endif
+}
 
-		//Negate that column in U, V, and W
-		if (determinant3By3OneBasedIndices(U) < 0)
-		{
-			for (int i = 1; i <= 3; i++)
-			{
-				U[i][minIndex] = -U[i][minIndex];
-			}
-			W[minIndex] = -W[minIndex];
+//Splits every color into blocks of FORCE_BLOCK_WIDTH consecutive tetrahedra for the SIMD force kernels (see computeBlockForces)
+//Tetrahedra left over at the end of a color are handled one at a time.
+void ParticleSystem::buildForceBlocks()
+{
+	colorBlockOffsets = new int[numTetraColors + 1];
+	numForceBlocks = 0;
+	for (int color = 0; color < numTetraColors; color++)
+	{
+		colorBlockOffsets[color] = numForceBlocks;
+		numForceBlocks += (tetraColorOffsets[color + 1] - tetraColorOffsets[color]) / FORCE_BLOCK_WIDTH;
+	}
+	colorBlockOffsets[numTetraColors] = numForceBlocks;
+}
 
-			for (int i = 1; i <= 3; i++)
-			{
-				V[i][minIndex] = -V[i][minIndex];
-	        }
-		}
+//The per body arrays come from arena and are zeroed here by the threads that later work on them, so that with the static
+//schedules of integrate and computeForces each thread's part of an array is first touched (and placed) on its own NUMA node.
 
-		//Final copies of U, V, and W that will be used to mutltiply the matrices back together
-		//and reform F
-		double lastU[3][3];
-		double lastW[3][3];
-		double lastV[3][3];
-		for (int i = 0; i < 3; i++)
+//Returns bytes from arena for the helpers below - throws bad_alloc, as new [] would, if the system is out of memory
+void * ParticleSystem::allocateArenaBytes(size_t bytes)
+{
+	void * memory = arena.allocateBytes(bytes);
+	if (memory == NULL)
+	{
+		cerr << "Out of memory allocating " << bytes << " bytes of mesh arrays (" << arena.getAllocatedBytes() << " allocated in " <<
+			arena.getChunkCount() << " chunks)" << endl;
+		throw bad_alloc();
+	}
+	return memory;
+}
+
+//Returns a zeroed per vertex array: value j of vertex i in stripe s is array[(s * numVertices + i) * valuesPerVertex + j]
+//(positions and the other vectors of the solvers are DIMENSION stripes of 1 value; a per vertex record is 1 stripe)
+double * ParticleSystem::allocateVertexArray(int valuesPerVertex, int stripes)
+{
+	double * array = (double *) allocateArenaBytes(sizeof(double) * stripes * numVertices * valuesPerVertex);
+
+	#pragma omp parallel num_threads(numThreads)
+	for (int s = 0; s < stripes; s++)
+	{
+		#pragma omp for schedule(static) nowait
+		for (int i = 0; i < numVertices; i++)
 		{
-			for (int j = 0; j < 3; j++)
+			for (int j = 0; j < valuesPerVertex; j++)
 			{
-				lastU[i][j] = U[i+1][j+1];
-				lastV[i][j] = V[j+1][i+1];  //Transposed
+				array[((size_t) s * numVertices + i) * valuesPerVertex + j] = 0;
 			}
 		}
+	}
+	return array;
+}
 
-		lastW[0][0] = W[1];  lastW[0][1] = 0;     lastW[0][2] = 0;
-		lastW[1][0] = 0;     lastW[1][1] = W[2];  lastW[1][2] = 0;
-		lastW[2][0] = 0;     lastW[2][1] = 0;     lastW[2][2] = W[3];
-
-		#ifdef DEBUGGING
-		if (logger -> isLogging && logger ->loggingLevel >= logger ->MEDIUM)
-		{
-			cout << "CORRECTED SVD for F:" << endl;
-			cout << "U:" << endl;
-			for (int i = 0; i <= 3; i++)
-			{
-				for (int j = 0; j <= 3; j++)
-				{
-					cout << lastU[i][j] << " ";
+//Returns numVertices default constructed Vertex structs (never destroyed - Vertex has no destructor)
+Vertex * ParticleSystem::allocateVertices()
+{
+	Vertex * vertices = (Vertex *) allocateArenaBytes(sizeof(Vertex) * numVertices);
 
-				}
-				cout << endl;
-			}
+	#pragma omp parallel for num_threads(numThreads) schedule(static)
+	for (int i = 0; i < numVertices; i++)
+	{
+		new (&vertices[i]) Vertex();
+	}
+	return vertices;
+}
 
-			cout << "W:" << endl;
-			for (int i = 0; i <= 3; i++)
-			{
-				for (int j = 0; j <= 3; j++)
-				{
-					cout << lastW[i][j] << " ";
+//Returns a zeroed per tetrahedron array: value j of tetrahedron t in stripe s is array[(s * numTetra + t) * valuesPerTetra + j]
+//Needs the coloring and the force blocks - each block is touched by the thread computeForces gives it.
+double * ParticleSystem::allocateTetraArray(int valuesPerTetra, int stripes)
+{
+	double * array = (double *) allocateArenaBytes(sizeof(double) * stripes * numTetra * valuesPerTetra);
 
-				}
-				cout << endl;
-			}
+	#pragma omp parallel num_threads(numThreads)
+	for (int color = 0; color < numTetraColors; color++)
+	{
+		int firstTetrad = tetraColorOffsets[color];
+		int firstBlock = colorBlockOffsets[color];
 
-			cout << "V:" << endl;
-			for (int i = 0; i <= 3; i++)
+		#pragma omp for schedule(static) nowait
+		for (int block = firstBlock; block < colorBlockOffsets[color + 1]; block++)
+		{
+			int blockStart = firstTetrad + (block - firstBlock) * FORCE_BLOCK_WIDTH;
+			for (int s = 0; s < stripes; s++)
 			{
-				for (int j = 0; j <= 3; j++)
-				{
-					cout << lastV[i][j] << " ";
-
-				}
-				cout << endl;
+				memset(&array[((size_t) s * numTetra + blockStart) * valuesPerTetra], 0, sizeof(double) * FORCE_BLOCK_WIDTH * valuesPerTetra);
 			}
 		}
-		#endif
-
-		//F = U * W * V
-		double uTimesW[3][3];
-		multiplyMatricesATimesB(uTimesW, lastU, 3, 3, lastW, 3, 3);
 
-		double finalF[3][3];
-		multiplyMatricesATimesB(finalF, uTimesW, 3, 3, lastV, 3, 3);
-
-		for (int i = 0; i < 3; i++)
+		int tailStart = firstTetrad + (colorBlockOffsets[color + 1] - firstBlock) * FORCE_BLOCK_WIDTH;
+		#pragma omp for schedule(static)
+		for (int currentTetrad = tailStart; currentTetrad < tetraColorOffsets[color + 1]; currentTetrad++)
 		{
-			for (int j = 0; j < 3; j++)
+			for (int s = 0; s < stripes; s++)
 			{
-				F[i * DIMENSION + j] = finalF[i][j];
+				memset(&array[((size_t) s * numTetra + currentTetrad) * valuesPerTetra], 0, sizeof(double) * valuesPerTetra);
 			}
 		}
+	}
+	return array;
+}
 
-		//Find the determinant of F and check it to make sure we actually uninverted the tetrahedra
-		double determinantF = determinant3By3SingleIndex(F);
-		
-		if (determinantF < 0)
-		{
-			cout << "bad det - uninversion algorithm did not work correctly" << endl;
-		}
+//Returns a zeroed array of valuesPerBlock SIMD vectors per force block (the repacked rest state of the SIMD kernels):
+//array[(block * valuesPerBlock + k) * FORCE_BLOCK_WIDTH + lane]
+ForceReal * ParticleSystem::allocateBlockArray(int valuesPerBlock)
+{
+	ForceReal * array = (ForceReal *) allocateArenaBytes(sizeof(ForceReal) * numForceBlocks * valuesPerBlock * FORCE_BLOCK_WIDTH);
 
-		for (int i = 0; i < 4; i++)
+	#pragma omp parallel num_threads(numThreads)
+	for (int color = 0; color < numTetraColors; color++)
+	{
+		#pragma omp for schedule(static)
+		for (int block = colorBlockOffsets[color]; block < colorBlockOffsets[color + 1]; block++)
 		{
-			delete [] U[i];
-			delete [] V[i];
+			memset(&array[(size_t) block * valuesPerBlock * FORCE_BLOCK_WIDTH], 0, sizeof(ForceReal) * valuesPerBlock * FORCE_BLOCK_WIDTH);
 		}
-
-		delete [] U;
-		delete [] V;
-		delete [] W;
-
-	} //if det F < 0...
-	
-	numTimes++;
-
+	}
+	return array;
 }
 
-////Method to calculate the normals used for lighting
-////Note that since the cross product is only defined in 3 dimensions, this method only works properly for 3 dimensions
-void ParticleSystem::calculateNormals()
+//One triangular face of a tetrahedron, identified by its sorted vertex indices (see buildSurface)
+struct TetraFace
 {
-//	//Cross product and this function only work if DIMENSION == 3
-//
-	double vectorDifferenceA[DIMENSION];  //1st vector formed for each cross product
-	double vectorDifferenceB[DIMENSION];  //2nd vector formed for each cross product
-	double crossProductResult[DIMENSION]; //Holds the result of a cross product from the macro
+	int sortedVertices[3];
+	int currentTetrad;
+	int face;
 
-	//Initialize items to 0
-	for (int i = 0; i < numVertices; i++)
+	bool operator < (const TetraFace & other) const
 	{
-		for (int j = 0; j < DIMENSION; j++)
+		for (int k = 0; k < 3; k++)
 		{
-			normals[numVertices * j + i] = 0;
-			defVertices[i].vertexNormal[j] = 0;
+			if (sortedVertices[k] != other.sortedVertices[k])
+			{
+				return sortedVertices[k] < other.sortedVertices[k];
+			}
 		}
-		tetraCounts[i] = 0;
+		return false;
 	}
 
-	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+	bool sameFace(const TetraFace & other) const
 	{
-		for (int i = 0; i < DIMENSION; i++)
-		{
-			vectorDifferenceA[i] = defVertices[tetraList[3 * numTetra + currentTetrad]].position[i] - defVertices[tetraList[1 * numTetra + currentTetrad]].position[i];
-			vectorDifferenceB[i] = defVertices[tetraList[1 * numTetra + currentTetrad]].position[i] - defVertices[tetraList[0 * numTetra + currentTetrad]].position[i];
-		}
-
-		//crossProductGeneral(crossProductResult, vectorDifferenceA, vectorDifferenceB);
-		crossProductGeneral(crossProductResult, vectorDifferenceA, vectorDifferenceB);
+		return sortedVertices[0] == other.sortedVertices[0] && sortedVertices[1] == other.sortedVertices[1] && sortedVertices[2] == other.sortedVertices[2];
+	}
+};
 
-		for (int i = 0; i < DIMENSION; i++)
-		{
-			defVertices[tetraList[3 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			defVertices[tetraList[1 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			defVertices[tetraList[0 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[3 * numTetra + currentTetrad]] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[1 * numTetra + currentTetrad]] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[0 * numTetra + currentTetrad]] += crossProductResult[i];
-		}
-		tetraCounts[tetraList[3 * numTetra + currentTetrad]]++;
-		tetraCounts[tetraList[1 * numTetra + currentTetrad]]++;
-		tetraCounts[tetraList[0 * numTetra + currentTetrad]]++;
+//Extracts the boundary surface of the mesh into indices (counter clockwise triangles) - done once, from the mesh at construction
+//Also builds the vertex to surface triangle adjacency calculateNormals gathers through (see buildVertexTriangles).
+//A method that changes the topology (fracture) reserves room beyond this surface with reserveSurfaceChanges and then edits it
+//in place with makeSurfaceRoom, addSurfaceTriangle and moveSurfaceTriangle, which are never followed by another buildSurface.
+void ParticleSystem::buildSurface()
+{
+	findSurfaceTriangles(tetraList, numTetra, indices);
 
-		//glVertex3f(defVertices[tetraList[3 * numTetra + i]].position[0], defVertices[tetraList[3 * numTetra + i]].position[1], defVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
-		//glVertex3f(defVertices[tetraList[1 * numTetra + i]].position[0], defVertices[tetraList[1 * numTetra + i]].position[1], defVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-		//glVertex3f(defVertices[tetraList[0 * numTetra + i]].position[0], defVertices[tetraList[0 * numTetra + i]].position[1], defVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
-		
-		for (int i = 0; i < DIMENSION; i++)
-		{
-			vectorDifferenceA[i] = defVertices[tetraList[2 * numTetra + currentTetrad]].position[i] - defVertices[tetraList[1 * numTetra + currentTetrad]].position[i];
-			vectorDifferenceB[i] = defVertices[tetraList[1 * numTetra + currentTetrad]].position[i] - defVertices[tetraList[3 * numTetra + currentTetrad]].position[i];
-		}
+	int numSurfaceTriangles = indices.size() / 3;
+	buildVertexTriangles(indices, numVertices, surfaceTriangleOffsets, surfaceTriangles);
+	faceNormals = new double[DIMENSION * numSurfaceTriangles];
+	surfaceTriangleEnds = NULL;
+	surfaceTriangleLimits = NULL;
+	vertexTriangleCapacity = vertexTriangleFill = surfaceTriangleOffsets[numVertices];
+	surfaceTriangleCapacity = numSurfaceTriangles;
+	changedTrianglesBegin = changedTrianglesEnd = 0;
 
-		//crossProductGeneral(crossProductResult, vectorDifferenceA, vectorDifferenceB);
-		crossProductGeneral(crossProductResult, vectorDifferenceA, vectorDifferenceB);
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Surface has " << indices.size() / 3 << " of " << 4 * numTetra << " tetrahedron faces" << endl;
+	}
+	#endif
+}
+
+//Makes room for surface triangles added after construction, for a deformation method that changes the mesh topology (fracture)
+//Nothing is reallocated after this: the triangles go into the spare room of indices, faceNormals and the index buffer, and
+//the vertex to triangle entries of a vertex that outgrows its room move to the unused end of surfaceTriangles.  Call it
+//before initVBOs, and not with GPU simulation (the GPU keeps the surface of buildSurface).
+//Parameter extraTriangles - surface triangles that may be added with addSurfaceTriangle
+//Parameter extraVertexTriangles - vertex to triangle entries the vertices may move to the end of surfaceTriangles
+void ParticleSystem::reserveSurfaceChanges(int extraTriangles, int extraVertexTriangles)
+{
+	int numSurfaceTriangles = indices.size() / 3;
+	surfaceTriangleCapacity = numSurfaceTriangles + extraTriangles;
+	indices.reserve(3 * surfaceTriangleCapacity);
+	delete [] faceNormals;
+	faceNormals = new double[DIMENSION * surfaceTriangleCapacity];
+
+	vertexTriangleCapacity = surfaceTriangleOffsets[numVertices] + extraVertexTriangles;
+	int * vertexTriangles = new int[vertexTriangleCapacity];
+	memcpy(vertexTriangles, surfaceTriangles, sizeof(int) * surfaceTriangleOffsets[numVertices]);
+	delete [] surfaceTriangles;
+	surfaceTriangles = vertexTriangles;
+
+	surfaceTriangleEnds = new int[numVertices];
+	surfaceTriangleLimits = new int[numVertices];
+	for (int i = 0; i < numVertices; i++)
+	{
+		surfaceTriangleEnds[i] = surfaceTriangleLimits[i] = surfaceTriangleOffsets[i + 1];
+	}
+}
+
+//Makes sure extraTriangles more surface triangles can be added to vertex, moving its entries to the end of surfaceTriangles if needed
+//Returns false if the room reserved by reserveSurfaceChanges has run out (nothing is changed then)
+bool ParticleSystem::makeSurfaceRoom(int vertex, int extraTriangles)
+{
+	if (surfaceTriangleEnds[vertex] + extraTriangles <= surfaceTriangleLimits[vertex])
+	{
+		return true;
+	}
+
+	//Twice the room needed, so a vertex on a growing crack moves a logarithmic number of times
+	int count = surfaceTriangleEnds[vertex] - surfaceTriangleOffsets[vertex];
+	int room = 2 * (count + extraTriangles);
+	if (vertexTriangleFill + room > vertexTriangleCapacity)
+	{
+		return false;
+	}
+
+	memmove(&surfaceTriangles[vertexTriangleFill], &surfaceTriangles[surfaceTriangleOffsets[vertex]], sizeof(int) * count);
+	surfaceTriangleOffsets[vertex] = vertexTriangleFill;
+	surfaceTriangleEnds[vertex] = vertexTriangleFill + count;
+	surfaceTriangleLimits[vertex] = vertexTriangleFill + room;
+	vertexTriangleFill += room;
+	return true;
+}
+
+//Adds a surface triangle (counter clockwise seen from outside) - the room for it must have been made with makeSurfaceRoom for each vertex
+//Returns the new triangle
+int ParticleSystem::addSurfaceTriangle(int vertex0, int vertex1, int vertex2)
+{
+	int triangle = indices.size() / 3;
+	assert(triangle < surfaceTriangleCapacity);
+	indices.push_back(vertex0);
+	indices.push_back(vertex1);
+	indices.push_back(vertex2);
+	addVertexTriangle(vertex0, triangle);
+	addVertexTriangle(vertex1, triangle);
+	addVertexTriangle(vertex2, triangle);
+
+	markTriangleChanged(triangle);
+	dropSelfCollision();
+	return triangle;
+}
+
+//Replaces oldVertex of a surface triangle with newVertex (room for one more triangle must have been made for newVertex)
+void ParticleSystem::moveSurfaceTriangle(int triangle, int oldVertex, int newVertex)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		if (indices[triangle * 3 + k] == oldVertex)
+		{
+			indices[triangle * 3 + k] = newVertex;
+		}
+	}
+
+	//The order of a vertex's entries does not matter, so the last one fills the gap
+	for (int k = surfaceTriangleOffsets[oldVertex]; k < surfaceTriangleEnds[oldVertex]; k++)
+	{
+		if (surfaceTriangles[k] == triangle)
+		{
+			surfaceTriangles[k] = surfaceTriangles[--surfaceTriangleEnds[oldVertex]];
+			break;
+		}
+	}
+	addVertexTriangle(newVertex, triangle);
+	markTriangleChanged(triangle);
+	dropSelfCollision();
+}
+
+//SelfCollision keeps its own copy of the surface, so a surface change drops it; it is built again from the changed surface
+//(and the current positions) the next time it is used
+void ParticleSystem::dropSelfCollision()
+{
+	delete selfCollision;
+	selfCollision = NULL;
+}
+
+//Adds an entry for triangle to the vertex's surface triangles; a vertex that was inside the mesh becomes a collision surface vertex
+void ParticleSystem::addVertexTriangle(int vertex, int triangle)
+{
+	if (surfaceTriangleEnds[vertex] == surfaceTriangleOffsets[vertex])
+	{
+		collisionSystem -> addSurfaceVertex(vertex);
+	}
+	surfaceTriangles[surfaceTriangleEnds[vertex]++] = triangle;
+}
+
+//Widens the range of surface triangles uploadMeshChanges sends to the index buffer
+void ParticleSystem::markTriangleChanged(int triangle)
+{
+	changedTrianglesBegin = changedTrianglesBegin < changedTrianglesEnd ? min(changedTrianglesBegin, triangle) : triangle;
+	changedTrianglesEnd = max(changedTrianglesEnd, triangle + 1);
+}
+
+//Fills triangleIndices with the boundary faces of a tetrahedral mesh (tetraList in the [k * tetraCount + tetrahedron] layout)
+//A face shared by two tetrahedra is inside the mesh and can never be seen, so only faces that belong to a single tetrahedron are kept.
+void ParticleSystem::findSurfaceTriangles(const int * tetraList, int tetraCount, vector<int> & triangleIndices)
+{
+	//Vertices of the 4 faces of a tetrahedron with counter clockwise winding
+	const int faceVertices[4][3] = {{3, 1, 0}, {2, 1, 3}, {2, 3, 0}, {0, 1, 2}};
+
+	//Sorting puts the two copies of every interior face next to each other
+	vector<TetraFace> faces(4 * tetraCount);
+	for (int currentTetrad = 0; currentTetrad < tetraCount; currentTetrad++)
+	{
+		for (int face = 0; face < 4; face++)
+		{
+			TetraFace & tetraFace = faces[currentTetrad * 4 + face];
+			for (int k = 0; k < 3; k++)
+			{
+				tetraFace.sortedVertices[k] = tetraList[faceVertices[face][k] * tetraCount + currentTetrad];
+			}
+			sort(tetraFace.sortedVertices, tetraFace.sortedVertices + 3);
+			tetraFace.currentTetrad = currentTetrad;
+			tetraFace.face = face;
+		}
+	}
+	sort(faces.begin(), faces.end());
+
+	triangleIndices.clear();
+	for (int i = 0; i < (int) faces.size(); )
+	{
+		int j = i + 1;
+		while (j < (int) faces.size() && faces[j].sameFace(faces[i]))
+		{
+			j++;
+		}
+
+		if (j == i + 1)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				triangleIndices.push_back(tetraList[faceVertices[faces[i].face][k] * tetraCount + faces[i].currentTetrad]);
+			}
+		}
+
+		i = j;
+	}
+}
+
+//Vertex to triangle adjacency in compressed sparse row form, so vertex normals can be gathered per vertex without locking
+//Parameter offsets - receives the first entry in triangles of each vertex (vertexCount + 1 entries, allocated with new [])
+//Parameter triangles - receives the triangles (triangleIndices / 3) containing each vertex, grouped by vertex (new [] as well)
+void ParticleSystem::buildVertexTriangles(const vector<int> & triangleIndices, int vertexCount, int *& offsets, int *& triangles)
+{
+	int triangleCount = triangleIndices.size() / 3;
+	offsets = new int[vertexCount + 1];
+	triangles = new int[3 * triangleCount];
+	for (int i = 0; i <= vertexCount; i++)
+	{
+		offsets[i] = 0;
+	}
+	for (int i = 0; i < 3 * triangleCount; i++)
+	{
+		offsets[triangleIndices[i] + 1]++;
+	}
+	for (int i = 0; i < vertexCount; i++)
+	{
+		offsets[i + 1] += offsets[i];
+	}
+
+	int * fillPosition = new int[vertexCount];
+	for (int i = 0; i < vertexCount; i++)
+	{
+		fillPosition[i] = offsets[i];
+	}
+	for (int i = 0; i < 3 * triangleCount; i++)
+	{
+		triangles[fillPosition[triangleIndices[i]]++] = i / 3;
+	}
+	delete [] fillPosition;
+}
+
+//Sets the number of threads used for force assembly and integration
+//Parameter threadCount - number of threads (values below 1 are treated as 1)
+void ParticleSystem::setThreadCount(int threadCount)
+{
+	numThreads = threadCount < 1 ? 1 : threadCount;
+}
+
+//Clears the accumulated time of every TimingPhase
+void ParticleSystem::resetPhaseTimings()
+{
+	for (int phase = 0; phase < NUM_TIMING_PHASES; phase++)
+	{
+		phaseSeconds[phase] = 0;
+	}
+}
+
+//Sums of all position and velocity components - a cheap fingerprint of the simulation state for comparing runs
+void ParticleSystem::getStateSums(double & positionSum, double & velocitySum)
+{
+	downloadGpuState();
+	positionSum = 0;
+	velocitySum = 0;
+	for (int i = 0; i < DIMENSION * numVertices; i++)
+	{
+		positionSum += positions[i];
+		velocitySum += velocities[i];
+	}
+}
+
+//Fills one summary per body given to setBodyMaterials, in the order of their first vertices
+void ParticleSystem::getBodySummaries(vector<BodySummary> & summaries)
+{
+	downloadGpuState();
+	summaries.resize(bodyMaterials.size());
+	for (int b = 0; b < (int) bodyMaterials.size(); b++)
+	{
+		BodySummary & summary = summaries[b];
+		int firstVertex = bodyMaterials[b].firstVertex;
+		int lastVertex = firstVertex + bodyMaterials[b].vertexCount;
+		double mass = 0;
+		double maxSpeedSquared = 0;
+		summary.kineticEnergy = 0;
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			summary.centerOfMass[j] = 0;
+			summary.boundsMin[j] = numeric_limits<double>::max();
+			summary.boundsMax[j] = -numeric_limits<double>::max();
+		}
+
+		for (int i = firstVertex; i < lastVertex; i++)
+		{
+			double speedSquared = 0;
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				double position = positions[j * numVertices + i];
+				double velocity = velocities[j * numVertices + i];
+				summary.centerOfMass[j] += massMatrix[i] * position;
+				summary.boundsMin[j] = min(summary.boundsMin[j], position);
+				summary.boundsMax[j] = max(summary.boundsMax[j], position);
+				speedSquared += velocity * velocity;
+			}
+			mass += massMatrix[i];
+			maxSpeedSquared = max(maxSpeedSquared, speedSquared);
+			summary.kineticEnergy += 0.5 * massMatrix[i] * speedSquared;
+		}
+
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			summary.centerOfMass[j] /= max(mass, epsilon);
+		}
+		summary.maxSpeed = sqrt(maxSpeedSquared);
+		summary.gravity = bodyMaterials[b].hasGravity ? bodyMaterials[b].gravity : earthGravityValue;
+	}
+}
+
+//Starts streaming the state into a trajectory file every stepsPerRecord time steps (see TrajectoryWriter)
+//The trajectory can be played back with showTrajectoryRecord on the same mesh.
+//Returns false if the file could not be created
+bool ParticleSystem::startRecording(const char * fileName, int stepsPerRecord)
+{
+	if (trajectoryWriter == NULL)
+	{
+		trajectoryWriter = new TrajectoryWriter(logger);
+	}
+	trajectoryWriter -> stop();
+	return trajectoryWriter -> start(fileName, orgVertices, numVertices, stepsPerRecord);
+}
+
+//Finishes the trajectory being recorded (the queued records are written first)
+void ParticleSystem::stopRecording()
+{
+	if (trajectoryWriter != NULL)
+	{
+		trajectoryWriter -> stop();
+	}
+}
+
+//Hands the state to the trajectory writer if a record is due after the step just taken
+void ParticleSystem::recordTrajectory()
+{
+	if (trajectoryWriter == NULL || !trajectoryWriter -> isRecording() || getStepCount() % trajectoryWriter -> getStepsPerRecord() != 0)
+	{
+		return;
+	}
+
+	ProfileScope profileScope(logger -> profiler, "recordTrajectory");
+	downloadGpuState();
+	trajectoryWriter -> record(getStepCount(), positions, velocities);
+}
+
+//Replaces the state with a record of a trajectory, for playing back a recorded run without simulating it
+//The caller computes the normals (calculateNormals) before rendering, as after a time step.
+//Returns false (and leaves the state alone) if the record cannot be read
+bool ParticleSystem::showTrajectoryRecord(TrajectoryReader & reader, int record)
+{
+	leaveGpuState();
+	if (!reader.readRecord(record, positions, velocities))
+	{
+		return false;
+	}
+	iteration = reader.getRecordStep(record) + 1;
+	wakeAll();
+	resetWarmStart();
+	return true;
+}
+
+//Hash identifying the mesh a checkpoint belongs to - the method arrays are per tetrahedron, so the colored tetraList counts too
+unsigned long long ParticleSystem::getCheckpointHash()
+{
+	return hashBytes(tetraList, sizeof(int) * 4 * numTetra, hashRestPositions(orgVertices, numVertices));
+}
+
+void ParticleSystem::addCheckpointArrays(vector<CheckpointArray> & arrays)
+{
+	CheckpointArray positionArray = {positions, sizeof(double) * DIMENSION * numVertices};
+	CheckpointArray velocityArray = {velocities, sizeof(double) * DIMENSION * numVertices};
+	arrays.push_back(positionArray);
+	arrays.push_back(velocityArray);
+}
+
+//Writes the complete simulation state to fileName, so a run can later continue from it with loadCheckpoint
+//The state is saved exactly (no quantization), so a resumed run takes the same steps the original one did.
+//The constants and settings are not part of the state; a resumed run uses its own.
+bool ParticleSystem::saveCheckpoint(const char * fileName)
+{
+	if (!canCheckpoint())
+	{
+		cerr << "A fracturing mesh can not be checkpointed - not saving " << fileName << endl;
+		return false;
+	}
+	downloadGpuState();
+
+	vector<CheckpointArray> arrays;
+	addCheckpointArrays(arrays);
+	if (useSleeping && calmSteps != NULL)
+	{
+		CheckpointArray calmArray = {calmSteps, sizeof(int) * numVertices};
+		CheckpointArray sleepingArray = {vertexSleeping, sizeof(bool) * numVertices};
+		CheckpointArray movingArray = {vertexMoving, sizeof(bool) * numVertices};
+		arrays.push_back(calmArray);
+		arrays.push_back(sleepingArray);
+		arrays.push_back(movingArray);
+	}
+
+	CheckpointHeader header;
+	memset(&header, 0, sizeof(CheckpointHeader));
+	strcpy(header.magic, "TETCKPT");
+	header.version = CHECKPOINT_VERSION;
+	header.byteOrderMark = TRAJECTORY_BYTE_ORDER_MARK;
+	header.meshHash = getCheckpointHash();
+	header.vertexCount = numVertices;
+	header.tetraCount = numTetra;
+	header.arrayCount = min((int) arrays.size(), MAX_CHECKPOINT_ARRAYS);
+	header.hasSleepState = (useSleeping && calmSteps != NULL) ? 1 : 0;
+	header.stepCount = getStepCount();
+	header.sleepingVertexCount = sleepingVertexCount;
+	header.earthGravity = earthGravityValue;
+	unsigned long long checksum = hashBytes(NULL, 0);
+	for (int i = 0; i < header.arrayCount; i++)
+	{
+		header.arrayBytes[i] = arrays[i].bytes;
+		checksum = hashBytes(arrays[i].data, arrays[i].bytes, checksum);
+	}
+	header.checksum = checksum;
+
+	FILE * file = fopen(fileName, "wb");
+	if (file == NULL)
+	{
+		cerr << "Could not write checkpoint " << fileName << endl;
+		return false;
+	}
+
+	bool written = fwrite(&header, sizeof(CheckpointHeader), 1, file) == 1;
+	for (int i = 0; i < header.arrayCount && written; i++)
+	{
+		written = fwrite(arrays[i].data, 1, arrays[i].bytes, file) == arrays[i].bytes;
+	}
+	written = (fclose(file) == 0) && written;
+	if (!written)
+	{
+		remove(fileName);	//Never leave a partial checkpoint behind
+		cerr << "Could not write checkpoint " << fileName << endl;
+	}
+
+	#ifdef DEBUGGING
+	if (written && logger -> isLogging)
+	{
+		cout << "Saved the state of step " << header.stepCount << " to " << fileName << endl;
+	}
+	#endif
+
+	return written;
+}
+
+//Restores the state saved by saveCheckpoint, so the simulation continues from that step
+//The checkpoint must come from the same mesh and a method that carries the same state (any of the methods without warm
+//started state can load each other's checkpoints).  Its sleep state is only used if sleeping is on; otherwise, or if the
+//checkpoint has none, every vertex starts awake.
+//Returns false (and leaves the state alone) if the file is not a matching, intact checkpoint
+bool ParticleSystem::loadCheckpoint(const char * fileName)
+{
+	if (!canCheckpoint())
+	{
+		cerr << "A fracturing mesh can not be checkpointed - not resuming from " << fileName << endl;
+		return false;
+	}
+
+	MappedFile file;
+	if (!file.open(fileName) || file.getSize() < sizeof(CheckpointHeader))
+	{
+		cerr << "Could not read checkpoint " << fileName << endl;
+		return false;
+	}
+
+	vector<CheckpointArray> arrays;
+	addCheckpointArrays(arrays);
+	const CheckpointHeader * header = (const CheckpointHeader *) file.getData();
+	bool useSleepState = header -> hasSleepState != 0 && useSleeping && calmSteps != NULL;
+	size_t expectedSize = sizeof(CheckpointHeader);
+	bool valid = strcmp(header -> magic, "TETCKPT") == 0 && header -> version == CHECKPOINT_VERSION && header -> byteOrderMark == TRAJECTORY_BYTE_ORDER_MARK &&
+		header -> meshHash == getCheckpointHash() && header -> vertexCount == numVertices && header -> tetraCount == numTetra &&
+		header -> arrayCount == (int) arrays.size() + (header -> hasSleepState ? 3 : 0);
+	for (int i = 0; i < header -> arrayCount && valid; i++)
+	{
+		valid = i >= (int) arrays.size() || header -> arrayBytes[i] == arrays[i].bytes;
+		expectedSize += header -> arrayBytes[i];
+	}
+	valid = valid && file.getSize() == expectedSize &&
+		header -> checksum == hashBytes(file.getData() + sizeof(CheckpointHeader), file.getSize() - sizeof(CheckpointHeader));
+	if (!valid)
+	{
+		cerr << "Checkpoint " << fileName << " does not belong to this mesh and method, or is damaged" << endl;
+		return false;
+	}
+
+	leaveGpuState();
+	const char * data = file.getData() + sizeof(CheckpointHeader);
+	for (size_t i = 0; i < arrays.size(); i++)
+	{
+		memcpy(arrays[i].data, data, arrays[i].bytes);
+		data += arrays[i].bytes;
+	}
+
+	wakeAll();
+	if (useSleepState)
+	{
+		memcpy(calmSteps, data, sizeof(int) * numVertices);
+		memcpy(vertexSleeping, data + sizeof(int) * numVertices, sizeof(bool) * numVertices);
+		memcpy(vertexMoving, data + (sizeof(int) + sizeof(bool)) * numVertices, sizeof(bool) * numVertices);
+		sleepingVertexCount = header -> sleepingVertexCount;
+	}
+	iteration = header -> stepCount + 1;
+	earthGravityValue = header -> earthGravity;
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Resumed from step " << header -> stepCount << " of " << fileName << endl;
+	}
+	#endif
+
+	return true;
+}
+
+//Advances the simulation by one rendered frame: STEPS_PER_FRAME explicit steps of stepSeconds, or a single implicit step of the same total time
+//With adaptive time stepping the explicit frame is instead split into the fewest equal steps estimateStableTimeStep allows.
+void ParticleSystem::advanceFrame(double stepSeconds)
+{
+	int numSteps = getStepsPerFrame();
+	double frameSeconds = stepSeconds * STEPS_PER_FRAME;
+	bool onGpu = canSimulateOnGpu();
+	if (useAdaptiveTimeStep && !useImplicit)
+	{
+		//The velocities are only read while they are on the CPU - the GPU steps use the elastic limit alone
+		double stableStep = estimateStableTimeStep(!onGpu || !gpuStateCurrent);
+		numSteps = (int) min(ceil(frameSeconds / stableStep), (double) MAX_STEPS_PER_FRAME);
+		numSteps = max(numSteps, 1);
+		logger -> profiler.recordCounter("steps per frame", numSteps);
+	}
+
+	if (!onGpu)
+	{
+		leaveGpuState();
+		for (int i = 0; i < numSteps; i++)
+		{
+			doUpdate(frameSeconds / numSteps);
+		}
+		return;
+	}
+
+	ProfileScope profileScope(logger -> profiler, "gpuSteps");
+	wakeAll();	//The GPU steps move every vertex
+	if (materialsChanged)
+	{
+		updateMaterials();
+		gpuSimulator -> uploadMaterials(tetraLambda, tetraMu, tetraKd);
+	}
+	if (!gpuStateCurrent)
+	{
+		gpuSimulator -> uploadState(positions, velocities);
+		gpuStateCurrent = true;
+	}
+
+	if (isAnimating)
+	{
+		for (int i = 0; i < numSteps; i++)
+		{
+			gpuSimulator -> step(frameSeconds / numSteps, earthGravityValue, doUninvert, collisionSystem);
+			timeSinceVideoWrite += frameSeconds / numSteps;
+			iteration++;
+			recordTrajectory();
+		}
+	}
+}
+
+//Estimates the largest explicit time step that keeps the simulation stable
+//The highest vibration frequency of the mesh is bounded by that of its stiffest tetrahedron (each vertex's mass shared
+//evenly among its tetrahedra), and for a tetrahedron it is at most (lambda + 2 * mu) * volume * sum |grad N_i|^2 / mass, the
+//N_i being the linear shape functions.  With the damping rate gamma = kd * (tetrahedra per vertex) / mass, the symplectic
+//Euler step of integrate is stable while omega^2 * dt^2 + 2 * gamma * dt < 4.  TIME_STEP_SAFETY leaves room for the
+//stiffening of large strains.
+//Parameter useVelocities - true to also keep every vertex from moving more than MAX_MOTION_PER_STEP of the smallest rest
+//altitude in one step, which keeps fast impacts from tunneling or overshooting the collision response
+double ParticleSystem::estimateStableTimeStep(bool useVelocities)
+{
+	if (tetraStiffnessRates == NULL)
+	{
+		computeStableStepData();
+	}
+	if (materialsChanged)
+	{
+		updateMaterials();
+	}
+
+	if (stableElasticStep == 0)
+	{
+		//Gershgorin bound on the assembled stiffness: each vertex row is at most twice its diagonal block
+		double * vertexStiffness = new double[numVertices];
+		memset(vertexStiffness, 0, sizeof(double) * numVertices);
+		for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+		{
+			double modulus = tetraLambda[currentTetrad] + 2 * tetraMu[currentTetrad];
+			for (int k = 0; k < 4; k++)
+			{
+				vertexStiffness[tetraList[k * numTetra + currentTetrad]] += modulus * tetraStiffnessRates[k * numTetra + currentTetrad];
+			}
+		}
+
+		double omegaSquared = 0;
+		double gamma = 0;
+		for (int i = 0; i < numVertices; i++)
+		{
+			omegaSquared = max(omegaSquared, 2 * vertexStiffness[i] / massMatrix[i]);
+			gamma = max(gamma, vertexKd[i] * vertexTetraCounts[i] / massMatrix[i]);
+		}
+		delete [] vertexStiffness;
+
+		stableElasticStep = TIME_STEP_SAFETY * 4 / (gamma + sqrt(gamma * gamma + 4 * omegaSquared));
+	}
+
+	double stableStep = stableElasticStep;
+	if (useVelocities)
+	{
+		double maxSpeedSquared = 0;
+		for (int i = 0; i < numVertices; i++)
+		{
+			double speedSquared = 0;
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				speedSquared += velocities[j * numVertices + i] * velocities[j * numVertices + i];
+			}
+			maxSpeedSquared = max(maxSpeedSquared, speedSquared);
+		}
+
+		if (maxSpeedSquared > 0)
+		{
+			stableStep = min(stableStep, MAX_MOTION_PER_STEP * minRestAltitude / sqrt(maxSpeedSquared));
+		}
+	}
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		logger -> printIteration("Stable time step (microseconds): ", (int) (stableStep * 1e6));
+	}
+	#endif
+
+	return stableStep;
+}
+
+//Turns sleeping on or off.  A vertex that stays calm for SLEEP_STEPS explicit steps in a row falls asleep: it is frozen (zero velocity, fixed position) and skipped by the integration, and tetrahedra made only of frozen vertices are
+//skipped by the force assembly.  A vertex is calm while it is slower than SLEEP_SPEED_FRACTION of the speed gravity adds in
+//SLEEP_STEPS steps - anything that is not supported (falling from rest, or at the top of a bounce) leaves that speed long before
+//it could fall asleep, while the vertices resting on the floor only pick up about one step of gravity.  A vertex wakes when a collision response gives it a velocity or when it shares a tetrahedron
+//with a moving vertex, so motion spreads back into a sleeping region one ring of tetrahedra per step.
+//Changing gravity or the constants, resetting and implicit or GPU steps wake everything.
+void ParticleSystem::setSleeping(bool useSleeping)
+{
+	this -> useSleeping = useSleeping;
+	if (!useSleeping)
+	{
+		wakeAll();
+		return;
+	}
+
+	if (calmSteps == NULL)
+	{
+		calmSteps = new int[numVertices];
+		vertexSleeping = new bool[numVertices];
+		vertexMoving = new bool[numVertices];
+		for (int i = 0; i < numVertices; i++)
+		{
+			calmSteps[i] = 0;
+			vertexSleeping[i] = false;
+			vertexMoving[i] = false;
+		}
+
+		vector< vector<int> > vertexNeighbors(numVertices);
+		for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+		{
+			for (int a = 0; a < 4; a++)
+			{
+				for (int b = 0; b < 4; b++)
+				{
+					if (a != b)
+					{
+						vertexNeighbors[tetraList[a * numTetra + currentTetrad]].push_back(tetraList[b * numTetra + currentTetrad]);
+					}
+				}
+			}
+		}
+
+		sleepNeighborOffsets.resize(numVertices + 1, 0);
+		for (int i = 0; i < numVertices; i++)
+		{
+			sort(vertexNeighbors[i].begin(), vertexNeighbors[i].end());
+			vertexNeighbors[i].erase(unique(vertexNeighbors[i].begin(), vertexNeighbors[i].end()), vertexNeighbors[i].end());
+			sleepNeighborOffsets[i + 1] = sleepNeighborOffsets[i] + (int) vertexNeighbors[i].size();
+			sleepNeighbors.insert(sleepNeighbors.end(), vertexNeighbors[i].begin(), vertexNeighbors[i].end());
+		}
+	}
+}
+
+//Wakes every vertex (their velocities are still zero, so the state itself is unchanged)
+void ParticleSystem::wakeAll()
+{
+	if (sleepingVertexCount == 0 && (calmSteps == NULL || !useSleeping))
+	{
+		return;
+	}
+
+	for (int i = 0; i < numVertices; i++)
+	{
+		calmSteps[i] = 0;
+		vertexSleeping[i] = false;
+	}
+	sleepingVertexCount = 0;
+}
+
+//Advances the sleep state by one explicit step (see setSleeping) - called after the collision response
+//Parameter - deltaT - length of the step just taken
+void ParticleSystem::updateSleeping(double deltaT)
+{
+	ProfileScope profileScope(logger -> profiler, "updateSleeping");
+	double speedLimit = SLEEP_SPEED_FRACTION * fabs(earthGravityValue) * SLEEP_STEPS * deltaT;
+	double speedLimitSquared = speedLimit * speedLimit;
+
+	//Classify the vertices.  A frozen vertex with a velocity was hit by a collision response.
+	int movingCount = 0;
+	#pragma omp parallel for num_threads(numThreads) schedule(static) reduction(+:movingCount)
+	for (int i = 0; i < numVertices; i++)
+	{
+		double speedSquared = 0;
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			speedSquared += velocities[j * numVertices + i] * velocities[j * numVertices + i];
+		}
+
+		if (vertexSleeping[i])
+		{
+			if (speedSquared == 0)
+			{
+				vertexMoving[i] = false;
+				continue;
+			}
+			vertexSleeping[i] = false;
+			calmSteps[i] = 0;
+		}
+
+		vertexMoving[i] = speedSquared >= speedLimitSquared;
+		calmSteps[i] = vertexMoving[i] ? 0 : calmSteps[i] + 1;
+		movingCount += vertexMoving[i] ? 1 : 0;
+	}
+
+	//A vertex sharing a tetrahedron with a moving vertex stays (or becomes) awake; the others that were calm for long enough
+	//fall asleep
+	int sleepingCount = 0;
+	#pragma omp parallel for num_threads(numThreads) schedule(static) reduction(+:sleepingCount)
+	for (int i = 0; i < numVertices; i++)
+	{
+		if (movingCount > 0 && !vertexMoving[i])
+		{
+			for (int k = sleepNeighborOffsets[i]; k < sleepNeighborOffsets[i + 1]; k++)
+			{
+				if (vertexMoving[sleepNeighbors[k]])
+				{
+					calmSteps[i] = 0;
+					vertexSleeping[i] = false;
+					break;
+				}
+			}
+		}
+
+		if (!vertexSleeping[i] && calmSteps[i] >= SLEEP_STEPS)
+		{
+			vertexSleeping[i] = true;
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				velocities[j * numVertices + i] = 0;
+			}
+		}
+		sleepingCount += vertexSleeping[i] ? 1 : 0;
+	}
+	sleepingVertexCount = sleepingCount;
+	logger -> profiler.recordCounter("sleeping vertices", sleepingVertexCount);
+}
+
+//Fills tetraStiffnessRates and minRestAltitude from the rest shape (see estimateStableTimeStep)
+//The face opposite vertex i has area A_i and |grad N_i| = A_i / (3 * volume), so the diagonal stiffness a tetrahedron adds to
+//vertex i is at most (lambda + 2 mu) * volume * |grad N_i|^2 = (lambda + 2 mu) * A_i^2 / (9 * volume).
+void ParticleSystem::computeStableStepData()
+{
+	if (vertexTetraCounts == NULL)
+	{
+		countVertexTetra();
+	}
+
+	tetraStiffnessRates = new double[4 * numTetra];
+	minRestAltitude = numeric_limits<double>::max();
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+	{
+		Vec3 corners[4];
+		for (int k = 0; k < 4; k++)
+		{
+			int vertex = tetraList[k * numTetra + currentTetrad];
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				corners[k][j] = orgVertices[vertex].position[j];
+			}
+			tetraStiffnessRates[k * numTetra + currentTetrad] = 0;
+		}
+
+		double volume = fabs(dot(cross(corners[1] - corners[0], corners[2] - corners[0]), corners[3] - corners[0])) / 6;
+		if (volume <= 0)
+		{
+			continue;	//Degenerate - it has no stiffness to bound
+		}
+
+		for (int k = 0; k < 4; k++)
+		{
+			const Vec3 & a = corners[(k + 1) % 4];
+			const Vec3 & b = corners[(k + 2) % 4];
+			const Vec3 & c = corners[(k + 3) % 4];
+			Vec3 areaVector = cross(b - a, c - a);
+			double area = 0.5 * sqrt(dot(areaVector, areaVector));
+			tetraStiffnessRates[k * numTetra + currentTetrad] = area * area / (9 * volume);
+			minRestAltitude = min(minRestAltitude, 3 * volume / area);
+		}
+	}
+}
+
+//Moves the explicit steps onto the graphics card (OpenGL 4.3 compute shaders - see GpuSimulator)
+//Must be called from the thread that owns the GL context after initVBOs, and every later step and render has to run on that
+//thread as well (no SimulationThread).  While implicit integration, self collision or a collider other than a plane is in use
+//the steps fall back to the CPU, with the state moved back and forth as needed.
+//Returns false (and keeps simulating on the CPU) if the context or the deformation method cannot simulate on the GPU.
+bool ParticleSystem::enableGpuSimulation()
+{
+	if (gpuSimulator != NULL)
+	{
+		return true;
+	}
+
+	if (!GpuSimulator::isSupported())
+	{
+		cerr << "GPU simulation needs OpenGL 4.3 compute shaders" << endl;
+		return false;
+	}
+	GpuForceModel model;
+	if (!getGpuForceModel(model))
+	{
+		cerr << "This deformation method has no GPU force model" << endl;
+		return false;
+	}
+
+	gpuSimulator = new GpuSimulator(logger);
+	if (!gpuSimulator -> initialize(model, tetraList, numTetra, numTetraColors, tetraColorOffsets, massMatrix, numVertices, indices,
+		surfaceTriangleOffsets, surfaceTriangles, defVertices, vboHandle[0]))
+	{
+		delete gpuSimulator;
+		gpuSimulator = NULL;
+		return false;
+	}
+
+	updateMaterials();
+	gpuSimulator -> uploadMaterials(tetraLambda, tetraMu, tetraKd);
+	gpuStateCurrent = false;
+	return true;
+}
+
+//Returns true if the next steps can run on the graphics card (not with a force exchange - the GPU step assembles all forces itself)
+bool ParticleSystem::canSimulateOnGpu()
+{
+	if (gpuSimulator == NULL || useImplicit || useSelfCollision || forceExchange != NULL || collisionSystem -> getColliderCount() > GPU_MAX_PLANES)
+	{
+		return false;
+	}
+	for (int i = 0; i < collisionSystem -> getColliderCount(); i++)
+	{
+		if (collisionSystem -> getCollider(i).type != COLLIDER_PLANE)
+		{
+			return false;
+		}
+	}
+
+	//The GPU step applies earthGravityValue to every vertex
+	for (int b = 0; b < (int) bodyMaterials.size(); b++)
+	{
+		if (bodyMaterials[b].hasGravity)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+//Copies the state from the graphics card into positions and velocities if it is newer there (it stays on the graphics card)
+void ParticleSystem::downloadGpuState()
+{
+	if (gpuStateCurrent)
+	{
+		gpuSimulator -> downloadState(positions, velocities);
+	}
+}
+
+//Makes positions and velocities the current state again, before they are changed on the CPU
+void ParticleSystem::leaveGpuState()
+{
+	downloadGpuState();
+	gpuStateCurrent = false;
+}
+
+//Update Method - Implements one time step for the animation
+//Assembles the elastic forces of all tetrahedra (see computeForces), then uses explicit (or implicit - see integrateImplicit) integration to update the particle velocities and in turn the positions
+//Parameter - deltaT - Amount of time elapsed to use in integrating.  Type double. 
+void ParticleSystem::doUpdate(double deltaT)
+{
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		logger -> printText("=======================================================================================================");
+		logger -> printIteration("Iteration #", iteration);
+		logger ->printVelocitiesAndPositions(positions, velocities, numVertices, "Positions - start of method", "Velocities - start of method", logger ->MEDIUM);
+	}
+	#endif
+
+	ProfileScope profileScope(logger -> profiler, "doUpdate");
+	double phaseStart = getTimeSeconds();
+	invertedTetraCount = 0;
+
+	if (materialsChanged)
+	{
+		updateMaterials();
+	}
+
+	//Start with 0 force each iteration
+	for (int i = 0; i < DIMENSION * numVertices; i++)
+	{
+		currentForce[i] = 0;
+	}
+
+	//A body with its own gravity starts with the difference to earthGravityValue, which both integrators add to every vertex
+	for (int b = 0; b < (int) bodyMaterials.size(); b++)
+	{
+		if (bodyMaterials[b].hasGravity)
+		{
+			for (int i = bodyMaterials[b].firstVertex; i < bodyMaterials[b].firstVertex + bodyMaterials[b].vertexCount; i++)
+			{
+				currentForce[numVertices + i] = massMatrix[i] * (earthGravityValue - bodyMaterials[b].gravity);
+			}
+		}
+	}
+
+	computeForces();
+
+	double phaseEnd = getTimeSeconds();
+	phaseSeconds[PHASE_FORCES] += phaseEnd - phaseStart;
+	logger -> profiler.recordSpan("computeForces", phaseStart, phaseEnd);
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		logger -> printVertexTypeMatrix(currentForce,numVertices,"currentForce", logger ->MEDIUM);
+	}
+	#endif
+
+	if (isAnimating)
+	{
+		phaseStart = phaseEnd;
+		if (useImplicit)
+		{
+			integrateImplicit(deltaT);
+		}
+		else
+		{
+			integrate(deltaT);
+		}
+		phaseEnd = getTimeSeconds();
+		phaseSeconds[PHASE_INTEGRATION] += phaseEnd - phaseStart;
+		logger -> profiler.recordSpan(useImplicit ? "integrateImplicit" : "integrate", phaseStart, phaseEnd);
+
+		phaseStart = phaseEnd;
+		doCollisionDetectionAndResponse(deltaT);
+		phaseEnd = getTimeSeconds();
+		phaseSeconds[PHASE_COLLISION] += phaseEnd - phaseStart;
+
+		//The implicit solve couples every vertex, so nothing sleeps with implicit integration
+		if (useSleeping && !useImplicit)
+		{
+			phaseStart = phaseEnd;
+			updateSleeping(deltaT);
+			phaseSeconds[PHASE_INTEGRATION] += getTimeSeconds() - phaseStart;
+		}
+		else
+		{
+			wakeAll();
+		}
+	}
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		logger ->printVelocitiesAndPositions(positions, velocities, numVertices,"Deformed Positions", "Deformed Velocities", logger ->MEDIUM);
+	}
+	#endif
+
+	logger -> profiler.recordCounter("inverted tetrahedra", invertedTetraCount);
+	logger -> profiler.recordCounter("collisions", collisionCount);
+
+	timeSinceVideoWrite += deltaT;
+	iteration++;
+	recordTrajectory();
+}
+
+//Fills vertexTetraCounts - the number of tetrahedra containing each vertex, each of which adds kd damping to it
+void ParticleSystem::countVertexTetra()
+{
+	vertexTetraCounts = new int[numVertices];
+	for (int i = 0; i < numVertices; i++)
+	{
+		vertexTetraCounts[i] = 0;
+	}
+	for (int i = 0; i < 4 * numTetra; i++)
+	{
+		vertexTetraCounts[tetraList[i]]++;
+	}
+}
+
+//Accumulates the force of every tetrahedron (plus damping) into currentForce
+//With a force exchange (see setForceExchange) the tetrahedra at the shared vertices are computed first, so that their forces
+//travel to the other processes while the interior tetrahedra are computed.
+void ParticleSystem::computeForces()
+{
+	if (forceExchange == NULL)
+	{
+		computeForcePass(FORCES_ALL);
+		return;
+	}
+
+	computeForcePass(FORCES_BOUNDARY);
+	forceExchange -> start(currentForce);
+	computeForcePass(FORCES_INTERIOR);
+	forceExchange -> finish(currentForce);
+}
+
+//Accumulates the force of the tetrahedra of one pass (see ForcePass) into currentForce
+//Colors are processed one after another; the blocks of tetrahedra within one color are split across the threads.
+//Since tetrahedra of the same color share no vertices, the scatter into currentForce needs no locking or reduction.
+//Blocks and tetrahedra whose vertices are all asleep are skipped - their forces would only reach frozen vertices.
+void ParticleSystem::computeForcePass(ForcePass pass)
+{
+	#ifdef DEBUGGING
+	bool useBlocks = !logger -> isLogging;	//The per tetrahedron matrices are only logged by the scalar kernels
+	#else
+	bool useBlocks = true;
+	#endif
+	bool skipAsleep = sleepingVertexCount > 0;
+
+	#pragma omp parallel num_threads(numThreads)
+	for (int color = 0; color < numTetraColors; color++)
+	{
+		int firstTetrad = tetraColorOffsets[color];
+		int firstBlock = colorBlockOffsets[color];
+		int tailStart = useBlocks ? firstTetrad + (colorBlockOffsets[color + 1] - firstBlock) * FORCE_BLOCK_WIDTH : firstTetrad;
+
+		if (useBlocks)
+		{
+			#pragma omp for schedule(static) nowait
+			for (int block = firstBlock; block < colorBlockOffsets[color + 1]; block++)
+			{
+				int blockStart = firstTetrad + (block - firstBlock) * FORCE_BLOCK_WIDTH;
+				if (pass != FORCES_ALL && (boundaryBlocks[block] != 0) != (pass == FORCES_BOUNDARY))
+				{
+					continue;
+				}
+				if (skipAsleep)
+				{
+					int awakeTetra = 0;
+					for (int i = blockStart; i < blockStart + FORCE_BLOCK_WIDTH; i++)
+					{
+						awakeTetra += !isTetraAsleep(i);
+					}
+					if (awakeTetra == 0)
+					{
+						continue;
+					}
+				}
+				computeBlockForces(blockStart, block);
+			}
+		}
 
-		for (int i = 0; i < DIMENSION; i++)
+		//Leftover tetrahedra of this color - they share no vertices with the blocks, so no barrier is needed in between
+		#pragma omp for schedule(static)
+		for (int currentTetrad = tailStart; currentTetrad < tetraColorOffsets[color + 1]; currentTetrad++)
+		{
+			if (pass != FORCES_ALL && (boundaryTetra[currentTetrad] != 0) != (pass == FORCES_BOUNDARY))
+			{
+				continue;
+			}
+			if (!skipAsleep || !isTetraAsleep(currentTetrad))
+			{
+				accumulateTetraForces(currentTetrad);
+			}
+		} //Implicit barrier - the next color starts once this one is complete
+	}
+}
+
+//Has computeForces complete the forces of the vertices other processes share through exchange (see DistributedSimulation)
+//Parameter sharedVertices - true for each vertex whose force the exchange completes; NULL exchange turns the exchange off again
+void ParticleSystem::setForceExchange(ForceExchange * exchange, const vector<bool> & sharedVertices)
+{
+	forceExchange = exchange;
+	boundaryTetra.assign(numTetra, 0);
+	boundaryBlocks.assign(numForceBlocks, 0);
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			boundaryTetra[currentTetrad] |= sharedVertices[tetraList[k * numTetra + currentTetrad]] ? 1 : 0;
+		}
+	}
+	for (int color = 0; color < numTetraColors; color++)
+	{
+		for (int block = colorBlockOffsets[color]; block < colorBlockOffsets[color + 1]; block++)
+		{
+			int blockStart = tetraColorOffsets[color] + (block - colorBlockOffsets[color]) * FORCE_BLOCK_WIDTH;
+			for (int i = blockStart; i < blockStart + FORCE_BLOCK_WIDTH; i++)
+			{
+				boundaryBlocks[block] |= boundaryTetra[i];
+			}
+		}
+	}
+}
+
+//Accumulates the forces of the block of FORCE_BLOCK_WIDTH tetrahedra starting at firstTetrad
+//Deformation methods with a SIMD kernel override this; by default the tetrahedra are processed one at a time.
+//The second parameter is the index of the block, for data a subclass repacked per block; the default does not need it.
+void ParticleSystem::computeBlockForces(int firstTetrad, int)
+{
+	for (int currentTetrad = firstTetrad; currentTetrad < firstTetrad + FORCE_BLOCK_WIDTH; currentTetrad++)
+	{
+		accumulateTetraForces(currentTetrad);
+	}
+}
+
+//Gathers the deformed positions and velocities of one tetrahedron, evaluates its force kernel and adds the forces (plus damping) into currentForce
+//Parameter - currentTetrad - index of the tetrahedron.  The caller guarantees no other thread is touching its vertices.
+void ParticleSystem::accumulateTetraForces(int currentTetrad)
+{
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		logger -> printText("**************");
+		logger -> printIteration("Tetrahedron #", currentTetrad);
+	}
+	#endif
+
+	//3 X 4 matrices
+	double p [12];
+	double v [12];
+	double forces [12];
+
+	for(int j = 0; j < DIMENSION; j++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			p[j * 4 + k] = positions[j * numVertices + tetraList[k * numTetra + currentTetrad]];
+			v[j * 4 + k] = velocities[j * numVertices + tetraList[k * numTetra + currentTetrad]];
+		}
+	}
+
+	computeTetraForces(currentTetrad, p, v, forces);
+
+	double damping = tetraKd[currentTetrad];
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			currentForce[j * numVertices + tetraList[k * numTetra + currentTetrad]] += forces[j * 4 + k] - damping * v[j * 4 + k];
+		}
+	}
+}
+
+//Explicit (symplectic Euler) integration of all particles using currentForce and earth gravity
+//Each dimension of the state is a contiguous array, so the inner loop streams through memory (and vectorizes)
+//Sleeping vertices keep their position and zero velocity.
+//Parameter - deltaT - Amount of time elapsed to use in integrating.
+void ParticleSystem::integrate(double deltaT)
+{
+	bool skipAsleep = sleepingVertexCount > 0;
+
+	#pragma omp parallel num_threads(numThreads)
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		double * position = &positions[j * numVertices];
+		double * velocity = &velocities[j * numVertices];
+		double * force = &currentForce[j * numVertices];
+		double gravityDeltaV = (j == 1) ? -earthGravityValue * deltaT : 0; //no mass matrix ref here since earthGravityValue is in fact acceleration
+
+		if (skipAsleep)
+		{
+			#pragma omp for schedule(static) nowait
+			for (int i = 0; i < numVertices; i++)
+			{
+				if (!vertexSleeping[i])
+				{
+					velocity[i] += (force[i] / massMatrix[i]) * deltaT;
+					velocity[i] += gravityDeltaV;
+					position[i] += velocity[i] * deltaT;
+				}
+			}
+			continue;
+		}
+
+		#pragma omp for schedule(static) nowait
+		for (int i = 0; i < numVertices; i++)
+		{
+			//Add delta velocity to each particle's velocity
+			velocity[i] += (force[i] / massMatrix[i]) * deltaT;
+			velocity[i] += gravityDeltaV;
+
+			//Use explicit integration with velocity to update each particle's position
+			position[i] += velocity[i] * deltaT;
+		}
+	}
+}
+
+//Linearized backward Euler integration (Baraff and Witkin, "Large Steps in Cloth Simulation")
+//Solves (M - h * df/dv - h^2 * df/dx) * deltaV = h * (f + h * df/dx * v) + h * M * g with preconditioned conjugate gradient,
+//then updates the velocities and positions with the new velocities.  currentForce must already hold the forces at the current state.
+//Much larger time steps than the explicit integrator stay stable.
+//Parameter - deltaT - Amount of time elapsed to use in integrating.
+void ParticleSystem::integrateImplicit(double deltaT)
+{
+	//The matrix is built again after a change of the mesh topology (see GeorgiaInstituteSystem::splitVertex)
+	if (systemMatrix == NULL)
+	{
+		systemMatrix = new BlockSparseMatrix(tetraList, numTetra, numVertices);
+	}
+	if (deltaV == NULL)
+	{
+		deltaV = alignedAlloc<double>(DIMENSION * numVertices);
+		implicitRHS = alignedAlloc<double>(DIMENSION * numVertices);
+		implicitDiagonal = alignedAlloc<double>(DIMENSION * numVertices);
+
+		if (vertexTetraCounts == NULL)
+		{
+			countVertexTetra();
+		}
+	}
+
+	//-h^2 * df/dx, one tetrahedron at a time.  Tetrahedra of one color share no vertices and therefore no blocks.
+	systemMatrix -> clear();
+	#pragma omp parallel num_threads(numThreads)
+	for (int color = 0; color < numTetraColors; color++)
+	{
+		#pragma omp for schedule(static)
+		for (int currentTetrad = tetraColorOffsets[color]; currentTetrad < tetraColorOffsets[color + 1]; currentTetrad++)
+		{
+			double p [12];
+			double v [12];
+			double stiffness [144];
+
+			for(int j = 0; j < DIMENSION; j++)
+			{
+				for (int k = 0; k < 4; k++)
+				{
+					p[j * 4 + k] = positions[j * numVertices + tetraList[k * numTetra + currentTetrad]];
+					v[j * 4 + k] = velocities[j * numVertices + tetraList[k * numTetra + currentTetrad]];
+				}
+			}
+
+			computeTetraStiffness(currentTetrad, p, v, stiffness);
+			systemMatrix -> addTetraBlocks(currentTetrad, stiffness, -deltaT * deltaT);
+		}
+	}
+
+	//M - h * df/dv, where df/dv = -kd * (number of tetrahedra containing the vertex) * I
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		for (int i = 0; i < numVertices; i++)
+		{
+			implicitDiagonal[j * numVertices + i] = massMatrix[i] + deltaT * vertexKd[i] * vertexTetraCounts[i];
+		}
+	}
+	systemMatrix -> addDiagonal(implicitDiagonal);
+
+	//h^2 * df/dx * v is (M - h * df/dv) * v - A * v, so the stiffness never needs to be stored separately
+	systemMatrix -> multiply(velocities, implicitRHS, numThreads);
+
+	#pragma omp parallel for num_threads(numThreads) schedule(static)
+	for (int i = 0; i < DIMENSION * numVertices; i++)
+	{
+		int vertex = i % numVertices;
+		double gravityForce = (i / numVertices == 1) ? -earthGravityValue * massMatrix[vertex] : 0;
+		implicitRHS[i] = deltaT * (currentForce[i] + gravityForce) + implicitDiagonal[i] * velocities[i] - implicitRHS[i];
+		deltaV[i] = 0;
+	}
+
+	int iterations = systemMatrix -> solveConjugateGradient(implicitRHS, deltaV, cgTolerance, cgMaxIterations, numThreads, logger);
+	logger -> profiler.recordCounter("cg iterations", iterations);
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		logger -> printIteration("Conjugate gradient iterations: ", iterations);
+		logger -> printVertexTypeMatrix(deltaV, numVertices, "deltaV", logger -> FULL);
+	}
+	#endif
+
+	#pragma omp parallel for num_threads(numThreads) schedule(static)
+	for (int i = 0; i < DIMENSION * numVertices; i++)
+	{
+		velocities[i] += deltaV[i];
+		positions[i] += velocities[i] * deltaT;
+	}
+}
+
+//Default force Jacobian - central differences of computeTetraForces with respect to each of the 12 position coordinates
+//Costs 24 force evaluations per tetrahedron; override with an analytic version where one is available.
+//Parameters p and v - deformed positions and velocities of the 4 vertices (3 X 4, p[j * 4 + vertex])
+//Parameter stiffness - receives the 12 X 12 Jacobian (see ParticleSystem.h for the layout)
+void ParticleSystem::computeTetraStiffness(int currentTetrad, double * p, double * v, double * stiffness)
+{
+	double perturbed[12];
+	double forcesPlus[12];
+	double forcesMinus[12];
+
+	for (int k = 0; k < 12; k++)
+	{
+		perturbed[k] = p[k];
+	}
+
+	for (int b = 0; b < 4; b++)
+	{
+		for (int c = 0; c < DIMENSION; c++)
+		{
+			double original = p[c * 4 + b];
+			double epsilon = 1e-6 * (1 + fabs(original));
+
+			perturbed[c * 4 + b] = original + epsilon;
+			computeTetraForces(currentTetrad, perturbed, v, forcesPlus);
+			perturbed[c * 4 + b] = original - epsilon;
+			computeTetraForces(currentTetrad, perturbed, v, forcesMinus);
+			perturbed[c * 4 + b] = original;
+
+			for (int a = 0; a < 4; a++)
+			{
+				for (int r = 0; r < DIMENSION; r++)
+				{
+					stiffness[(a * 3 + r) * 12 + b * 3 + c] = (forcesPlus[r * 4 + a] - forcesMinus[r * 4 + a]) / (2 * epsilon);
+				}
+			}
+		}
+	}
+}
+
+//Copies the simulation state into the Vertex buffer used for rendering (defVertices)
+void ParticleSystem::updateRenderVertices()
+{
+	#pragma omp parallel for num_threads(numThreads) schedule(static)
+	for (int i = 0; i < numVertices; i++)
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			defVertices[i].position[j] = positions[j * numVertices + i];
+			defVertices[i].velocity[j] = velocities[j * numVertices + i];
+		}
+	}
+}
+
+//Renders a detailed mesh driven by the simulated one instead of the simulated surface (see RenderEmbedding)
+//The render mesh must be in the coordinates of the simulated rest state; only its surface is kept, so the arrays can be freed
+//afterwards.  Call it before initVBOs and enableRenderSnapshots.
+void ParticleSystem::setRenderMesh(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount)
+{
+	delete renderEmbedding;
+	renderEmbedding = new RenderEmbedding(orgVertices, numVertices, this -> tetraList, numTetra, vertexList, vertexCount, tetraList, tetraCount, logger);
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Rendering " << renderEmbedding -> getVertexCount() << " vertices embedded in the " << numVertices << " simulated vertices" << endl;
+	}
+	#endif
+}
+
+//Number of vertices in the streamed render layout (the simulated vertices unless a render mesh is set)
+int ParticleSystem::getRenderVertexCount()
+{
+	return renderEmbedding != NULL ? renderEmbedding -> getVertexCount() : numVertices;
+}
+
+//Triangles drawn - indices of the stream's vertices
+const vector<int> & ParticleSystem::getRenderIndices()
+{
+	return renderEmbedding != NULL ? renderEmbedding -> getIndices() : indices;
+}
+
+//Switches rendering to the render snapshots, for running the simulation on another thread (see SimulationThread)
+//From then on the render thread only reads the snapshots, never the simulation arrays.  Call it before that thread starts.
+void ParticleSystem::enableRenderSnapshots()
+{
+	for (int i = 0; i < RENDER_SNAPSHOTS; i++)
+	{
+		if (renderSnapshots[i] == NULL)
+		{
+			renderSnapshots[i] = alignedAlloc<float>(RENDER_STREAM_FLOATS * getRenderVertexCount());
+		}
+	}
+
+	//Every snapshot starts out as the current state, so the first frames have something to draw
+	for (int i = 0; i < RENDER_SNAPSHOTS; i++)
+	{
+		writeSnapshot = i;
+		publishRenderSnapshot();
+	}
+	writeSnapshot = 0;
+	displaySnapshot = 1;
+	readySnapshot = 2 | RENDER_SNAPSHOT_FRESH;
+	snapshotChanged = true;
+	useRenderSnapshots = true;
+}
+
+//Copies the current positions and normals (see calculateNormals) into a snapshot and hands it to the render thread
+//Triple buffering: the simulation fills writeSnapshot, then swaps it with readySnapshot in one atomic exchange.  The render
+//thread swaps readySnapshot with displaySnapshot the same way (acquireRenderSnapshot), so neither side ever waits for the other
+//and the render thread always draws the newest completed frame.
+void ParticleSystem::publishRenderSnapshot()
+{
+	updateRenderVertices();
+
+	float * snapshot = renderSnapshots[writeSnapshot];
+	if (renderEmbedding != NULL)
+	{
+		memcpy(snapshot, renderEmbedding -> getStream(), sizeof(float) * RENDER_STREAM_FLOATS * renderEmbedding -> getVertexCount());
+	}
+	else
+	{
+		#pragma omp parallel for num_threads(numThreads) schedule(static)
+		for (int i = 0; i < numVertices; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				snapshot[i * RENDER_STREAM_FLOATS + j] = defVertices[i].position[j];
+				snapshot[i * RENDER_STREAM_FLOATS + 4 + j] = defVertices[i].vertexNormal[j];
+			}
+		}
+	}
+
+	if (useRenderSnapshots)
+	{
+		writeSnapshot = atomicExchange(&readySnapshot, writeSnapshot | RENDER_SNAPSHOT_FRESH) & ~RENDER_SNAPSHOT_FRESH;
+	}
+}
+
+//Takes the newest snapshot for rendering if one was published since the last call
+//Returns true if displaySnapshot changed
+bool ParticleSystem::acquireRenderSnapshot()
+{
+	if ((atomicLoad(&readySnapshot) & RENDER_SNAPSHOT_FRESH) == 0)
+	{
+		return false;
+	}
+
+	displaySnapshot = atomicExchange(&readySnapshot, displaySnapshot) & ~RENDER_SNAPSHOT_FRESH;
+	snapshotChanged = true;
+	return true;
+}
+
+//Implement collision detection against the floor and collison response
+void ParticleSystem::doCollisionDetectionAndResponse(double deltaT)
+{
+	ProfileScope profileScope(logger -> profiler, "doCollisionDetectionAndResponse");
+	collisionCount = collisionSystem -> detectAndRespond(positions, velocities, deltaT, numThreads);
+	if (useSelfCollision)
+	{
+		if (selfCollision == NULL)
+		{
+			selfCollision = new SelfCollision(numVertices, indices, positions, logger);
+		}
+		selfCollisionCount = selfCollision -> detectAndRespond(positions, velocities, massMatrix, deltaT, numThreads);
+		logger -> profiler.recordCounter("self collisions", selfCollisionCount);
+	}
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging && collisionCount > 0)
+	{
+		logger ->printVelocitiesAndPositions(positions, velocities, numVertices,"Positions after collision response", "Velocities", logger->LIGHT);
+	}
+	#endif
+}
+
+//This method uses the SVD to uninvert F based on the paper by Fedkiw et al
+//F is the matrix representing the change in the deformed vertices versus the original vertices
+//Algorithm is based directly on the paper at: http://physbam.stanford.edu/~fedkiw/papers/stanford2004-04.pdf
+void ParticleSystem::uninvertF( double * F)
+{
+	if (!doUninvert) //Guarantee any caller checks the setting
+	{
+		return;
+	}
+
+	static int numTimes = 1;
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging && logger ->loggingLevel >= logger ->MEDIUM)
+	{
+		cout << "F:" << endl;
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				cout << F[i * 3 + j] << " ";
+			}
+			cout << endl;
+		}
+	}
+	#endif
+
+	
+	double determinantF = determinant(Mat3::fromArray(F));
+	if (determinantF < 0)
+	{
+		//cout << "Inverted tetrahedron -- determinant of F is less than 0" << endl;
+
+		//Step 1: find the svd of F = U * W * V' with U and V rotations (see SVD3.h)
+		//Keeping both rotations proper leaves the inversion in the sign of the smallest singular value W[2]
+		double U[9];
+		double W[3];
+		double V[9];
+		svd3(F, U, W, V);
+
+		#ifdef DEBUGGING
+		if (logger -> isLogging && logger ->loggingLevel >= logger ->MEDIUM)
+		{
+			cout << "num times is " << numTimes << endl;
+			logger -> print3By3MatrixSingleIndex(U, "SVD for F: U", logger -> MEDIUM);
+			cout << "W:" << endl << W[0] << " " << W[1] << " " << W[2] << endl;
+			logger -> print3By3MatrixSingleIndex(V, "V", logger -> MEDIUM);
+		}
+		#endif
+
+		//Step 2: negate the smallest singular value - this is the essence of uninversion
+		//F = U * diag(W[0], W[1], -W[2]) * V' = F - 2 * W[2] * (column 2 of U) * (column 2 of V)'
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				F[i * DIMENSION + j] -= 2 * W[2] * U[i * 3 + 2] * V[j * 3 + 2];
+			}
+		}
+
+		#pragma omp atomic
+		invertedTetraCount++;
+
+		//Find the determinant of F and check it to make sure we actually uninverted the tetrahedra
+		double determinantF = determinant(Mat3::fromArray(F));
+		
+		if (determinantF < 0)
 		{
-			defVertices[tetraList[2 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			defVertices[tetraList[1 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			defVertices[tetraList[3 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[2 * numTetra + currentTetrad]] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[1 * numTetra + currentTetrad]] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[3 * numTetra + currentTetrad]] += crossProductResult[i];
+			cout << "bad det - uninversion algorithm did not work correctly" << endl;
 		}
-		tetraCounts[tetraList[2 * numTetra + currentTetrad]]++;
-		tetraCounts[tetraList[1 * numTetra + currentTetrad]]++;
-		tetraCounts[tetraList[3 * numTetra + currentTetrad]]++;
 
-		//glVertex3f(defVertices[tetraList[2 * numTetra + i]].position[0], defVertices[tetraList[2 * numTetra + i]].position[1], defVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
-		//glVertex3f(defVertices[tetraList[1 * numTetra + i]].position[0], defVertices[tetraList[1 * numTetra + i]].position[1], defVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-		//glVertex3f(defVertices[tetraList[3 * numTetra + i]].position[0], defVertices[tetraList[3 * numTetra + i]].position[1], defVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
+	} //if det F < 0...
+	
+	#pragma omp atomic
+	numTimes++;
 
-		for (int i = 0; i < DIMENSION; i++)
-		{
-			vectorDifferenceA[i] =  defVertices[tetraList[2 * numTetra + currentTetrad]].position[i] - defVertices[tetraList[3 * numTetra + currentTetrad]].position[i];
-			vectorDifferenceB[i] =  defVertices[tetraList[3 * numTetra + currentTetrad]].position[i] - defVertices[tetraList[0 * numTetra + currentTetrad]].position[i];
-		}
+}
+
+//SIMD version of uninvertF for FORCE_BLOCK_WIDTH deformation gradients at once (F[row * 3 + col] holds one matrix per lane)
+//Only lanes whose determinant is negative are changed, and the SVD only runs when at least one lane is inverted.
+void ParticleSystem::uninvertFBlock(SimdForce * F)
+{
+	if (!doUninvert)
+	{
+		return;
+	}
 
-		crossProductGeneral(crossProductResult, vectorDifferenceA, vectorDifferenceB);
+	SimdForce zero = simdConstant<SimdForce>(0);
+	SimdForce determinantF = simdMul(F[0], simdSub(simdMul(F[4], F[8]), simdMul(F[5], F[7])));
+	determinantF = simdSub(determinantF, simdMul(F[1], simdSub(simdMul(F[3], F[8]), simdMul(F[5], F[6]))));
+	determinantF = simdAdd(determinantF, simdMul(F[2], simdSub(simdMul(F[3], F[7]), simdMul(F[4], F[6]))));
 
-		for (int i = 0; i < DIMENSION; i++)
+	SimdTraits<SimdForce>::Mask inverted = simdLess(determinantF, zero);
+	if (!simdAny(inverted))
+	{
+		return;
+	}
+
+	double laneDeterminants[FORCE_BLOCK_WIDTH];
+	simdStoreForce(laneDeterminants, determinantF);
+	int invertedLanes = 0;
+	for (int lane = 0; lane < FORCE_BLOCK_WIDTH; lane++)
+	{
+		invertedLanes += laneDeterminants[lane] < 0 ? 1 : 0;
+	}
+	#pragma omp atomic
+	invertedTetraCount += invertedLanes;
+
+	SimdForce U[9];
+	SimdForce W[3];
+	SimdForce V[9];
+	svd3(F, U, W, V);
+
+	SimdForce twoW = simdAdd(W[2], W[2]);
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
 		{
-			defVertices[tetraList[2 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			defVertices[tetraList[3 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			defVertices[tetraList[0 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[2 * numTetra + currentTetrad]] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[3 * numTetra + currentTetrad]] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[0 * numTetra + currentTetrad]] += crossProductResult[i];
+			SimdForce uninverted = simdSub(F[i * 3 + j], simdMul(twoW, simdMul(U[i * 3 + 2], V[j * 3 + 2])));
+			F[i * 3 + j] = simdSelect(inverted, uninverted, F[i * 3 + j]);
 		}
-		tetraCounts[tetraList[2 * numTetra + currentTetrad]]++;
-		tetraCounts[tetraList[3 * numTetra + currentTetrad]]++;
-		tetraCounts[tetraList[0 * numTetra + currentTetrad]]++;
+	}
+}
+
+////Method to calculate the normals used for lighting
+////Note that since the cross product is only defined in 3 dimensions, this method only works properly for 3 dimensions
+void ParticleSystem::calculateNormals()
+{
+	ProfileScope profileScope(logger -> profiler, "calculateNormals");
+	double phaseStart = getTimeSeconds();
 
-		//glVertex3f(defVertices[tetraList[2 * numTetra + i]].position[0], defVertices[tetraList[2 * numTetra + i]].position[1], defVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
-		//glVertex3f(defVertices[tetraList[3 * numTetra + i]].position[0], defVertices[tetraList[3 * numTetra + i]].position[1], defVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
-		//glVertex3f(defVertices[tetraList[0 * numTetra + i]].position[0], defVertices[tetraList[0 * numTetra + i]].position[1], defVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
+	//A render mesh is moved with the simulated vertices and gets its own normals; the simulated surface is not drawn.
+	//The GPU render buffer has the simulated layout, so the state is read back for this.
+	if (renderEmbedding != NULL)
+	{
+		downloadGpuState();
+		renderEmbedding -> apply(positions, numThreads);
+		phaseSeconds[PHASE_NORMALS] += getTimeSeconds() - phaseStart;
+		return;
+	}
+
+	//The GPU writes the normals straight into the render buffer (see GpuSimulator)
+	if (gpuStateCurrent)
+	{
+		gpuSimulator -> calculateNormals();
+		phaseSeconds[PHASE_NORMALS] += getTimeSeconds() - phaseStart;
+		return;
+	}
+
+	//Cross product and this function only work if DIMENSION == 3
+	//Only the surface is rendered, so only surface triangles contribute (see buildSurface)
+	int numSurfaceTriangles = indices.size() / 3;
+
+	//Face normals (area weighted - the cross product is not normalized)
+	#pragma omp parallel for num_threads(numThreads) schedule(static)
+	for (int triangle = 0; triangle < numSurfaceTriangles; triangle++)
+	{
+		Vec3 vectorDifferenceA;  //1st vector formed for each cross product
+		Vec3 vectorDifferenceB;  //2nd vector formed for each cross product
+
+		int vertex0 = indices[triangle * 3 + 0];
+		int vertex1 = indices[triangle * 3 + 1];
+		int vertex2 = indices[triangle * 3 + 2];
 
 		for (int i = 0; i < DIMENSION; i++)
 		{
-			vectorDifferenceA[i] =  defVertices[tetraList[0 * numTetra + currentTetrad]].position[i] - defVertices[tetraList[1 * numTetra + currentTetrad]].position[i];
-			vectorDifferenceB[i] =  defVertices[tetraList[1 * numTetra + currentTetrad]].position[i] - defVertices[tetraList[2 * numTetra + currentTetrad]].position[i];
+			vectorDifferenceA[i] = positions[i * numVertices + vertex0] - positions[i * numVertices + vertex1];
+			vectorDifferenceB[i] = positions[i * numVertices + vertex1] - positions[i * numVertices + vertex2];
 		}
 
-		crossProductGeneral(crossProductResult, vectorDifferenceA, vectorDifferenceB);
+		Vec3 crossProductResult = cross(vectorDifferenceA, vectorDifferenceB);
 
 		for (int i = 0; i < DIMENSION; i++)
 		{
-			defVertices[tetraList[0 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			defVertices[tetraList[1 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			defVertices[tetraList[2 * numTetra + currentTetrad]].vertexNormal[i] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[0 * numTetra + currentTetrad]] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[1 * numTetra + currentTetrad]] += crossProductResult[i];
-			//vertexNormals[i * numVertices + tetraList[2 * numTetra + currentTetrad]] += crossProductResult[i];
+			faceNormals[triangle * DIMENSION + i] = crossProductResult[i];
 		}
-		tetraCounts[tetraList[0 * numTetra + currentTetrad]]++;
-		tetraCounts[tetraList[1 * numTetra + currentTetrad]]++;
-		tetraCounts[tetraList[2 * numTetra + currentTetrad]]++;
-
-		//glVertex3f(defVertices[tetraList[0 * numTetra + i]].position[0], defVertices[tetraList[0 * numTetra + i]].position[1], defVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
-		//glVertex3f(defVertices[tetraList[1 * numTetra + i]].position[0], defVertices[tetraList[1 * numTetra + i]].position[1], defVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-		//glVertex3f(defVertices[tetraList[2 * numTetra + i]].position[0], defVertices[tetraList[2 * numTetra + i]].position[1], defVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
-
-
 	}
 
-	for (int i = 0; i < numVertices; i++)
+	//Each vertex gathers the normals of its own surface triangles, so no two threads write the same vertex
+	#pragma omp parallel for num_threads(numThreads) schedule(static)
+	for (int vertex = 0; vertex < numVertices; vertex++)
 	{
-		double magnitude = 0;
-		for (int j = 0; j < DIMENSION; j++)
+		Vec3 vertexNormal = Vec3::zero();
+		int end = surfaceTriangleEnds != NULL ? surfaceTriangleEnds[vertex] : surfaceTriangleOffsets[vertex + 1];
+		for (int k = surfaceTriangleOffsets[vertex]; k < end; k++)
 		{
-			defVertices[i].vertexNormal[j] /= tetraCounts[i];
-			//vertexNormals[j * numVertices + i] /= tetraCounts[i];  //Find average direction of all normals for adjacent triangles
-			magnitude += defVertices[i].vertexNormal[j] * defVertices[i].vertexNormal[j];
-			//magnitude += vertexNormals[j * numVertices + i] * vertexNormals[j * numVertices + i];
+			for (int i = 0; i < DIMENSION; i++)
+			{
+				vertexNormal[i] += faceNormals[surfaceTriangles[k] * DIMENSION + i];
+			}
 		}
 
-		magnitude = sqrt(magnitude);
+		double magnitude = sqrt(dot(vertexNormal, vertexNormal));
+		if (magnitude == 0)
+		{
+			magnitude = 1;	//Interior vertex (or collapsed neighborhood) - never lit, so leave the normal zero
+		}
 
-		for (int j = 0; j < DIMENSION; j++)
+		for (int i = 0; i < DIMENSION; i++)
 		{
-			defVertices[i].vertexNormal[j] /= magnitude;
-			//vertexNormals[j * numVertices + i] /= magnitude;  //Normalize the normal to be unit length
+			defVertices[vertex].vertexNormal[i] = vertexNormal[i] / magnitude;
 		}
-		
 	}
 
+	phaseSeconds[PHASE_NORMALS] += getTimeSeconds() - phaseStart;
+
 
 //
 //	int edgeCounter = 0;	//Represents current edge number
@@ -958,398 +2478,453 @@ void ParticleSystem::calculateNormals()
 //	#endif
 }
 
-//Render the particles
-//This method is now DEPRECATED
-void ParticleSystem::doRender(double videoWriteDeltaT)
+//This method stores the current eye position (from the camera) for this mesh
+//parameter eyePos - the eye position to store
+void ParticleSystem::setEyePos(glm::vec3 & eyePos)
 {
-	
-	//glTranslatef(-halfWidth, 0.0f, halfHeight);
-	//#ifdef DEBUGGING
-	//if (logger -> isLogging)
-	//{
-	//	cout << "Entering do Render method" << endl;
-	//	logger ->printVelocitiesAndPositions(defVertices,numVertices,"Deformed Positions", "Deformed Velocities", logger ->FULL);
-	///#endif
+	this -> eyePos[0] = eyePos[0];
+	this -> eyePos[1] = eyePos[1];
+	this -> eyePos[2] = eyePos[2];
+	lightingChanged = true;
+}
 
-	for (int i = 0; i < numTetra; i++)
+//Method to externally set K and mu constants
+//The bodies given to setBodyMaterials keep their own constants
+void ParticleSystem::setConstants(double K, double mu)
+{
+	this->mu = mu;
+	this->lambda = K - (2.0/3) * mu;		//Lame's first parameter
+	materialsChanged = true;
+}
+
+//Method to externally set K, mu, and kd constants
+void ParticleSystem::setConstants(double K, double mu, double kd)
+{
+	this->mu = mu;
+	this->lambda = K - (2.0/3) * mu;		//Lame's first parameter
+	this->kd = kd;
+	materialsChanged = true;
+}
+
+//Orders bodies by their first vertex (and finds the body of a vertex with upper_bound)
+struct BodyMaterialLess
+{
+	bool operator () (const BodyMaterial & a, const BodyMaterial & b) const {return a.firstVertex < b.firstVertex;}
+	bool operator () (int vertex, const BodyMaterial & b) const {return vertex < b.firstVertex;}
+	bool operator () (const BodyMaterial & a, int vertex) const {return a.firstVertex < vertex;}
+};
+
+//Gives ranges of vertices their own constants (the bodies of a Scene); vertices outside every range use lambda, mu and kd
+//A body with hasGravity set falls with its own gravity; GPU simulation is then not used (see canSimulateOnGpu).
+//Each tetrahedron takes the constants of its vertices, so the ranges must not split a tetrahedron.
+void ParticleSystem::setBodyMaterials(const vector<BodyMaterial> & bodyMaterials)
+{
+	this -> bodyMaterials = bodyMaterials;
+	sort(this -> bodyMaterials.begin(), this -> bodyMaterials.end(), BodyMaterialLess());
+	materialsChanged = true;
+}
+
+//Fills the per tetrahedron and per vertex constants from lambda, mu, kd and bodyMaterials
+void ParticleSystem::updateMaterials()
+{
+	wakeAll();	//The frozen vertices were only at rest with the old constants
+	for (int i = 0; i < numVertices; i++)
+	{
+		vertexKd[i] = kd;
+	}
+	for (int b = 0; b < (int) bodyMaterials.size(); b++)
 	{
-		float myTetraColor(0.0);
-		if (i == 0)
+		for (int i = bodyMaterials[b].firstVertex; i < bodyMaterials[b].firstVertex + bodyMaterials[b].vertexCount; i++)
 		{
-			myTetraColor = 0.0f; // Green for tetra 1
+			vertexKd[i] = bodyMaterials[b].kd;
 		}
-		else
+	}
+
+	for (int currentTetrad = 0; currentTetrad < numTetra; currentTetrad++)
+	{
+		tetraLambda[currentTetrad] = lambda;
+		tetraMu[currentTetrad] = mu;
+		tetraKd[currentTetrad] = kd;
+
+		//Last body starting at or before the tetrahedron's first vertex
+		int vertex = tetraList[currentTetrad];
+		int b = (int) (upper_bound(bodyMaterials.begin(), bodyMaterials.end(), vertex, BodyMaterialLess()) - bodyMaterials.begin()) - 1;
+		if (b >= 0 && vertex < bodyMaterials[b].firstVertex + bodyMaterials[b].vertexCount)
 		{
-			//myTetraColor = 1.0f;  //Will end up with Green + Red for tetra 2
-			myTetraColor = 0.0f;
+			tetraLambda[currentTetrad] = bodyMaterials[b].lambda;
+			tetraMu[currentTetrad] = bodyMaterials[b].mu;
+			tetraKd[currentTetrad] = bodyMaterials[b].kd;
 		}
+	}
+	materialsChanged = false;
+	stableElasticStep = 0;
+}
 
-		if (false)
-		{
-			glColor3f(1.0f, myTetraColor, 0.0f);
-			glBegin(GL_TRIANGLES);
-			//Counter clockwise winding
-			//Triangle 1
-			glVertex3f(orgVertices[tetraList[3 * numTetra + i]].position[0], orgVertices[tetraList[3 * numTetra + i]].position[1], orgVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
-			glVertex3f(orgVertices[tetraList[1 * numTetra + i]].position[0], orgVertices[tetraList[1 * numTetra + i]].position[1], orgVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-			glVertex3f(orgVertices[tetraList[0 * numTetra + i]].position[0], orgVertices[tetraList[0 * numTetra + i]].position[1], orgVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
-		
-			glColor3f(0.8f, myTetraColor, 0.0f);
-			//Triangle 2
-			glVertex3f(orgVertices[tetraList[2 * numTetra + i]].position[0], orgVertices[tetraList[2 * numTetra + i]].position[1], orgVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
-			glVertex3f(orgVertices[tetraList[1 * numTetra + i]].position[0], orgVertices[tetraList[1 * numTetra + i]].position[1], orgVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-			glVertex3f(orgVertices[tetraList[3 * numTetra + i]].position[0], orgVertices[tetraList[3 * numTetra + i]].position[1], orgVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
+//Methods to invit Vertex buffer objects
+//Everything except the deformed positions and normals is constant, so it is uploaded here once (see sendVBOs for the per frame part)
+void ParticleSystem::initVBOs()
+{
+	//Tetrahedral mesh
+	glGenBuffers(1, vboHandle);
+	glGenBuffers(1, colorVboHandle);
+	glGenBuffers(1, indexVboHandle);
 
-			glColor3f(0.6f, myTetraColor, 0.0f);
-			//Triangle 3
-			glVertex3f(orgVertices[tetraList[2 * numTetra + i]].position[0], orgVertices[tetraList[2 * numTetra + i]].position[1], orgVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
-			glVertex3f(orgVertices[tetraList[3 * numTetra + i]].position[0], orgVertices[tetraList[3 * numTetra + i]].position[1], orgVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
-			glVertex3f(orgVertices[tetraList[0 * numTetra + i]].position[0], orgVertices[tetraList[0 * numTetra + i]].position[1], orgVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
+	//Floor
+	glGenBuffers(1, floorVboHandle);
+	glGenBuffers(1, floorIndexVboHandle);
 
-			glColor3f(0.4f, myTetraColor, 0.0f);
-			//Triangle 4
-			glVertex3f(orgVertices[tetraList[0 * numTetra + i]].position[0], orgVertices[tetraList[0 * numTetra + i]].position[1], orgVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
-			glVertex3f(orgVertices[tetraList[1 * numTetra + i]].position[0], orgVertices[tetraList[1 * numTetra + i]].position[1], orgVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-			glVertex3f(orgVertices[tetraList[2 * numTetra + i]].position[0], orgVertices[tetraList[2 * numTetra + i]].position[1], orgVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
+	//Surface triangles (see buildSurface), with room for the ones reserveSurfaceChanges made room for
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexVboHandle[0]);
+	const vector<int> & renderIndices = getRenderIndices();
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * renderIndices.capacity(), NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(int) * renderIndices.size(), &renderIndices[0]);
+	changedTrianglesBegin = changedTrianglesEnd = 0;
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-			glEnd();
+	//Vertex colors
+	vector<GLfloat> colors(4 * numVertices);
+	for (int i = 0; i < numVertices; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			colors[i * 4 + j] = defVertices[i].color[j];
 		}
+	}
+	if (renderEmbedding != NULL)
+	{
+		colors = renderEmbedding -> getColors();
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, colorVboHandle[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * colors.size(), &colors[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		glColor3f(myTetraColor, 1.0, 0.0f);
-		glBegin(GL_TRIANGLES);
-		
-		
-		int normalVertex = 0;
-		//Counter clockwise winding
-		//Triangle 1
-
-		normalVertex = tetraList[3 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[3 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[3 * numTetra + i]].position[0], defVertices[tetraList[3 * numTetra + i]].position[1], defVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
-		normalVertex = tetraList[1 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[1 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[1 * numTetra + i]].position[0], defVertices[tetraList[1 * numTetra + i]].position[1], defVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-		normalVertex = tetraList[0 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[0 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[0 * numTetra + i]].position[0], defVertices[tetraList[0 * numTetra + i]].position[1], defVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
-		
+	//Floor
+	floorVertices.clear();
+	//Vertex vertex0 = {-halfWidth, -halfHeight, halfDepth, 1, normal0[0], normal0[1], normal0[2], 0, color1[0], color1[1], color1[2], 1.0f}; //Front lower left
+	Vertex vertex0 = Vertex(-10.0f, -4.0f, -10.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0);
+	Vertex vertex1 = Vertex(10.0f, -4.0f, -10.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f,  0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0);
+	Vertex vertex2 = Vertex(10.0f, -4.0f, 10.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0);
+	Vertex vertex3 = Vertex(-10.0f, -4.0f, 10.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0);
+
+	floorVertices.push_back(vertex0);
+	floorVertices.push_back(vertex1);
+	floorVertices.push_back(vertex2);
+	floorVertices.push_back(vertex3);
 
-		glColor3f(myTetraColor, 0.8f, 0.0f);
-		normalVertex = tetraList[2 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[2 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[2 * numTetra + i]].position[0], defVertices[tetraList[2 * numTetra + i]].position[1], defVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
-		normalVertex = tetraList[1 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[1 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[1 * numTetra + i]].position[0], defVertices[tetraList[1 * numTetra + i]].position[1], defVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-		normalVertex = tetraList[3 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[3 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[3 * numTetra + i]].position[0], defVertices[tetraList[3 * numTetra + i]].position[1], defVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
-
-
-		glColor3f(myTetraColor, 0.6f, 0.0f);
-		normalVertex = tetraList[2 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[2 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[2 * numTetra + i]].position[0], defVertices[tetraList[2 * numTetra + i]].position[1], defVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
-		normalVertex = tetraList[3 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[3 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[3 * numTetra + i]].position[0], defVertices[tetraList[3 * numTetra + i]].position[1], defVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
-		normalVertex = tetraList[0 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[0 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[0 * numTetra + i]].position[0], defVertices[tetraList[0 * numTetra + i]].position[1], defVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
-
-
-		glColor3f(myTetraColor, 0.4f, 0.0f);
-		normalVertex = tetraList[0 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[0 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[0 * numTetra + i]].position[0], defVertices[tetraList[0 * numTetra + i]].position[1], defVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
-		normalVertex = tetraList[1 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[1 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[1 * numTetra + i]].position[0], defVertices[tetraList[1 * numTetra + i]].position[1], defVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-		normalVertex = tetraList[2 * numTetra + i];
-		glNormal3f(defVertices[normalVertex].vertexNormal[0], defVertices[normalVertex].vertexNormal[1], defVertices[normalVertex].vertexNormal[2]);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[2 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[2 * numTetra + i]].position[0], defVertices[tetraList[2 * numTetra + i]].position[1], defVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
-
-		glEnd();
 		
-	}
+	floorIndices.clear();
+	//Two triangles for a quad
+	floorIndices.push_back(0);
+	floorIndices.push_back(1);
+	floorIndices.push_back(2);
+	floorIndices.push_back(2);
+	floorIndices.push_back(3);
+	floorIndices.push_back(0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, floorVboHandle[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * floorVertices.size(), &floorVertices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, floorIndexVboHandle[0]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * floorIndices.size(), &floorIndices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-	//Draw Normals
-	if (showNormals)
+	//Every face of every tetrahedron, counter clockwise seen from outside, for the RGB view
+	//With a render mesh the streamed buffer holds the render vertices instead, and the RGB view colors its surface.
+	vector<int> tetraFaceIndices;
+	if (renderEmbedding == NULL)
 	{
-		int verticesForNormals [3][4] = {{0, 1, 0 , 0}, {1, 2, 1, 2}, {2, 3, 3, 3}};
-		double midPoint[3];
-		double midPlusNormal[3];
+		tetraFaceIndices.resize(12 * numTetra);
 		for (int i = 0; i < numTetra; i++)
 		{
-			for (int j = 0; j < 4; j++)
+			for (int k = 0; k < 12; k++)
 			{
-				midPoint[0] = (defVertices[tetraList[verticesForNormals[0][j] * numTetra+ i]].position[0] + defVertices[tetraList[verticesForNormals[1][j] * numTetra+ i]].position[0] + defVertices[tetraList[verticesForNormals[2][j] * numTetra+ i]].position[0]) / 3.0;
-				midPoint[1] = (defVertices[tetraList[verticesForNormals[0][j] * numTetra+ i]].position[1] + defVertices[tetraList[verticesForNormals[1][j] * numTetra+ i]].position[1] + defVertices[tetraList[verticesForNormals[2][j] * numTetra+ i]].position[1]) / 3.0;
-				midPoint[2] = (defVertices[tetraList[verticesForNormals[0][j] * numTetra+ i]].position[2] + defVertices[tetraList[verticesForNormals[1][j] * numTetra+ i]].position[2] + defVertices[tetraList[verticesForNormals[2][j] * numTetra+ i]].position[2]) / 3.0;
-
-				//Vertex vertex1 = defVertices[tetraList[verticesForNormals[0][j] * numTetra+ i]];
-				//cout << "Midpoint vertex #1:" << endl;
-				//for (int i = 0; i < 3; i++)
-				//{
-				//	cout << vertex1.position[i] << " ";
-				//}
-				//cout << endl;
-
-				//Vertex vertex2 = defVertices[tetraList[verticesForNormals[1][j] * numTetra+ i]];
-				//cout << "Midpoint vertex #2:" << endl;
-				//for (int i = 0; i < 3; i++)
-				//{
-				//	cout << vertex2.position[i] << " ";
-				//}
-				//cout << endl;
-				
-				//Vertex vertex3 = defVertices[tetraList[verticesForNormals[2][j] * numTetra+ i]];
-				//cout << "Midpoint vertex #3:" << endl;
-				//for (int i = 0; i < 3; i++)
-				//{
-				//	cout << vertex3.position[i] << " ";
-				//}
-				//cout << endl;
-
-				#ifdef DEBUGGING
-				if (logger -> isLogging)
-				{
-					logger -> printVector(midPoint,3,"midPoint", logger -> FULL);
-					cout << endl;
-				}
-				#endif
+				tetraFaceIndices[i * 12 + k] = tetraList[TETRA_FACE_CORNERS[k] * numTetra + i];
+			}
+		}
+		glGenBuffers(1, &tetraFaceIndexVboHandle);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tetraFaceIndexVboHandle);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * tetraFaceIndices.size(), &tetraFaceIndices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	tetraFaceIndexCount = (int) tetraFaceIndices.size();
 
+	//Vertex array objects - the attribute layout is specified here once instead of at every draw
+	glGenVertexArrays(1, &meshVao);
+	glBindVertexArray(meshVao);
+	glBindBuffer(GL_ARRAY_BUFFER, vboHandle[0]);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * RENDER_STREAM_FLOATS, (char *) NULL + 0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * RENDER_STREAM_FLOATS, (char *) NULL + 16);
+	glBindBuffer(GL_ARRAY_BUFFER, colorVboHandle[0]);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4, (char *) NULL + 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexVboHandle[0]);
 
-				midPlusNormal[0] = midPoint[0] + normals[0 * 4 * numTetra + i * 4 + j];
-				midPlusNormal[1] = midPoint[1] + normals[1 * 4 * numTetra + i * 4 + j];
-				midPlusNormal[2] = midPoint[2] + normals[2 * 4 * numTetra + i * 4 + j];
+	//The same vertices drawn as tetrahedron faces
+	if (tetraFaceIndexCount > 0)
+	{
+		glGenVertexArrays(1, &tetraFaceVao);
+		glBindVertexArray(tetraFaceVao);
+		glBindBuffer(GL_ARRAY_BUFFER, vboHandle[0]);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * RENDER_STREAM_FLOATS, (char *) NULL + 0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * RENDER_STREAM_FLOATS, (char *) NULL + 16);
+		glBindBuffer(GL_ARRAY_BUFFER, colorVboHandle[0]);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4, (char *) NULL + 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tetraFaceIndexVboHandle);
+	}
 
-				#ifdef DEBUGGING
-				if (logger -> isLogging)
-				{
-					logger -> printVector(midPlusNormal,3,"midPlusNormal", logger -> FULL);
-					cout << endl;
-				}
-				#endif
+	glGenVertexArrays(1, &floorVao);
+	glBindVertexArray(floorVao);
+	glBindBuffer(GL_ARRAY_BUFFER, floorVboHandle[0]);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (char *) NULL + 0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (char *) NULL + 16);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (char *) NULL + 32);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, floorIndexVboHandle[0]);
 
-				glColor3f(1.0f, 0.0f, 0.0f);
-				glBegin(GL_LINES);
-				glVertex3f(midPoint[0], midPoint[1], midPoint[2]);
-				glVertex3f(midPlusNormal[0], midPlusNormal[1], midPlusNormal[2]);
-				glEnd();
-			}
-		}
-	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-	glBegin(GL_QUADS);
-		glNormal3f(0.0f, 1.0f, 0.0f);
-		glVertex3f(-10.0f, -4.0f, -10.0f);
-		glNormal3f(0.0f, 1.0f, 0.0f);
-		glVertex3f(10.0f, -4.0f, -10.0f);
-		glNormal3f(0.0f, 1.0f, 0.0f);
-		glVertex3f(10.0f, -4.0f, 10.0f);
-		glNormal3f(0.0f, 1.0f, 0.0f);
-		glVertex3f(-10.0f, -4.0f, 10.0f);
-	glEnd();
+	//Lighting and material (uploaded by updateLightingBlocks whenever they change)
+	glGenBuffers(2, lightingUboHandles);
+	for (int i = 0; i < 2; i++)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, lightingUboHandles[i]);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(LightingBlock), NULL, GL_DYNAMIC_DRAW);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	lightingChanged = true;
+}
 
-	//Render onscreen text with informational messages
-	//Note: This now will be written to the video images
-	if (showInfoText)
+//Sends the parts of the surface triangles, the RGB view faces and the vertex colors that changed with the mesh topology (fracture)
+//Only the changed ranges are uploaded into the buffers initVBOs made, so a frame with a few splits costs a few small uploads.
+void ParticleSystem::uploadMeshChanges()
+{
+	if (changedTrianglesBegin == changedTrianglesEnd && changedTetra.empty() && changedVertices.empty())
 	{
-		//Reference: http://programming-technique.blogspot.com/2012/05/font-rendering-in-glut-using-bitmap.html
-		glDisable(GL_LIGHTING);
-		glColor4f(0.0f, 0.0f, 1.0f, 1.0f);
-		glMatrixMode(GL_PROJECTION);
-		glPushMatrix();
-		glLoadIdentity();
-		gluOrtho2D(0, windowWidth, 0, windowHeight);
-		
-		glMatrixMode(GL_MODELVIEW);
-		glPushMatrix();
-		glLoadIdentity();
-		glRasterPos2i(20, 20);
-		for (int i = 0; i < strlen(text); i++)
-		{
-			glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, text[i]);
-		}
-		glPopMatrix();
-		glMatrixMode(GL_PROJECTION);
-		glPopMatrix();
-		glMatrixMode(GL_MODELVIEW);
-		glEnable(GL_LIGHTING);
+		return;
 	}
 
-	if (renderToImage)
+	glBindVertexArray(0);	//The element array binding belongs to the bound vertex array object
+	if (changedTrianglesBegin < changedTrianglesEnd && renderEmbedding == NULL)
 	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexVboHandle[0]);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * 3 * changedTrianglesBegin, sizeof(int) * 3 * (changedTrianglesEnd - changedTrianglesBegin),
+			&indices[3 * changedTrianglesBegin]);
+	}
+	changedTrianglesBegin = changedTrianglesEnd = 0;
 
-		if (timeSinceVideoWrite >= videoWriteDeltaT)
+	if (tetraFaceIndexCount > 0)
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tetraFaceIndexVboHandle);
+		for (int i = 0; i < (int) changedTetra.size(); i++)
 		{
-			timeSinceVideoWrite = 0.0;
-			//Read the rendered image into a buffer
-			glFlush();
-			glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, screenBuffer);
-
-			//Vertically flip the image in memory - it flips two rows from the screen in memory at a time
-			for (int i = 0; i < windowHeight / 2; i++)
+			int faceIndices[12];
+			for (int k = 0; k < 12; k++)
 			{
-				if (i != windowHeight - i)
-				{
-					memcpy(screenRowTemp,(uint8_t *)&screenBuffer[i * windowWidth * 4], windowWidth * 4 * sizeof(uint8_t));
-					memcpy((uint8_t *)&screenBuffer[i * windowWidth * 4], (uint8_t *)&screenBuffer[(windowHeight - i) * windowWidth * 4], windowWidth * 4 * sizeof(uint8_t));
-					memcpy((uint8_t *)&screenBuffer[(windowHeight - i) * windowWidth * 4], screenRowTemp, windowWidth * 4 * sizeof(uint8_t));
-				}
+				faceIndices[k] = tetraList[TETRA_FACE_CORNERS[k] * numTetra + changedTetra[i]];
 			}
-		
-			//Write a new targa file, with a new number
-			sprintf(imageFileName, "images\\ImplicitMethods%d.tga", frameNumber);
-			tga_result result = tga_write_rgb(imageFileName, screenBuffer, windowWidth, windowHeight, 32);
-			#ifdef DEBUGGING
-			if (logger -> isLogging && logger -> loggingLevel >= logger -> LIGHT)
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * 12 * changedTetra[i], sizeof(faceIndices), faceIndices);
+		}
+	}
+	changedTetra.clear();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	if (renderEmbedding == NULL)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, colorVboHandle[0]);
+		for (int i = 0; i < (int) changedVertices.size(); i++)
+		{
+			GLfloat color[4];
+			for (int j = 0; j < 4; j++)
 			{
-				if (result != TGA_NOERR)
-				{
-					cout << tga_error(result) << " at frame number " << frameNumber << endl;
-				}
+				color[j] = defVertices[changedVertices[i]].color[j];
 			}
-			#endif
-
-			frameNumber++;
+			glBufferSubData(GL_ARRAY_BUFFER, sizeof(color) * changedVertices[i], sizeof(color), color);
 		}
-
-		
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
-		
-}
-
-//This method stores the current eye position (from the camera) for this mesh
-//parameter eyePos - the eye position to store
-void ParticleSystem::setEyePos(glm::vec3 & eyePos)
-{
-	this -> eyePos[0] = eyePos[0];
-	this -> eyePos[1] = eyePos[1];
-	this -> eyePos[2] = eyePos[2];
-}
-
-//Method to externally set K and mu constants
-void ParticleSystem::setConstants(double K, double mu)
-{
-	this->mu = mu;
-	this->lambda = K - (2.0/3) * mu;		//Lame's first parameter
-}
-
-//Method to externally set K, mu, and kd constants
-void ParticleSystem::setConstants(double K, double mu, double kd)
-{
-	this->mu = mu;
-	this->lambda = K - (2.0/3) * mu;		//Lame's first parameter
-	this->kd = kd;
+	changedVertices.clear();
 }
 
-//Methods to invit Vertex buffer objects
-void ParticleSystem::initVBOs()
-{
-	//Tetrahedral mesh
-	glGenBuffers(1, vboHandle);
-	glGenBuffers(1, indexVboHandle);
-
-	//Floor
-	glGenBuffers(1, floorVboHandle);
-	glGenBuffers(1, floorIndexVboHandle);
-}
-
-//Method to send vertex buffer objects to graphics card, needed for GLSL
+//Method to send the deformed vertices to graphics card each frame, needed for GLSL
+//Only the positions and normals change (apart from uploadMeshChanges), so they are streamed interleaved (RENDER_STREAM_FLOATS floats per vertex).
+//The buffer is orphaned before it is mapped so the driver hands out fresh memory instead of waiting for the previous frame's draw.
 void ParticleSystem::sendVBOs()
 {
-	//Tetrahedral Mesh
-	glBindBuffer(GL_ARRAY_BUFFER, vboHandle[0]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * numVertices, defVertices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	uploadMeshChanges();
 
-	//glColor3f(myTetraColor, 1.0, 0.0f);
-	indices.clear();
-	for (int i = 0; i < numTetra; i++)
+	//With render snapshots the buffer only has to change when the simulation thread has published a new frame, and with
+	//GPU simulation calculateNormals already wrote it (unless a render mesh is drawn instead)
+	if ((useRenderSnapshots && !snapshotChanged) || (gpuStateCurrent && renderEmbedding == NULL))
 	{
-		//Counter clockwise winding
-		//Triangle 1
-		indices.push_back(tetraList[3 * numTetra + i]);
-		indices.push_back(tetraList[1 * numTetra + i]);
-		indices.push_back(tetraList[0 * numTetra + i]);
-		
-		indices.push_back(tetraList[2 * numTetra + i]);
-		indices.push_back(tetraList[1 * numTetra + i]);
-		indices.push_back(tetraList[3 * numTetra + i]);
+		return;
+	}
 
-		indices.push_back(tetraList[2 * numTetra + i]);
-		indices.push_back(tetraList[3 * numTetra + i]);
-		indices.push_back(tetraList[0 * numTetra + i]);
+	ProfileScope profileScope(logger -> profiler, "sendVBOs");
 
-		indices.push_back(tetraList[0 * numTetra + i]);
-		indices.push_back(tetraList[1 * numTetra + i]);
-		indices.push_back(tetraList[2 * numTetra + i]);
+	int renderVertexCount = getRenderVertexCount();
+	glBindBuffer(GL_ARRAY_BUFFER, vboHandle[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * RENDER_STREAM_FLOATS * renderVertexCount, NULL, GL_STREAM_DRAW);
 
+	GLfloat * stream = (GLfloat *) glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+	if (stream != NULL && useRenderSnapshots)
+	{
+		//The snapshot already has the streamed layout
+		memcpy(stream, renderSnapshots[displaySnapshot], sizeof(GLfloat) * RENDER_STREAM_FLOATS * renderVertexCount);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		snapshotChanged = false;
+	}
+	else if (stream != NULL && renderEmbedding != NULL)
+	{
+		memcpy(stream, renderEmbedding -> getStream(), sizeof(GLfloat) * RENDER_STREAM_FLOATS * renderVertexCount);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	else if (stream != NULL)
+	{
+		for (int i = 0; i < numVertices; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				stream[i * RENDER_STREAM_FLOATS + j] = defVertices[i].position[j];
+				stream[i * RENDER_STREAM_FLOATS + 4 + j] = defVertices[i].vertexNormal[j];
+			}
+		}
+		glUnmapBuffer(GL_ARRAY_BUFFER);
 	}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexVboHandle[0]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * indices.size(), &indices[0], GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-	//Floor
-	floorVertices.clear();
-	//Vertex vertex0 = {-halfWidth, -halfHeight, halfDepth, 1, normal0[0], normal0[1], normal0[2], 0, color1[0], color1[1], color1[2], 1.0f}; //Front lower left
-	Vertex vertex0 = Vertex(-10.0f, -4.0f, -10.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0);
-	Vertex vertex1 = Vertex(10.0f, -4.0f, -10.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f,  0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0);
-	Vertex vertex2 = Vertex(10.0f, -4.0f, 10.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0);
-	Vertex vertex3 = Vertex(-10.0f, -4.0f, 10.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-	floorVertices.push_back(vertex0);
-	floorVertices.push_back(vertex1);
-	floorVertices.push_back(vertex2);
-	floorVertices.push_back(vertex3);
+//Resolves the per draw uniforms of the shader programs and binds their Lighting blocks to LIGHTING_UNIFORM_BINDING
+//Parameter programObject - the lighting shaders (maze)
+//Parameter rgbProgramObject - the RGB debugging variant of them (maze with RGB_COLORS and the geometry shader - see SetupGLSL)
+void ParticleSystem::setProgramObject(GLuint programObject, GLuint rgbProgramObject)
+{
+	GLuint programObjects[2] = {programObject, rgbProgramObject};
+	RenderProgram * renderPrograms[2] = {&lightingProgram, &rgbProgram};
+	for (int i = 0; i < 2; i++)
+	{
+		RenderProgram & renderProgram = *renderPrograms[i];
+		renderProgram.program = programObjects[i];
+		renderProgram.local2clip = glGetUniformLocation(programObjects[i], "local2clip");
+		renderProgram.local2eye = glGetUniformLocation(programObjects[i], "local2eye");
+		renderProgram.normalMatrix = glGetUniformLocation(programObjects[i], "normalMatrix");
+
+		GLuint blockIndex = glGetUniformBlockIndex(programObjects[i], "Lighting");
+		if (blockIndex != GL_INVALID_INDEX)
+		{
+			glUniformBlockBinding(programObjects[i], blockIndex, LIGHTING_UNIFORM_BINDING);
+		}
+	}
+}
 
-		
-	floorIndices.clear();
-	//Two triangles for a quad
-	floorIndices.push_back(0);
-	floorIndices.push_back(1);
-	floorIndices.push_back(2);
-	floorIndices.push_back(2);
-	floorIndices.push_back(3);
-	floorIndices.push_back(0);
+//Uploads the lighting and material of the mesh and of the floor if they changed since the last draw
+void ParticleSystem::updateLightingBlocks()
+{
+	if (!lightingChanged)
+	{
+		return;
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, floorVboHandle[0]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * floorVertices.size(), &floorVertices[0], GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	LightingBlock blocks[2];
+	for (int i = 0; i < 2; i++)
+	{
+		LightingBlock & block = blocks[i];
+		for (int j = 0; j < 3; j++)
+		{
+			block.lightDiffuse[j] = lightDiffuse[j];
+			block.lightSpecular[j] = lightSpecular[j];
+			block.eyePosition[j] = eyePos[j];
+			block.ambientCoefficient[j] = matAmbient[j];
+			block.diffuseCoefficient[j] = matDiffuse[j];
+			block.specularCoefficient[j] = matSpecular[j];
+		}
+		for (int j = 0; j < 4; j++)
+		{
+			block.lightPosition[j] = lightPosition[j];
+		}
+		block.lightAmbient[3] = block.lightDiffuse[3] = block.lightSpecular[3] = block.eyePosition[3] = 1;
+		block.ambientCoefficient[3] = block.diffuseCoefficient[3] = block.specularCoefficient[3] = 1;
+		block.shininess = matShininess[0];
+		block.padding[0] = block.padding[1] = block.padding[2] = 0;
+	}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, floorIndexVboHandle[0]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * floorIndices.size(), &floorIndices[0], GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	//If in ambient mode, add extra ambience to make things really bright
+	//Otherwise use normal ambience (the floor gets a little more)
+	for (int j = 0; j < 3; j++)
+	{
+		blocks[0].lightAmbient[j] = ambientMode ? lightFullAmbient[j] : lightAmbient[j];
+		blocks[1].lightAmbient[j] = ambientMode ? lightAmbient[j] : 0.125f;
+	}
+	if (ambientMode)
+	{
+		blocks[1].lightAmbient[2] = lightFullAmbient[2];
+	}
 
+	for (int i = 0; i < 2; i++)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, lightingUboHandles[i]);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightingBlock), &blocks[i]);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	lightingChanged = false;
+}
 
+//Draws indexCount indices of vao with renderProgram
+//Parameter lightingUbo - the lighting block to use (see lightingUboHandles)
+void ParticleSystem::drawElements(const RenderProgram & renderProgram, GLuint vao, int indexCount, GLuint lightingUbo, glm::mat4 & projMatrix, glm::mat4 & modelViewMatrix)
+{
+	glm::mat4 totalMatrix = projMatrix * modelViewMatrix;
+	glm::mat4 normalMatrix = glm::transpose(glm::inverse(modelViewMatrix));
+
+	glUseProgram(renderProgram.program);
+	glUniformMatrix4fv(renderProgram.local2clip, 1, GL_FALSE, &totalMatrix[0][0]);
+	glUniformMatrix4fv(renderProgram.local2eye, 1, GL_FALSE, &modelViewMatrix[0][0]);
+	glUniformMatrix4fv(renderProgram.normalMatrix, 1, GL_FALSE, &normalMatrix[0][0]);
+	glBindBufferBase(GL_UNIFORM_BUFFER, LIGHTING_UNIFORM_BINDING, lightingUbo);
+
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, (char *) NULL + 0);
+	glBindVertexArray(0);
+	glUseProgram(0);
 }
 
 //Method to render output to screen
+//The mesh is drawn with the lighting shaders, or in RGB mode with their RGB variant (all tetrahedron faces, no lighting), and
+//the floor always with lighting.  All vertex data is already on the graphics card, so a draw only sets the matrices.
 void ParticleSystem::doRender(double videoWriteDeltaT, glm::mat4 & projMatrix, glm::mat4 & floorModelViewMatrix, glm::mat4 & tetraModelViewMatrix)
 {
-	if (this->useRGBColor)
+	//When the simulation runs on its own thread the newest published snapshot is drawn instead of the live state
+	if (useRenderSnapshots)
 	{
-		doRenderRGB(videoWriteDeltaT, projMatrix, floorModelViewMatrix, tetraModelViewMatrix);
+		acquireRenderSnapshot();
+	}
+	else if (!gpuStateCurrent)
+	{
+		updateRenderVertices();
+	}
+
+	sendVBOs();
+	updateLightingBlocks();
+
+	if (useRGBColor && tetraFaceIndexCount > 0)
+	{
+		drawElements(rgbProgram, tetraFaceVao, tetraFaceIndexCount, lightingUboHandles[0], projMatrix, tetraModelViewMatrix);
 	}
 	else
 	{
-		doRenderWithLighting(videoWriteDeltaT, projMatrix, floorModelViewMatrix, tetraModelViewMatrix);
+		drawElements(useRGBColor ? rgbProgram : lightingProgram, meshVao, (int) getRenderIndices().size(), lightingUboHandles[0], projMatrix, tetraModelViewMatrix);
 	}
+	drawElements(lightingProgram, floorVao, (int) floorIndices.size(), lightingUboHandles[1], projMatrix, floorModelViewMatrix);
 	
 	//Render onscreen text with informational messages
 	//Note: This now will be written to the video images
@@ -1383,35 +2958,7 @@ void ParticleSystem::doRender(double videoWriteDeltaT, glm::mat4 & projMatrix, g
 		//if (timeSinceVideoWrite >= videoWriteDeltaT)
 		{
 			timeSinceVideoWrite = 0.0;
-			//Read the rendered image into a buffer
-			glFlush();
-			glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, screenBuffer);
-
-			//Vertically flip the image in memory - it flips two rows from the screen in memory at a time
-			for (int i = 0; i < windowHeight / 2; i++)
-			{
-				if (i != windowHeight - i)
-				{
-					memcpy(screenRowTemp,(uint8_t *)&screenBuffer[i * windowWidth * 4], windowWidth * 4 * sizeof(uint8_t));
-					memcpy((uint8_t *)&screenBuffer[i * windowWidth * 4], (uint8_t *)&screenBuffer[(windowHeight - i) * windowWidth * 4], windowWidth * 4 * sizeof(uint8_t));
-					memcpy((uint8_t *)&screenBuffer[(windowHeight - i) * windowWidth * 4], screenRowTemp, windowWidth * 4 * sizeof(uint8_t));
-				}
-			}
-		
-			//Write a new targa file, with a new number
-			sprintf(imageFileName, "images\\ImplicitMethods%d.tga", frameNumber);
-			tga_result result = tga_write_rgb(imageFileName, screenBuffer, windowWidth, windowHeight, 32);
-			#ifdef DEBUGGING
-			if (logger -> isLogging && logger -> loggingLevel >= logger -> LIGHT)
-			{
-				if (result != TGA_NOERR)
-				{
-					cout << tga_error(result) << " at frame number " << frameNumber << endl;
-				}
-			}
-			#endif
-
-			frameNumber++;
+			captureFrame();
 		}
 
 		
@@ -1419,231 +2966,6 @@ void ParticleSystem::doRender(double videoWriteDeltaT, glm::mat4 & projMatrix, g
 		
 }
 
-//Render with full GLSL lighting
-void ParticleSystem::doRenderWithLighting(double videoWriteDeltaT, glm::mat4 & projMatrix, glm::mat4 & floorModelViewMatrix, glm::mat4 & tetraModelViewMatrix)
-{
-	sendVBOs();
-
-	glm::mat4 totalMatrix = projMatrix * tetraModelViewMatrix;
-	glm::mat4 normalMatrix = glm::inverse(tetraModelViewMatrix);
-	normalMatrix = glm::transpose(normalMatrix);
-
-	//Tetrahedral mesh rendering
-	glUseProgram(programObject);
-
-	//Parameter setup
-	GLuint c0 = glGetAttribLocation(programObject, "position");
-	GLuint c1 = glGetAttribLocation(programObject, "normal");
-	GLuint c2 = glGetAttribLocation(programObject, "color1");
-
-	GLuint l1 = glGetUniformLocation(programObject, "lightAmbient");
-	GLuint l2 = glGetUniformLocation(programObject, "lightDiffuse");
-	GLuint l3 = glGetUniformLocation(programObject, "lightSpecular");
-	GLuint lp = glGetUniformLocation(programObject, "lightPosition");
-	GLuint ep = glGetUniformLocation(programObject, "eyePosition");
-
-	GLuint d1 = glGetUniformLocation(programObject, "ambient_coef");
-	GLuint d2 = glGetUniformLocation(programObject, "diffuse_coef");
-	GLuint d3 = glGetUniformLocation(programObject, "specular_coef");
-	GLuint d4 = glGetUniformLocation(programObject, "mat_shininess");
-
-	GLuint m1 = glGetUniformLocation(programObject, "local2clip");
-	GLuint m2 = glGetUniformLocation(programObject, "local2eye");
-	GLuint m3 = glGetUniformLocation(programObject, "normalMatrix");
-
-	glEnableVertexAttribArray(c0); 
-	glEnableVertexAttribArray(c1);
-    glEnableVertexAttribArray(c2); 
-
-	glBindBuffer(GL_ARRAY_BUFFER, vboHandle[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexVboHandle[0]);
-
-	glVertexAttribPointer(c0,4,GL_FLOAT, GL_FALSE, sizeof(Vertex),(char*) NULL+0); 
-	glVertexAttribPointer(c1,4,GL_FLOAT, GL_FALSE, sizeof(Vertex),(char*) NULL+16); 
-    glVertexAttribPointer(c2,4,GL_FLOAT, GL_FALSE, sizeof(Vertex),(char*) NULL+32); 
-
-	//If in ambient mode, add extra ambience to make things really bright
-	//Otherwise use normal ambience
-	if (ambientMode)
-	{
-		glUniform4f(l1, lightFullAmbient[0], lightFullAmbient[1], lightFullAmbient[2], 1.0);
-	}
-	else
-	{
-		glUniform4f(l1, lightAmbient[0], lightAmbient[1], lightAmbient[2], 1.0);
-	}
-	glUniform4f(l2, lightDiffuse[0], lightDiffuse[1], lightDiffuse[2], 1.0);
-	glUniform4f(l3, lightSpecular[0], lightSpecular[1], lightSpecular[2],1.0);
-	glUniform4f(lp, lightPosition[0], lightPosition[1], lightPosition[2], lightPosition[3]);
-	glUniform4f(ep, eyePos[0], eyePos[1], eyePos[2], 1); 
-
-	glUniform4f(d1, matAmbient[0], matAmbient[1], matAmbient[2], 1.0);
-	glUniform4f(d2, matDiffuse[0], matDiffuse[1], matDiffuse[2], 1.0);
-	glUniform4f(d3, matSpecular[0], matSpecular[1], matSpecular[2],1.0);
-	glUniform1f(d4, matShininess[0]);
-
-	glUniformMatrix4fv(m1, 1, GL_FALSE, &totalMatrix[0][0]);
-	glUniformMatrix4fv(m2, 1, GL_FALSE, &tetraModelViewMatrix[0][0]);
-	glUniformMatrix4fv(m3, 1, GL_FALSE, &normalMatrix[0][0]);
-
-	//Draw
-	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (char *) NULL + 0);
-
-	glUseProgram(0);
-	
-	////////////////////////////////////////////////////////////////////////////////////
-	//Floor rendering
-
-	totalMatrix = projMatrix * floorModelViewMatrix;
-	normalMatrix = glm::inverse(floorModelViewMatrix);
-	normalMatrix = glm::transpose(normalMatrix);
-
-
-	glUseProgram(programObject);
-
-	//Parameter setup
-	c0 = glGetAttribLocation(programObject, "position");
-	c1 = glGetAttribLocation(programObject, "normal");
-	c2 = glGetAttribLocation(programObject, "color1");
-
-	l1 = glGetUniformLocation(programObject, "lightAmbient");
-	l2 = glGetUniformLocation(programObject, "lightDiffuse");
-	l3 = glGetUniformLocation(programObject, "lightSpecular");
-	lp = glGetUniformLocation(programObject, "lightPosition");
-	ep = glGetUniformLocation(programObject, "eyePosition");
-
-	d1 = glGetUniformLocation(programObject, "ambient_coef");
-	d2 = glGetUniformLocation(programObject, "diffuse_coef");
-	d3 = glGetUniformLocation(programObject, "specular_coef");
-	d4 = glGetUniformLocation(programObject, "mat_shininess");
-
-	m1 = glGetUniformLocation(programObject, "local2clip");
-	m2 = glGetUniformLocation(programObject, "local2eye");
-	m3 = glGetUniformLocation(programObject, "normalMatrix");
-
-	glEnableVertexAttribArray(c0); 
-	glEnableVertexAttribArray(c1);
-    glEnableVertexAttribArray(c2); 
-
-	glBindBuffer(GL_ARRAY_BUFFER, floorVboHandle[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, floorIndexVboHandle[0]);
-
-	glVertexAttribPointer(c0,4,GL_FLOAT, GL_FALSE, sizeof(Vertex),(char*) NULL+0); 
-	glVertexAttribPointer(c1,4,GL_FLOAT, GL_FALSE, sizeof(Vertex),(char*) NULL+16); 
-    glVertexAttribPointer(c2,4,GL_FLOAT, GL_FALSE, sizeof(Vertex),(char*) NULL+32); 
-
-	//If in ambient mode, add extra ambience to make things really bright
-	//Otherwise use normal ambience
-	if (ambientMode)
-	{
-		glUniform4f(l1, lightAmbient[0], lightAmbient[1], lightFullAmbient[2], 1.0);
-	}
-	else
-	{
-		glUniform4f(l1, 0.125, 0.125, 0.125, 1.0);
-	}
-	glUniform4f(l2, lightDiffuse[0], lightDiffuse[1], lightDiffuse[2], 1.0);
-	glUniform4f(l3, lightSpecular[0], lightSpecular[1], lightSpecular[2],1.0);
-	glUniform4f(lp, lightPosition[0], lightPosition[1], lightPosition[2], lightPosition[3]);
-	glUniform4f(ep, eyePos[0], eyePos[1], eyePos[2], 1); 
-
-	glUniform4f(d1, matAmbient[0], matAmbient[1], matAmbient[2], 1.0);
-	glUniform4f(d2, matDiffuse[0], matDiffuse[1], matDiffuse[2], 1.0);
-	glUniform4f(d3, matSpecular[0], matSpecular[1], matSpecular[2],1.0);
-	glUniform1f(d4, matShininess[0]);
-
-	glUniformMatrix4fv(m1, 1, GL_FALSE, &totalMatrix[0][0]);
-	glUniformMatrix4fv(m2, 1, GL_FALSE, &floorModelViewMatrix[0][0]);
-	glUniformMatrix4fv(m3, 1, GL_FALSE, &normalMatrix[0][0]);
-
-	//Draw
-	glDrawElements(GL_TRIANGLES, floorIndices.size(), GL_UNSIGNED_INT, (char *) NULL + 0);
-
-	glUseProgram(0);
-}
-
-//Render in special RGB mode for debugging, with no lighting
-void ParticleSystem::doRenderRGB(double videoWriteDeltaT, glm::mat4 & projMatrix, glm::mat4 & floorModelViewMatrix, glm::mat4 & tetraModelViewMatrix)
-{
-	glm::mat4 totalMatrix = projMatrix * tetraModelViewMatrix;
-		
-	glMatrixMode(GL_MODELVIEW);
-	glLoadMatrixf(&totalMatrix[0][0]);
-
-	for (int i = 0; i < numTetra; i++)
-	{
-		//glColor3f(myTetraColor, 1.0, 0.0f);
-		glBegin(GL_TRIANGLES);
-		//Counter clockwise winding
-		//Triangle 1
-		glColor3f(1.0f, 0.0f, 0.0f);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[3 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[3 * numTetra + i]].position[0], defVertices[tetraList[3 * numTetra + i]].position[1], defVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[1 * numTetra + i]]);
-		
-		glColor3f(0.0f, 1.0f, 0.0f);
-		glVertex3f(defVertices[tetraList[1 * numTetra + i]].position[0], defVertices[tetraList[1 * numTetra + i]].position[1], defVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-		
-		glColor3f(0.0f, 0.0f, 1.0f);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[0 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[0 * numTetra + i]].position[0], defVertices[tetraList[0 * numTetra + i]].position[1], defVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
-		
-		
-		glColor3f(1.0f, 0.0f, 0.0f);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[2 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[2 * numTetra + i]].position[0], defVertices[tetraList[2 * numTetra + i]].position[1], defVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[1 * numTetra + i]]);
-		
-		glColor3f(0.0f, 1.0f, 0.0f);
-		glVertex3f(defVertices[tetraList[1 * numTetra + i]].position[0], defVertices[tetraList[1 * numTetra + i]].position[1], defVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-		
-		glColor3f(0.0f, 0.0f, 1.0f);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[3 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[3 * numTetra + i]].position[0], defVertices[tetraList[3 * numTetra + i]].position[1], defVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
-
-		glColor3f(1.0f, 0.0f, 0.0f);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[2 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[2 * numTetra + i]].position[0], defVertices[tetraList[2 * numTetra + i]].position[1], defVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
-		
-		glColor3f(0.0f, 1.0f, 0.0f);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[3 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[3 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[3 * numTetra + i]].position[0], defVertices[tetraList[3 * numTetra + i]].position[1], defVertices[tetraList[3 * numTetra + i]].position[2]);  //vertex 3
-		
-		glColor3f(0.0f, 0.0f, 1.0f);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[0 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[0 * numTetra + i]].position[0], defVertices[tetraList[0 * numTetra + i]].position[1], defVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
-
-		glColor3f(1.0f, 0.0f, 0.0f);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[0 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[0 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[0 * numTetra + i]].position[0], defVertices[tetraList[0 * numTetra + i]].position[1], defVertices[tetraList[0 * numTetra + i]].position[2]);  //vertex 0
-		
-		glColor3f(0.0f, 1.0f, 0.0f);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[1 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[1 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[1 * numTetra + i]].position[0], defVertices[tetraList[1 * numTetra + i]].position[1], defVertices[tetraList[1 * numTetra + i]].position[2]);  //vertex 1
-		
-		glColor3f(0.0f, 0.0f, 1.0f);
-		//glNormal3f(vertexNormals[numVertices * 0 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 1 + tetraList[2 * numTetra + i]], vertexNormals[numVertices * 2 + tetraList[2 * numTetra + i]]);
-		glVertex3f(defVertices[tetraList[2 * numTetra + i]].position[0], defVertices[tetraList[2 * numTetra + i]].position[1], defVertices[tetraList[2 * numTetra + i]].position[2]);  //vertex 2
-
-		glEnd();
-		
-	}
-
-	glColor3f(0.0f, 0.0f, 0.5f);
-	glBegin(GL_QUADS);
-		glNormal3f(0.0f, 1.0f, 0.0f);
-		glVertex3f(-10.0f, -4.0f, -10.0f);
-		glNormal3f(0.0f, 1.0f, 0.0f);
-		glVertex3f(10.0f, -4.0f, -10.0f);
-		glNormal3f(0.0f, 1.0f, 0.0f);
-		glVertex3f(10.0f, -4.0f, 10.0f);
-		glNormal3f(0.0f, 1.0f, 0.0f);
-		glVertex3f(-10.0f, -4.0f, 10.0f);
-	glEnd();
-
-
-}
-
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////User Interface methods to alter attributes of the particle system///////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1653,6 +2975,7 @@ void ParticleSystem::doRenderRGB(double videoWriteDeltaT, glm::mat4 & projMatrix
 void ParticleSystem::increaseEarthGravity(double amount)
 {
 	earthGravityValue += amount;
+	wakeAll();	//The frozen vertices were only at rest under the old gravity
 	if (true)
 	{
 		cout << "Earth Gravity value is now " << earthGravityValue << endl;
@@ -1721,7 +3044,72 @@ void ParticleSystem::increaseStraightRestLength(double amount)
 	//sprintf(text, "Straight Rest Length: %f", restLengthValues[0]);
 }
 
+//Method to toggle between explicit and implicit (backward Euler) integration
+void ParticleSystem::toggleImplicitIntegration()
+{
+	useImplicit = !useImplicit;
+
+	if (useImplicit)
+	{
+		sprintf(text, "Implicit Integration");
+	}
+	else
+	{
+		sprintf(text, "Explicit Integration");
+	}
+}
+
+//Method to toggle adaptive explicit time steps (see advanceFrame)
+void ParticleSystem::toggleAdaptiveTimeStep()
+{
+	useAdaptiveTimeStep = !useAdaptiveTimeStep;
+
+	if (useAdaptiveTimeStep)
+	{
+		sprintf(text, "Adaptive Time Step On");
+	}
+	else
+	{
+		sprintf(text, "Adaptive Time Step Off");
+	}
+}
+
+//Method to toggle sleeping of the vertices at rest (see setSleeping)
+void ParticleSystem::toggleSleeping()
+{
+	setSleeping(!useSleeping);
+
+	if (useSleeping)
+	{
+		sprintf(text, "Sleeping On");
+	}
+	else
+	{
+		sprintf(text, "Sleeping Off");
+	}
+}
+
 //Method to toggle whether or not auomatic uninversion occurs
+//Method to toggle self collision of the surface (see SelfCollision)
+void ParticleSystem::toggleSelfCollision()
+{
+	useSelfCollision = !useSelfCollision;
+
+	if (useSelfCollision)
+	{
+		//The hierarchy is only built over the current state if it is ever needed
+		if (selfCollision == NULL)
+		{
+			selfCollision = new SelfCollision(numVertices, indices, positions, logger);
+		}
+		sprintf(text, "Self Collision On");
+	}
+	else
+	{
+		sprintf(text, "Self Collision Off");
+	}
+}
+
 void ParticleSystem::toggleUninversion()
 {
 	doUninvert = !doUninvert;
@@ -1754,6 +3142,7 @@ void ParticleSystem::toggleInfoText()
 void ParticleSystem::toggleFullAmbient()
 {
 	ambientMode = !ambientMode;
+	lightingChanged = true;
 }
 
 //Method to set the window width and height
@@ -1785,6 +3174,21 @@ void ParticleSystem::toggleRenderMode()
 	}
 }
 
+//Starts recording the run to trajectory.traj, one record per frame of time steps, or finishes the recording (see startRecording)
+//Play the recording back with -play trajectory.traj.
+void ParticleSystem::toggleRecording()
+{
+	if (isRecording())
+	{
+		stopRecording();
+		cout << "Stopped recording trajectory.traj" << endl;
+	}
+	else if (startRecording("trajectory.traj", STEPS_PER_FRAME))
+	{
+		cout << "Recording trajectory.traj" << endl;
+	}
+}
+
 //Method to toggle between rendering to a series of numbered images and not rendering to them
 //It ALWAYS renders to the screen regardless
 void ParticleSystem::toggleImageRendering()
@@ -1797,7 +3201,33 @@ void ParticleSystem::toggleImageRendering()
 	else
 	{
 		//sprintf(text, "Image rendering off");
+		frameCapture -> stop();		//Writes out the frames still queued
+	}
+}
+
+//Sets the command line recorded frames are piped to (see FrameCapture) - empty writes numbered TGA images
+//Takes effect the next time image rendering is turned on
+void ParticleSystem::setCaptureEncoder(const string & encoderCommand)
+{
+	captureEncoder = encoderCommand;
+}
+
+//Hands the frame just rendered to the frame capture, (re)starting it if needed
+void ParticleSystem::captureFrame()
+{
+	//A recording has a fixed frame size, so resizing the window starts a new one
+	if (frameCapture -> isCapturing() && (frameCapture -> getWidth() != windowWidth || frameCapture -> getHeight() != windowHeight))
+	{
+		frameCapture -> stop();
+	}
+
+	if (!frameCapture -> isCapturing() && !frameCapture -> start(windowWidth, windowHeight, captureEncoder))
+	{
+		renderToImage = false;
+		return;
 	}
+
+	frameCapture -> captureFrame();
 }
 
 //This method implements a transform on the mesh
@@ -1806,64 +3236,48 @@ void ParticleSystem::doTransform()
 
 	//return;
 	
-	double identity[3][3] = {{1,0,0},{0,1,0},{0,0,1}};
 	double scaleFactor = 1;
-	double scaleTransform[3][3] = {{scaleFactor, 0, 0}, {0, scaleFactor, 0}, {0, 0, scaleFactor}};
+	Mat3 scaleTransform = {{scaleFactor, 0, 0, 0, scaleFactor, 0, 0, 0, scaleFactor}};
 	double angle = -90;
 	//double angle = 0;
-	double rotateTransform[3][3] = {{1, 0, 0}, {0, cos (angle * 3.14 / 180), -sin (angle * 3.14 / 180)}, {0, sin (angle * 3.14 / 180), cos (angle * 3.14 / 180)}};
-	double totalTransform[3][3];
-	
-	multiplyMatricesATimesB(totalTransform,rotateTransform,3,3,scaleTransform,3,3);  //couldn't use because it requires two subscripts
-	
-	//multiplyMatricesATimesB(totalTransform,scaleTransform,3,3,rotateTransform,3,3);  //couldn't use because it requires two subscripts
+	Mat3 rotateTransform = {{1, 0, 0, 0, cos (angle * 3.14 / 180), -sin (angle * 3.14 / 180), 0, sin (angle * 3.14 / 180), cos (angle * 3.14 / 180)}};
+	Mat3 totalTransform = rotateTransform * scaleTransform;
+	//Mat3 totalTransform = scaleTransform * rotateTransform;
 
 	////////////////////////////////
 	//do transform
 
-	
-	double * temp = new double [DIMENSION * numVertices];
-	
-	for (int i = 0; i < DIMENSION; i++) //Current row # of calculated final matrix element						
-	{																											
-		for (int j = 0; j < numVertices; j++) //current col # of calculated final matrix element					
-		{																										
-			temp[i * numVertices + j] = 0;																				
-			for (int k = 0; k < 3; k++) //current col in left matrix and row in right matrix for summing
-			{																									
-				temp[i * numVertices + j] += totalTransform[i][k] * defVertices[j].position[k];											
-			}																									
-																												
-		}																										
-																												
-	}			
-	
-	for (int i = 0; i < DIMENSION; i++)
+	for (int j = 0; j < numVertices; j++)
 	{
-		for (int j = 0; j < numVertices; j++)
+		Vec3 position;
+		for (int i = 0; i < DIMENSION; i++)
 		{
-			defVertices[j].position[i] = temp[i * numVertices + j];
+			position[i] = positions[i * numVertices + j];
 		}
-	}
-
-	delete [] temp;
 
+		Vec3 transformed = totalTransform * position;
+		for (int i = 0; i < DIMENSION; i++)
+		{
+			positions[i * numVertices + j] = transformed[i];
+		}
+	}
 }
 
 //Prints information for a number of items in the program when called
 void ParticleSystem::printStateReport()
 {
+	downloadGpuState();
 	/*
 	for (int i = 0; i < numVertices; i++)
 	{
 		cout << "Vertex " << i << " Position:" << endl;
-		cout << defVertices[i].position[0] << " " << defVertices[i].position[1] << " " << defVertices[i].position[2] << endl;
+		cout << positions[0 * numVertices + i] << " " << positions[1 * numVertices + i] << " " << positions[2 * numVertices + i] << endl;
 	}
 
 	for (int i = 0; i < numVertices; i++)
 	{
 		cout << "Vertex " << i << " Velocity :" << endl;
-		cout << defVertices[i].velocity[0] << " " << defVertices[i].velocity[1] << " " << defVertices[i].velocity[2] << endl;
+		cout << velocities[0 * numVertices + i] << " " << velocities[1 * numVertices + i] << " " << velocities[2 * numVertices + i] << endl;
 	}
 	*/
 
@@ -1889,7 +3303,7 @@ void ParticleSystem::printStateReport()
 		{
 			cout << "Vertex " << j << ":" << endl;
 			///cout << defVertices[tetraList[
-			cout << defVertices[tetraList[j * numTetra + i]].position[0] << " " << defVertices[tetraList[j * numTetra + i]].position[1] << " " << defVertices[tetraList[j * numTetra + i]].position[2] << endl;;
+			cout << positions[0 * numVertices + tetraList[j * numTetra + i]] << " " << positions[1 * numVertices + tetraList[j * numTetra + i]] << " " << positions[2 * numVertices + tetraList[j * numTetra + i]] << endl;;
 		}
 	}
 
@@ -1899,6 +3313,8 @@ void ParticleSystem::printStateReport()
 //This method can be used to load some information when desired to help with debugging
 void ParticleSystem::loadSpecialState()
 {
+	leaveGpuState();
+	wakeAll();
 	
 	//Vertex 0 Position:
 	//-0.00664436 1.4789 -0.777403
@@ -1939,43 +3355,44 @@ void ParticleSystem::loadSpecialState()
 	
 	  
 
-	defVertices[0].position[0] = -0.00664436;
-	defVertices[0].position[1] = 1.4789;
-	defVertices[0].position[2] = -0.777403;
-	defVertices[1].position[0] = 2.15984;
-	defVertices[1].position[1] = -0.137176;
-	defVertices[1].position[2] = -2.39931;
-	defVertices[2].position[0] = 1.00832;
-	defVertices[2].position[1] = -0.99262;
-	defVertices[2].position[2] = 0.434279;
-    defVertices[3].position[0] = -0.472082;
-	defVertices[3].position[1] = -0.970312;
-	defVertices[3].position[2] = -2.10122;
-	defVertices[4].position[0] = 2.79938;
-	defVertices[4].position[1] = -0.999992;
-	defVertices[4].position[2] = -1.83487;
+	positions[0 * numVertices + 0] = -0.00664436;
+	positions[1 * numVertices + 0] = 1.4789;
+	positions[2 * numVertices + 0] = -0.777403;
+	positions[0 * numVertices + 1] = 2.15984;
+	positions[1 * numVertices + 1] = -0.137176;
+	positions[2 * numVertices + 1] = -2.39931;
+	positions[0 * numVertices + 2] = 1.00832;
+	positions[1 * numVertices + 2] = -0.99262;
+	positions[2 * numVertices + 2] = 0.434279;
+    positions[0 * numVertices + 3] = -0.472082;
+	positions[1 * numVertices + 3] = -0.970312;
+	positions[2 * numVertices + 3] = -2.10122;
+	positions[0 * numVertices + 4] = 2.79938;
+	positions[1 * numVertices + 4] = -0.999992;
+	positions[2 * numVertices + 4] = -1.83487;
 
 	
 
-	defVertices[0].velocity[0] = 0.476164;
-	defVertices[0].velocity[1] = 0.18778;
-	defVertices[0].velocity[2] = -0.121715;
-	defVertices[1].velocity[0] = -0.0326747;
-	defVertices[1].velocity[1] = -1.39825;
-	defVertices[1].velocity[2] = -0.148798;
-	defVertices[2].velocity[0] = -0.052081;
-	defVertices[2].velocity[1] = 0.126357;
-	defVertices[2].velocity[2] = 0.102539;
-    defVertices[3].velocity[0] = -0.132509;
-	defVertices[3].velocity[1] = 0.305334;
-	defVertices[3].velocity[2] = 0.088056;
-	defVertices[4].velocity[0] = 0.00300343;
-	defVertices[4].velocity[1] = 0.015784;
-	defVertices[4].velocity[2] = -0.00969502;
+	velocities[0 * numVertices + 0] = 0.476164;
+	velocities[1 * numVertices + 0] = 0.18778;
+	velocities[2 * numVertices + 0] = -0.121715;
+	velocities[0 * numVertices + 1] = -0.0326747;
+	velocities[1 * numVertices + 1] = -1.39825;
+	velocities[2 * numVertices + 1] = -0.148798;
+	velocities[0 * numVertices + 2] = -0.052081;
+	velocities[1 * numVertices + 2] = 0.126357;
+	velocities[2 * numVertices + 2] = 0.102539;
+    velocities[0 * numVertices + 3] = -0.132509;
+	velocities[1 * numVertices + 3] = 0.305334;
+	velocities[2 * numVertices + 3] = 0.088056;
+	velocities[0 * numVertices + 4] = 0.00300343;
+	velocities[1 * numVertices + 4] = 0.015784;
+	velocities[2 * numVertices + 4] = -0.00969502;
 
 	lambda = 116.667;
 	mu = 350;
 	kd = 10;
+	materialsChanged = true;
 
 	
 
@@ -8,9 +8,107 @@
 #include "Vertex.h"
 //#include "Edge.h"
 #include "Logger.h"
-#include "targa.h"
+#include "BlockSparseMatrix.h"
+#include "Simd.h"
+#include "Memory.h"
+#include "FrameCapture.h"
+#include "CollisionSystem.h"
+#include "SelfCollision.h"
+#include "Trajectory.h"
 
 #define TEXT_SIZE 256	//Maximum length of the on screen message text
+#define RENDER_STREAM_FLOATS 8	//Floats per vertex streamed to the graphics card each frame (position and normal, 4 each)
+#define STEPS_PER_FRAME 10		//Explicit time steps per rendered frame (implicit integration takes the whole frame in one step)
+#define MAX_STEPS_PER_FRAME 200	//Most explicit time steps an adaptive frame is split into (see setAdaptiveTimeStep)
+#define TIME_STEP_SAFETY 0.5	//Fraction of the estimated stability limit an adaptive step may use
+#define MAX_MOTION_PER_STEP 0.25	//Fraction of the smallest rest altitude a vertex may travel in one adaptive step
+#define FLOOR_HEIGHT (-4.0)	//Height of the floor plane the mesh lands on
+#define RENDER_SNAPSHOTS 3		//Render snapshot buffers (triple buffering - see publishRenderSnapshot)
+#define SLEEP_STEPS 100			//Consecutive calm time steps after which a vertex falls asleep (see setSleeping)
+#define SLEEP_SPEED_FRACTION 0.1	//Speed below which a vertex is calm, as a fraction of the speed gravity adds in SLEEP_STEPS steps
+#define LIGHTING_UNIFORM_BINDING 0	//Uniform buffer binding point of the Lighting block of the shaders (see LightingBlock)
+#define BASE_ARENA_VALUES_PER_VERTEX 14	//Doubles per vertex ParticleSystem takes from its arena (positions, velocities, forces, ...)
+#define BASE_ARENA_VALUES_PER_TETRA 15		//Doubles per tetrahedron ParticleSystem takes from its arena (normals and materials)
+#define METHOD_ARENA_VALUES_PER_TETRA 48	//Estimate of the doubles per tetrahedron a deformation method adds (rest state and its SIMD blocks)
+#define ARENA_SLACK_BYTES (64 * 1024)		//Room for the alignment of the arena's arrays and the leftover tetrahedra of each color
+
+class GpuSimulator;
+struct GpuForceModel;
+class RenderEmbedding;
+
+//Tetrahedra computeForcePass computes - with a force exchange (see ParticleSystem::setForceExchange) the boundary tetrahedra
+//are those with a vertex shared with another process, and the interior ones the rest
+enum ForcePass {FORCES_ALL, FORCES_BOUNDARY, FORCES_INTERIOR};
+
+//Completes the forces of the vertices a particle system shares with other processes (see DistributedSimulation)
+//computeForces calls start once the boundary tetrahedra are done and finish after the interior ones, so the exchange can
+//proceed in between.  finish must leave every shared vertex with the same total force in each process that has it.
+class ForceExchange
+{
+public:
+	virtual ~ForceExchange() {}
+	virtual void start(const double * forces) = 0;
+	virtual void finish(double * forces) = 0;
+};
+
+//Constants of one body of a multi body system (see ParticleSystem::setBodyMaterials and Scene)
+struct BodyMaterial
+{
+	int firstVertex;					//The body is vertices [firstVertex, firstVertex + vertexCount)
+	int vertexCount;
+	double lambda;
+	double mu;
+	double kd;
+	bool hasGravity;					//True if the body falls with gravity instead of earthGravityValue (see increaseEarthGravity)
+	double gravity;
+};
+
+//State of one body at the end of a run, for comparing the variants of an ensemble (see ParticleSystem::getBodySummaries)
+struct BodySummary
+{
+	double centerOfMass[DIMENSION];
+	double boundsMin[DIMENSION];		//Axis aligned bounding box of the deformed body
+	double boundsMax[DIMENSION];
+	double maxSpeed;
+	double kineticEnergy;
+	double gravity;						//Gravity the body fell with
+};
+
+//A linked shader program with the locations of its per draw uniforms, resolved once in setProgramObject
+//The vertex attributes have fixed locations (0 position, 1 normal, 2 color - see maze.vert), so one vertex array object serves every program.
+struct RenderProgram
+{
+	GLuint program;
+	GLint local2clip;
+	GLint local2eye;
+	GLint normalMatrix;
+};
+
+//Contents of the std140 Lighting uniform block of maze.frag
+struct LightingBlock
+{
+	GLfloat lightAmbient[4];
+	GLfloat lightDiffuse[4];
+	GLfloat lightSpecular[4];
+	GLfloat lightPosition[4];
+	GLfloat eyePosition[4];
+	GLfloat ambientCoefficient[4];
+	GLfloat diffuseCoefficient[4];
+	GLfloat specularCoefficient[4];
+	GLfloat shininess;
+	GLfloat padding[3];				//std140 rounds the block up to a multiple of 16 bytes
+};
+
+//Phases of a time step whose wall clock time is accumulated (see getPhaseSeconds)
+enum TimingPhase
+{
+	PHASE_FORCES,			//Force assembly (computeForces)
+	PHASE_INTEGRATION,		//Explicit or implicit integration
+	PHASE_COLLISION,		//Collision detection and response
+	PHASE_FRACTURE,			//Fracture test and vertex splits (GeorgiaInstituteSystem::updateFracture)
+	PHASE_NORMALS,			//Vertex normals for rendering (calculateNormals)
+	NUM_TIMING_PHASES
+};
 
 //Particle System class
 //This is the base class for all other classes derived from ParticleSystem
@@ -19,19 +117,40 @@ class ParticleSystem
 {
 	public:
 	ParticleSystem(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger);
-	~ParticleSystem();
+	virtual ~ParticleSystem();
 	void initVBOs();
 	void sendVBOs();
 	void invertTetra();
 	void reset();
 	virtual void doUpdate(double elapsedSeconds);
+	void advanceFrame(double stepSeconds);
+	int getStepsPerFrame() {return useImplicit ? 1 : STEPS_PER_FRAME;}
+	int getStepCount() {return iteration - 1;}
+	void setAdaptiveTimeStep(bool useAdaptiveTimeStep) {this -> useAdaptiveTimeStep = useAdaptiveTimeStep;}
+	bool isAdaptiveTimeStep() {return useAdaptiveTimeStep;}
+	void toggleAdaptiveTimeStep();
+	double estimateStableTimeStep(bool useVelocities);
+	void setSleeping(bool useSleeping);
+	bool isSleeping() {return useSleeping;}
+	void toggleSleeping();
+	void wakeAll();
+	int getSleepingVertexCount() {return sleepingVertexCount;}
+	//Vertices split by fracture so far (see GeorgiaInstituteSystem::setFractureToughness) - always 0 for the methods that do not fracture
+	virtual int getSplitCount() {return 0;}
+	void setRenderMesh(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount);
+	bool hasRenderMesh() {return renderEmbedding != NULL;}
+	void enableRenderSnapshots();
+	bool enableGpuSimulation();
+	bool isGpuSimulated() {return gpuSimulator != NULL;}
+	void publishRenderSnapshot();
 	void doCollisionDetectionAndResponse(double deltaT);
+	CollisionSystem * getCollisionSystem() {return collisionSystem;}
+	//Restitution and friction of the floor - obstacles added to the collision system share them
+	ContactMaterial getContactMaterial() {ContactMaterial material = {restitution, us, ud}; return material;}
 	void uninvertF( double * F);
+	void uninvertFBlock(SimdForce * F);
 	void calculateNormals();
-	void doRender(double videoWriteDeltaT);
 	void doRender(double videoWriteDeltaT, glm::mat4 & projMatrix, glm::mat4 & floorModelViewMatrix, glm::mat4 & tetraModelViewMatrix);
-	void doRenderWithLighting(double videoWriteDeltaT, glm::mat4 & projMatrix, glm::mat4 & floorModelViewMatrix, glm::mat4 & tetraModelViewMatrix);
-	void doRenderRGB(double videoWriteDeltaT, glm::mat4 & projMatrix, glm::mat4 & floorModelViewMatrix, glm::mat4 & tetraModelViewMatrix);
 	//UI Methods
 	void increaseEarthGravity(double amount);
 	void increaseStraightRestLength(double amount);
@@ -39,17 +158,48 @@ class ParticleSystem
 	void toggleFullAmbient();
 	void setWindowDimensions(int width, int height);
 	void toggleUninversion();
+	void toggleSelfCollision();
+	bool isSelfColliding() {return useSelfCollision;}
+	void toggleImplicitIntegration();
+	bool isImplicit() {return useImplicit;}
 	void toggleRGB();
 	void toggleAnimation();
 	void toggleRenderMode();
 	void toggleImageRendering();
+	void setCaptureEncoder(const string & encoderCommand);
 	void doTransform();
 	void printStateReport();
 	void loadSpecialState();
-	void setProgramObject(GLuint programObject) {this->programObject = programObject;}
+	void setProgramObject(GLuint programObject, GLuint rgbProgramObject);
 	void setEyePos(glm::vec3 & eyePos);
 	void setConstants(double K, double mu);
 	void setConstants(double K, double mu, double kd);
+	void setBodyMaterials(const vector<BodyMaterial> & bodyMaterials);
+	double getLambda() {return lambda;}
+	double getMu() {return mu;}
+	double getKd() {return kd;}
+	void setThreadCount(int threadCount);
+	int getThreadCount() {return numThreads;}
+	int getVertexCount() {return numVertices;}
+	int getTetraCount() {return numTetra;}
+	double getPhaseSeconds(int phase) {return phaseSeconds[phase];}
+	void resetPhaseTimings();
+	void getStateSums(double & positionSum, double & velocitySum);
+	void getBodySummaries(vector<BodySummary> & summaries);
+	//The state, in the layout of positions and velocities below
+	const double * getPositions() {downloadGpuState(); return positions;}
+	const double * getVelocities() {downloadGpuState(); return velocities;}
+	void setForceExchange(ForceExchange * exchange, const vector<bool> & sharedVertices);
+	bool startRecording(const char * fileName, int stepsPerRecord);
+	void stopRecording();
+	bool isRecording() {return trajectoryWriter != NULL && trajectoryWriter -> isRecording();}
+	void toggleRecording();
+	bool openTrajectory(TrajectoryReader & reader, const char * fileName) {return reader.open(fileName, orgVertices, numVertices);}
+	bool showTrajectoryRecord(TrajectoryReader & reader, int record);
+	bool saveCheckpoint(const char * fileName);
+	bool loadCheckpoint(const char * fileName);
+	static void findSurfaceTriangles(const int * tetraList, int tetraCount, vector<int> & triangleIndices);
+	static void buildVertexTriangles(const vector<int> & triangleIndices, int vertexCount, int *& offsets, int *& triangles);
 
 	protected:
 	double halfWidth;					//Half the width of the original grid.  Used to make the grid initially be centered.
@@ -59,22 +209,47 @@ class ParticleSystem
 	int * tetraList;					//Represents the tetrehdron vertex structures.  int because it contains indexes into the vertex lists.
 	int numTetra;						//Number of tetrahedron in the mesh
 	Vertex * orgVertices;				//Original set of vertices (undeformed)
-	Vertex * defVertices;				//Deformed set of vertices
+	Vertex * defVertices;				//Deformed set of vertices (render buffer only - filled from positions by updateRenderVertices)
+	double * positions;					//Deformed positions, aligned, stored as positions[dimension * numVertices + vertex]
+	double * velocities;				//Velocities, same layout as positions
 	int numVertices;					//Number of particles in the system
-	vector<int> indices;				//Tetrahedral mesh indices
+	vector<int> indices;				//Surface triangle indices - boundary faces only (see buildSurface)
 
 	vector<Vertex> floorVertices;		//Flor mesh vertices
 	vector<int> floorIndices;			//Floor mesh indices
 	
 	double * normals;					//Array holding all face normals (if used)
 	//double * vertexNormals;				//Normals for LIGHTING
-	int * tetraCounts;					//Array holding number of tetrahedra adjacent to each vertex (used for normal averaging)
+	int * surfaceTriangleOffsets;		//First entry in surfaceTriangles of each vertex (numVertices + 1 entries)
+	int * surfaceTriangles;				//Surface triangles (indices / 3) containing each vertex, grouped by vertex
+	double * faceNormals;				//Normal of each surface triangle, faceNormals[triangle * DIMENSION + dimension]
+
+	//Surface changes after construction (see reserveSurfaceChanges) - the entries of vertex v are then
+	//surfaceTriangles[surfaceTriangleOffsets[v] ... surfaceTriangleEnds[v]), with room up to surfaceTriangleLimits[v]
+	int * surfaceTriangleEnds;			//NULL while the surface is the one buildSurface found (the entries end at surfaceTriangleOffsets[v + 1])
+	int * surfaceTriangleLimits;
+	int vertexTriangleCapacity;			//Entries surfaceTriangles has room for
+	int vertexTriangleFill;				//First entry no vertex uses - a vertex whose entries outgrow their room moves them here
+	int surfaceTriangleCapacity;		//Surface triangles faceNormals, indices and the index buffer have room for
+	int changedTrianglesBegin;			//Surface triangles changed since the index buffer was last uploaded (see uploadMeshChanges)
+	int changedTrianglesEnd;
+	vector<int> changedTetra;			//Tetrahedra and vertices changed since the RGB view and color buffers were last uploaded
+	vector<int> changedVertices;
 
 	//Deformation data
 	double lambda;
 	double mu;
 
 	double kd;							//Damping constant (Following Choi's name of kd)
+
+	//The constants each tetrahedron / vertex is simulated with - lambda, mu and kd, except for the vertices of the bodies
+	//given to setBodyMaterials.  Refilled by updateMaterials before the next step whenever materialsChanged is set.
+	vector<BodyMaterial> bodyMaterials;	//Sorted by firstVertex
+	double * tetraLambda;
+	double * tetraMu;
+	double * tetraKd;
+	double * vertexKd;
+	bool materialsChanged;
 	double earthGravityValue;			//Acceleration rate for gravity
 
 	double restitution;					//Restitution constant for collision response (controls how much the object bounces back up)
@@ -90,6 +265,128 @@ class ParticleSystem
 
 	int dimensionSquared;				//DIMENSION * DIMENSION occurs so frequently that a lot of computation can be saved by storing this
 
+	//Parallel force assembly data
+	int numThreads;						//Number of threads used for force assembly and integration
+	int numTetraColors;					//Number of tetrahedron colors (groups of tetrahedra sharing no vertices)
+	int * tetraColorOffsets;			//First tetrahedron of each color (numTetraColors + 1 entries; tetraList is sorted by color)
+	int numForceBlocks;					//Number of blocks of FORCE_BLOCK_WIDTH consecutive tetrahedra of one color
+	int * colorBlockOffsets;			//First block of each color (numTetraColors + 1 entries); leftover tetrahedra follow the blocks of their color
+	int iteration;						//Number of time steps taken (used for logging)
+
+	//Per body arrays - everything sized by the mesh that lives as long as the system comes from arena (see allocateVertexArray)
+	MemoryArena arena;
+	void * allocateArenaBytes(size_t bytes);
+	double * allocateVertexArray(int valuesPerVertex, int stripes);
+	Vertex * allocateVertices();
+	double * allocateTetraArray(int valuesPerTetra, int stripes);
+	ForceReal * allocateBlockArray(int valuesPerBlock);
+	double phaseSeconds[NUM_TIMING_PHASES];	//Wall clock seconds spent in each TimingPhase since the last resetPhaseTimings
+	int invertedTetraCount;				//Tetrahedra uninverted during the current time step (profiler counter)
+	int collisionCount;					//Contacts given a collision response in the last time step (profiler counter)
+	CollisionSystem * collisionSystem;	//The floor and any other colliders
+	bool useSelfCollision;
+	SelfCollision * selfCollision;		//Built the first time self collision is turned on, and again after the surface changes (NULL until then)
+	int selfCollisionCount;				//Self contacts found in the last time step (profiler counter)
+	ForceExchange * forceExchange;		//Completes the forces of vertices shared with other processes, NULL for none (see setForceExchange)
+	vector<char> boundaryTetra;			//1 for each tetrahedron with a shared vertex (only with a force exchange)
+	vector<char> boundaryBlocks;		//1 for each force block with a boundary tetrahedron
+
+	void buildTetraColoring();
+	void buildForceBlocks();
+	void buildSurface();
+	void reserveSurfaceChanges(int extraTriangles, int extraVertexTriangles);
+	bool makeSurfaceRoom(int vertex, int extraTriangles);
+	int addSurfaceTriangle(int vertex0, int vertex1, int vertex2);
+	void moveSurfaceTriangle(int triangle, int oldVertex, int newVertex);
+	void dropSelfCollision();
+	void addVertexTriangle(int vertex, int triangle);
+	void markTriangleChanged(int triangle);
+	void uploadMeshChanges();
+	void updateMaterials();
+	virtual void computeForces();
+	void computeForcePass(ForcePass pass);
+	virtual void computeBlockForces(int firstTetrad, int block);
+	void accumulateTetraForces(int currentTetrad);
+	//Per tetrahedron force kernel implemented by each deformation method
+	//p and v hold the deformed positions and velocities of the 4 vertices as 3 X 4 matrices (p[j * 4 + vertex]); forces uses the same layout
+	virtual void computeTetraForces(int currentTetrad, double * p, double * v, double * forces) = 0;
+	void integrate(double deltaT);
+	void updateRenderVertices();
+
+	//Render snapshots - completed frames handed from a simulation thread to the render thread (see publishRenderSnapshot)
+	bool useRenderSnapshots;			//True once enableRenderSnapshots is called: rendering then only reads the snapshots
+	float * renderSnapshots[RENDER_SNAPSHOTS];	//Positions and normals of every vertex in the RENDER_STREAM_FLOATS stream layout
+	int writeSnapshot;					//Snapshot the simulation thread fills next (owned by the simulation thread)
+	int displaySnapshot;				//Snapshot being rendered (owned by the render thread)
+	volatile long readySnapshot;		//Most recently completed snapshot, plus RENDER_SNAPSHOT_FRESH if the render thread has not taken it yet
+	bool snapshotChanged;				//True if displaySnapshot changed since it was last uploaded (render thread)
+	bool acquireRenderSnapshot();
+
+	//Detailed render mesh driven by the simulated mesh (see setRenderMesh) - NULL to render the simulated surface itself
+	RenderEmbedding * renderEmbedding;
+	int getRenderVertexCount();
+	const vector<int> & getRenderIndices();
+
+	//GPU simulation (see enableGpuSimulation) - explicit steps run on the graphics card while canSimulateOnGpu allows it
+	GpuSimulator * gpuSimulator;		//NULL unless enabled
+	bool gpuStateCurrent;				//True if the graphics card holds the newest state (positions and velocities are then stale)
+	bool canSimulateOnGpu();
+	void downloadGpuState();
+	void leaveGpuState();
+	//Fills the rest state data of the deformation method in the form of the GPU force shader (see GpuForceModel)
+	//Returns false if the method (or its current settings) has no GPU force model.
+	virtual bool getGpuForceModel(GpuForceModel &) {return false;}
+
+	//Trajectory recording and checkpoints (see startRecording and saveCheckpoint)
+	TrajectoryWriter * trajectoryWriter;	//NULL until recording is first started
+	void recordTrajectory();
+	//Adds the simulation state saved in a checkpoint: the positions and velocities, and whatever state a deformation
+	//method carries from one step to the next (the sleep state is saved separately, since it only exists while sleeping is on)
+	virtual void addCheckpointArrays(vector<CheckpointArray> & arrays);
+	//False for a method whose mesh topology can change during the run, which the checkpoint arrays do not hold (see GeorgiaInstituteSystem)
+	virtual bool canCheckpoint() {return true;}
+	unsigned long long getCheckpointHash();
+	//Drops whatever a deformation method carries from one step to the next only to speed up the next one (see CorotationalSystem);
+	//called when the state jumps rather than steps: reset, invertTetra and showTrajectoryRecord
+	virtual void resetWarmStart() {}
+
+	//Implicit (backward Euler) integration data
+	bool useImplicit;					//True to integrate with integrateImplicit; false for the explicit integrate
+	BlockSparseMatrix * systemMatrix;	//M - h * df/dv - h^2 * df/dx, created on the first implicit step
+	double * deltaV;					//Velocity change solved for each implicit step
+	double * implicitRHS;				//Right hand side of the implicit system
+	double * implicitDiagonal;			//M - h * df/dv (diagonal, since the kd damping only depends on each vertex's own velocity)
+	int * vertexTetraCounts;			//Number of tetrahedra containing each vertex (each adds kd damping to it)
+	double cgTolerance;					//Relative residual at which the conjugate gradient solve stops
+	int cgMaxIterations;				//Maximum conjugate gradient iterations per time step
+
+	void integrateImplicit(double deltaT);
+	void countVertexTetra();
+
+	//Adaptive explicit time stepping (see setAdaptiveTimeStep) - each frame is split into as few steps as stay stable
+	bool useAdaptiveTimeStep;
+	double * tetraStiffnessRates;		//Rest shape diagonal stiffness each tetrahedron adds to its vertices per unit of lambda + 2 * mu, [k * numTetra + t] (NULL until needed)
+	double minRestAltitude;				//Smallest altitude of any tetrahedron in the rest shape
+	double stableElasticStep;			//Largest stable step for the current constants, ignoring the motion limit (0 when stale)
+	void computeStableStepData();
+
+	//Sleeping (see setSleeping) - vertices at rest are frozen, and tetrahedra with only frozen vertices are not evaluated
+	bool useSleeping;
+	int * calmSteps;					//Consecutive steps each vertex has been calm for (NULL until sleeping is first turned on)
+	bool * vertexSleeping;				//True if the vertex is frozen: it keeps its position and zero velocity
+	bool * vertexMoving;				//True if the vertex was faster than the calm speed limit in the last step (keeps its neighbors awake)
+	//Vertices sharing a tetrahedron in compressed sparse row form - the neighbors of vertex v are
+	//sleepNeighbors[sleepNeighborOffsets[v] ... sleepNeighborOffsets[v + 1])
+	vector<int> sleepNeighborOffsets;
+	vector<int> sleepNeighbors;
+	int sleepingVertexCount;
+	void updateSleeping(double deltaT);
+	bool isTetraAsleep(int currentTetrad) {return vertexSleeping[tetraList[currentTetrad]] && vertexSleeping[tetraList[numTetra + currentTetrad]] &&
+		vertexSleeping[tetraList[2 * numTetra + currentTetrad]] && vertexSleeping[tetraList[3 * numTetra + currentTetrad]];}
+	//Per tetrahedron force Jacobian df/dx (12 X 12, stiffness[(a * 3 + r) * 12 + b * 3 + c] = d force(r, a) / d position(c, b))
+	//The default uses central differences of computeTetraForces; deformation methods may override it with an analytic Jacobian.
+	virtual void computeTetraStiffness(int currentTetrad, double * p, double * v, double * stiffness);
+
 public:
 	bool isAnimating;					//True if particles should move; false if not
 protected:
@@ -111,21 +408,30 @@ protected:
 	
 	//Video generation variables (generates a series of numbered images that can be combined into a video with a tool)
 	bool renderToImage;					//If true will begin rendering to series of numbered images
-	uint8_t * screenBuffer;				//Buffer to hold screen capture
-	uint8_t * screenRowTemp;			//Buffer to temporarily hold one row from the screen while flipping image verticaly
-	int frameNumber;					//Numbered frame for series of images to be video
-	char imageFileName[100];			//Name of output image file
+	FrameCapture * frameCapture;		//Reads the frames back and writes them out on its own thread
+	string captureEncoder;				//Command the frames are piped to instead (see setCaptureEncoder)
 	double timeSinceVideoWrite;			//Number of seconds elapsed since a frame was written to an image file
+	void captureFrame();
 
 	Logger * logger;					//Reference to Logger class to perform all
 
-	GLuint vboHandle[1];	  //handle to vertex buffer object for vertices
+	GLuint vboHandle[1];	  //handle to vertex buffer object for vertices (positions and normals, streamed every frame)
+	GLuint colorVboHandle[1]; //handle to vertex buffer object for vertex colors (static)
 	GLuint indexVboHandle[1]; //handle to vertex buffer object for indices
 	GLuint floorVboHandle[1];	  //handle to vertex buffer object for vertices
 	GLuint floorIndexVboHandle[1]; //handle to vertex buffer object for indices
+	GLuint tetraFaceIndexVboHandle;	//Faces of every tetrahedron, for the RGB debugging view (only without a render mesh)
+	int tetraFaceIndexCount;
+	GLuint meshVao;						//Vertex array objects: the surface, every tetrahedron face (RGB view) and the floor
+	GLuint tetraFaceVao;
+	GLuint floorVao;
+	GLuint lightingUboHandles[2];		//Lighting uniform blocks of the mesh and of the floor (the floor has its own ambient light)
+	bool lightingChanged;				//True if the lighting blocks have to be uploaded again before the next draw
 
-
-	GLuint programObject;				//Program object needed for shaders (notably lighting)
+	RenderProgram lightingProgram;		//Shaders with lighting for the mesh and the floor
+	RenderProgram rgbProgram;			//Variant coloring the corners of each triangle red, green and blue (useful for debugging inversions)
+	void updateLightingBlocks();
+	void drawElements(const RenderProgram & renderProgram, GLuint vao, int indexCount, GLuint lightingUbo, glm::mat4 & projMatrix, glm::mat4 & modelViewMatrix);
 	GLfloat eyePos[3];		  //Position of the eye (for the camera)
 
 	GLfloat lightAmbient[4];  //Normal ambient light setting
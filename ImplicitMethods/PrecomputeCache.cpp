@@ -0,0 +1,140 @@
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include "PrecomputeCache.h"
+
+using namespace std;
+
+bool PrecomputeCache::enabled = true;
+
+const unsigned int BYTE_ORDER_MARK = 0x01020304;
+
+//Parameter solverName - short name of the deformation method (at most 15 characters)
+//Parameters vertices, vertexCount, tetraList and tetraCount - the rest state mesh the precomputation is derived from
+PrecomputeCache::PrecomputeCache(const char * solverName, Vertex * vertices, int vertexCount, int * tetraList, int tetraCount)
+{
+	memset(&header, 0, sizeof(PrecomputeCacheHeader));
+	strcpy(header.magic, "TETPREC");
+	header.version = PRECOMPUTE_CACHE_VERSION;
+	header.byteOrderMark = BYTE_ORDER_MARK;
+	strncpy(header.solverName, solverName, sizeof(header.solverName) - 1);
+	header.vertexCount = vertexCount;
+	header.tetraCount = tetraCount;
+
+	//Only the 3 position components are set for every vertex, so the padding component is left out of the hash
+	unsigned long long hash = hashBytes(header.solverName, sizeof(header.solverName));
+	for (int i = 0; i < vertexCount; i++)
+	{
+		hash = hashBytes(vertices[i].position, sizeof(float) * DIMENSION, hash);
+	}
+	header.meshHash = hashBytes(tetraList, sizeof(int) * 4 * tetraCount, hash);
+
+	char name[64];
+	sprintf(name, "precompute_%s_%016llx.cache", header.solverName, header.meshHash);
+	fileName = name;
+}
+
+//Registers an array of count doubles to be loaded from / saved to the cache
+//Arrays are stored in the order they are added, so load and save must see the same sequence.
+void PrecomputeCache::addArray(double * data, int count)
+{
+	if (header.arrayCount < MAX_PRECOMPUTE_ARRAYS)
+	{
+		header.arraySizes[header.arrayCount++] = count;
+		arrays.push_back(data);
+	}
+}
+
+size_t PrecomputeCache::payloadSize()
+{
+	size_t size = 0;
+	for (int i = 0; i < header.arrayCount; i++)
+	{
+		size += sizeof(double) * header.arraySizes[i];
+	}
+	return size;
+}
+
+//Fills the registered arrays from the cache file
+//Returns false (and leaves the arrays untouched) if caching is disabled or there is no matching, intact cache.
+bool PrecomputeCache::load(Logger * logger)
+{
+	(void) logger;	//Only read by the DEBUGGING reports
+	MappedFile cache;
+	if (!enabled || !cache.open(fileName.c_str()))
+	{
+		return false;
+	}
+
+	//Everything up to the checksum must match what this mesh and solver would write
+	PrecomputeCacheHeader * cachedHeader = (PrecomputeCacheHeader *) cache.getData();
+	bool valid = cache.getSize() == sizeof(PrecomputeCacheHeader) + payloadSize() &&
+		memcmp(cachedHeader, &header, offsetof(PrecomputeCacheHeader, checksum)) == 0 &&
+		cachedHeader -> checksum == hashBytes(cache.getData() + sizeof(PrecomputeCacheHeader), payloadSize());
+
+	if (!valid)
+	{
+		#ifdef DEBUGGING
+		if (logger -> isLogging)
+		{
+			cout << "Precompute cache " << fileName << " is out of date - recomputing" << endl;
+		}
+		#endif
+		return false;
+	}
+
+	//The methods own (and later repack) their arrays, so the data is copied out of the mapping rather than used in place
+	const char * data = cache.getData() + sizeof(PrecomputeCacheHeader);
+	for (int i = 0; i < header.arrayCount; i++)
+	{
+		size_t size = sizeof(double) * header.arraySizes[i];
+		memcpy(arrays[i], data, size);
+		data += size;
+	}
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Loaded " << header.solverName << " precomputation from " << fileName << endl;
+	}
+	#endif
+
+	return true;
+}
+
+//Writes the registered arrays to the cache file (see PrecomputeCacheHeader for the layout)
+bool PrecomputeCache::save()
+{
+	if (!enabled)
+	{
+		return false;
+	}
+
+	unsigned long long checksum = hashBytes(NULL, 0);
+	for (int i = 0; i < header.arrayCount; i++)
+	{
+		checksum = hashBytes(arrays[i], sizeof(double) * header.arraySizes[i], checksum);
+	}
+	header.checksum = checksum;
+
+	FILE * file = fopen(fileName.c_str(), "wb");
+	if (file == NULL)
+	{
+		cerr << "Could not write precompute cache " << fileName << endl;
+		return false;
+	}
+
+	bool written = fwrite(&header, sizeof(PrecomputeCacheHeader), 1, file) == 1;
+	for (int i = 0; i < header.arrayCount && written; i++)
+	{
+		written = fwrite(arrays[i], sizeof(double), header.arraySizes[i], file) == header.arraySizes[i];
+	}
+	written = (fclose(file) == 0) && written;
+	if (!written)
+	{
+		remove(fileName.c_str());	//Never leave a partial cache behind
+		cerr << "Could not write precompute cache " << fileName << endl;
+	}
+
+	return written;
+}
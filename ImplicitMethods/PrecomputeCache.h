@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Vertex.h"
+#include "Logger.h"
+#include "MappedFile.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const int PRECOMPUTE_CACHE_VERSION = 1;
+const int MAX_PRECOMPUTE_ARRAYS = 8;
+
+//Header of a precompute cache file (little endian like the x86 machines that write and read it)
+//It is followed by the registered arrays of doubles, back to back in the order they were added.
+struct PrecomputeCacheHeader
+{
+	char magic[8];									//"TETPREC" - identifies the file type
+	int version;									//PRECOMPUTE_CACHE_VERSION
+	unsigned int byteOrderMark;						//0x01020304 as written - rejects caches written with the other byte order
+	char solverName[16];							//Deformation method the arrays belong to
+	unsigned long long meshHash;					//hashBytes of the rest positions and the (colored) tetraList
+	int vertexCount;
+	int tetraCount;
+	int arrayCount;
+	int reserved;
+	unsigned long long arraySizes[MAX_PRECOMPUTE_ARRAYS];	//Number of doubles in each array
+	unsigned long long checksum;					//hashBytes of everything after the header
+};
+
+//Optional disk cache for the rest state precomputation of a deformation method (inverse rest matrices, weights, volumes)
+//The constructor of a method registers the arrays it fills with addArray; load then fills them from the cache file
+//if one exists for the same solver and mesh, otherwise the method computes them itself and calls save.
+//The cache is keyed by the solver name and a hash of the rest positions and tetraList (after ParticleSystem has colored it),
+//so editing the mesh, or a change to the coloring, simply makes a new cache file: precompute_<solver>_<hash>.cache
+class PrecomputeCache
+{
+public:
+	PrecomputeCache(const char * solverName, Vertex * vertices, int vertexCount, int * tetraList, int tetraCount);
+	void addArray(double * data, int count);
+	bool load(Logger * logger);
+	bool save();
+
+	static void setEnabled(bool enabled) {PrecomputeCache::enabled = enabled;}
+	static bool isEnabled() {return enabled;}
+
+private:
+	static bool enabled;		//False to always recompute (and never write) the precomputed data
+
+	string fileName;
+	PrecomputeCacheHeader header;
+	vector<double *> arrays;
+
+	size_t payloadSize();
+};
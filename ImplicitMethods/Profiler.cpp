@@ -0,0 +1,118 @@
+#include <cstdio>
+#include "Profiler.h"
+
+Profiler::Profiler(int capacity)
+{
+	this -> capacity = capacity > 0 ? capacity : 1;
+	events = new ProfileEvent[this -> capacity];
+	enabled = false;
+	next = 0;
+	count = 0;
+	originSeconds = getTimeSeconds();
+}
+
+Profiler::~Profiler()
+{
+	delete [] events;
+}
+
+//Records a span from absolute getTimeSeconds() times (see ProfileScope)
+void Profiler::recordSpan(const char * name, double startSeconds, double endSeconds)
+{
+	if (enabled)
+	{
+		record(name, startSeconds - originSeconds, endSeconds - startSeconds, 0, false);
+	}
+}
+
+//Records the current value of a counter (for example the inverted tetrahedra of one time step)
+void Profiler::recordCounter(const char * name, double value)
+{
+	if (enabled)
+	{
+		record(name, getTimeSeconds() - originSeconds, 0, value, true);
+	}
+}
+
+void Profiler::record(const char * name, double startSeconds, double durationSeconds, double value, bool isCounter)
+{
+	bufferLock.lock();
+	ProfileEvent & event = events[next];
+	event.name = name;
+	event.startSeconds = startSeconds;
+	event.durationSeconds = durationSeconds;
+	event.value = value;
+	event.isCounter = isCounter;
+
+	next = (next + 1) % capacity;
+	if (count < capacity)
+	{
+		count++;
+	}
+	bufferLock.unlock();
+}
+
+//Forgets all recorded events
+void Profiler::clear()
+{
+	bufferLock.lock();
+	next = 0;
+	count = 0;
+	bufferLock.unlock();
+}
+
+//Writes the recorded events in the Chrome trace event format (complete "X" events for spans, "C" events for counters)
+//Returns false if the file could not be written
+bool Profiler::writeChromeTrace(const char * fileName)
+{
+	FILE * file = fopen(fileName, "w");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	for (int i = 0; i < count; i++)
+	{
+		ProfileEvent & event = getEvent(i);
+		const char * separator = i < count - 1 ? "," : "";
+		if (event.isCounter)
+		{
+			fprintf(file, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":1,\"args\":{\"value\":%.17g}}%s\n", event.name, event.startSeconds * 1e6, event.value, separator);
+		}
+		else
+		{
+			fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}%s\n", event.name, event.startSeconds * 1e6, event.durationSeconds * 1e6, separator);
+		}
+	}
+	fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+
+	return fclose(file) == 0;
+}
+
+//Writes the recorded events as CSV, oldest first: type,name,start_ms,duration_ms,value
+//Returns false if the file could not be written
+bool Profiler::writeCsv(const char * fileName)
+{
+	FILE * file = fopen(fileName, "w");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	fprintf(file, "type,name,start_ms,duration_ms,value\n");
+	for (int i = 0; i < count; i++)
+	{
+		ProfileEvent & event = getEvent(i);
+		if (event.isCounter)
+		{
+			fprintf(file, "counter,%s,%.6f,0,%.17g\n", event.name, event.startSeconds * 1e3, event.value);
+		}
+		else
+		{
+			fprintf(file, "span,%s,%.6f,%.6f,\n", event.name, event.startSeconds * 1e3, event.durationSeconds * 1e3);
+		}
+	}
+
+	return fclose(file) == 0;
+}
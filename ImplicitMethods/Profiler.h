@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Timer.h"
+#include "Threading.h"
+
+const int PROFILER_DEFAULT_CAPACITY = 65536;	//Events kept before the oldest are overwritten
+
+//One timed span or counter sample
+struct ProfileEvent
+{
+	const char * name;			//Must be a string literal (only the pointer is stored)
+	double startSeconds;		//Relative to the creation of the profiler
+	double durationSeconds;		//0 for counters
+	double value;				//Counter value (unused for spans)
+	bool isCounter;
+};
+
+//Always compiled in, low overhead instrumentation of the hot paths
+//Scoped timers (ProfileScope) and counters are recorded into a fixed size ring buffer, which can be written out as
+//Chrome trace JSON (load it in chrome://tracing) or CSV.  While disabled every call is a single branch.
+//Events must be recorded from serial code only (counters from parallel loops are summed by the caller first); the
+//simulation and render threads (see SimulationThread) can both record, as the buffer is locked while enabled.
+class Profiler
+{
+public:
+	Profiler(int capacity = PROFILER_DEFAULT_CAPACITY);
+	~Profiler();
+	bool isEnabled() {return enabled;}
+	void setEnabled(bool enabled) {this -> enabled = enabled;}
+	void recordSpan(const char * name, double startSeconds, double endSeconds);
+	void recordCounter(const char * name, double value);
+	void clear();
+	int getEventCount() {return count;}
+	bool writeChromeTrace(const char * fileName);
+	bool writeCsv(const char * fileName);
+
+private:
+	Profiler(const Profiler &);				//Not copyable - owns the ring buffer
+	Profiler & operator = (const Profiler &);
+
+	bool enabled;
+	ProfileEvent * events;
+	int capacity;
+	int next;								//Slot the next event is written to
+	int count;								//Number of valid events (at most capacity)
+	double originSeconds;					//getTimeSeconds() at creation; event times are relative to it
+	Mutex bufferLock;
+
+	void record(const char * name, double startSeconds, double durationSeconds, double value, bool isCounter);
+	ProfileEvent & getEvent(int i) {return events[(next - count + i + capacity) % capacity];}	//i = 0 is the oldest event
+};
+
+//Times the enclosing scope and records it as a span (nothing is timed if the profiler is disabled when the scope starts)
+class ProfileScope
+{
+public:
+	ProfileScope(Profiler & profiler, const char * name) : profiler(profiler), name(name)
+	{
+		active = profiler.isEnabled();
+		startSeconds = active ? getTimeSeconds() : 0;
+	}
+	~ProfileScope()
+	{
+		if (active)
+		{
+			profiler.recordSpan(name, startSeconds, getTimeSeconds());
+		}
+	}
+
+private:
+	ProfileScope & operator = (const ProfileScope &);
+
+	Profiler & profiler;
+	const char * name;
+	double startSeconds;
+	bool active;
+};
@@ -0,0 +1,335 @@
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include "RenderEmbedding.h"
+#include "ParticleSystem.h"
+#include "SmallMatrix.h"
+#include "Memory.h"
+
+using namespace std;
+
+const double EMBEDDING_EPSILON = 1e-12;	//Used to check approximate equality to 0
+
+//Parameters simVertices, simTetraList - the simulated mesh in its rest state (tetraList in the [k * tetraCount + tetrahedron] layout)
+//Parameters renderVertices, renderTetraList - the render mesh, in the same coordinates as the simulated rest state
+RenderEmbedding::RenderEmbedding(const Vertex * simVertices, int simVertexCount, const int * simTetraList, int simTetraCount,
+	const Vertex * renderVertices, int renderVertexCount, const int * renderTetraList, int renderTetraCount, Logger * logger)
+{
+	this -> logger = logger;
+	numSimVertices = simVertexCount;
+
+	//Keep only the surface of the render mesh and renumber its vertices in order of first use
+	vector<int> renderSurface;
+	ParticleSystem::findSurfaceTriangles(renderTetraList, renderTetraCount, renderSurface);
+	vector<int> newIndex(renderVertexCount, -1);
+	vector<int> surfaceVertices;
+	indices.resize(renderSurface.size());
+	for (int i = 0; i < (int) renderSurface.size(); i++)
+	{
+		int vertex = renderSurface[i];
+		if (newIndex[vertex] < 0)
+		{
+			newIndex[vertex] = (int) surfaceVertices.size();
+			surfaceVertices.push_back(vertex);
+		}
+		indices[i] = newIndex[vertex];
+	}
+	numVertices = (int) surfaceVertices.size();
+
+	ParticleSystem::buildVertexTriangles(indices, numVertices, triangleOffsets, vertexTriangles);
+	faceNormals = new double[DIMENSION * (indices.size() / 3 + 1)];
+	embeddingVertices = new int[4 * numVertices];
+	weights = new double[4 * numVertices];
+
+	//The w components of the stream never change, so they are set once here
+	stream = alignedAlloc<float>(RENDER_STREAM_FLOATS * numVertices);
+	colors.resize(4 * numVertices);
+	for (int i = 0; i < numVertices; i++)
+	{
+		const Vertex & vertex = renderVertices[surfaceVertices[i]];
+		for (int j = 0; j < 4; j++)
+		{
+			stream[i * RENDER_STREAM_FLOATS + j] = vertex.position[j];
+			stream[i * RENDER_STREAM_FLOATS + 4 + j] = vertex.vertexNormal[j];
+			colors[i * 4 + j] = vertex.color[j];
+		}
+	}
+
+	//Barycentric coordinates of p in tetrahedron t are inverse([x0 x1 x2 x3; 1 1 1 1]) * [p; 1].  Row k of the first 3 columns
+	//is the gradient of coordinate k, whose length is 1 / (altitude of vertex k), so -coordinate / length is how far p lies
+	//outside the face opposite vertex k.
+	vector<Mat4> barycentric(simTetraCount);
+	vector<bool> degenerate(simTetraCount, false);
+	double boxMin[DIMENSION];
+	double boxMax[DIMENSION];
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		boxMin[j] = numeric_limits<double>::max();
+		boxMax[j] = -numeric_limits<double>::max();
+	}
+	for (int i = 0; i < simVertexCount; i++)
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			boxMin[j] = min(boxMin[j], (double) simVertices[i].position[j]);
+			boxMax[j] = max(boxMax[j], (double) simVertices[i].position[j]);
+		}
+	}
+
+	for (int t = 0; t < simTetraCount; t++)
+	{
+		Mat4 corners;
+		for (int k = 0; k < 4; k++)
+		{
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				corners(j, k) = simVertices[simTetraList[k * simTetraCount + t]].position[j];
+			}
+			corners(3, k) = 1;
+		}
+		double volume6 = determinant(corners);
+		if (fabs(volume6) < EMBEDDING_EPSILON)
+		{
+			degenerate[t] = true;
+			continue;
+		}
+		barycentric[t] = inverse(corners);
+	}
+
+	//Uniform grid over the simulated mesh, each cell listing the tetrahedra whose bounding box overlaps it (compressed sparse row)
+	double longestSide = EMBEDDING_EPSILON;
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		longestSide = max(longestSide, boxMax[j] - boxMin[j]);
+	}
+	double cellSize = longestSide / EMBEDDING_GRID_CELLS;
+	int gridSize[DIMENSION];
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		gridSize[j] = max(1, (int) ceil((boxMax[j] - boxMin[j]) / cellSize));
+	}
+	int cellCount = gridSize[0] * gridSize[1] * gridSize[2];
+
+	vector<int> tetraCells(2 * DIMENSION * simTetraCount);	//Lowest and highest cell of each tetrahedron's bounding box
+	vector<int> cellOffsets(cellCount + 1, 0);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		vector<int> fillPosition(cellOffsets.begin(), cellOffsets.end() - 1);
+		vector<int> cellTetra(pass == 1 ? cellOffsets[cellCount] : 0);
+		for (int t = 0; t < simTetraCount; t++)
+		{
+			if (degenerate[t])
+			{
+				continue;
+			}
+
+			int * range = &tetraCells[2 * DIMENSION * t];
+			if (pass == 0)
+			{
+				for (int j = 0; j < DIMENSION; j++)
+				{
+					double low = numeric_limits<double>::max();
+					double high = -numeric_limits<double>::max();
+					for (int k = 0; k < 4; k++)
+					{
+						low = min(low, (double) simVertices[simTetraList[k * simTetraCount + t]].position[j]);
+						high = max(high, (double) simVertices[simTetraList[k * simTetraCount + t]].position[j]);
+					}
+					range[j] = min(gridSize[j] - 1, max(0, (int) floor((low - boxMin[j]) / cellSize)));
+					range[DIMENSION + j] = min(gridSize[j] - 1, max(0, (int) floor((high - boxMin[j]) / cellSize)));
+				}
+			}
+
+			for (int x = range[0]; x <= range[DIMENSION + 0]; x++)
+			{
+				for (int y = range[1]; y <= range[DIMENSION + 1]; y++)
+				{
+					for (int z = range[2]; z <= range[DIMENSION + 2]; z++)
+					{
+						int cell = (z * gridSize[1] + y) * gridSize[0] + x;
+						if (pass == 0)
+						{
+							cellOffsets[cell + 1]++;
+						}
+						else
+						{
+							cellTetra[fillPosition[cell]++] = t;
+						}
+					}
+				}
+			}
+		}
+
+		if (pass == 0)
+		{
+			for (int cell = 0; cell < cellCount; cell++)
+			{
+				cellOffsets[cell + 1] += cellOffsets[cell];
+			}
+		}
+		else
+		{
+			tetraCells.swap(cellTetra);		//tetraCells now holds the tetrahedra of each cell
+		}
+	}
+	const vector<int> & cellTetra = tetraCells;
+
+	//Search rings of cells around each render vertex until the best tetrahedron found is closer than any unsearched ring
+	//(a containing tetrahedron has distance 0 and ends the search in its own cell)
+	int maxRing = max(gridSize[0], max(gridSize[1], gridSize[2]));
+	maxOutsideDistance = 0;
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = 0; i < numVertices; i++)
+	{
+		Vec4 point;
+		int center[DIMENSION];
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			point[j] = stream[i * RENDER_STREAM_FLOATS + j];
+			center[j] = min(gridSize[j] - 1, max(0, (int) floor((point[j] - boxMin[j]) / cellSize)));
+		}
+		point[3] = 1;
+
+		int bestTetra = -1;
+		double bestDistance = numeric_limits<double>::max();
+		Vec4 bestWeights = Vec4::zero();
+		for (int ring = 0; ring <= maxRing && bestDistance > (ring - 1) * cellSize; ring++)
+		{
+			for (int x = center[0] - ring; x <= center[0] + ring; x++)
+			{
+				for (int y = center[1] - ring; y <= center[1] + ring; y++)
+				{
+					for (int z = center[2] - ring; z <= center[2] + ring; z++)
+					{
+						bool onRing = abs(x - center[0]) == ring || abs(y - center[1]) == ring || abs(z - center[2]) == ring;
+						if (!onRing || x < 0 || y < 0 || z < 0 || x >= gridSize[0] || y >= gridSize[1] || z >= gridSize[2])
+						{
+							continue;
+						}
+
+						int cell = (z * gridSize[1] + y) * gridSize[0] + x;
+						for (int k = cellOffsets[cell]; k < cellOffsets[cell + 1]; k++)
+						{
+							int t = cellTetra[k];
+							Vec4 coordinates = barycentric[t] * point;
+							double distance = 0;
+							for (int vertex = 0; vertex < 4; vertex++)
+							{
+								const Mat4 & inverseCorners = barycentric[t];
+								double gradientLength = sqrt(inverseCorners(vertex, 0) * inverseCorners(vertex, 0) +
+									inverseCorners(vertex, 1) * inverseCorners(vertex, 1) + inverseCorners(vertex, 2) * inverseCorners(vertex, 2));
+								distance = max(distance, -coordinates[vertex] / gradientLength);
+							}
+							if (distance < bestDistance)
+							{
+								bestDistance = distance;
+								bestTetra = t;
+								bestWeights = coordinates;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		//Only possible if every tetrahedron is degenerate - the vertex then follows vertex 0
+		if (bestTetra < 0)
+		{
+			for (int k = 0; k < 4; k++)
+			{
+				embeddingVertices[i * 4 + k] = 0;
+				weights[i * 4 + k] = k == 0 ? 1 : 0;
+			}
+			continue;
+		}
+
+		for (int k = 0; k < 4; k++)
+		{
+			embeddingVertices[i * 4 + k] = simTetraList[k * simTetraCount + bestTetra];
+			weights[i * 4 + k] = bestWeights[k];
+		}
+
+		#pragma omp critical
+		maxOutsideDistance = max(maxOutsideDistance, bestDistance);
+	}
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Render mesh of " << numVertices << " surface vertices and " << indices.size() / 3 << " triangles embedded in "
+			<< simTetraCount << " tetrahedra (farthest outside: " << maxOutsideDistance << ")" << endl;
+	}
+	#endif
+}
+
+RenderEmbedding::~RenderEmbedding()
+{
+	delete [] embeddingVertices;
+	delete [] weights;
+	delete [] triangleOffsets;
+	delete [] vertexTriangles;
+	delete [] faceNormals;
+	alignedFree(stream);
+}
+
+//Moves the render vertices with the simulated mesh and recomputes their normals (the same area weighted normals as
+//ParticleSystem::calculateNormals) into the stream
+//Parameter positions - deformed simulation positions, positions[dimension * simVertexCount + vertex]
+void RenderEmbedding::apply(const double * positions, int numThreads)
+{
+	#pragma omp parallel num_threads(numThreads)
+	{
+		#pragma omp for schedule(static)
+		for (int i = 0; i < numVertices; i++)
+		{
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				const double * position = &positions[j * numSimVertices];
+				stream[i * RENDER_STREAM_FLOATS + j] = (float) (weights[i * 4 + 0] * position[embeddingVertices[i * 4 + 0]] +
+					weights[i * 4 + 1] * position[embeddingVertices[i * 4 + 1]] +
+					weights[i * 4 + 2] * position[embeddingVertices[i * 4 + 2]] +
+					weights[i * 4 + 3] * position[embeddingVertices[i * 4 + 3]]);
+			}
+		}
+
+		int numTriangles = (int) indices.size() / 3;
+		#pragma omp for schedule(static)
+		for (int triangle = 0; triangle < numTriangles; triangle++)
+		{
+			const float * p0 = &stream[indices[triangle * 3 + 0] * RENDER_STREAM_FLOATS];
+			const float * p1 = &stream[indices[triangle * 3 + 1] * RENDER_STREAM_FLOATS];
+			const float * p2 = &stream[indices[triangle * 3 + 2] * RENDER_STREAM_FLOATS];
+			Vec3 vectorDifferenceA = {{p0[0] - p1[0], p0[1] - p1[1], p0[2] - p1[2]}};
+			Vec3 vectorDifferenceB = {{p1[0] - p2[0], p1[1] - p2[1], p1[2] - p2[2]}};
+			Vec3 crossProductResult = cross(vectorDifferenceA, vectorDifferenceB);
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				faceNormals[triangle * DIMENSION + j] = crossProductResult[j];
+			}
+		}
+
+		#pragma omp for schedule(static)
+		for (int i = 0; i < numVertices; i++)
+		{
+			Vec3 vertexNormal = Vec3::zero();
+			for (int k = triangleOffsets[i]; k < triangleOffsets[i + 1]; k++)
+			{
+				for (int j = 0; j < DIMENSION; j++)
+				{
+					vertexNormal[j] += faceNormals[vertexTriangles[k] * DIMENSION + j];
+				}
+			}
+
+			double magnitude = sqrt(dot(vertexNormal, vertexNormal));
+			if (magnitude == 0)
+			{
+				magnitude = 1;
+			}
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				stream[i * RENDER_STREAM_FLOATS + 4 + j] = (float) (vertexNormal[j] / magnitude);
+			}
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include "Vertex.h"
+#include "Logger.h"
+
+using namespace std;
+
+const int EMBEDDING_GRID_CELLS = 32;		//Cells along the longest side of the point location grid over the simulated mesh
+
+//Drives a detailed render mesh with a coarser simulated tetrahedral mesh
+//Every surface vertex of the render mesh is bound once, in the rest state, to the simulated tetrahedron containing it (or, for
+//vertices outside the simulated mesh, the one it is least outside of) by its 4 barycentric coordinates.  Each frame apply moves
+//the render vertices with the deformed simulation positions and recomputes the render normals, straight into the streamed
+//render layout (RENDER_STREAM_FLOATS floats per vertex - see ParticleSystem::sendVBOs).
+//Only the surface of the render mesh is kept, renumbered, since its interior is never drawn.
+class RenderEmbedding
+{
+public:
+	RenderEmbedding(const Vertex * simVertices, int simVertexCount, const int * simTetraList, int simTetraCount,
+		const Vertex * renderVertices, int renderVertexCount, const int * renderTetraList, int renderTetraCount, Logger * logger);
+	~RenderEmbedding();
+	void apply(const double * positions, int numThreads);
+	int getVertexCount() {return numVertices;}
+	const vector<int> & getIndices() {return indices;}
+	const vector<float> & getColors() {return colors;}
+	const float * getStream() {return stream;}
+	double getMaxOutsideDistance() {return maxOutsideDistance;}
+
+private:
+	int numVertices;				//Render surface vertices
+	int numSimVertices;
+	vector<int> indices;			//Render surface triangles (counter clockwise, renumbered)
+	vector<float> colors;			//4 per render vertex
+	int * embeddingVertices;		//The 4 vertices of the simulated tetrahedron render vertex i follows, embeddingVertices[i * 4 + k]
+	double * weights;				//Barycentric coordinates, weights[i * 4 + k]
+	int * triangleOffsets;			//Render vertex to surface triangle adjacency (see ParticleSystem::buildVertexTriangles)
+	int * vertexTriangles;
+	double * faceNormals;			//Area weighted normal of each render triangle, faceNormals[triangle * DIMENSION + dimension]
+	float * stream;					//Positions and normals in the streamed render layout
+	double maxOutsideDistance;		//Farthest any render vertex lies outside its tetrahedron in the rest state
+	Logger * logger;
+};
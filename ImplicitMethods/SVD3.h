@@ -0,0 +1,248 @@
+#pragma once
+
+#include "Simd.h"
+
+//Allocation free singular value decomposition of 3 X 3 matrices with minimal branching
+//Based on: McAdams et al., "Computing the Singular Value Decomposition of 3 x 3 matrices with minimal branching and elementary floating point operations"
+//A = U * diag(sigma) * V' where U and V are rotations (determinant +1), so an inverted A (determinant < 0) gets a negative sigma[2].
+//sigma is sorted by decreasing magnitude.  All matrices are row major: A[row * 3 + col].
+//V comes from a cyclic Jacobi eigenanalysis of A' * A and U, sigma from a Givens QR factorization of A * V.
+//Nothing branches on the data, so T may be double, SimdDouble or SimdFloat (SIMD_WIDTH or SIMD_FLOAT_WIDTH independent matrices, one per lane).
+
+#define SVD3_JACOBI_SWEEPS 5	//Jacobi converges quadratically; 5 sweeps reach double precision for any 3 X 3 matrix
+#define SVD3_WARM_SWEEPS 1		//Sweeps of svd3WarmStart - a good starting rotation leaves only small off diagonal entries
+
+//One Jacobi rotation in the (p, q) plane that zeros S[p][q]: S = J' * S * J and V = V * J
+template <typename T> inline void svd3JacobiRotate(T * S, T * V, int p, int q)
+{
+	T zero = simdConstant<T>(0);
+	T one = simdConstant<T>(1);
+
+	T a = S[p * 3 + p];
+	T d = S[q * 3 + q];
+	T b = S[p * 3 + q];
+
+	//Skip (use the identity) when the off diagonal entry is already negligible
+	typename SimdTraits<T>::Mask negligible = simdLess(simdMul(b, b), simdAdd(simdMul(simdConstant<T>(1e-30), simdAdd(simdMul(a, a), simdMul(d, d))), simdConstant<T>(SimdTraits<T>::tiny())));
+	T safeB = simdSelect(negligible, one, b);
+
+	//Smaller root of t^2 + 2 * theta * t - 1 = 0 (Numerical Recipes, section 11.1)
+	T theta = simdDiv(simdSub(d, a), simdMul(simdConstant<T>(2), safeB));
+	T absTheta = simdMax(theta, simdSub(zero, theta));
+	T t = simdDiv(one, simdAdd(absTheta, simdSqrt(simdMulAdd(theta, theta, one))));
+	t = simdSelect(simdLess(theta, zero), simdSub(zero, t), t);
+	t = simdSelect(negligible, zero, t);
+
+	T c = simdDiv(one, simdSqrt(simdMulAdd(t, t, one)));
+	T s = simdMul(t, c);
+
+	for (int k = 0; k < 3; k++)
+	{
+		T skp = S[k * 3 + p];
+		T skq = S[k * 3 + q];
+		S[k * 3 + p] = simdSub(simdMul(c, skp), simdMul(s, skq));
+		S[k * 3 + q] = simdMulAdd(s, skp, simdMul(c, skq));
+
+		T vkp = V[k * 3 + p];
+		T vkq = V[k * 3 + q];
+		V[k * 3 + p] = simdSub(simdMul(c, vkp), simdMul(s, vkq));
+		V[k * 3 + q] = simdMulAdd(s, vkp, simdMul(c, vkq));
+	}
+
+	for (int k = 0; k < 3; k++)
+	{
+		T spk = S[p * 3 + k];
+		T sqk = S[q * 3 + k];
+		S[p * 3 + k] = simdSub(simdMul(c, spk), simdMul(s, sqk));
+		S[q * 3 + k] = simdMulAdd(s, spk, simdMul(c, sqk));
+	}
+}
+
+//Swaps eigenvalues i and j (and their columns of V) if lambda[i] < lambda[j]
+//One of the swapped columns is negated so V stays a rotation.
+template <typename T> inline void svd3ConditionalSwap(T * lambda, T * V, int i, int j)
+{
+	T zero = simdConstant<T>(0);
+	typename SimdTraits<T>::Mask swap = simdLess(lambda[i], lambda[j]);
+
+	T lambdaI = lambda[i];
+	lambda[i] = simdSelect(swap, lambda[j], lambdaI);
+	lambda[j] = simdSelect(swap, lambdaI, lambda[j]);
+
+	for (int k = 0; k < 3; k++)
+	{
+		T vi = V[k * 3 + i];
+		T vj = V[k * 3 + j];
+		V[k * 3 + i] = simdSelect(swap, vj, vi);
+		V[k * 3 + j] = simdSelect(swap, simdSub(zero, vi), vj);
+	}
+}
+
+//Givens rotation G of rows p and q that zeros B[q][p]: B = G * B and U = U * G'
+template <typename T> inline void svd3GivensQR(T * B, T * U, int p, int q)
+{
+	T zero = simdConstant<T>(0);
+	T one = simdConstant<T>(1);
+
+	T a = B[p * 3 + p];
+	T b = B[q * 3 + p];
+	T lengthSquared = simdMulAdd(a, a, simdMul(b, b));
+
+	//A (numerically) zero column needs no rotation
+	typename SimdTraits<T>::Mask degenerate = simdLess(lengthSquared, simdConstant<T>(SimdTraits<T>::tiny()));
+	T inverseLength = simdDiv(one, simdSqrt(simdSelect(degenerate, one, lengthSquared)));
+	T c = simdSelect(degenerate, one, simdMul(a, inverseLength));
+	T s = simdSelect(degenerate, zero, simdMul(b, inverseLength));
+
+	for (int k = 0; k < 3; k++)
+	{
+		T bpk = B[p * 3 + k];
+		T bqk = B[q * 3 + k];
+		B[p * 3 + k] = simdMulAdd(c, bpk, simdMul(s, bqk));
+		B[q * 3 + k] = simdSub(simdMul(c, bqk), simdMul(s, bpk));
+
+		T ukp = U[k * 3 + p];
+		T ukq = U[k * 3 + q];
+		U[k * 3 + p] = simdMulAdd(c, ukp, simdMul(s, ukq));
+		U[k * 3 + q] = simdSub(simdMul(c, ukq), simdMul(s, ukp));
+	}
+}
+
+//Finishes the decomposition once S = V' * A' * A * V for the starting rotation V: sweeps Jacobi sweeps diagonalize S (updating V),
+//then the columns are sorted and U, sigma come from the QR factorization of A * V
+template <typename T> inline void svd3FromNormalMatrix(const T * A, T * S, T * U, T * sigma, T * V, int sweeps)
+{
+	T zero = simdConstant<T>(0);
+	T one = simdConstant<T>(1);
+
+	for (int k = 0; k < 9; k++)
+	{
+		U[k] = (k % 4 == 0) ? one : zero;
+	}
+
+	//V' * S * V becomes diagonal (the eigenvalues of A' * A are the squared singular values)
+	for (int sweep = 0; sweep < sweeps; sweep++)
+	{
+		svd3JacobiRotate(S, V, 0, 1);
+		svd3JacobiRotate(S, V, 0, 2);
+		svd3JacobiRotate(S, V, 1, 2);
+	}
+
+	T lambda[3] = {S[0], S[4], S[8]};
+	svd3ConditionalSwap(lambda, V, 0, 1);
+	svd3ConditionalSwap(lambda, V, 0, 2);
+	svd3ConditionalSwap(lambda, V, 1, 2);
+
+	//B = A * V has orthogonal columns; its QR factorization B = U * R leaves the singular values on the diagonal of R
+	T B[9];
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = 0; col < 3; col++)
+		{
+			T sum = simdMul(A[row * 3 + 0], V[0 * 3 + col]);
+			sum = simdMulAdd(A[row * 3 + 1], V[1 * 3 + col], sum);
+			B[row * 3 + col] = simdMulAdd(A[row * 3 + 2], V[2 * 3 + col], sum);
+		}
+	}
+
+	svd3GivensQR(B, U, 0, 1);
+	svd3GivensQR(B, U, 0, 2);
+	svd3GivensQR(B, U, 1, 2);
+
+	sigma[0] = B[0];
+	sigma[1] = B[4];
+	sigma[2] = B[8];
+}
+
+//A = U * diag(sigma) * V' (see the top of this file)
+//Parameter A - 3 X 3 input matrix
+//Parameters U and V - receive the 3 X 3 rotations
+//Parameter sigma - receives the 3 singular values (sigma[2] is negative when the determinant of A is)
+template <typename T> void svd3(const T * A, T * U, T * sigma, T * V)
+{
+	T zero = simdConstant<T>(0);
+	T one = simdConstant<T>(1);
+
+	//S = A' * A
+	T S[9];
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = 0; col < 3; col++)
+		{
+			T sum = simdMul(A[0 * 3 + row], A[0 * 3 + col]);
+			sum = simdMulAdd(A[1 * 3 + row], A[1 * 3 + col], sum);
+			S[row * 3 + col] = simdMulAdd(A[2 * 3 + row], A[2 * 3 + col], sum);
+		}
+	}
+
+	for (int k = 0; k < 9; k++)
+	{
+		V[k] = (k % 4 == 0) ? one : zero;
+	}
+
+	svd3FromNormalMatrix(A, S, U, sigma, V, SVD3_JACOBI_SWEEPS);
+}
+
+//svd3 starting the Jacobi sweeps from the rotation already in V instead of the identity
+//When V is the V of a nearby matrix (the same tetrahedron one time step earlier) A' * A is nearly diagonal in its basis, and
+//with quadratic convergence SVD3_WARM_SWEEPS sweeps are as accurate as SVD3_JACOBI_SWEEPS from the identity.
+//Parameter V - the starting rotation on input, the rotation of A on output (so it can start the next step)
+template <typename T> void svd3WarmStart(const T * A, T * U, T * sigma, T * V, int sweeps)
+{
+	//AV = A * V, S = AV' * AV
+	T AV[9];
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = 0; col < 3; col++)
+		{
+			T sum = simdMul(A[row * 3 + 0], V[0 * 3 + col]);
+			sum = simdMulAdd(A[row * 3 + 1], V[1 * 3 + col], sum);
+			AV[row * 3 + col] = simdMulAdd(A[row * 3 + 2], V[2 * 3 + col], sum);
+		}
+	}
+
+	T S[9];
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = row; col < 3; col++)
+		{
+			T sum = simdMul(AV[0 * 3 + row], AV[0 * 3 + col]);
+			sum = simdMulAdd(AV[1 * 3 + row], AV[1 * 3 + col], sum);
+			S[row * 3 + col] = S[col * 3 + row] = simdMulAdd(AV[2 * 3 + row], AV[2 * 3 + col], sum);
+		}
+	}
+
+	svd3FromNormalMatrix(A, S, U, sigma, V, sweeps);
+}
+
+//Eigendecomposition of a symmetric 3 X 3 matrix: A = V * diag(lambda) * V', with lambda sorted in decreasing order
+//Uses the Jacobi sweeps of svd3 on A itself instead of A' * A, so the eigenvalues keep their signs.
+//Parameter A - symmetric 3 X 3 input matrix
+//Parameter lambda - receives the 3 eigenvalues
+//Parameter V - receives the eigenvectors as its columns (a rotation)
+template <typename T> void symmetricEigen3(const T * A, T * lambda, T * V)
+{
+	T zero = simdConstant<T>(0);
+	T one = simdConstant<T>(1);
+
+	T S[9];
+	for (int k = 0; k < 9; k++)
+	{
+		S[k] = A[k];
+		V[k] = (k % 4 == 0) ? one : zero;
+	}
+
+	for (int sweep = 0; sweep < SVD3_JACOBI_SWEEPS; sweep++)
+	{
+		svd3JacobiRotate(S, V, 0, 1);
+		svd3JacobiRotate(S, V, 0, 2);
+		svd3JacobiRotate(S, V, 1, 2);
+	}
+
+	lambda[0] = S[0];
+	lambda[1] = S[4];
+	lambda[2] = S[8];
+	svd3ConditionalSwap(lambda, V, 0, 1);
+	svd3ConditionalSwap(lambda, V, 0, 2);
+	svd3ConditionalSwap(lambda, V, 1, 2);
+}
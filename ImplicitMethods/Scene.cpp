@@ -0,0 +1,424 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include "Scene.h"
+#include "BatchRunner.h"
+#include "TetraMeshReader.h"
+
+using namespace std;
+
+Scene::Scene()
+{
+	deltaT = 0;
+	useCache = true;
+	reorder = false;
+	vertexList = NULL;
+	vertexCount = 0;
+	tetraList = NULL;
+	tetraCount = 0;
+}
+
+Scene::~Scene()
+{
+	delete [] vertexList;	//Only still set if no particle system was created
+	delete [] tetraList;
+}
+
+//Reads the bodies of a scene file (see the class comment for the format)
+//Returns false if the file cannot be read, a line is not understood or there are no bodies.
+bool Scene::loadFile(const char * fileName)
+{
+	ifstream file(fileName);
+	if (!file)
+	{
+		cerr << "Could not open scene file " << fileName << endl;
+		return false;
+	}
+
+	string line;
+	int lineNumber = 0;
+	while (getline(file, line))
+	{
+		lineNumber++;
+		line = line.substr(0, line.find('#'));
+
+		istringstream tokens(line);
+		string keyword;
+		if (!(tokens >> keyword))
+		{
+			continue;	//Blank or comment line
+		}
+
+		bool valid = true;
+		if (keyword == "dt")
+		{
+			valid = (tokens >> deltaT) && deltaT > 0;
+		}
+		else if (keyword == "body")
+		{
+			SceneBody body;
+			valid = !(tokens >> body.meshName).fail() && readBodyValues(tokens, body, NULL);
+			if (valid)
+			{
+				bodies.push_back(body);
+			}
+		}
+		else if (keyword == "sweep")
+		{
+			//COUNT bodies with each swept value stepping evenly from the first body's to the last body's
+			SceneBody first;
+			int count = 0;
+			valid = !(tokens >> first.meshName >> count).fail() && count > 0;
+			SceneBody last = first;
+			valid = valid && readBodyValues(tokens, first, &last);
+			for (int i = 0; valid && i < count; i++)
+			{
+				double t = count > 1 ? (double) i / (count - 1) : 0;
+				SceneBody body = first;
+				body.K = first.K + t * (last.K - first.K);
+				body.mu = first.mu + t * (last.mu - first.mu);
+				body.kd = first.kd + t * (last.kd - first.kd);
+				body.gravity = first.gravity + t * (last.gravity - first.gravity);
+				bodies.push_back(body);
+			}
+		}
+		else if (keyword == "sphere")
+		{
+			SceneObstacle obstacle;
+			obstacle.type = COLLIDER_SPHERE;
+			valid = !(tokens >> obstacle.center[0] >> obstacle.center[1] >> obstacle.center[2] >> obstacle.radius).fail() && obstacle.radius > 0;
+			if (valid)
+			{
+				obstacles.push_back(obstacle);
+			}
+		}
+		else if (keyword == "box")
+		{
+			SceneObstacle obstacle;
+			obstacle.type = COLLIDER_BOX;
+			valid = !(tokens >> obstacle.boxMin[0] >> obstacle.boxMin[1] >> obstacle.boxMin[2] >> obstacle.boxMax[0] >> obstacle.boxMax[1] >> obstacle.boxMax[2]).fail();
+			for (int j = 0; j < DIMENSION && valid; j++)
+			{
+				valid = obstacle.boxMin[j] < obstacle.boxMax[j];
+			}
+			if (valid)
+			{
+				obstacles.push_back(obstacle);
+			}
+		}
+		else
+		{
+			valid = false;
+		}
+
+		if (!valid)
+		{
+			cerr << fileName << " line " << lineNumber << ": cannot read \"" << line << "\"" << endl;
+			return false;
+		}
+	}
+
+	if (bodies.empty())
+	{
+		cerr << "Scene file " << fileName << " has no bodies" << endl;
+		return false;
+	}
+	return true;
+}
+
+//Reads the optional offset and named values of a body or sweep line after the mesh name (see the class comment)
+//Parameter last - NULL for a body line; for a sweep line receives the values of the last body, since each value of K, mu, kd
+//and gravity is then a pair
+//Returns false if a value is missing or not understood
+bool Scene::readBodyValues(istringstream & tokens, SceneBody & body, SceneBody * last)
+{
+	body.offset[0] = body.offset[1] = body.offset[2] = 0;
+	body.scale = 1;
+	body.K = 0;
+	body.mu = 0;
+	body.kd = -1;
+	body.hasGravity = false;
+	body.gravity = 0;
+	if (last != NULL)
+	{
+		*last = body;
+	}
+
+	//Optional offset, then named values
+	string value;
+	if (!(tokens >> value))
+	{
+		return true;
+	}
+	istringstream number(value);
+	if (number >> body.offset[0])
+	{
+		if ((tokens >> body.offset[1] >> body.offset[2]).fail())
+		{
+			return false;
+		}
+		value.clear();
+		tokens >> value;
+	}
+
+	bool valid = true;
+	while (valid && !value.empty())
+	{
+		double * swept = NULL;
+		double * sweptLast = NULL;
+		if (value == "scale")
+		{
+			valid = (tokens >> body.scale) && body.scale > 0;
+		}
+		else if (value == "K")
+		{
+			swept = &body.K;
+			sweptLast = last != NULL ? &last -> K : NULL;
+		}
+		else if (value == "mu")
+		{
+			swept = &body.mu;
+			sweptLast = last != NULL ? &last -> mu : NULL;
+		}
+		else if (value == "kd")
+		{
+			swept = &body.kd;
+			sweptLast = last != NULL ? &last -> kd : NULL;
+		}
+		else if (value == "gravity")
+		{
+			body.hasGravity = true;
+			swept = &body.gravity;
+			sweptLast = last != NULL ? &last -> gravity : NULL;
+		}
+		else
+		{
+			valid = false;
+		}
+
+		if (swept != NULL)
+		{
+			valid = !(tokens >> *swept).fail() && (sweptLast == NULL || !(tokens >> *sweptLast).fail());
+		}
+		value.clear();
+		tokens >> value;
+	}
+
+	//Values that are not swept are the same for every body
+	if (last != NULL)
+	{
+		SceneBody swept = *last;
+		*last = body;
+		last -> K = swept.K;
+		last -> mu = swept.mu;
+		last -> kd = swept.kd;
+		last -> gravity = swept.gravity;
+	}
+	return valid;
+}
+
+//Returns the time step of the scene - the dt line of the file, or else the smallest interactive time step of its meshes
+//(the stiffest body decides what is stable)
+double Scene::getDeltaT(int whichMethod)
+{
+	if (deltaT > 0)
+	{
+		return deltaT;
+	}
+
+	double smallest = 0;
+	for (int i = 0; i < (int) bodies.size(); i++)
+	{
+		double bodyDeltaT = getDefaultSettings(getModelNumber(bodies[i].meshName.c_str()), whichMethod).deltaT;
+		if (i == 0 || bodyDeltaT < smallest)
+		{
+			smallest = bodyDeltaT;
+		}
+	}
+	return smallest;
+}
+
+//Reads every body's mesh and packs them into vertexList and tetraList (vertex indices offset by the body's first vertex)
+//Meshes used by several bodies are only read once.
+bool Scene::loadMeshes(Logger * logger)
+{
+	//Each distinct mesh, with the readers kept open until packing is done (a cached tetraList points into its reader's mapping)
+	vector<string> meshNames;
+	vector<TetraMeshReader *> readers;
+	vector<Vertex *> meshVertices;
+	vector<int> meshVertexCounts;
+	vector<int *> meshTetra;
+	vector<int> meshTetraCounts;
+	vector<int> bodyMeshes(bodies.size());
+
+	bool loaded = true;
+	for (int i = 0; i < (int) bodies.size() && loaded; i++)
+	{
+		int mesh = 0;
+		while (mesh < (int) meshNames.size() && meshNames[mesh] != bodies[i].meshName)
+		{
+			mesh++;
+		}
+		bodyMeshes[i] = mesh;
+		if (mesh < (int) meshNames.size())
+		{
+			continue;
+		}
+
+		string nodeFileName = bodies[i].meshName + ".node";
+		string elementFileName = bodies[i].meshName + ".ele";
+		TetraMeshReader * reader = new TetraMeshReader();
+		reader -> setUseCache(useCache);
+		reader -> setReorder(reorder);
+		Vertex * vertices = NULL;
+		int * tetra = NULL;
+		int meshVertexCount = 0;
+		int meshTetraCount = 0;
+		loaded = reader -> openFile((char *) nodeFileName.c_str(), (char *) elementFileName.c_str()) &&
+			reader -> loadData(vertices, meshVertexCount, tetra, meshTetraCount, logger);
+		reader -> closeFile();
+		if (!loaded)
+		{
+			cerr << "Could not load mesh " << bodies[i].meshName << endl;
+		}
+
+		meshNames.push_back(bodies[i].meshName);
+		readers.push_back(reader);
+		meshVertices.push_back(vertices);
+		meshVertexCounts.push_back(meshVertexCount);
+		meshTetra.push_back(tetra);
+		meshTetraCounts.push_back(meshTetraCount);
+	}
+
+	if (loaded)
+	{
+		delete [] vertexList;
+		delete [] tetraList;
+
+		firstVertices.resize(bodies.size());
+		vector<int> firstTetra(bodies.size());
+		vertexCount = 0;
+		tetraCount = 0;
+		for (int i = 0; i < (int) bodies.size(); i++)
+		{
+			firstVertices[i] = vertexCount;
+			firstTetra[i] = tetraCount;
+			vertexCount += meshVertexCounts[bodyMeshes[i]];
+			tetraCount += meshTetraCounts[bodyMeshes[i]];
+		}
+
+		vertexList = new Vertex[vertexCount];
+		tetraList = new int[4 * tetraCount];
+		for (int i = 0; i < (int) bodies.size(); i++)
+		{
+			int mesh = bodyMeshes[i];
+			const SceneBody & body = bodies[i];
+			for (int v = 0; v < meshVertexCounts[mesh]; v++)
+			{
+				Vertex & vertex = vertexList[firstVertices[i] + v];
+				vertex = meshVertices[mesh][v];
+				for (int j = 0; j < DIMENSION; j++)
+				{
+					vertex.position[j] = (float) (body.scale * vertex.position[j] + body.offset[j]);
+				}
+			}
+
+			//tetraList is stored corner by corner (k * tetraCount + tetrahedron), so each body's corners land in 4 separate ranges
+			for (int k = 0; k < 4; k++)
+			{
+				for (int t = 0; t < meshTetraCounts[mesh]; t++)
+				{
+					tetraList[k * tetraCount + firstTetra[i] + t] = meshTetra[mesh][k * meshTetraCounts[mesh] + t] + firstVertices[i];
+				}
+			}
+		}
+
+		#ifdef DEBUGGING
+		if (logger -> isLogging)
+		{
+			cout << "Scene packed " << bodies.size() << " bodies (" << meshNames.size() << " meshes) into " << vertexCount << " vertices and " << tetraCount << " tetrahedra" << endl;
+		}
+		#endif
+	}
+
+	for (int mesh = 0; mesh < (int) meshNames.size(); mesh++)
+	{
+		delete [] meshVertices[mesh];
+		delete readers[mesh];
+	}
+	return loaded;
+}
+
+//Creates the particle system of a deformation method over the packed meshes (see loadMeshes), gives each body its constants
+//and adds the obstacles
+//The particle system takes the vertex list; the scene keeps the tetraList and must be deleted after the particle system.
+ParticleSystem * Scene::createParticleSystem(int whichMethod, Logger * logger)
+{
+	if (vertexList == NULL)
+	{
+		return NULL;
+	}
+
+	ParticleSystem * particleSystem = ::createParticleSystem(whichMethod, vertexList, vertexCount, tetraList, tetraCount, logger);
+	vertexList = NULL;
+
+	bodyMaterials.resize(bodies.size());
+	for (int i = 0; i < (int) bodies.size(); i++)
+	{
+		const SceneBody & body = bodies[i];
+		SimulationSettings settings = getDefaultSettings(getModelNumber(body.meshName.c_str()), whichMethod);
+		//Each constant the body does not set keeps its default, as on the command line
+		if (body.K != 0)
+		{
+			settings.K = body.K;
+		}
+		if (body.mu != 0)
+		{
+			settings.mu = body.mu;
+		}
+		if (body.kd >= 0)
+		{
+			settings.kd = body.kd;
+		}
+
+		BodyMaterial & material = bodyMaterials[i];
+		material.firstVertex = firstVertices[i];
+		material.vertexCount = (i + 1 < (int) bodies.size() ? firstVertices[i + 1] : vertexCount) - firstVertices[i];
+
+		//Same rules as applySettings - constants that are not set keep the deformation method's own
+		material.lambda = particleSystem -> getLambda();
+		material.mu = particleSystem -> getMu();
+		material.kd = settings.kd < 0 ? particleSystem -> getKd() : settings.kd;
+		material.hasGravity = body.hasGravity;
+		material.gravity = body.gravity;
+		if (settings.K != 0 || settings.mu != 0)
+		{
+			double methodK = material.lambda + (2.0/3) * material.mu;
+			material.mu = settings.mu != 0 ? settings.mu : material.mu;
+			material.lambda = (settings.K != 0 ? settings.K : methodK) - (2.0/3) * material.mu;		//Lame's first parameter
+		}
+	}
+	particleSystem -> setBodyMaterials(bodyMaterials);
+
+	addObstacles(particleSystem, obstacles);
+
+	return particleSystem;
+}
+
+//Adds static obstacles to the collision system of a particle system, with the floor's restitution and friction
+void addObstacles(ParticleSystem * particleSystem, const vector<SceneObstacle> & obstacles)
+{
+	ContactMaterial contactMaterial = particleSystem -> getContactMaterial();
+	for (int i = 0; i < (int) obstacles.size(); i++)
+	{
+		const SceneObstacle & obstacle = obstacles[i];
+		if (obstacle.type == COLLIDER_SPHERE)
+		{
+			particleSystem -> getCollisionSystem() -> addSphere(obstacle.center, obstacle.radius, contactMaterial);
+		}
+		else
+		{
+			particleSystem -> getCollisionSystem() -> addBox(obstacle.boxMin, obstacle.boxMax, contactMaterial);
+		}
+	}
+}
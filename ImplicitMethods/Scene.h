@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include "ParticleSystem.h"
+#include "Logger.h"
+
+using namespace std;
+
+//One mesh placed in a Scene
+struct SceneBody
+{
+	string meshName;				//Loads meshName.node and meshName.ele
+	double offset[DIMENSION];		//Translation, in the coordinates of the .node file (z is up there - see ParticleSystem::doTransform)
+	double scale;					//Uniform scale about the .node file origin, applied before the offset
+	double K;						//Bulk modulus - K and mu both 0 use the interactive settings of the mesh (see getDefaultSettings)
+	double mu;						//Shear modulus
+	double kd;						//Damping constant - negative uses the interactive settings of the mesh
+	bool hasGravity;				//True if the body falls with gravity instead of the system's (see BodyMaterial)
+	double gravity;
+};
+
+//A static obstacle of a Scene - a sphere or an axis aligned box, in simulation coordinates (see CollisionSystem)
+struct SceneObstacle
+{
+	ColliderType type;				//COLLIDER_SPHERE or COLLIDER_BOX
+	double center[DIMENSION];		//Sphere
+	double radius;
+	double boxMin[DIMENSION];		//Box
+	double boxMax[DIMENSION];
+};
+
+void addObstacles(ParticleSystem * particleSystem, const vector<SceneObstacle> & obstacles);
+
+//A world of several meshes simulated as one ParticleSystem
+//The vertices of the bodies are packed one body after another into one vertex list and their tetrahedra into one tetraList,
+//so every body shares the same contiguous state arrays, force assembly pass (the coloring mixes the tetrahedra of all bodies
+//into each color, since bodies share no vertices), integration, collision passes and draw call.  Each body keeps its own
+//constants through ParticleSystem::setBodyMaterials.
+//Scene files are text, one setting per line (# starts a comment):
+//	body NAME [X Y Z] [scale S] [K BULK] [mu SHEAR] [kd DAMPING] [gravity G]
+//	sweep NAME COUNT [X Y Z] [scale S] [K FIRST LAST] [mu FIRST LAST] [kd FIRST LAST] [gravity FIRST LAST]
+//					COUNT bodies of NAME with the constants stepping evenly from FIRST to LAST
+//	sphere X Y Z RADIUS
+//	box MINX MINY MINZ MAXX MAXY MAXZ
+//					Static obstacles the bodies collide with (the floor's restitution and friction), in simulation
+//					coordinates: y is up and the floor is at y = FLOOR_HEIGHT.  They are not drawn.
+//	dt SECONDS		Time step (defaults to the smallest interactive time step of the bodies' meshes)
+//A sweep (or several bodies of one mesh) is an ensemble for tuning constants: the mesh is read once, the rest state of all
+//the copies is computed in one pass (and cached - it does not depend on the constants) and one force pass steps every
+//variant.  Bodies only collide with each other with self collision on, so the variants may all stand in the same place.
+class Scene
+{
+public:
+	Scene();
+	~Scene();
+	bool loadFile(const char * fileName);
+	void addBody(const SceneBody & body) {bodies.push_back(body);}
+	int getBodyCount() {return (int) bodies.size();}
+	const SceneBody & getBody(int i) {return bodies[i];}
+	int getObstacleCount() {return (int) obstacles.size();}
+	int getFirstVertex(int i) {return firstVertices[i];}
+	double getDeltaT(int whichMethod);
+	void setUseCache(bool useCache) {this -> useCache = useCache;}
+	void setReorder(bool reorder) {this -> reorder = reorder;}
+	bool loadMeshes(Logger * logger);
+	ParticleSystem * createParticleSystem(int whichMethod, Logger * logger);
+	const BodyMaterial & getBodyMaterial(int i) {return bodyMaterials[i];}
+
+private:
+	Scene(const Scene &);					//Not copyable - owns the packed tetraList
+	Scene & operator = (const Scene &);
+
+	bool readBodyValues(istringstream & tokens, SceneBody & body, SceneBody * last);
+
+	vector<SceneBody> bodies;
+	vector<SceneObstacle> obstacles;
+	vector<BodyMaterial> bodyMaterials;		//Constants of each body, as given to the particle system (see createParticleSystem)
+	double deltaT;							//From the scene file (0 if it has no dt line)
+	bool useCache;							//False to bypass the mesh caches (see TetraMeshReader)
+	bool reorder;							//Renumber each mesh for memory locality (see TetraMeshReader)
+
+	//Packed meshes (see loadMeshes)
+	vector<int> firstVertices;				//First vertex of each body
+	Vertex * vertexList;					//Handed to the particle system, which deletes it
+	int vertexCount;
+	int * tetraList;						//Referenced by the particle system, so the scene must outlive it
+	int tetraCount;
+};
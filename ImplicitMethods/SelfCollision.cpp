@@ -0,0 +1,488 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include "SelfCollision.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+const double SELF_COLLISION_EPSILON = 1e-12;	//Used to check approximate equality to 0
+const int BVH_STACK_SIZE = 64;					//Deeper than any median split hierarchy of an int sized triangle count
+
+//Orders triangles by their centroid along one axis (for the median split in buildNode)
+struct CentroidLess
+{
+	const double * centroids;
+	int axis;
+	CentroidLess(const double * centroids, int axis) : centroids(centroids), axis(axis) {}
+	bool operator () (int a, int b) const {return centroids[a * DIMENSION + axis] < centroids[b * DIMENSION + axis];}
+};
+
+//Parameter triangleIndices - the surface triangles, 3 vertex indices each (see ParticleSystem::buildSurface)
+//Parameter positions - rest positions the hierarchy is built over, positions[dimension * numVertices + vertex]
+SelfCollision::SelfCollision(int numVertices, const vector<int> & triangleIndices, const double * positions, Logger * logger)
+{
+	this -> numVertices = numVertices;
+	this -> triangleIndices = triangleIndices;
+	this -> logger = logger;
+	numTriangles = (int) triangleIndices.size() / 3;
+
+	//Surface edges (each one is seen from both of its triangles; duplicates are removed below)
+	vector< vector<int> > vertexNeighbors(numVertices);
+	double edgeLengthSum = 0;
+	for (int i = 0; i < numTriangles; i++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			int a = triangleIndices[3 * i + k];
+			int b = triangleIndices[3 * i + (k + 1) % 3];
+			vertexNeighbors[a].push_back(b);
+			vertexNeighbors[b].push_back(a);
+
+			double lengthSquared = 0;
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				double difference = positions[j * numVertices + a] - positions[j * numVertices + b];
+				lengthSquared += difference * difference;
+			}
+			edgeLengthSum += sqrt(lengthSquared);
+		}
+	}
+
+	neighborOffsets.resize(numVertices + 1, 0);
+	for (int i = 0; i < numVertices; i++)
+	{
+		sort(vertexNeighbors[i].begin(), vertexNeighbors[i].end());
+		vertexNeighbors[i].erase(unique(vertexNeighbors[i].begin(), vertexNeighbors[i].end()), vertexNeighbors[i].end());
+		neighborOffsets[i + 1] = neighborOffsets[i] + (int) vertexNeighbors[i].size();
+		neighbors.insert(neighbors.end(), vertexNeighbors[i].begin(), vertexNeighbors[i].end());
+		if (!vertexNeighbors[i].empty())
+		{
+			surfaceVertices.push_back(i);
+		}
+	}
+
+	thickness = numTriangles > 0 ? SELF_COLLISION_THICKNESS * edgeLengthSum / (3 * numTriangles) : 0;
+	candidatesValid = false;
+
+	//Median split hierarchy over the rest state triangle centroids
+	vector<double> centroids(DIMENSION * numTriangles + 1);
+	triangleOrder.resize(numTriangles);
+	for (int i = 0; i < numTriangles; i++)
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			centroids[i * DIMENSION + j] = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				centroids[i * DIMENSION + j] += positions[j * numVertices + triangleIndices[3 * i + k]] / 3;
+			}
+		}
+		triangleOrder[i] = i;
+	}
+	if (numTriangles > 0)
+	{
+		buildNode(&centroids[0], 0, numTriangles);
+		refit(positions);
+	}
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Self collision hierarchy has " << nodes.size() << " nodes over " << numTriangles << " triangles, thickness " << thickness << endl;
+	}
+	#endif
+}
+
+//Builds the subtree over triangleOrder[first ... first + count) and returns its node index
+int SelfCollision::buildNode(const double * centroids, int first, int count)
+{
+	int index = (int) nodes.size();
+	nodes.push_back(BvhNode());
+	nodes[index].left = -1;
+	nodes[index].right = -1;
+	nodes[index].firstTriangle = first;
+	nodes[index].triangleCount = count;
+
+	if (count <= SELF_COLLISION_LEAF_TRIANGLES)
+	{
+		return index;
+	}
+
+	//Split at the median centroid along the longest side of the centroid bounds
+	double centroidMin[DIMENSION];
+	double centroidMax[DIMENSION];
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		centroidMin[j] = centroids[triangleOrder[first] * DIMENSION + j];
+		centroidMax[j] = centroidMin[j];
+	}
+	for (int i = first + 1; i < first + count; i++)
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			centroidMin[j] = min(centroidMin[j], centroids[triangleOrder[i] * DIMENSION + j]);
+			centroidMax[j] = max(centroidMax[j], centroids[triangleOrder[i] * DIMENSION + j]);
+		}
+	}
+	int axis = 0;
+	for (int j = 1; j < DIMENSION; j++)
+	{
+		if (centroidMax[j] - centroidMin[j] > centroidMax[axis] - centroidMin[axis])
+		{
+			axis = j;
+		}
+	}
+
+	int half = count / 2;
+	nth_element(triangleOrder.begin() + first, triangleOrder.begin() + first + half, triangleOrder.begin() + first + count, CentroidLess(centroids, axis));
+
+	//push_back may move the nodes, so the children are stored through the index
+	int left = buildNode(centroids, first, half);
+	int right = buildNode(centroids, first + half, count - half);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	nodes[index].triangleCount = 0;
+	return index;
+}
+
+//Recomputes every box from the current positions, children before parents
+void SelfCollision::refit(const double * positions)
+{
+	for (int n = (int) nodes.size() - 1; n >= 0; n--)
+	{
+		BvhNode & node = nodes[n];
+		if (node.triangleCount > 0)
+		{
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				node.boxMin[j] = positions[j * numVertices + triangleIndices[3 * triangleOrder[node.firstTriangle]]];
+				node.boxMax[j] = node.boxMin[j];
+			}
+			for (int i = node.firstTriangle; i < node.firstTriangle + node.triangleCount; i++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					int vertex = triangleIndices[3 * triangleOrder[i] + k];
+					for (int j = 0; j < DIMENSION; j++)
+					{
+						node.boxMin[j] = min(node.boxMin[j], positions[j * numVertices + vertex]);
+						node.boxMax[j] = max(node.boxMax[j], positions[j * numVertices + vertex]);
+					}
+				}
+			}
+		}
+		else
+		{
+			const BvhNode & left = nodes[node.left];
+			const BvhNode & right = nodes[node.right];
+			for (int j = 0; j < DIMENSION; j++)
+			{
+				node.boxMin[j] = min(left.boxMin[j], right.boxMin[j]);
+				node.boxMax[j] = max(left.boxMax[j], right.boxMax[j]);
+			}
+		}
+	}
+}
+
+//Returns true if the vertex is a corner of the triangle or shares a surface edge with one
+//Those pairs are always within the thickness of each other, so they are never treated as contacts.
+bool SelfCollision::isConnected(int vertex, int triangle)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		int corner = triangleIndices[3 * triangle + k];
+		if (corner == vertex || binary_search(neighbors.begin() + neighborOffsets[corner], neighbors.begin() + neighborOffsets[corner + 1], vertex))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//Returns true if a surface vertex has moved half the margin or more since the candidates were gathered
+//Until then no vertex and triangle can have closed more than the margin, so every pair within the thickness is a candidate.
+bool SelfCollision::candidatesMoved(const double * positions)
+{
+	double limit = SELF_COLLISION_MARGIN * thickness / 2;
+	for (int i = 0; i < (int) surfaceVertices.size(); i++)
+	{
+		double distanceSquared = 0;
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			double difference = positions[j * numVertices + surfaceVertices[i]] - candidatePositions[i * DIMENSION + j];
+			distanceSquared += difference * difference;
+		}
+		if (distanceSquared >= limit * limit)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//Refits the hierarchy and queries it for every surface vertex, in parallel
+void SelfCollision::gatherCandidates(const double * positions, int numThreads)
+{
+	refit(positions);
+
+	if ((int) threadCandidates.size() < numThreads)
+	{
+		threadCandidates.resize(numThreads);
+	}
+	for (int t = 0; t < (int) threadCandidates.size(); t++)
+	{
+		threadCandidates[t].clear();
+	}
+
+	double radius = (1 + SELF_COLLISION_MARGIN) * thickness;
+	int numSurfaceVertices = (int) surfaceVertices.size();
+	//Static, so each thread takes one run of vertices in order: joined in thread order the candidates (and the contacts found
+	//from them, which are responded to in that order) come out in the serial order, whatever the thread count
+	#pragma omp parallel for num_threads(numThreads) schedule(static)
+	for (int i = 0; i < numSurfaceVertices; i++)
+	{
+		int thread = 0;
+		#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		#endif
+		findCandidates(surfaceVertices[i], positions, radius, threadCandidates[thread]);
+	}
+
+	candidates.clear();
+	for (int t = 0; t < (int) threadCandidates.size(); t++)
+	{
+		candidates.insert(candidates.end(), threadCandidates[t].begin(), threadCandidates[t].end());
+	}
+
+	candidatePositions.resize(DIMENSION * numSurfaceVertices);
+	for (int i = 0; i < numSurfaceVertices; i++)
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			candidatePositions[i * DIMENSION + j] = positions[j * numVertices + surfaceVertices[i]];
+		}
+	}
+	candidatesValid = true;
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Self collision gathered " << candidates.size() << " candidate pairs" << endl;
+	}
+	#endif
+}
+
+//Appends the triangles not connected to the vertex whose boxes it is within radius of
+void SelfCollision::findCandidates(int vertex, const double * positions, double radius, vector<SelfCandidate> & found)
+{
+	double point[DIMENSION];
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		point[j] = positions[j * numVertices + vertex];
+	}
+
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const BvhNode & node = nodes[stack[--stackSize]];
+
+		bool overlaps = true;
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			overlaps = overlaps && point[j] > node.boxMin[j] - radius && point[j] < node.boxMax[j] + radius;
+		}
+		if (!overlaps)
+		{
+			continue;
+		}
+
+		if (node.triangleCount == 0)
+		{
+			stack[stackSize++] = node.left;
+			stack[stackSize++] = node.right;
+			continue;
+		}
+
+		for (int i = node.firstTriangle; i < node.firstTriangle + node.triangleCount; i++)
+		{
+			if (!isConnected(vertex, triangleOrder[i]))
+			{
+				SelfCandidate candidate = {vertex, triangleOrder[i]};
+				found.push_back(candidate);
+			}
+		}
+	}
+}
+
+//Exact test of one candidate pair - the vertex is in contact if it is closer than the thickness to the triangle plane and
+//its projection onto the plane is inside the triangle
+bool SelfCollision::testContact(const SelfCandidate & candidate, const double * positions, SelfContact & contact)
+{
+	const int * corners = &triangleIndices[3 * candidate.triangle];
+	double edge1[DIMENSION], edge2[DIMENSION], offset[DIMENSION];
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		double origin = positions[j * numVertices + corners[0]];
+		edge1[j] = positions[j * numVertices + corners[1]] - origin;
+		edge2[j] = positions[j * numVertices + corners[2]] - origin;
+		offset[j] = positions[j * numVertices + candidate.vertex] - origin;
+	}
+
+	double normal[DIMENSION] = {edge1[1] * edge2[2] - edge1[2] * edge2[1], edge1[2] * edge2[0] - edge1[0] * edge2[2], edge1[0] * edge2[1] - edge1[1] * edge2[0]};
+	double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	if (length < SELF_COLLISION_EPSILON)
+	{
+		return false;	//Degenerate triangle
+	}
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		normal[j] /= length;
+	}
+	double distance = offset[0] * normal[0] + offset[1] * normal[1] + offset[2] * normal[2];
+	if (fabs(distance) >= thickness)
+	{
+		return false;
+	}
+
+	//Barycentric coordinates of the projection onto the triangle plane
+	double d00 = 0, d01 = 0, d11 = 0, d20 = 0, d21 = 0;
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		double projected = offset[j] - distance * normal[j];
+		d00 += edge1[j] * edge1[j];
+		d01 += edge1[j] * edge2[j];
+		d11 += edge2[j] * edge2[j];
+		d20 += projected * edge1[j];
+		d21 += projected * edge2[j];
+	}
+	double denominator = d00 * d11 - d01 * d01;
+	double v = (d11 * d20 - d01 * d21) / denominator;
+	double w = (d00 * d21 - d01 * d20) / denominator;
+	double u = 1 - v - w;
+	if (u < 0 || v < 0 || w < 0)
+	{
+		return false;
+	}
+
+	contact.vertex = candidate.vertex;
+	contact.triangle = candidate.triangle;
+	contact.weights[0] = u;
+	contact.weights[1] = v;
+	contact.weights[2] = w;
+	double side = distance >= 0 ? 1 : -1;
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		contact.normal[j] = side * normal[j];
+	}
+	return true;
+}
+
+//Finds all contacts (gathering new candidates first if the old ones are out of date) and stops every approaching
+//vertex / triangle pair
+//Returns the number of contacts
+int SelfCollision::detectAndRespond(double * positions, double * velocities, const double * masses, double deltaT, int numThreads)
+{
+	if (numTriangles == 0)
+	{
+		return 0;
+	}
+
+	if (!candidatesValid || candidatesMoved(positions))
+	{
+		gatherCandidates(positions, numThreads);
+	}
+
+	if ((int) threadContacts.size() < numThreads)
+	{
+		threadContacts.resize(numThreads);
+	}
+	for (int t = 0; t < (int) threadContacts.size(); t++)
+	{
+		threadContacts[t].clear();
+	}
+
+	//The tests only read the positions, so the candidates are split across the threads; each thread keeps its own contacts
+	int numCandidates = (int) candidates.size();
+	#pragma omp parallel for num_threads(numThreads) schedule(static)
+	for (int i = 0; i < numCandidates; i++)
+	{
+		int thread = 0;
+		#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		#endif
+		SelfContact contact;
+		if (testContact(candidates[i], positions, contact))
+		{
+			threadContacts[thread].push_back(contact);
+		}
+	}
+
+	//Contacts share vertices, so the response is serial (there are few contacts compared to the candidates tested)
+	int contactCount = 0;
+	for (int t = 0; t < (int) threadContacts.size(); t++)
+	{
+		for (int i = 0; i < (int) threadContacts[t].size(); i++)
+		{
+			respond(threadContacts[t][i], positions, velocities, masses, deltaT);
+		}
+		contactCount += (int) threadContacts[t].size();
+	}
+
+	return contactCount;
+}
+
+//Inelastic impulse along the contact normal that cancels the approaching part of the relative velocity, shared between the
+//vertex and the triangle corners by mass and barycentric weight.  Separating pairs are left alone.
+void SelfCollision::respond(const SelfContact & contact, double * positions, double * velocities, const double * masses, double deltaT)
+{
+	const int * corners = &triangleIndices[3 * contact.triangle];
+
+	double normalVelocity = 0;
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		double relativeVelocity = velocities[j * numVertices + contact.vertex];
+		for (int k = 0; k < 3; k++)
+		{
+			relativeVelocity -= contact.weights[k] * velocities[j * numVertices + corners[k]];
+		}
+		normalVelocity += relativeVelocity * contact.normal[j];
+	}
+	if (normalVelocity >= 0)
+	{
+		return;
+	}
+
+	double inverseMassSum = 1 / masses[contact.vertex];
+	for (int k = 0; k < 3; k++)
+	{
+		inverseMassSum += contact.weights[k] * contact.weights[k] / masses[corners[k]];
+	}
+	double impulse = -normalVelocity / inverseMassSum;
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Self contact of vertex " << contact.vertex << " with triangle " << contact.triangle << ": impulse " << impulse << endl;
+	}
+	#endif
+
+	//Positions are moved by the impulse times deltaT, like the collision response (see CollisionSystem::respond)
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		double change = impulse / masses[contact.vertex] * contact.normal[j];
+		velocities[j * numVertices + contact.vertex] += change;
+		positions[j * numVertices + contact.vertex] += change * deltaT;
+		for (int k = 0; k < 3; k++)
+		{
+			change = -contact.weights[k] * impulse / masses[corners[k]] * contact.normal[j];
+			velocities[j * numVertices + corners[k]] += change;
+			positions[j * numVertices + corners[k]] += change * deltaT;
+		}
+	}
+}
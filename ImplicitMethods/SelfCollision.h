@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include "Vertex.h"
+#include "Logger.h"
+
+using namespace std;
+
+const int SELF_COLLISION_LEAF_TRIANGLES = 4;	//Most triangles in one leaf of the hierarchy
+const double SELF_COLLISION_THICKNESS = 0.1;	//Default contact distance, as a fraction of the mean surface edge length
+const double SELF_COLLISION_MARGIN = 1.0;		//Extra distance candidate pairs are gathered within, as a multiple of the thickness
+
+//Node of the bounding volume hierarchy over the surface triangles
+//Nodes are stored parent before children, so a reverse pass over the array refits children before their parents.
+struct BvhNode
+{
+	double boxMin[DIMENSION];
+	double boxMax[DIMENSION];
+	int left, right;				//Child nodes (-1 for a leaf)
+	int firstTriangle;				//Leaf: first entry in triangleOrder
+	int triangleCount;				//Leaf: number of triangles (0 for an inner node)
+};
+
+//A surface vertex near a surface triangle it is not connected to, to be tested each step
+struct SelfCandidate
+{
+	int vertex;
+	int triangle;
+};
+
+//A surface vertex closer than the thickness to a surface triangle it is not connected to
+struct SelfContact
+{
+	int vertex;
+	int triangle;					//Surface triangle (indices / 3)
+	double weights[3];				//Barycentric coordinates of the closest point on the triangle
+	double normal[DIMENSION];		//Triangle normal, pointing to the side the vertex is on
+};
+
+//Self collision of the mesh surface - keeps surface vertices from passing through the surface triangles
+//The hierarchy is built once over the rest state and only refit (the boxes recomputed bottom up) when it is used, since the
+//triangles never change.  Querying it for every surface vertex gives the candidate pairs within thickness + margin, which
+//stay valid until some vertex has moved half the margin - so with small time steps the hierarchy is only walked every few
+//steps, and each step just runs the exact vertex - triangle test over the candidates, in parallel.  The contacts found get an
+//inelastic impulse that stops the vertex and the triangle approaching each other (Bridson et al. 2002 - Robust Treatment
+//of Collisions, Contact and Friction for Cloth Animation).
+//Works with the surface, positions and velocities of any ParticleSystem.
+class SelfCollision
+{
+public:
+	SelfCollision(int numVertices, const vector<int> & triangleIndices, const double * positions, Logger * logger);
+	void setThickness(double thickness) {this -> thickness = thickness; candidatesValid = false;}
+	double getThickness() {return thickness;}
+	int detectAndRespond(double * positions, double * velocities, const double * masses, double deltaT, int numThreads);
+
+private:
+	int numVertices;
+	int numTriangles;
+	vector<int> triangleIndices;	//3 vertices per triangle
+	vector<int> surfaceVertices;
+	double thickness;
+	Logger * logger;
+
+	vector<BvhNode> nodes;
+	vector<int> triangleOrder;		//Triangles grouped by leaf
+
+	//Surface edges in compressed sparse row form - the neighbors of vertex v are neighbors[neighborOffsets[v] ... neighborOffsets[v + 1])
+	vector<int> neighborOffsets;
+	vector<int> neighbors;
+
+	vector<SelfCandidate> candidates;
+	vector<double> candidatePositions;				//Surface positions when the candidates were gathered
+	bool candidatesValid;
+	vector< vector<SelfCandidate> > threadCandidates;
+	vector< vector<SelfContact> > threadContacts;	//Contacts found by each thread in the last step
+
+	int buildNode(const double * centroids, int first, int count);
+	void refit(const double * positions);
+	bool isConnected(int vertex, int triangle);
+	bool candidatesMoved(const double * positions);
+	void gatherCandidates(const double * positions, int numThreads);
+	void findCandidates(int vertex, const double * positions, double radius, vector<SelfCandidate> & found);
+	bool testContact(const SelfCandidate & candidate, const double * positions, SelfContact & contact);
+	void respond(const SelfContact & contact, double * positions, double * velocities, const double * masses, double deltaT);
+};
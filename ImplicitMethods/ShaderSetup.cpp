@@ -35,8 +35,12 @@ GLchar *fragmentShaderSource;
 typedef enum {
     EVertexShader,
     EFragmentShader,
+    EGeometryShader,
 } EShaderType;
 
+//Prepended to every shader source, ahead of the defines of a variant (see SetupGLSL)
+const char * shaderVersionLine = "#version 330\n";
+
 
 /////////////////////////////////////
 
@@ -118,6 +122,9 @@ int shaderSize(char *fileName, EShaderType shaderType)
         case EFragmentShader:
             strcat(name, ".frag");
             break;
+        case EGeometryShader:
+            strcat(name, ".geom");
+            break;
         default:
             printf("ERROR: unknown shader file type\n");
             exit(1);
@@ -169,6 +176,9 @@ int readShader(char *fileName, EShaderType shaderType, char *shaderText, int siz
         case EFragmentShader:
             strcat(name, ".frag");
             break;
+        case EGeometryShader:
+            strcat(name, ".geom");
+            break;
         default:
             printf("ERROR: unknown shader file type\n");
             exit(1);
@@ -248,15 +258,55 @@ GLint getUniLoc(GLuint program, const GLchar *name)
 }
 
 
+///////////////////////////////////////////////////////
+//
+//  Compiles one shader from the version line, the defines and source; prints the log and returns 0 if it fails
+//
+GLuint compileShader(GLenum shaderType, const char *defines, const GLchar *source, const char *typeName)
+{
+	GLuint shaderObject = glCreateShader(shaderType);
+	if (shaderObject == 0) {  // error checking 
+	  printf(" Error creating %s shader object.\n", typeName); 
+	  exit(1); 
+	} 
+	else printf(" Succeeded creating %s shader object.\n", typeName); 
+
+	const GLchar *sources[3] = {shaderVersionLine, defines, source};
+	glShaderSource(shaderObject, 3, sources, NULL);
+	glCompileShader(shaderObject);
+
+	// error checking and printing out log if error 
+	GLint result; 
+	glGetShaderiv(shaderObject, GL_COMPILE_STATUS, &result); 
+	if (result == GL_FALSE) {
+	  printf(" %s shader compilation failed!\n", typeName); 
+	  GLint logLen; 
+	  glGetShaderiv(shaderObject, GL_INFO_LOG_LENGTH, &logLen); 
+	  if (logLen > 0) {
+	    char *log = (char*) malloc(logLen); 
+	    GLsizei written; 
+	    glGetShaderInfoLog(shaderObject, logLen, &written, log); 
+	    printf("Shader log: \n %s", log); 
+	    free(log); 
+	  }
+	  glDeleteShader(shaderObject);
+	  return 0;
+	}
+	return shaderObject;
+}
+
 ///////////////////////////////////////////////////////
 //
 //  This routine creates the shader program, including the vertex shader and fragment shader objects 
+//  A variant of the same files is built by passing defines (lines such as "#define RGB_COLORS\n", inserted after the
+//  #version line) and, with useGeometryShader, the geometry shader <fileName>.geom as well.
 //
-GLuint SetupGLSL(char *fileName){
+GLuint SetupGLSL(char *fileName, const char *defines, bool useGeometryShader){
 
         GLuint programObject;
 	GLuint vertexShaderObject;
 	GLuint fragmentShaderObject;
+	GLuint geometryShaderObject = 0;
 
 	check_graphics();  // check the capability of the graphics card in use
 	
@@ -267,66 +317,52 @@ GLuint SetupGLSL(char *fileName){
 	} 
 	else printf(" Succeeded creating shader program object.\n"); 
 
-	vertexShaderObject = glCreateShader(GL_VERTEX_SHADER);
-	if (vertexShaderObject == 0) {  // error checking 
-	  printf(" Error creating vertex shader object.\n"); 
-	  exit(1); 
-	} 
-	else printf(" Succeeded creating vertex shader object.\n"); 
-
-	fragmentShaderObject = glCreateShader(GL_FRAGMENT_SHADER);
-	if (fragmentShaderObject == 0) {  // error checking 
-	  printf(" Error creating fragment shader object.\n"); 
-	  exit(1); 
-	} 
-	else printf(" Succeeded creating fragment shader object.\n"); 
-
-	// now input the vertex and fragment programs as ascii 
+	// now input the vertex and fragment programs as ascii, then compile the shader code; vertex shader first, followed by fragment shader 
 	readShaderSource(fileName, &vertexShaderSource, &fragmentShaderSource); 
-	glShaderSource(vertexShaderObject,1,(const GLchar**)&vertexShaderSource,NULL);
-	glShaderSource(fragmentShaderObject,1,(const GLchar**)&fragmentShaderSource,NULL);
+	vertexShaderObject = compileShader(GL_VERTEX_SHADER, defines, vertexShaderSource, "vertex");
+	fragmentShaderObject = compileShader(GL_FRAGMENT_SHADER, defines, fragmentShaderSource, "fragment");
+
+	if (useGeometryShader) {
+	  int gSize = shaderSize(fileName, EGeometryShader);
+	  GLchar *geometryShaderSource = (GLchar *) malloc(gSize > 0 ? gSize : 1);
+	  if (gSize == -1 || !readShader(fileName, EGeometryShader, geometryShaderSource, gSize)) {
+	    printf("Cannot read the file %s.geom\n", fileName);
+	  }
+	  else {
+	    geometryShaderObject = compileShader(GL_GEOMETRY_SHADER, defines, geometryShaderSource, "geometry");
+	  }
+	  free(geometryShaderSource);
+	}
 
-	// now compile the shader code; vertex shader first, followed by fragment shader 
-	glCompileShader(vertexShaderObject);
+	glAttachShader(programObject, vertexShaderObject);
+	glAttachShader(programObject, fragmentShaderObject);
+	if (geometryShaderObject != 0) {
+	  glAttachShader(programObject, geometryShaderObject);
+	}
+
+	glLinkProgram(programObject);
 
-	// error checking and printing out log if error 
 	GLint result; 
-	glGetShaderiv(vertexShaderObject, GL_COMPILE_STATUS, &result); 
+	glGetProgramiv(programObject, GL_LINK_STATUS, &result); 
 	if (result == GL_FALSE) {
-	  printf(" vertex shader compilation failed!\n"); 
+	  printf(" shader program linking failed!\n"); 
 	  GLint logLen; 
-	  glGetShaderiv(vertexShaderObject, GL_INFO_LOG_LENGTH, &logLen); 
+	  glGetProgramiv(programObject, GL_INFO_LOG_LENGTH, &logLen); 
 	  if (logLen > 0) {
 	    char *log = (char*) malloc(logLen); 
 	    GLsizei written; 
-	    glGetShaderInfoLog(vertexShaderObject, logLen, &written, log); 
-	    printf("Sahder log: \n %s", log); 
+	    glGetProgramInfoLog(programObject, logLen, &written, log); 
+	    printf("Program log: \n %s", log); 
 	    free(log); 
 	  }
 	}
 
-	glCompileShader(fragmentShaderObject);
-	glGetShaderiv(fragmentShaderObject, GL_COMPILE_STATUS, &result); 
-	if (result == GL_FALSE) {
-	  printf(" fragment shader compilation failed!\n"); 
-	  GLint logLen; 
-	  glGetShaderiv(fragmentShaderObject, GL_INFO_LOG_LENGTH, &logLen); 
-	  if (logLen > 0) {
-	    char *log = (char*) malloc(logLen); 
-	    GLsizei written; 
-	    glGetShaderInfoLog(fragmentShaderObject, logLen, &written, log); 
-	    printf("Sahder log: \n %s", log); 
-	    free(log); 
-	  }
+	// the program keeps what it needs; the shader objects are only flagged for deletion 
+	glDeleteShader(vertexShaderObject);
+	glDeleteShader(fragmentShaderObject);
+	if (geometryShaderObject != 0) {
+	  glDeleteShader(geometryShaderObject);
 	}
-	// insert compiler error checking code later 
-
-	glAttachShader(programObject, vertexShaderObject);
-	glAttachShader(programObject, fragmentShaderObject);
-
-	glLinkProgram(programObject);
-	// insert linking error checking code later 
 
 	return(programObject); 
 }
-
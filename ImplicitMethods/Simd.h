@@ -0,0 +1,256 @@
+#pragma once
+
+#include <cmath>
+
+//Thin wrapper over the SIMD instruction set selected at compile time
+//AVX-512 (/arch:AVX512) processes 8 doubles at once, AVX or AVX2 (/arch:AVX, /arch:AVX2) 4 and SSE2 2.
+//Without any of them a scalar fallback with a width of 1 is used, so callers never need their own #ifdefs.
+//All operands are SimdDouble values; simdLoad / simdStore require MEMORY_ALIGNMENT (see Memory.h) aligned addresses.
+//Comparisons return a SimdMask that simdSelect uses to pick per lane between two values (mask ? a : b), so per lane branches can be avoided.
+//simdMaskBits packs a mask into an int with bit i set for lane i, for compacting the lanes that passed a test.
+//SimdFloat holds SIMD_FLOAT_WIDTH (twice SIMD_WIDTH, 1 for the scalar fallback) floats and has the same operations as overloads.  simdLoadFloat / simdStoreFloat
+//convert SIMD_FLOAT_WIDTH doubles to and from one SimdFloat, so float kernels can gather and scatter through double arrays.
+
+//#define SINGLE_PRECISION_FORCES 1	//If present, the SIMD force kernels run in float (see SimdForce below).  The state, the force accumulation and the integration stay double.
+
+#if defined(__AVX512F__)
+
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+typedef __m512d SimdDouble;
+
+inline SimdDouble simdSet(double a) {return _mm512_set1_pd(a);}
+inline SimdDouble simdLoad(const double * a) {return _mm512_load_pd(a);}
+inline SimdDouble simdLoadUnaligned(const double * a) {return _mm512_loadu_pd(a);}
+inline void simdStore(double * a, SimdDouble b) {_mm512_store_pd(a, b);}
+inline void simdStoreUnaligned(double * a, SimdDouble b) {_mm512_storeu_pd(a, b);}
+inline SimdDouble simdAdd(SimdDouble a, SimdDouble b) {return _mm512_add_pd(a, b);}
+inline SimdDouble simdSub(SimdDouble a, SimdDouble b) {return _mm512_sub_pd(a, b);}
+inline SimdDouble simdMul(SimdDouble a, SimdDouble b) {return _mm512_mul_pd(a, b);}
+inline SimdDouble simdMulAdd(SimdDouble a, SimdDouble b, SimdDouble c) {return _mm512_fmadd_pd(a, b, c);}	//a * b + c
+inline SimdDouble simdDiv(SimdDouble a, SimdDouble b) {return _mm512_div_pd(a, b);}
+inline SimdDouble simdSqrt(SimdDouble a) {return _mm512_sqrt_pd(a);}
+inline SimdDouble simdMax(SimdDouble a, SimdDouble b) {return _mm512_max_pd(a, b);}
+
+typedef __mmask8 SimdMask;
+inline SimdMask simdLess(SimdDouble a, SimdDouble b) {return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ);}
+inline SimdDouble simdSelect(SimdMask mask, SimdDouble a, SimdDouble b) {return _mm512_mask_blend_pd(mask, b, a);}
+inline bool simdAny(SimdMask mask) {return mask != 0;}
+inline int simdMaskBits(SimdMask mask) {return mask;}
+
+#define SIMD_FLOAT_WIDTH 16
+typedef __m512 SimdFloat;
+typedef __mmask16 SimdFloatMask;
+
+inline SimdFloat simdSetFloat(float a) {return _mm512_set1_ps(a);}
+inline SimdFloat simdLoad(const float * a) {return _mm512_load_ps(a);}
+inline SimdFloat simdLoadUnaligned(const float * a) {return _mm512_loadu_ps(a);}
+inline void simdStore(float * a, SimdFloat b) {_mm512_store_ps(a, b);}
+inline void simdStoreUnaligned(float * a, SimdFloat b) {_mm512_storeu_ps(a, b);}
+inline SimdFloat simdLoadFloat(const double * a) {return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(_mm512_cvtpd_ps(_mm512_loadu_pd(a)))), _mm256_castps_pd(_mm512_cvtpd_ps(_mm512_loadu_pd(a + 8))), 1));}
+inline void simdStoreFloat(double * a, SimdFloat b) {_mm512_storeu_pd(a, _mm512_cvtps_pd(_mm512_castps512_ps256(b))); _mm512_storeu_pd(a + 8, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(b), 1))));}
+inline SimdFloat simdAdd(SimdFloat a, SimdFloat b) {return _mm512_add_ps(a, b);}
+inline SimdFloat simdSub(SimdFloat a, SimdFloat b) {return _mm512_sub_ps(a, b);}
+inline SimdFloat simdMul(SimdFloat a, SimdFloat b) {return _mm512_mul_ps(a, b);}
+inline SimdFloat simdMulAdd(SimdFloat a, SimdFloat b, SimdFloat c) {return _mm512_fmadd_ps(a, b, c);}
+inline SimdFloat simdDiv(SimdFloat a, SimdFloat b) {return _mm512_div_ps(a, b);}
+inline SimdFloat simdSqrt(SimdFloat a) {return _mm512_sqrt_ps(a);}
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) {return _mm512_max_ps(a, b);}
+inline SimdFloatMask simdLess(SimdFloat a, SimdFloat b) {return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ);}
+inline SimdFloat simdSelect(SimdFloatMask mask, SimdFloat a, SimdFloat b) {return _mm512_mask_blend_ps(mask, b, a);}
+inline bool simdAny(SimdFloatMask mask) {return mask != 0;}
+inline int simdMaskBits(SimdFloatMask mask) {return mask;}
+
+#elif defined(__AVX__)
+
+#include <immintrin.h>
+#define SIMD_WIDTH 4
+typedef __m256d SimdDouble;
+
+inline SimdDouble simdSet(double a) {return _mm256_set1_pd(a);}
+inline SimdDouble simdLoad(const double * a) {return _mm256_load_pd(a);}
+inline SimdDouble simdLoadUnaligned(const double * a) {return _mm256_loadu_pd(a);}
+inline void simdStore(double * a, SimdDouble b) {_mm256_store_pd(a, b);}
+inline void simdStoreUnaligned(double * a, SimdDouble b) {_mm256_storeu_pd(a, b);}
+inline SimdDouble simdAdd(SimdDouble a, SimdDouble b) {return _mm256_add_pd(a, b);}
+inline SimdDouble simdSub(SimdDouble a, SimdDouble b) {return _mm256_sub_pd(a, b);}
+inline SimdDouble simdMul(SimdDouble a, SimdDouble b) {return _mm256_mul_pd(a, b);}
+#if defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__))
+inline SimdDouble simdMulAdd(SimdDouble a, SimdDouble b, SimdDouble c) {return _mm256_fmadd_pd(a, b, c);}	//a * b + c (MSVC has no FMA define, but every AVX2 processor has FMA)
+#else
+inline SimdDouble simdMulAdd(SimdDouble a, SimdDouble b, SimdDouble c) {return _mm256_add_pd(_mm256_mul_pd(a, b), c);}
+#endif
+inline SimdDouble simdDiv(SimdDouble a, SimdDouble b) {return _mm256_div_pd(a, b);}
+inline SimdDouble simdSqrt(SimdDouble a) {return _mm256_sqrt_pd(a);}
+inline SimdDouble simdMax(SimdDouble a, SimdDouble b) {return _mm256_max_pd(a, b);}
+
+typedef __m256d SimdMask;
+inline SimdMask simdLess(SimdDouble a, SimdDouble b) {return _mm256_cmp_pd(a, b, _CMP_LT_OQ);}
+inline SimdDouble simdSelect(SimdMask mask, SimdDouble a, SimdDouble b) {return _mm256_blendv_pd(b, a, mask);}
+inline bool simdAny(SimdMask mask) {return _mm256_movemask_pd(mask) != 0;}
+inline int simdMaskBits(SimdMask mask) {return _mm256_movemask_pd(mask);}
+
+#define SIMD_FLOAT_WIDTH 8
+typedef __m256 SimdFloat;
+typedef __m256 SimdFloatMask;
+
+inline SimdFloat simdSetFloat(float a) {return _mm256_set1_ps(a);}
+inline SimdFloat simdLoad(const float * a) {return _mm256_load_ps(a);}
+inline SimdFloat simdLoadUnaligned(const float * a) {return _mm256_loadu_ps(a);}
+inline void simdStore(float * a, SimdFloat b) {_mm256_store_ps(a, b);}
+inline void simdStoreUnaligned(float * a, SimdFloat b) {_mm256_storeu_ps(a, b);}
+inline SimdFloat simdLoadFloat(const double * a) {return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_loadu_pd(a))), _mm256_cvtpd_ps(_mm256_loadu_pd(a + 4)), 1);}
+inline void simdStoreFloat(double * a, SimdFloat b) {_mm256_storeu_pd(a, _mm256_cvtps_pd(_mm256_castps256_ps128(b))); _mm256_storeu_pd(a + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(b, 1)));}
+inline SimdFloat simdAdd(SimdFloat a, SimdFloat b) {return _mm256_add_ps(a, b);}
+inline SimdFloat simdSub(SimdFloat a, SimdFloat b) {return _mm256_sub_ps(a, b);}
+inline SimdFloat simdMul(SimdFloat a, SimdFloat b) {return _mm256_mul_ps(a, b);}
+#if defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__))
+inline SimdFloat simdMulAdd(SimdFloat a, SimdFloat b, SimdFloat c) {return _mm256_fmadd_ps(a, b, c);}
+#else
+inline SimdFloat simdMulAdd(SimdFloat a, SimdFloat b, SimdFloat c) {return _mm256_add_ps(_mm256_mul_ps(a, b), c);}
+#endif
+inline SimdFloat simdDiv(SimdFloat a, SimdFloat b) {return _mm256_div_ps(a, b);}
+inline SimdFloat simdSqrt(SimdFloat a) {return _mm256_sqrt_ps(a);}
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) {return _mm256_max_ps(a, b);}
+inline SimdFloatMask simdLess(SimdFloat a, SimdFloat b) {return _mm256_cmp_ps(a, b, _CMP_LT_OQ);}
+inline SimdFloat simdSelect(SimdFloatMask mask, SimdFloat a, SimdFloat b) {return _mm256_blendv_ps(b, a, mask);}
+inline bool simdAny(SimdFloatMask mask) {return _mm256_movemask_ps(mask) != 0;}
+inline int simdMaskBits(SimdFloatMask mask) {return _mm256_movemask_ps(mask);}
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+#define SIMD_WIDTH 2
+typedef __m128d SimdDouble;
+
+inline SimdDouble simdSet(double a) {return _mm_set1_pd(a);}
+inline SimdDouble simdLoad(const double * a) {return _mm_load_pd(a);}
+inline SimdDouble simdLoadUnaligned(const double * a) {return _mm_loadu_pd(a);}
+inline void simdStore(double * a, SimdDouble b) {_mm_store_pd(a, b);}
+inline void simdStoreUnaligned(double * a, SimdDouble b) {_mm_storeu_pd(a, b);}
+inline SimdDouble simdAdd(SimdDouble a, SimdDouble b) {return _mm_add_pd(a, b);}
+inline SimdDouble simdSub(SimdDouble a, SimdDouble b) {return _mm_sub_pd(a, b);}
+inline SimdDouble simdMul(SimdDouble a, SimdDouble b) {return _mm_mul_pd(a, b);}
+inline SimdDouble simdMulAdd(SimdDouble a, SimdDouble b, SimdDouble c) {return _mm_add_pd(_mm_mul_pd(a, b), c);}
+inline SimdDouble simdDiv(SimdDouble a, SimdDouble b) {return _mm_div_pd(a, b);}
+inline SimdDouble simdSqrt(SimdDouble a) {return _mm_sqrt_pd(a);}
+inline SimdDouble simdMax(SimdDouble a, SimdDouble b) {return _mm_max_pd(a, b);}
+
+typedef __m128d SimdMask;
+inline SimdMask simdLess(SimdDouble a, SimdDouble b) {return _mm_cmplt_pd(a, b);}
+inline SimdDouble simdSelect(SimdMask mask, SimdDouble a, SimdDouble b) {return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));}
+inline bool simdAny(SimdMask mask) {return _mm_movemask_pd(mask) != 0;}
+inline int simdMaskBits(SimdMask mask) {return _mm_movemask_pd(mask);}
+
+#define SIMD_FLOAT_WIDTH 4
+typedef __m128 SimdFloat;
+typedef __m128 SimdFloatMask;
+
+inline SimdFloat simdSetFloat(float a) {return _mm_set1_ps(a);}
+inline SimdFloat simdLoad(const float * a) {return _mm_load_ps(a);}
+inline SimdFloat simdLoadUnaligned(const float * a) {return _mm_loadu_ps(a);}
+inline void simdStore(float * a, SimdFloat b) {_mm_store_ps(a, b);}
+inline void simdStoreUnaligned(float * a, SimdFloat b) {_mm_storeu_ps(a, b);}
+inline SimdFloat simdLoadFloat(const double * a) {return _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(a)), _mm_cvtpd_ps(_mm_loadu_pd(a + 2)));}
+inline void simdStoreFloat(double * a, SimdFloat b) {_mm_storeu_pd(a, _mm_cvtps_pd(b)); _mm_storeu_pd(a + 2, _mm_cvtps_pd(_mm_movehl_ps(b, b)));}
+inline SimdFloat simdAdd(SimdFloat a, SimdFloat b) {return _mm_add_ps(a, b);}
+inline SimdFloat simdSub(SimdFloat a, SimdFloat b) {return _mm_sub_ps(a, b);}
+inline SimdFloat simdMul(SimdFloat a, SimdFloat b) {return _mm_mul_ps(a, b);}
+inline SimdFloat simdMulAdd(SimdFloat a, SimdFloat b, SimdFloat c) {return _mm_add_ps(_mm_mul_ps(a, b), c);}
+inline SimdFloat simdDiv(SimdFloat a, SimdFloat b) {return _mm_div_ps(a, b);}
+inline SimdFloat simdSqrt(SimdFloat a) {return _mm_sqrt_ps(a);}
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) {return _mm_max_ps(a, b);}
+inline SimdFloatMask simdLess(SimdFloat a, SimdFloat b) {return _mm_cmplt_ps(a, b);}
+inline SimdFloat simdSelect(SimdFloatMask mask, SimdFloat a, SimdFloat b) {return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));}
+inline bool simdAny(SimdFloatMask mask) {return _mm_movemask_ps(mask) != 0;}
+inline int simdMaskBits(SimdFloatMask mask) {return _mm_movemask_ps(mask);}
+
+#else
+
+#define SIMD_WIDTH 1
+typedef double SimdDouble;
+
+inline SimdDouble simdSet(double a) {return a;}
+inline SimdDouble simdLoad(const double * a) {return *a;}
+inline SimdDouble simdLoadUnaligned(const double * a) {return *a;}
+inline void simdStore(double * a, SimdDouble b) {*a = b;}
+inline void simdStoreUnaligned(double * a, SimdDouble b) {*a = b;}
+inline SimdDouble simdAdd(SimdDouble a, SimdDouble b) {return a + b;}
+inline SimdDouble simdSub(SimdDouble a, SimdDouble b) {return a - b;}
+inline SimdDouble simdMul(SimdDouble a, SimdDouble b) {return a * b;}
+inline SimdDouble simdMulAdd(SimdDouble a, SimdDouble b, SimdDouble c) {return a * b + c;}
+inline SimdDouble simdDiv(SimdDouble a, SimdDouble b) {return a / b;}
+inline SimdDouble simdSqrt(SimdDouble a) {return sqrt(a);}
+inline SimdDouble simdMax(SimdDouble a, SimdDouble b) {return a > b ? a : b;}
+
+typedef bool SimdMask;
+inline SimdMask simdLess(SimdDouble a, SimdDouble b) {return a < b;}
+inline SimdDouble simdSelect(SimdMask mask, SimdDouble a, SimdDouble b) {return mask ? a : b;}
+inline bool simdAny(SimdMask mask) {return mask;}
+inline int simdMaskBits(SimdMask mask) {return mask ? 1 : 0;}
+
+#define SIMD_FLOAT_WIDTH 1
+typedef float SimdFloat;
+typedef bool SimdFloatMask;
+
+inline SimdFloat simdSetFloat(float a) {return a;}
+inline SimdFloat simdLoad(const float * a) {return *a;}
+inline SimdFloat simdLoadUnaligned(const float * a) {return *a;}
+inline void simdStore(float * a, SimdFloat b) {*a = b;}
+inline void simdStoreUnaligned(float * a, SimdFloat b) {*a = b;}
+inline SimdFloat simdLoadFloat(const double * a) {return (float) *a;}
+inline void simdStoreFloat(double * a, SimdFloat b) {*a = b;}
+inline SimdFloat simdAdd(SimdFloat a, SimdFloat b) {return a + b;}
+inline SimdFloat simdSub(SimdFloat a, SimdFloat b) {return a - b;}
+inline SimdFloat simdMul(SimdFloat a, SimdFloat b) {return a * b;}
+inline SimdFloat simdMulAdd(SimdFloat a, SimdFloat b, SimdFloat c) {return a * b + c;}
+inline SimdFloat simdDiv(SimdFloat a, SimdFloat b) {return a / b;}
+inline SimdFloat simdSqrt(SimdFloat a) {return sqrt(a);}
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) {return a > b ? a : b;}
+inline SimdFloatMask simdLess(SimdFloat a, SimdFloat b) {return a < b;}
+inline SimdFloat simdSelect(SimdFloatMask mask, SimdFloat a, SimdFloat b) {return mask ? a : b;}
+
+#endif
+
+//Templated kernels (see SVD3.h) are written once against these names and instantiated for both double and SimdDouble
+//SimdTraits<T>::Mask is the comparison result type and simdConstant<T> broadcasts a constant.  SimdTraits<T>::tiny() is the
+//smallest squared magnitude the kernels treat as nonzero - far above the underflow of the element type, so it never rounds to 0.
+template <typename T> struct SimdTraits {typedef SimdMask Mask; static double tiny() {return 1e-300;}};
+template <typename T> inline T simdConstant(double a) {return simdSet(a);}
+
+#if SIMD_WIDTH > 1
+//Plain double versions of the operations (with SIMD_WIDTH 1 the fallback above already is the double version)
+template <> struct SimdTraits<double> {typedef bool Mask; static double tiny() {return 1e-300;}};
+template <> inline double simdConstant<double>(double a) {return a;}
+
+inline double simdAdd(double a, double b) {return a + b;}
+inline double simdSub(double a, double b) {return a - b;}
+inline double simdMul(double a, double b) {return a * b;}
+inline double simdMulAdd(double a, double b, double c) {return a * b + c;}
+inline double simdDiv(double a, double b) {return a / b;}
+inline double simdSqrt(double a) {return sqrt(a);}
+inline double simdMax(double a, double b) {return a > b ? a : b;}
+inline bool simdLess(double a, double b) {return a < b;}
+inline double simdSelect(bool mask, double a, double b) {return mask ? a : b;}
+inline bool simdAny(bool mask) {return mask;}
+#endif
+
+//Float specializations (simdSet has no float overload since simdSet(2) would be ambiguous - simdSetFloat broadcasts a float)
+template <> struct SimdTraits<SimdFloat> {typedef SimdFloatMask Mask; static double tiny() {return 1e-30;}};
+template <> inline SimdFloat simdConstant<SimdFloat>(double a) {return simdSetFloat((float) a);}
+
+//SimdForce is the type the SIMD force kernels compute in, and FORCE_BLOCK_WIDTH the number of tetrahedra in one of their blocks
+//(see ParticleSystem::buildForceBlocks).  ForceReal is the element type of the per block rest state the kernels load.
+#ifdef SINGLE_PRECISION_FORCES
+typedef float ForceReal;
+typedef SimdFloat SimdForce;
+#define FORCE_BLOCK_WIDTH SIMD_FLOAT_WIDTH
+inline SimdForce simdLoadForce(const double * a) {return simdLoadFloat(a);}
+inline void simdStoreForce(double * a, SimdForce b) {simdStoreFloat(a, b);}
+#else
+typedef double ForceReal;
+typedef SimdDouble SimdForce;
+#define FORCE_BLOCK_WIDTH SIMD_WIDTH
+inline SimdForce simdLoadForce(const double * a) {return simdLoadUnaligned(a);}
+inline void simdStoreForce(double * a, SimdForce b) {simdStoreUnaligned(a, b);}
+#endif
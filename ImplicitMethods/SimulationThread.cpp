@@ -0,0 +1,80 @@
+#include "SimulationThread.h"
+#include "Timer.h"
+
+//Parameter stepSeconds - time of one doUpdate step, as in the synchronous render loop
+//Parameter tickSeconds - real time between simulated frames
+SimulationThread::SimulationThread(ParticleSystem * particleSystem, double stepSeconds, double tickSeconds)
+{
+	this -> particleSystem = particleSystem;
+	this -> stepSeconds = stepSeconds;
+	this -> tickSeconds = tickSeconds;
+	stopRequested = 0;
+}
+
+SimulationThread::~SimulationThread()
+{
+	stop();
+}
+
+//Returns false if the thread could not be created (the caller can fall back to simulating in the render loop)
+bool SimulationThread::start()
+{
+	if (thread.isStarted())
+	{
+		return true;
+	}
+
+	atomicExchange(&stopRequested, 0);
+	return thread.start(threadMain, this);
+}
+
+//Waits for the current tick to finish and the thread to exit
+void SimulationThread::stop()
+{
+	if (thread.isStarted())
+	{
+		atomicExchange(&stopRequested, 1);
+		thread.join();
+	}
+}
+
+void SimulationThread::threadMain(void * simulationThread)
+{
+	((SimulationThread *) simulationThread) -> run();
+}
+
+//Fixed timestep loop: real time is accumulated and consumed in whole ticks, so the simulated time matches real time
+//no matter how fast the window renders
+void SimulationThread::run()
+{
+	double accumulatedSeconds = 0;
+	double lastSeconds = getTimeSeconds();
+
+	while (atomicLoad(&stopRequested) == 0)
+	{
+		double nowSeconds = getTimeSeconds();
+		accumulatedSeconds += nowSeconds - lastSeconds;
+		lastSeconds = nowSeconds;
+
+		if (accumulatedSeconds > MAX_TICKS_PER_UPDATE * tickSeconds)
+		{
+			accumulatedSeconds = MAX_TICKS_PER_UPDATE * tickSeconds;
+		}
+
+		if (accumulatedSeconds < tickSeconds)
+		{
+			sleepMilliseconds(1);
+			continue;
+		}
+
+		stateLock.lock();
+		while (accumulatedSeconds >= tickSeconds)
+		{
+			particleSystem -> advanceFrame(stepSeconds);
+			accumulatedSeconds -= tickSeconds;
+		}
+		particleSystem -> calculateNormals();
+		particleSystem -> publishRenderSnapshot();
+		stateLock.unlock();
+	}
+}
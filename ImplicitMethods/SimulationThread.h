@@ -0,0 +1,37 @@
+#pragma once
+
+#include "ParticleSystem.h"
+#include "Threading.h"
+
+const double SIMULATION_TICK_SECONDS = 1.0 / 60;	//Real time of one simulated frame
+const int MAX_TICKS_PER_UPDATE = 4;					//Ticks caught up at once - the simulation slows down rather than spiralling when it cannot keep up
+
+//Runs the simulation on its own thread at a fixed rate, independent of the frame rate of the window
+//Every tick of real time advances the particle system by one frame (ParticleSystem::advanceFrame) and publishes the
+//result as a render snapshot, which the render thread draws without waiting (see ParticleSystem::publishRenderSnapshot).
+//The render thread must call ParticleSystem::enableRenderSnapshots before start, and must hold lock() while it changes
+//simulation state (key presses).
+class SimulationThread
+{
+public:
+	SimulationThread(ParticleSystem * particleSystem, double stepSeconds, double tickSeconds = SIMULATION_TICK_SECONDS);
+	~SimulationThread();
+	bool start();
+	void stop();
+	void lock() {stateLock.lock();}
+	void unlock() {stateLock.unlock();}
+
+private:
+	SimulationThread(const SimulationThread &);				//Not copyable - owns the thread
+	SimulationThread & operator = (const SimulationThread &);
+
+	ParticleSystem * particleSystem;
+	double stepSeconds;				//Time of one doUpdate step (see ParticleSystem::advanceFrame)
+	double tickSeconds;
+	volatile long stopRequested;
+	Mutex stateLock;				//Held by the simulation thread for each tick, and by the render thread while it changes the state
+	Thread thread;
+
+	static void threadMain(void * simulationThread);
+	void run();
+};
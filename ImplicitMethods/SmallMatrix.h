@@ -0,0 +1,322 @@
+#pragma once
+
+#include <cmath>
+
+//Fixed size matrices and vectors for the per tetrahedron kernels
+//Mat<R, C, T> keeps its R * C entries of type T (float or double) inline and row major (data[row * C + col]), so temporaries
+//live on the stack or in registers and never touch the heap.  The sizes are template constants, so every loop below has a
+//constant trip count that the compiler unrolls (and vectorizes) for the 3 X 3, 3 X 4, 4 X 4 and 6 X 6 cases.
+//Everything is an inline function of its arguments, each evaluated once - unlike the macros this replaces.
+//The common products with a transpose (A' * B, A * B') and the multiply adds are fused: they read the operands in place
+//instead of building the transposed or intermediate matrix.
+//Sums run in index order starting from the first term, so results match the plain loops they replaced bit for bit.
+
+template <int R, int C, typename T = double> struct Mat
+{
+	enum {ROWS = R, COLUMNS = C, SIZE = R * C};
+
+	T data[R * C];
+
+	T & operator()(int row, int col) {return data[row * C + col];}
+	const T & operator()(int row, int col) const {return data[row * C + col];}
+	T & operator[](int i) {return data[i];}				//Flat (row major) index - the natural one for vectors
+	const T & operator[](int i) const {return data[i];}
+
+	static Mat zero()
+	{
+		Mat result;
+		for (int i = 0; i < R * C; i++)
+		{
+			result.data[i] = 0;
+		}
+		return result;
+	}
+
+	static Mat identity()
+	{
+		Mat result;
+		for (int i = 0; i < R; i++)
+		{
+			for (int j = 0; j < C; j++)
+			{
+				result.data[i * C + j] = (T) (i == j);
+			}
+		}
+		return result;
+	}
+
+	//Copies R * C row major values
+	static Mat fromArray(const T * values)
+	{
+		Mat result;
+		for (int i = 0; i < R * C; i++)
+		{
+			result.data[i] = values[i];
+		}
+		return result;
+	}
+
+	void toArray(T * values) const
+	{
+		for (int i = 0; i < R * C; i++)
+		{
+			values[i] = data[i];
+		}
+	}
+
+	Mat & operator+=(const Mat & b)
+	{
+		for (int i = 0; i < R * C; i++)
+		{
+			data[i] += b.data[i];
+		}
+		return *this;
+	}
+
+	Mat & operator-=(const Mat & b)
+	{
+		for (int i = 0; i < R * C; i++)
+		{
+			data[i] -= b.data[i];
+		}
+		return *this;
+	}
+
+	Mat & operator*=(T scale)
+	{
+		for (int i = 0; i < R * C; i++)
+		{
+			data[i] *= scale;
+		}
+		return *this;
+	}
+};
+
+typedef Mat<3, 1> Vec3;
+typedef Mat<4, 1> Vec4;
+typedef Mat<6, 1> Vec6;
+typedef Mat<3, 3> Mat3;
+typedef Mat<3, 4> Mat34;
+typedef Mat<4, 4> Mat4;
+typedef Mat<6, 6> Mat6;
+typedef Mat<3, 1, float> Vec3f;
+typedef Mat<3, 3, float> Mat3f;
+typedef Mat<4, 4, float> Mat4f;
+
+template <int R, int C, typename T> inline Mat<R, C, T> operator+(const Mat<R, C, T> & a, const Mat<R, C, T> & b)
+{
+	Mat<R, C, T> result;
+	for (int i = 0; i < R * C; i++)
+	{
+		result.data[i] = a.data[i] + b.data[i];
+	}
+	return result;
+}
+
+template <int R, int C, typename T> inline Mat<R, C, T> operator-(const Mat<R, C, T> & a, const Mat<R, C, T> & b)
+{
+	Mat<R, C, T> result;
+	for (int i = 0; i < R * C; i++)
+	{
+		result.data[i] = a.data[i] - b.data[i];
+	}
+	return result;
+}
+
+template <int R, int C, typename T> inline Mat<R, C, T> operator-(const Mat<R, C, T> & a)
+{
+	Mat<R, C, T> result;
+	for (int i = 0; i < R * C; i++)
+	{
+		result.data[i] = -a.data[i];
+	}
+	return result;
+}
+
+template <int R, int C, typename T> inline Mat<R, C, T> operator*(T scale, const Mat<R, C, T> & a)
+{
+	Mat<R, C, T> result;
+	for (int i = 0; i < R * C; i++)
+	{
+		result.data[i] = scale * a.data[i];
+	}
+	return result;
+}
+
+//A * B - the inner dimensions must match at compile time
+template <int R, int K, int C, typename T> inline Mat<R, C, T> operator*(const Mat<R, K, T> & a, const Mat<K, C, T> & b)
+{
+	Mat<R, C, T> result;
+	for (int i = 0; i < R; i++)
+	{
+		for (int j = 0; j < C; j++)
+		{
+			T sum = a.data[i * K + 0] * b.data[0 * C + j];
+			for (int k = 1; k < K; k++)
+			{
+				sum += a.data[i * K + k] * b.data[k * C + j];
+			}
+			result.data[i * C + j] = sum;
+		}
+	}
+	return result;
+}
+
+//A' * B without forming A'
+template <int K, int R, int C, typename T> inline Mat<R, C, T> transposeTimes(const Mat<K, R, T> & a, const Mat<K, C, T> & b)
+{
+	Mat<R, C, T> result;
+	for (int i = 0; i < R; i++)
+	{
+		for (int j = 0; j < C; j++)
+		{
+			T sum = a.data[0 * R + i] * b.data[0 * C + j];
+			for (int k = 1; k < K; k++)
+			{
+				sum += a.data[k * R + i] * b.data[k * C + j];
+			}
+			result.data[i * C + j] = sum;
+		}
+	}
+	return result;
+}
+
+//A * B' without forming B'
+template <int R, int K, int C, typename T> inline Mat<R, C, T> timesTranspose(const Mat<R, K, T> & a, const Mat<C, K, T> & b)
+{
+	Mat<R, C, T> result;
+	for (int i = 0; i < R; i++)
+	{
+		for (int j = 0; j < C; j++)
+		{
+			T sum = a.data[i * K + 0] * b.data[j * K + 0];
+			for (int k = 1; k < K; k++)
+			{
+				sum += a.data[i * K + k] * b.data[j * K + k];
+			}
+			result.data[i * C + j] = sum;
+		}
+	}
+	return result;
+}
+
+//result += scale * a, in place
+template <int R, int C, typename T> inline void multiplyAdd(Mat<R, C, T> & result, T scale, const Mat<R, C, T> & a)
+{
+	for (int i = 0; i < R * C; i++)
+	{
+		result.data[i] += scale * a.data[i];
+	}
+}
+
+template <int R, int C, typename T> inline Mat<C, R, T> transpose(const Mat<R, C, T> & a)
+{
+	Mat<C, R, T> result;
+	for (int i = 0; i < R; i++)
+	{
+		for (int j = 0; j < C; j++)
+		{
+			result.data[j * R + i] = a.data[i * C + j];
+		}
+	}
+	return result;
+}
+
+//Column col of A as a vector
+template <int R, int C, typename T> inline Mat<R, 1, T> column(const Mat<R, C, T> & a, int col)
+{
+	Mat<R, 1, T> result;
+	for (int i = 0; i < R; i++)
+	{
+		result.data[i] = a.data[i * C + col];
+	}
+	return result;
+}
+
+template <int N, typename T> inline T dot(const Mat<N, 1, T> & a, const Mat<N, 1, T> & b)
+{
+	T sum = a.data[0] * b.data[0];
+	for (int i = 1; i < N; i++)
+	{
+		sum += a.data[i] * b.data[i];
+	}
+	return sum;
+}
+
+template <typename T> inline Mat<3, 1, T> cross(const Mat<3, 1, T> & a, const Mat<3, 1, T> & b)
+{
+	Mat<3, 1, T> result;
+	result.data[0] = a.data[1] * b.data[2] - a.data[2] * b.data[1];
+	result.data[1] = a.data[2] * b.data[0] - a.data[0] * b.data[2];
+	result.data[2] = a.data[0] * b.data[1] - a.data[1] * b.data[0];
+	return result;
+}
+
+template <int N, typename T> inline T trace(const Mat<N, N, T> & a)
+{
+	T sum = a.data[0];
+	for (int i = 1; i < N; i++)
+	{
+		sum += a.data[i * N + i];
+	}
+	return sum;
+}
+
+//Bounds the 2-norm (largest singular value) from above
+template <int R, int C, typename T> inline T frobeniusNorm(const Mat<R, C, T> & a)
+{
+	T sum = a.data[0] * a.data[0];
+	for (int i = 1; i < R * C; i++)
+	{
+		sum += a.data[i] * a.data[i];
+	}
+	return std::sqrt(sum);
+}
+
+template <typename T> inline T determinant(const Mat<3, 3, T> & a)
+{
+	const T * m = a.data;
+	return m[0*3+0] * m[1*3+1] * m[2*3+2] + m[0*3+1] * m[1*3+2] * m[2*3+0] + m[0*3+2] * m[1*3+0] * m[2*3+1]
+		- m[0*3+2] * m[1*3+1] * m[2*3+0] - m[0*3+0] * m[1*3+2] * m[2*3+1] - m[0*3+1] * m[1*3+0] * m[2*3+2];
+}
+
+template <typename T> inline T determinant(const Mat<4, 4, T> & a)
+{
+	const T * m = a.data;
+	return m[0*4+0]*m[1*4+1]*m[2*4+2]*m[3*4+3] + m[0*4+0]*m[1*4+2]*m[2*4+3]*m[3*4+1] + m[0*4+0]*m[1*4+3]*m[2*4+1]*m[3*4+2]
+		+ m[0*4+1]*m[1*4+0]*m[2*4+3]*m[3*4+2] + m[0*4+1]*m[1*4+2]*m[2*4+0]*m[3*4+3] + m[0*4+1]*m[1*4+3]*m[2*4+2]*m[3*4+0]
+		+ m[0*4+2]*m[1*4+0]*m[2*4+1]*m[3*4+3] + m[0*4+2]*m[1*4+1]*m[2*4+3]*m[3*4+0] + m[0*4+2]*m[1*4+3]*m[2*4+0]*m[3*4+1]
+		+ m[0*4+3]*m[1*4+0]*m[2*4+2]*m[3*4+1] + m[0*4+3]*m[1*4+1]*m[2*4+0]*m[3*4+2] + m[0*4+3]*m[1*4+2]*m[2*4+1]*m[3*4+0]
+		- m[0*4+0]*m[1*4+1]*m[2*4+3]*m[3*4+2] - m[0*4+0]*m[1*4+2]*m[2*4+1]*m[3*4+3] - m[0*4+0]*m[1*4+3]*m[2*4+2]*m[3*4+1]
+		- m[0*4+1]*m[1*4+0]*m[2*4+2]*m[3*4+3] - m[0*4+1]*m[1*4+2]*m[2*4+3]*m[3*4+0] - m[0*4+1]*m[1*4+3]*m[2*4+0]*m[3*4+2]
+		- m[0*4+2]*m[1*4+0]*m[2*4+3]*m[3*4+1] - m[0*4+2]*m[1*4+1]*m[2*4+0]*m[3*4+3] - m[0*4+2]*m[1*4+3]*m[2*4+1]*m[3*4+0]
+		- m[0*4+3]*m[1*4+0]*m[2*4+1]*m[3*4+2] - m[0*4+3]*m[1*4+1]*m[2*4+2]*m[3*4+0] - m[0*4+3]*m[1*4+2]*m[2*4+0]*m[3*4+1];
+}
+
+//Inverse of a 4 X 4 matrix by cofactors
+//From http://www.cg.info.hiroshima-cu.ac.jp/~miyazaki/knowledge/teche23.html
+template <typename T> inline Mat<4, 4, T> inverse(const Mat<4, 4, T> & a)
+{
+	const T * m = a.data;
+	T invDeterminant = 1 / determinant(a);
+
+	Mat<4, 4, T> result;
+	T * r = result.data;
+	r[0*4+0] = invDeterminant * (m[1*4+1]*m[2*4+2]*m[3*4+3] + m[1*4+2]*m[2*4+3]*m[3*4+1] + m[1*4+3]*m[2*4+1]*m[3*4+2] - m[1*4+1]*m[2*4+3]*m[3*4+2] - m[1*4+2]*m[2*4+1]*m[3*4+3] - m[1*4+3]*m[2*4+2]*m[3*4+1]);
+	r[0*4+1] = invDeterminant * (m[0*4+1]*m[2*4+3]*m[3*4+2] + m[0*4+2]*m[2*4+1]*m[3*4+3] + m[0*4+3]*m[2*4+2]*m[3*4+1] - m[0*4+1]*m[2*4+2]*m[3*4+3] - m[0*4+2]*m[2*4+3]*m[3*4+1] - m[0*4+3]*m[2*4+1]*m[3*4+2]);
+	r[0*4+2] = invDeterminant * (m[0*4+1]*m[1*4+2]*m[3*4+3] + m[0*4+2]*m[1*4+3]*m[3*4+1] + m[0*4+3]*m[1*4+1]*m[3*4+2] - m[0*4+1]*m[1*4+3]*m[3*4+2] - m[0*4+2]*m[1*4+1]*m[3*4+3] - m[0*4+3]*m[1*4+2]*m[3*4+1]);
+	r[0*4+3] = invDeterminant * (m[0*4+1]*m[1*4+3]*m[2*4+2] + m[0*4+2]*m[1*4+1]*m[2*4+3] + m[0*4+3]*m[1*4+2]*m[2*4+1] - m[0*4+1]*m[1*4+2]*m[2*4+3] - m[0*4+2]*m[1*4+3]*m[2*4+1] - m[0*4+3]*m[1*4+1]*m[2*4+2]);
+	r[1*4+0] = invDeterminant * (m[1*4+0]*m[2*4+3]*m[3*4+2] + m[1*4+2]*m[2*4+0]*m[3*4+3] + m[1*4+3]*m[2*4+2]*m[3*4+0] - m[1*4+0]*m[2*4+2]*m[3*4+3] - m[1*4+2]*m[2*4+3]*m[3*4+0] - m[1*4+3]*m[2*4+0]*m[3*4+2]);
+	r[1*4+1] = invDeterminant * (m[0*4+0]*m[2*4+2]*m[3*4+3] + m[0*4+2]*m[2*4+3]*m[3*4+0] + m[0*4+3]*m[2*4+0]*m[3*4+2] - m[0*4+0]*m[2*4+3]*m[3*4+2] - m[0*4+2]*m[2*4+0]*m[3*4+3] - m[0*4+3]*m[2*4+2]*m[3*4+0]);
+	r[1*4+2] = invDeterminant * (m[0*4+0]*m[1*4+3]*m[3*4+2] + m[0*4+2]*m[1*4+0]*m[3*4+3] + m[0*4+3]*m[1*4+2]*m[3*4+0] - m[0*4+0]*m[1*4+2]*m[3*4+3] - m[0*4+2]*m[1*4+3]*m[3*4+0] - m[0*4+3]*m[1*4+0]*m[3*4+2]);
+	r[1*4+3] = invDeterminant * (m[0*4+0]*m[1*4+2]*m[2*4+3] + m[0*4+2]*m[1*4+3]*m[2*4+0] + m[0*4+3]*m[1*4+0]*m[2*4+2] - m[0*4+0]*m[1*4+3]*m[2*4+2] - m[0*4+2]*m[1*4+0]*m[2*4+3] - m[0*4+3]*m[1*4+2]*m[2*4+0]);
+	r[2*4+0] = invDeterminant * (m[1*4+0]*m[2*4+1]*m[3*4+3] + m[1*4+1]*m[2*4+3]*m[3*4+0] + m[1*4+3]*m[2*4+0]*m[3*4+1] - m[1*4+0]*m[2*4+3]*m[3*4+1] - m[1*4+1]*m[2*4+0]*m[3*4+3] - m[1*4+3]*m[2*4+1]*m[3*4+0]);
+	r[2*4+1] = invDeterminant * (m[0*4+0]*m[2*4+3]*m[3*4+1] + m[0*4+1]*m[2*4+0]*m[3*4+3] + m[0*4+3]*m[2*4+1]*m[3*4+0] - m[0*4+0]*m[2*4+1]*m[3*4+3] - m[0*4+1]*m[2*4+3]*m[3*4+0] - m[0*4+3]*m[2*4+0]*m[3*4+1]);
+	r[2*4+2] = invDeterminant * (m[0*4+0]*m[1*4+1]*m[3*4+3] + m[0*4+1]*m[1*4+3]*m[3*4+0] + m[0*4+3]*m[1*4+0]*m[3*4+1] - m[0*4+0]*m[1*4+3]*m[3*4+1] - m[0*4+1]*m[1*4+0]*m[3*4+3] - m[0*4+3]*m[1*4+1]*m[3*4+0]);
+	r[2*4+3] = invDeterminant * (m[0*4+0]*m[1*4+3]*m[2*4+1] + m[0*4+1]*m[1*4+0]*m[2*4+3] + m[0*4+3]*m[1*4+1]*m[2*4+0] - m[0*4+0]*m[1*4+1]*m[2*4+3] - m[0*4+1]*m[1*4+3]*m[2*4+0] - m[0*4+3]*m[1*4+0]*m[2*4+1]);
+	r[3*4+0] = invDeterminant * (m[1*4+0]*m[2*4+2]*m[3*4+1] + m[1*4+1]*m[2*4+0]*m[3*4+2] + m[1*4+2]*m[2*4+1]*m[3*4+0] - m[1*4+0]*m[2*4+1]*m[3*4+2] - m[1*4+1]*m[2*4+2]*m[3*4+0] - m[1*4+2]*m[2*4+0]*m[3*4+1]);
+	r[3*4+1] = invDeterminant * (m[0*4+0]*m[2*4+1]*m[3*4+2] + m[0*4+1]*m[2*4+2]*m[3*4+0] + m[0*4+2]*m[2*4+0]*m[3*4+1] - m[0*4+0]*m[2*4+2]*m[3*4+1] - m[0*4+1]*m[2*4+0]*m[3*4+2] - m[0*4+2]*m[2*4+1]*m[3*4+0]);
+	r[3*4+2] = invDeterminant * (m[0*4+0]*m[1*4+2]*m[3*4+1] + m[0*4+1]*m[1*4+0]*m[3*4+2] + m[0*4+2]*m[1*4+1]*m[3*4+0] - m[0*4+0]*m[1*4+1]*m[3*4+2] - m[0*4+1]*m[1*4+2]*m[3*4+0] - m[0*4+2]*m[1*4+0]*m[3*4+1]);
+	r[3*4+3] = invDeterminant * (m[0*4+0]*m[1*4+1]*m[2*4+2] + m[0*4+1]*m[1*4+2]*m[2*4+0] + m[0*4+2]*m[1*4+0]*m[2*4+1] - m[0*4+0]*m[1*4+2]*m[2*4+1] - m[0*4+1]*m[1*4+0]*m[2*4+2] - m[0*4+2]*m[1*4+1]*m[2*4+0]);
+	return result;
+}
@@ -4,15 +4,17 @@
 #include <limits>
 #include "Logger.h"
 #include "StanfordSystem.h"
+#include "Memory.h"
+#include "Simd.h"
+#include "PrecomputeCache.h"
+#include "GpuSimulator.h"
+#include "SmallMatrix.h"
 #include <iomanip>
 #include <fstream>
 
 using namespace std;
 
-#include "Macros.h"
-
 const double epsilon = 1e-12;	//Used to check approximate equality to 0
-int iteration = 1;
 
 //Based on the paper at http://www.math.ucla.edu/~jteran/papers/TSNF03.pdf  Finite Volume Methods for the Simulation of Skeletal Muscle
 //By R. Fedkiw et. al
@@ -33,9 +35,32 @@ StanfordSystem::StanfordSystem(Vertex * vertexList, int vertexCount, int * tetra
 	//Optimization - Precompute cross products and force contribution sums derived from
 	//the original vertices
 	
-	crossProductSums = new double[DIMENSION * numTetra * 4];
-	invDm = new double[DIMENSION * DIMENSION * numTetra]; //1 3X3 matrix for each tetrahedron
+	crossProductSums = allocateTetraArray(4, DIMENSION);
+	invDm = allocateTetraArray(DIMENSION, DIMENSION); //1 3X3 matrix for each tetrahedron
+
+	//The rest state data only depends on the mesh, so it comes from the precompute cache when this mesh has been simulated before
+	//(normals is included so that the debug normal rendering still has the initial cross products)
+	PrecomputeCache precompute("stanford", orgVertices, numVertices, tetraList, numTetra);
+	precompute.addArray(normals, DIMENSION * numTetra * 4);
+	precompute.addArray(crossProductSums, DIMENSION * numTetra * 4);
+	precompute.addArray(invDm, DIMENSION * DIMENSION * numTetra);
+	if (!precompute.load(logger))
+	{
+		computeRestState();
+		precompute.save();
+	}
+
+	buildBlockedData();
+}
 
+StanfordSystem::~StanfordSystem()
+{
+	//The rest state and the SIMD blocks belong to the arena
+}
+
+//Computes the cross product sums and inverse rest matrices (invDm) of every tetrahedron from the original vertices
+void StanfordSystem::computeRestState()
+{
 	//for i = 1:size(triangles,2)
 	for (int i = 0; i < numTetra; i++)
 	{
@@ -175,79 +200,176 @@ StanfordSystem::StanfordSystem(Vertex * vertexList, int vertexCount, int * tetra
 
 	//end
 	}
-
-	
-
-
 }
 
-StanfordSystem::~StanfordSystem()
+//Repacks invDm and crossProductSums for the blocks of FORCE_BLOCK_WIDTH tetrahedra (see ParticleSystem::buildForceBlocks)
+//so that entry k of the tetrahedra in a block are adjacent (one SIMD load per matrix entry).
+void StanfordSystem::buildBlockedData()
 {
-	delete [] crossProductSums;
-	delete [] invDm;
-}
+	blockedInvDm = allocateBlockArray(9);
+	blockedCrossProductSums = allocateBlockArray(9);
 
-//Overridden update method
-void StanfordSystem::doUpdate(double deltaT)
-{
-	#ifdef DEBUGGING
-	if (logger -> isLogging)
+	for (int color = 0; color < numTetraColors; color++)
 	{
-		logger -> printText("=======================================================================================================");
-		logger -> printIteration("Iteration #", iteration);
-		logger ->printVelocitiesAndPositions(defVertices, numVertices, "Def Positions - start of method", "Velocities - start of method", logger ->MEDIUM);
-		logger ->printVelocitiesAndPositions(orgVertices, numVertices, "Org Positions - start of method", "Velocities - start of method", logger ->MEDIUM);
-		if (logger -> loggingLevel >= logger ->MEDIUM)
+		for (int block = colorBlockOffsets[color]; block < colorBlockOffsets[color + 1]; block++)
 		{
-			for (int i = 0; i < numTetra; i++)
+			for (int lane = 0; lane < FORCE_BLOCK_WIDTH; lane++)
 			{
-				for (int j = 0; j < 4; j++)
+				int i = tetraColorOffsets[color] + (block - colorBlockOffsets[color]) * FORCE_BLOCK_WIDTH + lane;
+				for (int row = 0; row < DIMENSION; row++)
 				{
-					cout << tetraList[j * numTetra + i] << " ";
+					for (int col = 0; col < DIMENSION; col++)
+					{
+						blockedInvDm[(block * 9 + row * 3 + col) * FORCE_BLOCK_WIDTH + lane] = invDm[row * numTetra * DIMENSION + i * DIMENSION + col];
+						blockedCrossProductSums[(block * 9 + row * 3 + col) * FORCE_BLOCK_WIDTH + lane] = crossProductSums[numTetra * 4 * row + i * 4 + col + 1];
+					}
 				}
-				cout << endl;
 			}
 		}
 	}
-	#endif
+}
+
+//SIMD version of computeTetraForces for the block of FORCE_BLOCK_WIDTH tetrahedra starting at firstTetrad
+//Each SimdForce holds one matrix entry for all tetrahedra of the block.  The forces (plus damping) are added into currentForce.
+//The 2nd Piola stress is evaluated directly as lambda * trace(E) * I + 2 * mu * E instead of multiplying by the 6 X 6 Voigt matrix.
+void StanfordSystem::computeBlockForces(int firstTetrad, int block)
+{
+	const ForceReal * blockInvDm = &blockedInvDm[block * 9 * FORCE_BLOCK_WIDTH];
+	const ForceReal * blockCrossProductSums = &blockedCrossProductSums[block * 9 * FORCE_BLOCK_WIDTH];
+
+	//Scratch space for moving lane data in and out of registers
+	double lanes[12 * FORCE_BLOCK_WIDTH];
 
-	//Start with 0 force each iteration
-	for (int i = 0; i < DIMENSION * numVertices; i++)
+	//Ds = [p0 - p1, p2 - p1, p3 - p1] gathered lane by lane
+	for (int lane = 0; lane < FORCE_BLOCK_WIDTH; lane++)
 	{
-		currentForce[i] = 0;
+		int i = firstTetrad + lane;
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			const double * position = &positions[j * numVertices];
+			double p1 = position[tetraList[1 * numTetra + i]];
+			lanes[(j * 3 + 0) * FORCE_BLOCK_WIDTH + lane] = position[tetraList[0 * numTetra + i]] - p1;
+			lanes[(j * 3 + 1) * FORCE_BLOCK_WIDTH + lane] = position[tetraList[2 * numTetra + i]] - p1;
+			lanes[(j * 3 + 2) * FORCE_BLOCK_WIDTH + lane] = position[tetraList[3 * numTetra + i]] - p1;
+		}
 	}
 
-	for (int i = 0; i < DIMENSION * numTetra * 4; i++)
+	SimdForce Ds[9];
+	for (int k = 0; k < 9; k++)
 	{
-		normals[i] = 0;
+		Ds[k] = simdLoadForce(&lanes[k * FORCE_BLOCK_WIDTH]);
 	}
 
-	for (int i = 0; i < numTetra; i++)
+	//F = Ds * inv(Dm)
+	SimdForce F[9];
+	for (int row = 0; row < DIMENSION; row++)
 	{
-		#ifdef DEBUGGING
-		if (logger -> isLogging)
+		for (int col = 0; col < DIMENSION; col++)
 		{
-			logger -> printText("**************");
-			logger -> printIteration("Tetrahedron #", i);
+			SimdForce sum = simdMul(Ds[row * 3 + 0], simdLoad(&blockInvDm[(0 * 3 + col) * FORCE_BLOCK_WIDTH]));
+			sum = simdMulAdd(Ds[row * 3 + 1], simdLoad(&blockInvDm[(1 * 3 + col) * FORCE_BLOCK_WIDTH]), sum);
+			F[row * 3 + col] = simdMulAdd(Ds[row * 3 + 2], simdLoad(&blockInvDm[(2 * 3 + col) * FORCE_BLOCK_WIDTH]), sum);
 		}
-		#endif
-		   
+	}
+
+	//Inverted tetrahedra are rare, so the SVD only runs for blocks that contain one
+	uninvertFBlock(F);
+
+	//greenStrain = (1 / 2) * (F' * F - eye(3)) - only the upper triangle is needed since it is symmetric
+	SimdForce half = simdConstant<SimdForce>(0.5);
+	SimdForce one = simdConstant<SimdForce>(1);
+	SimdForce greenStrain[9];
+	for (int row = 0; row < DIMENSION; row++)
+	{
+		for (int col = row; col < DIMENSION; col++)
+		{
+			SimdForce sum = simdMul(F[0 * 3 + row], F[0 * 3 + col]);
+			sum = simdMulAdd(F[1 * 3 + row], F[1 * 3 + col], sum);
+			sum = simdMulAdd(F[2 * 3 + row], F[2 * 3 + col], sum);
+			if (row == col)
+			{
+				sum = simdSub(sum, one);
+			}
+			greenStrain[row * 3 + col] = simdMul(half, sum);
+		}
+	}
+
+	//secondStress = lambda * trace(greenStrain) * eye(3) + 2 * mu * greenStrain
+	SimdForce twoMu = simdMul(simdConstant<SimdForce>(2), simdLoadForce(&tetraMu[firstTetrad]));
+	SimdForce lambdaTrace = simdMul(simdLoadForce(&tetraLambda[firstTetrad]), simdAdd(simdAdd(greenStrain[0], greenStrain[4]), greenStrain[8]));
+	SimdForce secondStress[9];
+	for (int row = 0; row < DIMENSION; row++)
+	{
+		secondStress[row * 3 + row] = simdMulAdd(twoMu, greenStrain[row * 3 + row], lambdaTrace);
+		for (int col = row + 1; col < DIMENSION; col++)
+		{
+			secondStress[row * 3 + col] = secondStress[col * 3 + row] = simdMul(twoMu, greenStrain[row * 3 + col]);
+		}
+	}
+
+	//firstStress = F * secondStress
+	SimdForce firstStress[9];
+	for (int row = 0; row < DIMENSION; row++)
+	{
+		for (int col = 0; col < DIMENSION; col++)
+		{
+			SimdForce sum = simdMul(F[row * 3 + 0], secondStress[0 * 3 + col]);
+			sum = simdMulAdd(F[row * 3 + 1], secondStress[1 * 3 + col], sum);
+			firstStress[row * 3 + col] = simdMulAdd(F[row * 3 + 2], secondStress[2 * 3 + col], sum);
+		}
+	}
+
+	//g2, g3, g4 = firstStress * crossProductSums of vertices 1 - 3; g1 = -(g2 + g3 + g4)
+	for (int row = 0; row < DIMENSION; row++)
+	{
+		SimdForce g1 = simdConstant<SimdForce>(0);
+		for (int vertex = 1; vertex < 4; vertex++)
+		{
+			SimdForce g = simdMul(firstStress[row * 3 + 0], simdLoad(&blockCrossProductSums[(0 * 3 + vertex - 1) * FORCE_BLOCK_WIDTH]));
+			g = simdMulAdd(firstStress[row * 3 + 1], simdLoad(&blockCrossProductSums[(1 * 3 + vertex - 1) * FORCE_BLOCK_WIDTH]), g);
+			g = simdMulAdd(firstStress[row * 3 + 2], simdLoad(&blockCrossProductSums[(2 * 3 + vertex - 1) * FORCE_BLOCK_WIDTH]), g);
+			simdStoreForce(&lanes[(row * 4 + vertex) * FORCE_BLOCK_WIDTH], g);
+			g1 = simdSub(g1, g);
+		}
+		simdStoreForce(&lanes[(row * 4 + 0) * FORCE_BLOCK_WIDTH], g1);
+	}
+
+	//Scatter the forces (plus damping) lane by lane
+	for (int lane = 0; lane < FORCE_BLOCK_WIDTH; lane++)
+	{
+		int i = firstTetrad + lane;
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			for (int k = 0; k < 4; k++)
+			{
+				int vertex = j * numVertices + tetraList[k * numTetra + i];
+				currentForce[vertex] += lanes[(j * 4 + k) * FORCE_BLOCK_WIDTH + lane] - tetraKd[i] * velocities[vertex];
+			}
+		}
+	}
+}
+
+//Overridden force kernel - computes the finite volume forces for one tetrahedron
+//Parameter p is the deformed positions of its 4 vertices (3 X 4, p[j * 4 + vertex]); the forces are written to forces in the same layout
+//The velocities are not used - accumulateTetraForces adds the kd damping.
+void StanfordSystem::computeTetraForces(int i, double * p, double *, double * forces)
+{
     //display('Dm is:');  
     //display(Dm);
 
-    double Ds [DIMENSION][DIMENSION];
+    Mat3 Ds;
     
 	for (int j = 0; j < DIMENSION; j++)
 	{
-		Ds[j][0] = defVertices[tetraList[0 * numTetra + i]].position[j] - defVertices[tetraList[1 * numTetra + i]].position[j];
-		Ds[j][1] = defVertices[tetraList[2 * numTetra + i]].position[j] - defVertices[tetraList[1 * numTetra + i]].position[j];
-		Ds[j][2] = defVertices[tetraList[3 * numTetra + i]].position[j] - defVertices[tetraList[1 * numTetra + i]].position[j];
+		Ds(j, 0) = p[j * 4 + 0] - p[j * 4 + 1];
+		Ds(j, 1) = p[j * 4 + 2] - p[j * 4 + 1];
+		Ds(j, 2) = p[j * 4 + 3] - p[j * 4 + 1];
 	}
 
 	#ifdef DEBUGGING
 	if (logger -> isLogging)
 	{
-		logger -> print3By3Matrix(Ds,"Ds", logger ->MEDIUM);
+		logger -> print3By3MatrixSingleIndex(Ds.data,"Ds", logger ->MEDIUM);
 	}
 	#endif
 
@@ -255,92 +377,39 @@ void StanfordSystem::doUpdate(double deltaT)
     //display(Ds);
 
 	//F = Ds * inv(Dm);
-	double F[DIMENSION][DIMENSION];
-	//multiplyMatricesATimesB(F,Ds, DIMENSION, DIMENSION, invDm, DIMENSION, DIMENSION);
-	//TO DO (TODO): Look into making a method that multiplies matrices FROM AN OFFSET
-
-	//////////////////////////////////////////////////
-
-	int aRows, bCols, aCols;
-	aRows = bCols = aCols = DIMENSION;
-	for (int ii = 0; ii < aRows; ii++) /*current row # of calculated final matrix element*/						\
-	{																											\
-		for (int j = 0; j < bCols; j++) /*current col # of calculated final matrix element*/					\
-		{																										\
-			F[ii][j] = 0;																						\
-			for (int k = 0; k < aCols; k++) /*current col in left matrix and row in right matrix for summing*/	\
-			{																									\
-				F[ii][j] += Ds[ii][k] * invDm[k * numTetra * DIMENSION + i * DIMENSION + j];														\
-			}																									\
-																												\
-		}																										\
-																												\
-	}	
-
-	//////////////////////////////////////////////////
+	Mat3 tetraInvDm;
+	for (int k = 0; k < DIMENSION; k++)
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			tetraInvDm(k, j) = invDm[k * numTetra * DIMENSION + i * DIMENSION + j];
+		}
+	}
+	Mat3 F = Ds * tetraInvDm;
+
 	#ifdef DEBUGGING
 	if (logger -> isLogging)
 	{
-		logger -> print3By3Matrix(F,"F", logger ->MEDIUM);
+		logger -> print3By3MatrixSingleIndex(F.data,"F", logger ->MEDIUM);
 
 		//Likely will be used for inverted tetrahedra code:
 		//Show us the determinant of F so that we can try to evaluate if it's inverted or not
-		//double thatDeterminant = determinant3By3(F);	
+		//double thatDeterminant = determinant(F);	
 	}
 	#endif
     
 	if (doUninvert) //Avoid any processing if it's turned off
 	{
-		double FOneIndex[9];
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				FOneIndex[i*3 + j] = F[i][j];
-			}
-		}
-
-		uninvertF(FOneIndex);
-
-		for (int i = 0; i < 3; i++)
-		{
-			for (int j = 0; j < 3; j++)
-			{
-				F[i][j] = FOneIndex[i*3 + j];
-			}
-		}
+		uninvertF(F.data);
 	}
 	
 	//greenStrain = (1 / 2) * (F' * F - eye(3));
-	//Part I: F' * F
-	double greenStrain[DIMENSION][DIMENSION];
-	for (int i = 0; i < DIMENSION; i++) //current row # of calculated final matrix element
-	{
-		for (int j = 0; j < DIMENSION; j++) //current col # of calculated final matrix element
-		{
-			greenStrain[i][j] = 0;
-			for (int k = 0; k < DIMENSION; k++) //current col in left matrix and row in right matrix for summing
-			{
-				greenStrain[i][j] += F[k][i] * F[k][j]; //We access first F in opposite order since transposed
-			}
-
-		}
-
-	}
-
-	//Part 2: Multiply by 0.5 and subtact eye(3) (Identity matrix)
-	for (int j = 0; j < DIMENSION; j++)
-	{
-		for (int k = 0; k < DIMENSION; k++)
-		{
-			greenStrain[j][k] = 0.5 * (greenStrain[j][k] - (j == k));
-		}
-	}
+	Mat3 greenStrain = 0.5 * (transposeTimes(F, F) - Mat3::identity());
 
 	#ifdef DEBUGGING
 	if (logger -> isLogging)
 	{
-		logger -> print3By3Matrix(greenStrain,"Green Strain", logger ->MEDIUM);
+		logger -> print3By3MatrixSingleIndex(greenStrain.data,"Green Strain", logger ->MEDIUM);
 	}
 	#endif
 
@@ -353,12 +422,12 @@ void StanfordSystem::doUpdate(double deltaT)
 	//voigtGreenStrain = [greenStrain(1,1) greenStrain(2,2) greenStrain(3,3) ...
     //    2 * greenStrain(2,3) 2 * greenStrain(3,1) 2 * greenStrain(1,2) ]';
 	double voigtGreenStrain[6];
-	voigtGreenStrain[0] = greenStrain[0][0];
-	voigtGreenStrain[1] = greenStrain[1][1];
-	voigtGreenStrain[2] = greenStrain[2][2];
-	voigtGreenStrain[3] = 2 * greenStrain[1][2];
-	voigtGreenStrain[4] = 2 * greenStrain[2][0];
-	voigtGreenStrain[5] = 2 * greenStrain[0][1];
+	voigtGreenStrain[0] = greenStrain(0, 0);
+	voigtGreenStrain[1] = greenStrain(1, 1);
+	voigtGreenStrain[2] = greenStrain(2, 2);
+	voigtGreenStrain[3] = 2 * greenStrain(1, 2);
+	voigtGreenStrain[4] = 2 * greenStrain(2, 0);
+	voigtGreenStrain[5] = 2 * greenStrain(0, 1);
 
 	#ifdef DEBUGGING
 	if (logger -> isLogging)
@@ -376,32 +445,14 @@ void StanfordSystem::doUpdate(double deltaT)
     //    0                   0                 0                   0   0   mu;   ...
     //];
 
-	double strainToStress[6][6] = {
-		{2 * mu + lambda,   lambda         ,   lambda         ,    0,   0,    0},   
-		{lambda         ,   2 * mu + lambda,   lambda         ,    0,   0,    0},   
-		{lambda         ,   lambda         ,   2 * mu + lambda,    0,   0,    0},   
-		{0              ,    0             ,   0              ,    mu,  0,    0},   
-		{0              ,    0             ,   0              ,    0,   mu,   0},   
-		{0              ,    0             ,   0              ,    0,   0 ,  mu}   
-	};
-
-	#ifdef DEBUGGING
-	if (logger -> isLogging)
-	{
-		logger -> printStrainToStressMatrix(strainToStress, "strainToStress", logger ->MEDIUM);
-	}
-	#endif
-
-	
     //voigtStress = strainToStress * voigtGreenStrain;
+	//strainToStress is never built - each normal stress is lambda * trace plus 2 * mu times its strain, and each shear stress is mu times its strain
+	double lambdaTrace = tetraLambda[i] * (voigtGreenStrain[0] + voigtGreenStrain[1] + voigtGreenStrain[2]);
 	double voigtStress[6];
-	for (int j = 0; j < 6; j++) //Current row in strainToStress Matrix
+	for (int j = 0; j < 3; j++)
 	{
-		voigtStress[j] = 0;
-		for (int k = 0; k < 6; k++) //Current Column in StrainToStressMatrix
-		{
-			voigtStress[j] += strainToStress[j][k] * voigtGreenStrain[k];
-		}
+		voigtStress[j] = lambdaTrace + 2 * tetraMu[i] * voigtGreenStrain[j];
+		voigtStress[j + 3] = tetraMu[i] * voigtGreenStrain[j + 3];
 	}
 
 	#ifdef DEBUGGING
@@ -418,16 +469,16 @@ void StanfordSystem::doUpdate(double deltaT)
     //    voigtStress(5,1) voigtStress(4,1)    voigtStress(3,1)  ...
     //];
 
-	double secondStress[DIMENSION][DIMENSION] = {
-		{voigtStress[0], voigtStress[5],    voigtStress[4]},
-		{voigtStress[5], voigtStress[1],    voigtStress[3]},
-		{voigtStress[4], voigtStress[3],    voigtStress[2]}
-	};
+	Mat3 secondStress = {{
+		voigtStress[0], voigtStress[5],    voigtStress[4],
+		voigtStress[5], voigtStress[1],    voigtStress[3],
+		voigtStress[4], voigtStress[3],    voigtStress[2]
+	}};
 
 	#ifdef DEBUGGING
 	if (logger -> isLogging)
 	{
-		logger -> print3By3Matrix(secondStress,"secondStress", logger ->MEDIUM);
+		logger -> print3By3MatrixSingleIndex(secondStress.data,"secondStress", logger ->MEDIUM);
 	}
 	#endif
 
@@ -435,13 +486,12 @@ void StanfordSystem::doUpdate(double deltaT)
     //display(secondStress);
 
     //firstStress = F * secondStress;
-	double firstStress[DIMENSION][DIMENSION];
-	multiplyMatricesATimesB(firstStress,F,DIMENSION,DIMENSION,secondStress,DIMENSION,DIMENSION);
+	Mat3 firstStress = F * secondStress;
 
 	#ifdef DEBUGGING
 	if (logger -> isLogging)
 	{
-		logger -> print3By3Matrix(firstStress,"firstStress", logger ->MEDIUM);
+		logger -> print3By3MatrixSingleIndex(firstStress.data,"firstStress", logger ->MEDIUM);
 	}
 	#endif
  
@@ -451,10 +501,9 @@ void StanfordSystem::doUpdate(double deltaT)
     //currentForce(:,triangles(4,i)) = currentForce(:,triangles(4,i)) + -1/3 * firstStress * (areas(1,2) * normals(:,2) + areas(1,3) * normals(:,3) + areas(1,4) * normals(:,4)) - kd * inVelocities(:,triangles(4,i));
 
 
-	double temp1[DIMENSION][1];
-	double temp2[DIMENSION][1];
-	double temp3[DIMENSION][1];
-	double temp4[DIMENSION][1];
+	Vec3 temp2;
+	Vec3 temp3;
+	Vec3 temp4;
 	for (int j = 0; j < DIMENSION; j++)
 	{
 		//FIX: added + i * 4 again...
@@ -462,106 +511,70 @@ void StanfordSystem::doUpdate(double deltaT)
 		//temp[j][1] = (areas[0] * normals[j * 4 * numTetra + i * 4 + 0] + areas[2] * normals[j * 4 * numTetra + i * 4 + 2] + areas[1] * normals[j * 4 * numTetra + i * 4 + 1]);
 		//temp[j][2] = (areas[0] * normals[j * 4 * numTetra + i * 4 + 0] + areas[1] * normals[j * 4 * numTetra + i * 4 + 1] + areas[3] * normals[j * 4 * numTetra + i * 4 + 3]);
 		//temp[j][3] = (areas[1] * normals[j * 4 * numTetra + i * 4 + 1] + areas[2] * normals[j * 4 * numTetra + i * 4 + 2] + areas[3] * normals[j * 4 * numTetra + i * 4 + 3]);
-		//TO DO: (TODO) : Get rid of temp - not needed.(?)
-		temp1[j][0] = crossProductSums[numTetra*4*j + i*4 + 0];
-		temp2[j][0] = crossProductSums[numTetra*4*j + i*4 + 1];
-		temp3[j][0] = crossProductSums[numTetra*4*j + i*4 + 2];
-		temp4[j][0] = crossProductSums[numTetra*4*j + i*4 + 3];
+		temp2[j] = crossProductSums[numTetra*4*j + i*4 + 1];
+		temp3[j] = crossProductSums[numTetra*4*j + i*4 + 2];
+		temp4[j] = crossProductSums[numTetra*4*j + i*4 + 3];
 		
 	}
 
 	#ifdef DEBUGGING
 	if (logger -> isLogging)
 	{
-		logger -> printVector(temp1[0],DIMENSION,"temp1", logger ->MEDIUM);
-		logger -> printVector(temp2[0],DIMENSION,"temp2", logger ->MEDIUM);
-		logger -> printVector(temp3[0],DIMENSION,"temp3", logger ->MEDIUM);
-		logger -> printVector(temp4[0],DIMENSION,"temp4", logger ->MEDIUM);
+		logger -> printVector(temp2.data,DIMENSION,"temp2", logger ->MEDIUM);
+		logger -> printVector(temp3.data,DIMENSION,"temp3", logger ->MEDIUM);
+		logger -> printVector(temp4.data,DIMENSION,"temp4", logger ->MEDIUM);
 	}
 	#endif
 
-	double g1[DIMENSION][1];
-	double g2[DIMENSION][1];
-	double g3[DIMENSION][1];
-	double g4[DIMENSION][1];
-	
-	multiplyMatricesATimesB(g2,firstStress,DIMENSION,DIMENSION,temp2,DIMENSION, 1);
-	multiplyMatricesATimesB(g3,firstStress,DIMENSION,DIMENSION,temp3,DIMENSION, 1);
-	multiplyMatricesATimesB(g4,firstStress,DIMENSION,DIMENSION,temp4,DIMENSION, 1);
-	for (int i = 0; i < DIMENSION; i++)
-	{
-		g1[i][0] = -(g2[i][0] + g3[i][0] + g4[i][0]);
-
-	}
+	//The crossProductSums of the 4 vertices add up to zero, so vertex 0 gets minus the sum of the others
+	Vec3 g2 = firstStress * temp2;
+	Vec3 g3 = firstStress * temp3;
+	Vec3 g4 = firstStress * temp4;
+	Vec3 g1 = -(g2 + g3 + g4);
 
 	//firstStress * temp   --multiplying the whole firstStress matrix by a matrix with each column being a normal is equivalent to multiplying firstStress matrix by each column separately
-		
+	//(damping is added by the caller while scattering the forces)
 	for (int j = 0; j < DIMENSION; j++)
 	{
-		currentForce[j * numVertices + tetraList[0 * numTetra + i]] += g1[j][0] - kd * defVertices[tetraList[0 * numTetra + i]].velocity[j];
-		currentForce[j * numVertices + tetraList[1 * numTetra + i]] += g2[j][0] - kd * defVertices[tetraList[1 * numTetra + i]].velocity[j];
-		currentForce[j * numVertices + tetraList[2 * numTetra + i]] += g3[j][0] - kd * defVertices[tetraList[2 * numTetra + i]].velocity[j];
-		currentForce[j * numVertices + tetraList[3 * numTetra + i]] += g4[j][0] - kd * defVertices[tetraList[3 * numTetra + i]].velocity[j];
+		forces[j * 4 + 0] = g1[j];
+		forces[j * 4 + 1] = g2[j];
+		forces[j * 4 + 2] = g3[j];
+		forces[j * 4 + 3] = g4[j];
 	}
-    
-	//LOGGING
-	#ifdef DEBUGGING
-	if (logger -> isLogging && logger -> loggingLevel >= logger -> FULL)
-	{
-		logger ->printText( "Current force for this tetrad in middle of loop");
-
-		logger -> printVertexTypeMatrix(currentForce,numVertices,"currentForce", logger ->MEDIUM);
-	}
-	#endif
-    
-    
-    
-    
-	}
-
-	#ifdef DEBUGGING
-	if (logger -> isLogging)
-	{
-		logger -> printVertexTypeMatrix(currentForce,numVertices,"currentForce", logger ->MEDIUM);
-	}
-	#endif
+}
 
-	if (isAnimating)
+//GPU form of the finite volume forces (see GpuForceModel)
+//F = Ds * inv(Dm) with Ds = [p0 - p1, p2 - p1, p3 - p1], so vertices 0, 2 and 3 get the rows of inv(Dm) and vertex 1 minus their sum;
+//the force on vertices 1 - 3 is firstStress times their crossProductSums, and vertex 0 gets minus the sum of those.
+bool StanfordSystem::getGpuForceModel(GpuForceModel & model)
+{
+	model.shapeGradients.resize(12 * numTetra);
+	model.forceWeights.resize(12 * numTetra);
+	for (int i = 0; i < numTetra; i++)
 	{
-		for (int i = 0; i < numVertices; i++)
+		float * G = &model.shapeGradients[i * 12];
+		float * h = &model.forceWeights[i * 12];
+		for (int col = 0; col < DIMENSION; col++)
 		{
-			for (int j = 0; j < DIMENSION; j++)
-			{
-				//Add delta velocity to each particle's velocity
-				defVertices[i].velocity[j] += (currentForce[j * numVertices + i] / massMatrix[i]) * deltaT;
-				
-								
-				if (j == 1)
-				{
-					defVertices[i].velocity[j] += -earthGravityValue * deltaT; //no mass matrix ref here since earthGravityValue is in fact acceleration
-				}
+			G[0 * 3 + col] = (float) invDm[0 * numTetra * DIMENSION + i * DIMENSION + col];
+			G[2 * 3 + col] = (float) invDm[1 * numTetra * DIMENSION + i * DIMENSION + col];
+			G[3 * 3 + col] = (float) invDm[2 * numTetra * DIMENSION + i * DIMENSION + col];
+			G[1 * 3 + col] = -(G[0 * 3 + col] + G[2 * 3 + col] + G[3 * 3 + col]);
 
-				//Use explicit integration with velocity to update each particle's position
-				defVertices[i].position[j] += defVertices[i].velocity[j] * deltaT;
+			double sum = 0;
+			for (int vertex = 1; vertex < 4; vertex++)
+			{
+				double weight = crossProductSums[numTetra * 4 * col + i * 4 + vertex];
+				h[vertex * 3 + col] = (float) weight;
+				sum += weight;
 			}
-		
+			h[0 * 3 + col] = (float) -sum;
 		}
-
-		doCollisionDetectionAndResponse(deltaT);
-
-		
-	}
-
-	#ifdef DEBUGGING
-	if (logger -> isLogging)
-	{
-		logger ->printVelocitiesAndPositions(defVertices,numVertices,"Deformed Positions", "Deformed Velocities", logger ->MEDIUM);
-		
 	}
-	#endif
-
-	timeSinceVideoWrite += deltaT;
-	iteration++;
-
-	
-}
\ No newline at end of file
+	model.strainScale = 0.5f;
+	model.shearScale = 1;
+	model.useDeformedVolume = false;
+	model.phi = 0;
+	model.psi = 0;
+	return true;
+}
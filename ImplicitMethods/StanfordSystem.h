@@ -13,5 +13,14 @@ class StanfordSystem : public ParticleSystem
 	~StanfordSystem();
 	double * crossProductSums;
 	double * invDm;
-	void doUpdate(double elapsedSeconds);
+	protected:
+	//SIMD batched force data - each block holds FORCE_BLOCK_WIDTH consecutive tetrahedra of one color
+	ForceReal * blockedInvDm;					//invDm repacked lane interleaved: [(block * 9 + row * 3 + col) * FORCE_BLOCK_WIDTH + lane]
+	ForceReal * blockedCrossProductSums;		//crossProductSums of vertices 1-3 repacked: [(block * 9 + row * 3 + vertex - 1) * FORCE_BLOCK_WIDTH + lane]
+
+	void computeRestState();
+	void buildBlockedData();
+	void computeBlockForces(int firstTetrad, int block);
+	void computeTetraForces(int currentTetrad, double * p, double * v, double * forces);
+	bool getGpuForceModel(GpuForceModel & model);
 };
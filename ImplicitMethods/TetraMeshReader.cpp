@@ -1,151 +1,335 @@
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include "TetraMeshReader.h"
+#include "Memory.h"
 
 using namespace std;
 
 //Meshes from and format based on: http://www.cs.berkeley.edu/~jrs/stellar/#anims
 
-//This method opens the stellar file but does not start reading it
+const unsigned int BYTE_ORDER_MARK = 0x01020304;
+
+//Byte offset of the tetrahedra in a cache file - right after the positions, rounded up to MEMORY_ALIGNMENT
+static size_t cacheTetraOffset(int vertexCount)
+{
+	size_t positionsEnd = sizeof(MeshCacheHeader) + sizeof(float) * 3 * vertexCount;
+	return (positionsEnd + MEMORY_ALIGNMENT - 1) / MEMORY_ALIGNMENT * MEMORY_ALIGNMENT;
+}
+
+//Reads a whole text file into buffer and collects the start of every line that is not blank or a # comment
+//Each line is terminated with '\0' in the buffer, so the lines can be parsed independently (and in parallel).
+static bool readLines(const char * fileName, vector<char> & buffer, vector<char *> & lines)
+{
+	FILE * file = fopen(fileName, "rb");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	buffer.resize(length + 1);
+	size_t readCount = length > 0 ? fread(&buffer[0], 1, length, file) : 0;
+	fclose(file);
+	if (length < 0 || readCount != (size_t) length)
+	{
+		return false;
+	}
+	buffer[length] = '\0';
+
+	char * line = &buffer[0];
+	char * end = &buffer[length];
+	while (line < end)
+	{
+		char * lineEnd = (char *) memchr(line, '\n', end - line);
+		if (lineEnd == NULL)
+		{
+			lineEnd = end;
+		}
+		*lineEnd = '\0';
+
+		while (*line == ' ' || *line == '\t' || *line == '\r')
+		{
+			line++;
+		}
+		if (*line != '\0' && *line != '#')
+		{
+			lines.push_back(line);
+		}
+
+		line = lineEnd + 1;
+	}
+
+	return true;
+}
+
+TetraMeshReader::TetraMeshReader()
+{
+	useCache = true;
+	reorder = false;
+	parsedTetraList = NULL;
+}
+
+TetraMeshReader::~TetraMeshReader()
+{
+	delete [] parsedTetraList;
+}
+
+//This method checks that the stellar files exist but does not start reading them
 bool TetraMeshReader::openFile(char * nodeFileName, char * elementFileName)
 {
-	nodeFile.open(nodeFileName, ios::in);
-	elementFile.open(elementFileName, ios::in);
+	unsigned long long fileSize;
+	unsigned long long fileTime;
 
-	if (!nodeFile.is_open())
+	if (!getFileStamp(nodeFileName, fileSize, fileTime))
 	{
 		cerr << "Issue loading node file " << nodeFileName << endl;
 		return false;
 	}
 	else
 	{
-		if (!elementFile.is_open())
+		if (!getFileStamp(elementFileName, fileSize, fileTime))
 		{
 			cerr << "Issue loading element file " << elementFileName << endl;
 			return false;
 		}
 		else
 		{
+			this -> nodeFileName = nodeFileName;
+			this -> elementFileName = elementFileName;
+			cacheFileName = this -> nodeFileName + ".cache";
 			return true;
 		}
 	}
 
 }
 
-//This method loads the data for a stellar input file
+//This method loads the data for a stellar input file - from the binary cache if it is up to date, otherwise from the text files
+//tetraList belongs to the reader (it points into the mapped cache file, or to the parsed text) and stays valid as long as the reader exists.
+//The caller takes ownership of vertexList.
 bool TetraMeshReader::loadData(Vertex *& vertexList, int & vertexCount, int *& tetraList, int & tetraCount, Logger * logger)
 {
-	if (!nodeFile.is_open() || !elementFile.is_open())
+	if (nodeFileName.empty() || elementFileName.empty())
 	{
 		cerr << "Files not opened properly for reading" << endl;
 		return false;
 	}
 
-	nodeFile >> vertexCount; //# vertices
-
-	if (!nodeFile)
+	if (!useCache || !loadCache(vertexList, vertexCount, tetraList, tetraCount, logger))
 	{
-		cerr << "Issue in loading data for node file" << endl;
-		return false;
-	}
+		if (!loadText(vertexList, vertexCount, tetraList, tetraCount, logger))
+		{
+			return false;
+		}
+		delete [] parsedTetraList;
+		parsedTetraList = tetraList;
 
-	#ifdef DEBUGGING
-	if (logger -> isLogging)
-	{
-		if (logger -> loggingLevel >= logger ->MEDIUM)
+		if (useCache && !saveCache(vertexList, vertexCount, tetraList, tetraCount))
 		{
-			cout << "Vertex Count: " << vertexCount << endl;
+			cerr << "Could not write mesh cache " << cacheFileName << endl;
 		}
 	}
-	#endif
 
-	vertexList = new Vertex[vertexCount];
+	//A cached tetraList may be renumbered in place too, since the mapping is copy on write
+	if (reorder)
+	{
+		reorderForLocality(vertexList, vertexCount, tetraList, tetraCount, logger);
+	}
+
+	return true;
+}
 
-	int temp;
+//Spreads the low 21 bits of value out to every third bit, for interleaving 3 coordinates into a Morton code
+static unsigned long long spreadBits(unsigned long long value)
+{
+	value &= 0x1fffff;
+	value = (value | value << 32) & 0x1f00000000ffffULL;
+	value = (value | value << 16) & 0x1f0000ff0000ffULL;
+	value = (value | value << 8) & 0x100f00f00f00f00fULL;
+	value = (value | value << 4) & 0x10c30c30c30c30c3ULL;
+	value = (value | value << 2) & 0x1249249249249249ULL;
+	return value;
+}
 
-	for (int i = 1; i <= 3; i++)
+//Renumbers the mesh so that vertices and tetrahedra close in space are close in memory
+//The vertices are sorted along a Morton (Z order) curve through their bounding box, then the tetrahedra are sorted by their
+//lowest numbered vertex, so the per tetrahedron gathers, the scatter into the forces, the normals and the rendering all walk
+//through the vertex arrays nearly in order instead of jumping across them.  The colors of ParticleSystem::buildTetraColoring
+//keep this order within each color.
+//The corners of each tetrahedron keep their order (and so its orientation).  Everything else indexed by vertex or tetrahedron
+//(surface, constraints, rest state data) is built by the ParticleSystem from these lists, so nothing else needs remapping.
+void TetraMeshReader::reorderForLocality(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger)
+{
+	(void) logger;	//Only read by the DEBUGGING report
+	float boxMin[DIMENSION];
+	float boxMax[DIMENSION];
+	for (int i = 0; i < DIMENSION; i++)
+	{
+		boxMin[i] = boxMax[i] = vertexList[0].position[i];
+	}
+	for (int vertex = 1; vertex < vertexCount; vertex++)
 	{
-		nodeFile >> temp; //dimension, #attributes, #boundary marker
-		if (!nodeFile)
+		for (int i = 0; i < DIMENSION; i++)
 		{
-			cerr << "Issue in loading data for node file" << endl;
-			return false;
+			boxMin[i] = min(boxMin[i], vertexList[vertex].position[i]);
+			boxMax[i] = max(boxMax[i], vertexList[vertex].position[i]);
 		}
 	}
-	
-	int vertexNumber = 0;
-	bool hadProblem = true;
-	while (nodeFile)
+	double extent = 0;
+	for (int i = 0; i < DIMENSION; i++)
 	{
-		nodeFile >> temp; //Point number (assuming they're all ordered)
+		extent = max(extent, (double) boxMax[i] - boxMin[i]);
+	}
+	double cellScale = extent > 0 ? ((1 << 21) - 1) / extent : 0;		//21 bits per coordinate
 
-		if (!nodeFile)
+	//Morton code of each vertex, paired with its number so equal codes keep the file order
+	vector< pair<unsigned long long, int> > codes(vertexCount);
+	#pragma omp parallel for schedule(static)
+	for (int vertex = 0; vertex < vertexCount; vertex++)
+	{
+		unsigned long long code = 0;
+		for (int i = 0; i < DIMENSION; i++)
 		{
-			if (nodeFile.eof()) //At the end of the file, this is where it will be caught.  There is no problem for eof.
-			{
-				hadProblem = false;
-			}
-			continue;  //Let the normal loop catch file failures and deal with them
+			code |= spreadBits((unsigned long long) ((vertexList[vertex].position[i] - boxMin[i]) * cellScale)) << i;
 		}
+		codes[vertex] = make_pair(code, vertex);
+	}
+	sort(codes.begin(), codes.end());
 
-		#ifdef DEBUGGING
-		if (logger -> isLogging)
+	vector<int> newNumbers(vertexCount);
+	vector<Vertex> originalVertices(vertexList, vertexList + vertexCount);
+	for (int vertex = 0; vertex < vertexCount; vertex++)
+	{
+		newNumbers[codes[vertex].second] = vertex;
+		vertexList[vertex] = originalVertices[codes[vertex].second];
+	}
+
+	//Counting sort of the tetrahedra by lowest new vertex number
+	vector<int> lowestVertices(tetraCount);
+	vector<int> tetraStarts(vertexCount + 1, 0);
+	for (int t = 0; t < tetraCount; t++)
+	{
+		int lowest = vertexCount;
+		for (int k = 0; k < 4; k++)
 		{
-			if (logger -> loggingLevel >= logger ->MEDIUM)
-			{
-				cout << "Vertex #" << temp << ":" << endl;
-			}
+			lowest = min(lowest, newNumbers[tetraList[k * tetraCount + t]]);
 		}
-		#endif
+		lowestVertices[t] = lowest;
+		tetraStarts[lowest + 1]++;
+	}
+	for (int vertex = 0; vertex < vertexCount; vertex++)
+	{
+		tetraStarts[vertex + 1] += tetraStarts[vertex];
+	}
 
-		for (int i = 0; i < 3; i++)
+	vector<int> originalTetra(tetraList, tetraList + 4 * tetraCount);
+	for (int t = 0; t < tetraCount; t++)
+	{
+		int newT = tetraStarts[lowestVertices[t]]++;
+		for (int k = 0; k < 4; k++)
 		{
-			nodeFile >> vertexList[vertexNumber].position[i];
-			if (!nodeFile)
-			{
-				break;	//Break out of for loop
-			}
-
-			vertexList[vertexNumber].velocity[i] = 0;
-			//vertexList[vertexNumber].normal[i] = 0;
+			tetraList[k * tetraCount + newT] = newNumbers[originalTetra[k * tetraCount + t]];
 		}
-		if (!nodeFile)
+	}
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Renumbered " << vertexCount << " vertices and " << tetraCount << " tetrahedra along a Morton curve" << endl;
+	}
+	#endif
+}
+
+//Parses the node and element files
+//Every line holds one record, so after splitting the files into lines all records are parsed in parallel.
+bool TetraMeshReader::loadText(Vertex *& vertexList, int & vertexCount, int *& tetraList, int & tetraCount, Logger * logger)
+{
+	(void) logger;	//Only read by the DEBUGGING reports
+	vector<char> nodeBuffer;
+	vector<char *> nodeLines;
+
+	//Header: # vertices, dimension, #attributes, #boundary markers
+	if (!readLines(nodeFileName.c_str(), nodeBuffer, nodeLines) || nodeLines.size() < 2)
+	{
+		cerr << "Issue in loading data for node file" << endl;
+		return false;
+	}
+
+	vertexCount = strtol(nodeLines[0], NULL, 10);
+	if (vertexCount <= 0 || (int) nodeLines.size() < vertexCount + 1)
+	{
+		cerr << "Issue in loading data for node file" << endl;
+		return false;
+	}
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		if (logger -> loggingLevel >= logger ->MEDIUM)
 		{
-			continue; //Let the loop catch the file failure and eal with it
+			cout << "Vertex Count: " << vertexCount << endl;
 		}
+	}
+	#endif
 
-		#ifdef DEBUGGING
-		if (logger -> isLogging)
+	//Stellar files number points from 0 or 1 and the element file uses the same numbering, so the first point number is the base
+	int firstPointNumber = strtol(nodeLines[1], NULL, 10);
+
+	vertexList = new Vertex[vertexCount];
+
+	int badFields = 0;
+	#pragma omp parallel for schedule(static) reduction(+:badFields)
+	for (int vertexNumber = 0; vertexNumber < vertexCount; vertexNumber++)
+	{
+		char * field = nodeLines[vertexNumber + 1];
+		char * next;
+		strtol(field, &next, 10); //Point number (assuming they're all ordered)
+
+		for (int i = 0; i < 3; i++)
 		{
-			if (logger -> loggingLevel >= logger ->MEDIUM)
+			field = next;
+			vertexList[vertexNumber].position[i] = (float) strtod(field, &next);
+			vertexList[vertexNumber].velocity[i] = 0;
+			if (next == field)
 			{
-				//cout << "Read a vertex" << endl;
-				for (int i = 0; i < 3; i++)
-				{
-					cout << vertexList[vertexNumber].position[i] << " ";
-				}
-				cout << endl;
+				badFields++;
 			}
 		}
-		#endif
-
-		nodeFile >> temp; //Boundary field
-
-		vertexNumber++;
 	}
 
-	if (hadProblem)
+	if (badFields > 0)
 	{
 		cerr << "Issue in loading data for node file" << endl;
+		delete [] vertexList;
+		vertexList = NULL;
 		return false;
 	}
 
 	////////////////////////////////////////
 	///////////////////////////////////////
-	elementFile >> tetraCount; //# tetrahedra
+	vector<char> elementBuffer;
+	vector<char *> elementLines;
+
+	//Header: # tetrahedra, points per tetrahedron, #attributes
+	if (!readLines(elementFileName.c_str(), elementBuffer, elementLines) || elementLines.empty())
+	{
+		cerr << "Issue in loading data for element file" << endl;
+		delete [] vertexList;
+		vertexList = NULL;
+		return false;
+	}
 
-	if (!elementFile)
+	tetraCount = strtol(elementLines[0], NULL, 10);
+	if (tetraCount <= 0 || (int) elementLines.size() < tetraCount + 1)
 	{
 		cerr << "Issue in loading data for element file" << endl;
+		delete [] vertexList;
+		vertexList = NULL;
 		return false;
 	}
 
@@ -161,50 +345,52 @@ bool TetraMeshReader::loadData(Vertex *& vertexList, int & vertexCount, int *& t
 
 	tetraList = new int [tetraCount * 4];
 
-	for (int i = 1; i <= 2; i++)
-	{
-		elementFile >> temp; //points per tetrahedron, #attributes
-		if (!elementFile)
-		{
-			cerr << "Issue in loading data for node file" << endl;
-			return false;
-		}
-	}
-	
-	int tetraNumber = 0;
-	hadProblem = true;
-	while (elementFile)
+	badFields = 0;
+	#pragma omp parallel for schedule(static) reduction(+:badFields)
+	for (int tetraNumber = 0; tetraNumber < tetraCount; tetraNumber++)
 	{
-		elementFile >> temp; //Tetrahedron number (assuming they're all ordered)
+		char * field = elementLines[tetraNumber + 1];
+		char * next;
+		strtol(field, &next, 10); //Tetrahedron number (assuming they're all ordered)
 
-		if (!elementFile)
+		for (int i = 0; i < 4; i++)
 		{
-			if (elementFile.eof())
+			field = next;
+			int vertex = strtol(field, &next, 10) - firstPointNumber; //Convert to a 0 based index system
+			tetraList[i * tetraCount + tetraNumber] = vertex;
+			if (next == field || vertex < 0 || vertex >= vertexCount)
 			{
-				hadProblem = false;
+				badFields++;
 			}
-			continue;  //Let the normal loop catch the file failure and deal with it
 		}
+	}
 
-		for (int i = 0; i < 4; i++)
+	if (badFields > 0)
+	{
+		cerr << "Issue in loading data for element file" << endl;
+		delete [] vertexList;
+		delete [] tetraList;
+		vertexList = NULL;
+		tetraList = NULL;
+		return false;
+	}
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		if (logger -> loggingLevel >= logger ->MEDIUM)
 		{
-			elementFile >> tetraList[i * tetraCount + tetraNumber];
-			tetraList[i * tetraCount + tetraNumber]--; //Convert from 1 based index system to 0 based index system
-			if (!elementFile)
+			for (int vertexNumber = 0; vertexNumber < vertexCount; vertexNumber++)
 			{
-				break;	//Break out of for loop
+				cout << "Vertex #" << vertexNumber + firstPointNumber << ":" << endl;
+				for (int i = 0; i < 3; i++)
+				{
+					cout << vertexList[vertexNumber].position[i] << " ";
+				}
+				cout << endl;
 			}
-		}
-
-		if (!elementFile)
-		{
-			continue;
-		}
 
-		#ifdef DEBUGGING
-		if (logger -> isLogging)
-		{
-			if (logger -> loggingLevel >= logger ->MEDIUM)
+			for (int tetraNumber = 0; tetraNumber < tetraCount; tetraNumber++)
 			{
 				cout << "Read tetrahedron:" << endl;
 				for (int i = 0; i < 4; i++)
@@ -214,25 +400,131 @@ bool TetraMeshReader::loadData(Vertex *& vertexList, int & vertexCount, int *& t
 				cout << endl;
 			}
 		}
-		#endif
+	}
+	#endif
 
-		tetraNumber++;
-	} //while (elementFile)
+	return true;
+}
+
+//Fills in the parts of a cache header that identify the source files
+bool TetraMeshReader::fillCacheHeader(MeshCacheHeader & header)
+{
+	memset(&header, 0, sizeof(MeshCacheHeader));
+	strcpy(header.magic, "TETMESH");
+	header.version = MESH_CACHE_VERSION;
+	header.byteOrderMark = BYTE_ORDER_MARK;
 
-	if (hadProblem)
+	return getFileStamp(nodeFileName.c_str(), header.nodeFileSize, header.nodeFileTime) &&
+		getFileStamp(elementFileName.c_str(), header.elementFileSize, header.elementFileTime);
+}
+
+//Maps the cache file and uses it if it matches the text files and its checksum is intact
+//Returns false (and leaves nothing mapped) if there is no usable cache.
+bool TetraMeshReader::loadCache(Vertex *& vertexList, int & vertexCount, int *& tetraList, int & tetraCount, Logger * logger)
+{
+	(void) logger;	//Only read by the DEBUGGING reports
+	MeshCacheHeader expected;
+	if (!fillCacheHeader(expected) || !cache.open(cacheFileName.c_str()))
 	{
-		cerr << "Issue in loading data for element file" << endl;
 		return false;
 	}
 
+	MeshCacheHeader * header = (MeshCacheHeader *) cache.getData();
+	bool valid = cache.getSize() >= sizeof(MeshCacheHeader) &&
+		memcmp(header -> magic, expected.magic, sizeof(expected.magic)) == 0 &&
+		header -> version == expected.version &&
+		header -> byteOrderMark == expected.byteOrderMark &&
+		header -> nodeFileSize == expected.nodeFileSize && header -> nodeFileTime == expected.nodeFileTime &&
+		header -> elementFileSize == expected.elementFileSize && header -> elementFileTime == expected.elementFileTime &&
+		header -> vertexCount > 0 && header -> tetraCount > 0 &&
+		cache.getSize() == cacheTetraOffset(header -> vertexCount) + sizeof(int) * 4 * header -> tetraCount &&
+		header -> checksum == hashBytes(cache.getData() + sizeof(MeshCacheHeader), cache.getSize() - sizeof(MeshCacheHeader));
+
+	if (!valid)
+	{
+		#ifdef DEBUGGING
+		if (logger -> isLogging)
+		{
+			cout << "Mesh cache " << cacheFileName << " is out of date - reading the text files" << endl;
+		}
+		#endif
+		cache.close();
+		return false;
+	}
+
+	vertexCount = header -> vertexCount;
+	tetraCount = header -> tetraCount;
+
+	//ParticleSystem takes ownership of the vertices, so they are copied; the tetrahedra are used in place (the mapping is copy on write)
+	float * cachedPositions = (float *) (cache.getData() + sizeof(MeshCacheHeader));
+	vertexList = new Vertex[vertexCount];
+	for (int vertexNumber = 0; vertexNumber < vertexCount; vertexNumber++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			vertexList[vertexNumber].position[i] = cachedPositions[vertexNumber * 3 + i];
+			vertexList[vertexNumber].velocity[i] = 0;
+		}
+	}
+
+	tetraList = (int *) (cache.getData() + cacheTetraOffset(vertexCount));
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Loaded " << vertexCount << " vertices and " << tetraCount << " tetrahedra from mesh cache " << cacheFileName << endl;
+	}
+	#endif
+
 	return true;
+}
 
+//Writes the mesh to the cache file (see MeshCacheHeader for the layout)
+bool TetraMeshReader::saveCache(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount)
+{
+	MeshCacheHeader header;
+	if (!fillCacheHeader(header))
+	{
+		return false;
+	}
+	header.vertexCount = vertexCount;
+	header.tetraCount = tetraCount;
 
+	size_t tetraOffset = cacheTetraOffset(vertexCount);
+	vector<char> payload(tetraOffset - sizeof(MeshCacheHeader) + sizeof(int) * 4 * tetraCount, 0);
+
+	float * cachedPositions = (float *) &payload[0];
+	for (int vertexNumber = 0; vertexNumber < vertexCount; vertexNumber++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			cachedPositions[vertexNumber * 3 + i] = vertexList[vertexNumber].position[i];
+		}
+	}
+	memcpy(&payload[tetraOffset - sizeof(MeshCacheHeader)], tetraList, sizeof(int) * 4 * tetraCount);
+
+	header.checksum = hashBytes(&payload[0], payload.size());
+
+	FILE * file = fopen(cacheFileName.c_str(), "wb");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	bool written = fwrite(&header, sizeof(MeshCacheHeader), 1, file) == 1 && fwrite(&payload[0], payload.size(), 1, file) == 1;
+	written = (fclose(file) == 0) && written;
+	if (!written)
+	{
+		remove(cacheFileName.c_str());	//Never leave a partial cache behind
+	}
+
+	return written;
 }
 
 //This method closes the stellar file
+//The text files are read completely by loadData, so there is nothing left open except a mapped cache, which tetraList may still point into.
 void TetraMeshReader::closeFile()
 {
-	nodeFile.close();
-	elementFile.close();
-}
\ No newline at end of file
+	nodeFileName.clear();
+	elementFileName.clear();
+}
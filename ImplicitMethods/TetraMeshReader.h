@@ -1,20 +1,62 @@
 #pragma once
 
 #include "ParticleSystem.h"
-#include <fstream>
+#include "MappedFile.h"
+#include <string>
+#include <vector>
 
 using namespace std;
 
+const int MESH_CACHE_VERSION = 1;
+
+//Header of a binary mesh cache file (64 bytes, little endian like the x86 machines that write and read it)
+//It is followed by vertexCount * 3 floats of positions (vertex * 3 + dimension) and, at the next multiple of
+//MEMORY_ALIGNMENT bytes, 4 * tetraCount ints of 0 based vertex indices in the ParticleSystem layout (k * tetraCount + tetrahedron).
+struct MeshCacheHeader
+{
+	char magic[8];							//"TETMESH" - identifies the file type
+	int version;							//MESH_CACHE_VERSION
+	unsigned int byteOrderMark;				//0x01020304 as written - rejects caches written with the other byte order
+	int vertexCount;
+	int tetraCount;
+	unsigned long long nodeFileSize;		//Size and modification time of the text files the cache was made from
+	unsigned long long nodeFileTime;
+	unsigned long long elementFileSize;
+	unsigned long long elementFileTime;
+	unsigned long long checksum;			//hashBytes of everything after the header
+};
+
 //This class reads a tetrahedral model from a Stellar input file
 //Meshes from and format based on: http://www.cs.berkeley.edu/~jrs/stellar/#anims
+//The first load parses the text files in parallel and saves them as a binary cache next to the node file (<node file>.cache);
+//later loads memory map the cache instead.  The cache is rebuilt whenever either text file changes.
+//Optionally (setReorder) the loaded mesh is renumbered for memory locality - see reorderForLocality.  The cache always keeps
+//the numbering of the text files.
 class TetraMeshReader
 {
 private:
-	fstream nodeFile;		
-	fstream elementFile;
+	string nodeFileName;
+	string elementFileName;
+	string cacheFileName;
+	bool useCache;
+	bool reorder;			//True to renumber the vertices and tetrahedra after loading (see reorderForLocality)
+	MappedFile cache;		//The tetraList from a cache load points into this mapping, so it stays mapped as long as the reader exists
+	int * parsedTetraList;	//The tetraList from a text load, likewise owned by the reader
+
+	bool loadCache(Vertex *& vertexList, int & vertexCount, int *& tetraList, int & tetraCount, Logger * logger);
+	bool saveCache(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount);
+	bool loadText(Vertex *& vertexList, int & vertexCount, int *& tetraList, int & tetraCount, Logger * logger);
+	bool fillCacheHeader(MeshCacheHeader & header);
+	void reorderForLocality(Vertex * vertexList, int vertexCount, int * tetraList, int tetraCount, Logger * logger);
+
 public:
+	TetraMeshReader();
+	~TetraMeshReader();
 	bool openFile(char * nodeFileName, char *elementFileName);
 	bool loadData(Vertex *& vertexList, int & vertexCount, int *& tetraList, int & tetraCount, Logger * logger);
 	void closeFile();
+	void setUseCache(bool useCache) {this -> useCache = useCache;}
+	bool getUseCache() {return useCache;}
+	void setReorder(bool reorder) {this -> reorder = reorder;}
+	bool getReorder() {return reorder;}
 };
-
@@ -0,0 +1,154 @@
+#include "Threading.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+long atomicExchange(volatile long * target, long value)
+{
+	#ifdef _WIN32
+	return InterlockedExchange(target, value);
+	#else
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+	#endif
+}
+
+long atomicLoad(volatile long * target)
+{
+	#ifdef _WIN32
+	return InterlockedCompareExchange(target, 0, 0);
+	#else
+	return __atomic_load_n(target, __ATOMIC_SEQ_CST);
+	#endif
+}
+
+void sleepMilliseconds(int milliseconds)
+{
+	#ifdef _WIN32
+	Sleep(milliseconds);
+	#else
+	usleep(milliseconds * 1000);
+	#endif
+}
+
+Mutex::Mutex()
+{
+	#ifdef _WIN32
+	CRITICAL_SECTION * section = new CRITICAL_SECTION;
+	InitializeCriticalSection(section);
+	handle = section;
+	#else
+	pthread_mutex_t * mutex = new pthread_mutex_t;
+	pthread_mutex_init(mutex, NULL);
+	handle = mutex;
+	#endif
+}
+
+Mutex::~Mutex()
+{
+	#ifdef _WIN32
+	DeleteCriticalSection((CRITICAL_SECTION *) handle);
+	delete (CRITICAL_SECTION *) handle;
+	#else
+	pthread_mutex_destroy((pthread_mutex_t *) handle);
+	delete (pthread_mutex_t *) handle;
+	#endif
+}
+
+void Mutex::lock()
+{
+	#ifdef _WIN32
+	EnterCriticalSection((CRITICAL_SECTION *) handle);
+	#else
+	pthread_mutex_lock((pthread_mutex_t *) handle);
+	#endif
+}
+
+void Mutex::unlock()
+{
+	#ifdef _WIN32
+	LeaveCriticalSection((CRITICAL_SECTION *) handle);
+	#else
+	pthread_mutex_unlock((pthread_mutex_t *) handle);
+	#endif
+}
+
+Thread::Thread()
+{
+	handle = 0;
+	function = 0;
+	argument = 0;
+}
+
+//A thread must be joined before it is destroyed
+Thread::~Thread()
+{
+	join();
+}
+
+//Starts running function(argument) on a new thread
+//Returns false if the thread could not be created (or one is already running)
+bool Thread::start(void (* function)(void *), void * argument)
+{
+	if (handle != 0)
+	{
+		return false;
+	}
+
+	this -> function = function;
+	this -> argument = argument;
+
+	#ifdef _WIN32
+	handle = CreateThread(NULL, 0, threadMain, this, 0, NULL);
+	#else
+	pthread_t * thread = new pthread_t;
+	if (pthread_create(thread, NULL, threadMain, this) == 0)
+	{
+		handle = thread;
+	}
+	else
+	{
+		delete thread;
+	}
+	#endif
+
+	return handle != 0;
+}
+
+//Waits for the thread to finish (does nothing if none was started)
+void Thread::join()
+{
+	if (handle == 0)
+	{
+		return;
+	}
+
+	#ifdef _WIN32
+	WaitForSingleObject((HANDLE) handle, INFINITE);
+	CloseHandle((HANDLE) handle);
+	#else
+	pthread_join(*(pthread_t *) handle, NULL);
+	delete (pthread_t *) handle;
+	#endif
+
+	handle = 0;
+}
+
+#ifdef _WIN32
+unsigned long __stdcall Thread::threadMain(void * thread)
+{
+	((Thread *) thread) -> function(((Thread *) thread) -> argument);
+	return 0;
+}
+#else
+void * Thread::threadMain(void * thread)
+{
+	((Thread *) thread) -> function(((Thread *) thread) -> argument);
+	return NULL;
+}
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+//Minimal threading support (the Visual Studio 2010 toolset has no <thread>, <mutex> or <atomic>)
+//Win32 threads and critical sections on Windows, pthreads elsewhere.
+
+//Atomically stores value in target and returns the previous value (full memory barrier)
+long atomicExchange(volatile long * target, long value);
+
+//Reads a value written with atomicExchange by another thread (full memory barrier)
+long atomicLoad(volatile long * target);
+
+void sleepMilliseconds(int milliseconds);
+
+//Mutual exclusion lock - not recursive
+class Mutex
+{
+public:
+	Mutex();
+	~Mutex();
+	void lock();
+	void unlock();
+
+private:
+	Mutex(const Mutex &);				//Not copyable - owns the operating system lock
+	Mutex & operator = (const Mutex &);
+
+	void * handle;
+};
+
+//An operating system thread running function(argument)
+class Thread
+{
+public:
+	Thread();
+	~Thread();
+	bool start(void (* function)(void *), void * argument);
+	void join();
+	bool isStarted() {return handle != 0;}
+
+private:
+	Thread(const Thread &);				//Not copyable - owns the operating system thread
+	Thread & operator = (const Thread &);
+
+	void * handle;
+	void (* function)(void *);
+	void * argument;
+
+	#ifdef _WIN32
+	static unsigned long __stdcall threadMain(void * thread);
+	#else
+	static void * threadMain(void * thread);
+	#endif
+};
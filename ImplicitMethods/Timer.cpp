@@ -0,0 +1,29 @@
+#include "Timer.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+double getTimeSeconds()
+{
+	#ifdef _WIN32
+	static double secondsPerCount = 0;
+	LARGE_INTEGER count;
+	if (secondsPerCount == 0)
+	{
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		secondsPerCount = 1.0 / frequency.QuadPart;
+	}
+	QueryPerformanceCounter(&count);
+	return count.QuadPart * secondsPerCount;
+	#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+	#endif
+}
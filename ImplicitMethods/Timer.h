@@ -0,0 +1,5 @@
+#pragma once
+
+//Wall clock time in seconds from a high resolution, monotonic clock (QueryPerformanceCounter on Windows, clock_gettime elsewhere)
+//Only differences between two calls are meaningful.
+double getTimeSeconds();
@@ -0,0 +1,390 @@
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "Trajectory.h"
+
+using namespace std;
+
+unsigned long long hashRestPositions(const Vertex * vertices, int vertexCount, unsigned long long hash)
+{
+	for (int i = 0; i < vertexCount; i++)
+	{
+		hash = hashBytes(vertices[i].position, sizeof(float) * DIMENSION, hash);
+	}
+	return hash;
+}
+
+//Nearest integer multiple of quantum, rounding halves up
+static long long quantize(double value, double quantum)
+{
+	return (long long) floor(value / quantum + 0.5);
+}
+
+//Appends value as a zigzag variable length integer: small magnitudes of either sign take few bytes, 7 bits per byte
+static void putVarint(vector<unsigned char> & bytes, long long value)
+{
+	unsigned long long zigzag = ((unsigned long long) value << 1) ^ (unsigned long long) (value >> 63);
+	while (zigzag >= 0x80)
+	{
+		bytes.push_back((unsigned char) (zigzag | 0x80));
+		zigzag >>= 7;
+	}
+	bytes.push_back((unsigned char) zigzag);
+}
+
+//Reads a value written by putVarint, advancing data
+//Returns false if the value does not end before end
+static bool getVarint(const unsigned char *& data, const unsigned char * end, long long & value)
+{
+	unsigned long long zigzag = 0;
+	for (int shift = 0; shift < 64 && data < end; shift += 7)
+	{
+		unsigned char byte = *data++;
+		zigzag |= (unsigned long long) (byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+		{
+			value = (long long) (zigzag >> 1) ^ -(long long) (zigzag & 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+TrajectoryWriter::TrajectoryWriter(Logger * logger)
+{
+	this -> logger = logger;
+	recording = false;
+	memset(&header, 0, sizeof(TrajectoryHeader));
+	file = NULL;
+	recordCount = 0;
+	byteCount = 0;
+	for (int i = 0; i < TRAJECTORY_QUEUE; i++)
+	{
+		states[i] = NULL;
+		steps[i] = 0;
+	}
+	queueHead = 0;
+	queueCount = 0;
+	stopRequested = 0;
+	previous = NULL;
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+	stop();
+}
+
+//Creates fileName and starts the writer thread
+//Parameters restVertices and vertexCount - the rest state of the simulated mesh (identifies the mesh, and sets the position quantum)
+//Parameter stepsPerRecord - time steps between records; the caller decides when to call record
+//Returns false if the file could not be created or the writer thread could not be started
+bool TrajectoryWriter::start(const char * fileName, const Vertex * restVertices, int vertexCount, int stepsPerRecord)
+{
+	if (recording)
+	{
+		return true;
+	}
+
+	double lowest[DIMENSION], highest[DIMENSION];
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		lowest[j] = highest[j] = vertexCount > 0 ? restVertices[0].position[j] : 0;
+	}
+	for (int i = 1; i < vertexCount; i++)
+	{
+		for (int j = 0; j < DIMENSION; j++)
+		{
+			lowest[j] = min(lowest[j], (double) restVertices[i].position[j]);
+			highest[j] = max(highest[j], (double) restVertices[i].position[j]);
+		}
+	}
+	double extent = 0;
+	for (int j = 0; j < DIMENSION; j++)
+	{
+		extent = max(extent, highest[j] - lowest[j]);
+	}
+
+	memset(&header, 0, sizeof(TrajectoryHeader));
+	strcpy(header.magic, "TETTRAJ");
+	header.version = TRAJECTORY_VERSION;
+	header.byteOrderMark = TRAJECTORY_BYTE_ORDER_MARK;
+	header.meshHash = hashRestPositions(restVertices, vertexCount);
+	header.vertexCount = vertexCount;
+	header.stepsPerRecord = max(stepsPerRecord, 1);
+	header.keyframeInterval = TRAJECTORY_KEYFRAME_INTERVAL;
+	header.positionQuantum = (extent > 0 ? extent : 1) / (1 << TRAJECTORY_POSITION_BITS);
+	header.velocityQuantum = header.positionQuantum * TRAJECTORY_VELOCITY_RATE;
+
+	file = fopen(fileName, "wb");
+	if (file == NULL || fwrite(&header, sizeof(TrajectoryHeader), 1, file) != 1)
+	{
+		cerr << "Could not write trajectory " << fileName << endl;
+		if (file != NULL)
+		{
+			fclose(file);
+			file = NULL;
+		}
+		return false;
+	}
+
+	for (int i = 0; i < TRAJECTORY_QUEUE; i++)
+	{
+		states[i] = new double[getStateValues()];
+	}
+	previous = new long long[getStateValues()];
+	recordCount = 0;
+	byteCount = sizeof(TrajectoryHeader);
+	queueHead = 0;
+	queueCount = 0;
+	atomicExchange(&stopRequested, 0);
+
+	recording = writer.start(writerMain, this);
+	if (!recording)
+	{
+		cerr << "Could not start the trajectory writer thread" << endl;
+		recording = true;	//Lets stop release everything
+		stop();
+	}
+
+	return recording;
+}
+
+//Waits for the writer to finish every queued record, closes the file and releases the buffers
+void TrajectoryWriter::stop()
+{
+	if (!recording)
+	{
+		return;
+	}
+
+	atomicExchange(&stopRequested, 1);
+	writer.join();
+
+	if (fclose(file) != 0)
+	{
+		cerr << "Could not finish writing the trajectory" << endl;
+	}
+	file = NULL;
+
+	#ifdef DEBUGGING
+	if (logger -> isLogging)
+	{
+		cout << "Trajectory: " << recordCount << " records, " << byteCount << " bytes (" << (double) byteCount / max(recordCount, 1) / header.vertexCount << " bytes per vertex and record)" << endl;
+	}
+	#endif
+
+	for (int i = 0; i < TRAJECTORY_QUEUE; i++)
+	{
+		delete [] states[i];
+		states[i] = NULL;
+	}
+	delete [] previous;
+	previous = NULL;
+	recording = false;
+}
+
+//Queues the state for the writer thread, waiting for it if the queue is full (records are never dropped)
+//Parameters positions and velocities - the state in the ParticleSystem layout, [dimension * vertexCount + vertex]
+void TrajectoryWriter::record(int step, const double * positions, const double * velocities)
+{
+	if (!recording)
+	{
+		return;
+	}
+
+	queueLock.lock();
+	while (queueCount == TRAJECTORY_QUEUE)
+	{
+		queueLock.unlock();
+		sleepMilliseconds(1);
+		queueLock.lock();
+	}
+	int slot = (queueHead + queueCount) % TRAJECTORY_QUEUE;
+	queueLock.unlock();
+
+	//The writer does not touch the slot until it is counted, so the copy needs no lock
+	memcpy(states[slot], positions, sizeof(double) * DIMENSION * header.vertexCount);
+	memcpy(states[slot] + DIMENSION * header.vertexCount, velocities, sizeof(double) * DIMENSION * header.vertexCount);
+	steps[slot] = step;
+
+	queueLock.lock();
+	queueCount++;
+	queueLock.unlock();
+}
+
+void TrajectoryWriter::writerMain(void * trajectoryWriter)
+{
+	((TrajectoryWriter *) trajectoryWriter) -> writeRecords();
+}
+
+//Writer thread - writes queued records, oldest first, until stop is requested and the queue is empty
+void TrajectoryWriter::writeRecords()
+{
+	while (true)
+	{
+		bool stopping = atomicLoad(&stopRequested) != 0;
+
+		queueLock.lock();
+		if (queueCount == 0)
+		{
+			queueLock.unlock();
+			if (stopping)
+			{
+				return;
+			}
+			sleepMilliseconds(1);
+			continue;
+		}
+		int slot = queueHead;
+		queueLock.unlock();
+
+		if (!writeRecord(states[slot], steps[slot]))
+		{
+			cerr << "Could not write trajectory record of step " << steps[slot] << endl;
+		}
+
+		queueLock.lock();
+		queueHead = (queueHead + 1) % TRAJECTORY_QUEUE;
+		queueCount--;
+		queueLock.unlock();
+	}
+}
+
+//Encodes one state (positions then velocities) and appends it to the file
+bool TrajectoryWriter::writeRecord(const double * state, int step)
+{
+	TrajectoryRecordHeader recordHeader;
+	recordHeader.step = step;
+	recordHeader.flags = (recordCount % header.keyframeInterval == 0) ? TRAJECTORY_KEYFRAME : 0;
+	recordHeader.reserved = 0;
+
+	encoded.clear();
+	int positionValues = DIMENSION * header.vertexCount;
+	for (int i = 0; i < getStateValues(); i++)
+	{
+		long long value = quantize(state[i], i < positionValues ? header.positionQuantum : header.velocityQuantum);
+		putVarint(encoded, (recordHeader.flags & TRAJECTORY_KEYFRAME) ? value : value - previous[i]);
+		previous[i] = value;
+	}
+	recordHeader.byteCount = (unsigned int) encoded.size();
+
+	bool written = fwrite(&recordHeader, sizeof(TrajectoryRecordHeader), 1, file) == 1 &&
+		fwrite(&encoded[0], 1, encoded.size(), file) == encoded.size();
+	recordCount++;
+	byteCount += sizeof(TrajectoryRecordHeader) + encoded.size();
+	return written;
+}
+
+TrajectoryReader::TrajectoryReader()
+{
+	memset(&header, 0, sizeof(TrajectoryHeader));
+	currentRecord = -1;
+}
+
+//Maps fileName and indexes its records
+//Parameters restVertices and vertexCount - the rest state of the mesh the trajectory is played on; it must be the recorded one
+//Returns false if the file cannot be read, or was recorded with another mesh
+bool TrajectoryReader::open(const char * fileName, const Vertex * restVertices, int vertexCount)
+{
+	recordOffsets.clear();
+	keyframes.clear();
+	currentRecord = -1;
+	if (!file.open(fileName) || file.getSize() < sizeof(TrajectoryHeader))
+	{
+		cerr << "Could not read trajectory " << fileName << endl;
+		return false;
+	}
+
+	memcpy(&header, file.getData(), sizeof(TrajectoryHeader));
+	if (strcmp(header.magic, "TETTRAJ") != 0 || header.version != TRAJECTORY_VERSION || header.byteOrderMark != TRAJECTORY_BYTE_ORDER_MARK)
+	{
+		cerr << fileName << " is not a trajectory file of this version" << endl;
+		file.close();
+		return false;
+	}
+	if (header.vertexCount != vertexCount || header.meshHash != hashRestPositions(restVertices, vertexCount))
+	{
+		cerr << "Trajectory " << fileName << " was recorded with a different mesh" << endl;
+		file.close();
+		return false;
+	}
+
+	//The first record is always a keyframe, so every record has one before it
+	size_t offset = sizeof(TrajectoryHeader);
+	int keyframe = 0;
+	while (offset + sizeof(TrajectoryRecordHeader) <= file.getSize())
+	{
+		const TrajectoryRecordHeader * recordHeader = (const TrajectoryRecordHeader *) (file.getData() + offset);
+		size_t next = offset + sizeof(TrajectoryRecordHeader) + recordHeader -> byteCount;
+		if (next > file.getSize())
+		{
+			break;
+		}
+		if (recordHeader -> flags & TRAJECTORY_KEYFRAME)
+		{
+			keyframe = (int) recordOffsets.size();
+		}
+		recordOffsets.push_back(offset);
+		keyframes.push_back(keyframe);
+		offset = next;
+	}
+
+	current.resize(getStateValues());
+	return true;
+}
+
+int TrajectoryReader::getRecordStep(int record)
+{
+	return ((const TrajectoryRecordHeader *) (file.getData() + recordOffsets[record])) -> step;
+}
+
+//Decodes a record into positions and velocities (same layout as TrajectoryWriter::record)
+//Returns false if there is no such record or it is damaged
+bool TrajectoryReader::readRecord(int record, double * positions, double * velocities)
+{
+	if (record < 0 || record >= getRecordCount())
+	{
+		return false;
+	}
+
+	//Continue from the record held, if it lies between the keyframe and the record
+	int first = (currentRecord >= keyframes[record] && currentRecord <= record) ? currentRecord + 1 : keyframes[record];
+	for (int i = first; i <= record; i++)
+	{
+		if (!decodeRecord(i))
+		{
+			currentRecord = -1;
+			return false;
+		}
+		currentRecord = i;
+	}
+
+	int positionValues = DIMENSION * header.vertexCount;
+	for (int i = 0; i < positionValues; i++)
+	{
+		positions[i] = current[i] * header.positionQuantum;
+		velocities[i] = current[positionValues + i] * header.velocityQuantum;
+	}
+	return true;
+}
+
+//Applies one record to current (a keyframe replaces it)
+bool TrajectoryReader::decodeRecord(int record)
+{
+	const TrajectoryRecordHeader * recordHeader = (const TrajectoryRecordHeader *) (file.getData() + recordOffsets[record]);
+	const unsigned char * data = (const unsigned char *) recordHeader + sizeof(TrajectoryRecordHeader);
+	const unsigned char * end = data + recordHeader -> byteCount;
+	bool isKeyframe = (recordHeader -> flags & TRAJECTORY_KEYFRAME) != 0;
+
+	for (int i = 0; i < getStateValues(); i++)
+	{
+		long long value;
+		if (!getVarint(data, end, value))
+		{
+			return false;
+		}
+		current[i] = isKeyframe ? value : current[i] + value;
+	}
+	return data == end;
+}
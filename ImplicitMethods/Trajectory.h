@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+#include "Vertex.h"
+#include "Logger.h"
+#include "MappedFile.h"
+#include "Threading.h"
+
+using namespace std;
+
+const unsigned int TRAJECTORY_BYTE_ORDER_MARK = 0x01020304;	//As written by trajectory and checkpoint files - rejects files written with the other byte order
+const int TRAJECTORY_VERSION = 1;
+const int TRAJECTORY_QUEUE = 4;					//Records waiting for the writer thread before record waits for it
+const int TRAJECTORY_KEYFRAME_INTERVAL = 64;	//Records between keyframes - a reader seeking to a record decodes at most this many
+const int TRAJECTORY_POSITION_BITS = 20;		//The position quantum is the longest side of the rest mesh over 2^TRAJECTORY_POSITION_BITS
+const double TRAJECTORY_VELOCITY_RATE = 16;		//The velocity quantum is the position quantum times this (per second)
+const int TRAJECTORY_KEYFRAME = 1;				//TrajectoryRecordHeader flag: the record is not relative to the one before it
+
+const int CHECKPOINT_VERSION = 1;
+const int MAX_CHECKPOINT_ARRAYS = 8;
+
+//Header of a trajectory file (little endian like the x86 machines that write and read it)
+//It is followed by the records, each a TrajectoryRecordHeader and byteCount bytes of encoded state.
+struct TrajectoryHeader
+{
+	char magic[8];						//"TETTRAJ" - identifies the file type
+	int version;						//TRAJECTORY_VERSION
+	unsigned int byteOrderMark;			//TRAJECTORY_BYTE_ORDER_MARK
+	unsigned long long meshHash;		//hashRestPositions of the simulated mesh
+	int vertexCount;
+	int stepsPerRecord;					//Time steps between records
+	int keyframeInterval;				//Every keyframeInterval-th record is a keyframe
+	int reserved;
+	double positionQuantum;				//Positions are stored as integer multiples of this
+	double velocityQuantum;				//Velocities likewise
+};
+
+struct TrajectoryRecordHeader
+{
+	int step;							//ParticleSystem::getStepCount when the state was recorded
+	int flags;							//TRAJECTORY_KEYFRAME
+	unsigned int byteCount;				//Encoded state following the header
+	unsigned int reserved;
+};
+
+//Header of a checkpoint file, followed by the checkpoint arrays back to back (see ParticleSystem::addCheckpointArrays)
+struct CheckpointHeader
+{
+	char magic[8];						//"TETCKPT" - identifies the file type
+	int version;						//CHECKPOINT_VERSION
+	unsigned int byteOrderMark;			//TRAJECTORY_BYTE_ORDER_MARK
+	unsigned long long meshHash;		//hashRestPositions of the mesh, continued over the (colored) tetraList
+	int vertexCount;
+	int tetraCount;
+	int arrayCount;
+	int hasSleepState;					//1 if the sleep state of every vertex follows the arrays (see ParticleSystem::setSleeping)
+	unsigned long long arrayBytes[MAX_CHECKPOINT_ARRAYS];
+	int stepCount;						//ParticleSystem::getStepCount
+	int sleepingVertexCount;
+	double earthGravity;
+	unsigned long long checksum;		//hashBytes of everything after the header
+};
+
+//One block of simulation state saved in a checkpoint
+struct CheckpointArray
+{
+	void * data;
+	size_t bytes;
+};
+
+//hashBytes of the rest positions (the padding component is left out, since only the 3 position components are set for every vertex)
+unsigned long long hashRestPositions(const Vertex * vertices, int vertexCount, unsigned long long hash = 14695981039346656037ULL);
+
+//Streams the simulation state into a trajectory file without stalling the simulation
+//record copies the positions and velocities into a bounded queue; a writer thread quantizes them (positions to
+//positionQuantum, velocities to velocityQuantum), takes the difference to the previous record and writes each difference
+//as a zigzag variable length integer, so a slowly moving or resting vertex costs 1 byte per component instead of 8.
+//Every TRAJECTORY_KEYFRAME_INTERVAL-th record is a keyframe, stored relative to zero, so a reader can start there.
+//The differences are taken between the quantized values, so the error of a decoded record never exceeds half a quantum
+//however long the trajectory.
+class TrajectoryWriter
+{
+public:
+	TrajectoryWriter(Logger * logger);
+	~TrajectoryWriter();
+	bool start(const char * fileName, const Vertex * restVertices, int vertexCount, int stepsPerRecord);
+	void stop();
+	bool isRecording() {return recording;}
+	int getStepsPerRecord() {return header.stepsPerRecord;}
+	void record(int step, const double * positions, const double * velocities);
+
+private:
+	TrajectoryWriter(const TrajectoryWriter &);				//Not copyable - owns the buffers and the writer thread
+	TrajectoryWriter & operator = (const TrajectoryWriter &);
+
+	Logger * logger;
+	bool recording;
+	TrajectoryHeader header;
+	FILE * file;
+	int recordCount;
+	unsigned long long byteCount;		//Bytes written, headers included
+
+	//Record queue - a ring of TRAJECTORY_QUEUE states (positions then velocities), filled by record and emptied by the writer thread
+	double * states[TRAJECTORY_QUEUE];
+	int steps[TRAJECTORY_QUEUE];
+	int queueHead;
+	int queueCount;
+	Mutex queueLock;					//Guards queueHead and queueCount
+	volatile long stopRequested;
+	Thread writer;
+
+	long long * previous;				//Quantized state of the last record written (writer thread)
+	vector<unsigned char> encoded;		//Encoded state of the record being written (writer thread)
+
+	static void writerMain(void * trajectoryWriter);
+	void writeRecords();
+	bool writeRecord(const double * state, int step);
+	int getStateValues() {return 2 * DIMENSION * header.vertexCount;}
+};
+
+//Reads back a trajectory file written by TrajectoryWriter, for playback (see ParticleSystem::showTrajectoryRecord)
+//The file is mapped and indexed when it is opened; a partly written last record (a run that was cut off) is left out.
+//Reading the records in order decodes each one once; any other record is decoded from the keyframe before it.
+class TrajectoryReader
+{
+public:
+	TrajectoryReader();
+	bool open(const char * fileName, const Vertex * restVertices, int vertexCount);
+	int getRecordCount() {return (int) recordOffsets.size();}
+	int getRecordStep(int record);
+	int getStepsPerRecord() {return header.stepsPerRecord;}
+	bool readRecord(int record, double * positions, double * velocities);
+
+private:
+	MappedFile file;
+	TrajectoryHeader header;
+	vector<size_t> recordOffsets;		//Offset of each record's TrajectoryRecordHeader in the file
+	vector<int> keyframes;				//Keyframe each record is decoded from
+	vector<long long> current;			//Quantized state of currentRecord
+	int currentRecord;					//Record held in current, -1 for none
+
+	bool decodeRecord(int record);
+	int getStateValues() {return 2 * DIMENSION * header.vertexCount;}
+};
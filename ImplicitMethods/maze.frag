@@ -3,26 +3,39 @@
 //and based on the code presented by graduate teaching associate Soumya Dutta in real time rendering class
 
 //This shader implements the equations for local illumination
-
-uniform vec4 ambient_coef;
-uniform vec4 diffuse_coef;
-uniform vec4 specular_coef;
-uniform float mat_shininess;
-uniform vec4 lightAmbient;
-uniform vec4 lightDiffuse;
-uniform vec4 lightSpecular;
-uniform vec4 lightPosition;
-uniform vec4 eyePosition;
-
-varying vec4 pcolor; 
-varying vec3 v_normal;
-varying vec4 pos_in_eye; 
+//Compiled with RGB_COLORS defined it is the unlit RGB debugging variant instead (see maze.geom)
+
+//Lighting and material, shared by all draws with the same light (see ParticleSystem::updateLightingBlocks)
+layout(std140) uniform Lighting
+{
+	vec4 lightAmbient;
+	vec4 lightDiffuse;
+	vec4 lightSpecular;
+	vec4 lightPosition;
+	vec4 eyePosition;
+	vec4 ambient_coef;
+	vec4 diffuse_coef;
+	vec4 specular_coef;
+	float mat_shininess;
+};
+
+in VertexData
+{
+	vec4 pcolor;
+	vec3 v_normal;
+	vec4 pos_in_eye;
+} vertexIn;
+
+layout(location = 0) out vec4 fragColor;
 
 void main() {
+#ifdef RGB_COLORS
+	fragColor = vertexIn.pcolor;
+#else
 	//Prepare vectors
-	vec3 lightVector = normalize(vec3(lightPosition - pos_in_eye));
-	vec3 eyeVector = normalize(vec3(eyePosition - pos_in_eye));
-	vec3 normal = normalize(vec3(v_normal));
+	vec3 lightVector = normalize(vec3(lightPosition - vertexIn.pos_in_eye));
+	vec3 eyeVector = normalize(vec3(eyePosition - vertexIn.pos_in_eye));
+	vec3 normal = normalize(vec3(vertexIn.v_normal));
 
 	//Ambient
 	vec4 ambient = ambient_coef * lightAmbient;
@@ -37,9 +50,6 @@ void main() {
 	vec4 specular = specular_coef * lightSpecular * pow(rdote, mat_shininess);
 
 	//Set the color
-	vec4 finalColor = (ambient + diffuse + specular) * pcolor;
-
-    gl_FragColor = finalColor; 
-	//gl_FragColor = vec4(1.0, 1.0, 1.0, 1.0);
-
- } 
\ No newline at end of file
+	fragColor = (ambient + diffuse + specular) * vertexIn.pcolor;
+#endif
+ }
\ No newline at end of file
@@ -4,36 +4,30 @@
 
 //This vertex shader applies the local2clip transformation to each point to set the vertex position, applies the local2eye transformation to each vertex so that the fragment shader can use it,
 //transforms normals, and passes info to the fragment shader
+//The #version line (and the defines of a variant) are prepended by SetupGLSL.  The attribute locations are fixed so that
+//every variant can draw from the same vertex array objects (see ParticleSystem::initVBOs).
 
-attribute vec4 position; 
-attribute vec4 color1; 
-attribute vec4 normal; 
-
-
-uniform vec4 ambient_coef;
-uniform vec4 diffuse_coef;
-uniform vec4 specular_coef;
-uniform float mat_shininess;
-uniform vec4 lightAmbient;
-uniform vec4 lightDiffuse;
-uniform vec4 lightSpecular;
-uniform vec4 lightPosition;
-uniform vec4 eyePosition;
+layout(location = 0) in vec4 position; 
+layout(location = 1) in vec4 normal; 
+layout(location = 2) in vec4 color1; 
 
 uniform mat4 local2clip; 
 uniform mat4 local2eye;
 uniform mat4 normalMatrix;
 
-varying vec4 pcolor;
-varying vec3 v_normal;
-varying vec4 pos_in_eye; 
+out VertexData
+{
+	vec4 pcolor;
+	vec3 v_normal;
+	vec4 pos_in_eye;
+} vertexOut;
 
 void main(){
 	  //Transform the normal using the transpose of the inverse, and transform the vertex into eye space
-	  v_normal = normalize(vec3(normalMatrix * normal));
-	  pos_in_eye = local2eye * position;
+	  vertexOut.v_normal = normalize(vec3(normalMatrix * normal));
+	  vertexOut.pos_in_eye = local2eye * position;
      
-      pcolor = color1; 
+      vertexOut.pcolor = color1; 
       
       gl_Position = local2clip * position; 
 